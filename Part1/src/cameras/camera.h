@@ -9,6 +9,7 @@ class Camera
 public:
     Camera() = delete;
     Camera(const Matrix4x4 &cameraToWorld_, const Film &film_);
+    virtual ~Camera() = default;
 
     // Given image plane coordinates (u, v) = [0,1]x[0,1] in normalized
     // device coordinates (NDC), returns a ray in WORLD COORDINATES which passes
@@ -16,6 +17,9 @@ public:
     virtual Ray generateRay(const double u, const double v) const = 0;
     virtual Vector3D ndcToCameraSpace(const double u, const double v) const = 0;
 
+    // Move the camera (animations)
+    virtual void setCameraToWorld(const Matrix4x4 &cameraToWorld_);
+
     /* ******************* */
     /* General Camera data */
     /* ******************* */
@@ -4,7 +4,15 @@ PerspectiveCamera::PerspectiveCamera(const Matrix4x4 &cameraToWorld_, const doub
                 const Film &film_ )
     : Camera(cameraToWorld_, film_),
       fov(fov_)
-{ }
+{
+    cameraToWorld.inverse(worldToCamera);
+}
+
+void PerspectiveCamera::setCameraToWorld(const Matrix4x4 &cameraToWorld_)
+{
+    cameraToWorld = cameraToWorld_;
+    cameraToWorld.inverse(worldToCamera);
+}
 
 Vector3D PerspectiveCamera::ndcToCameraSpace(const double u, const double v) const
 {
@@ -46,3 +54,35 @@ Ray PerspectiveCamera::generateRay(const double u, const double v) const
 
     return r;
 }
+
+bool PerspectiveCamera::worldToNDC(const Vector3D &p, double &u, double &v) const
+{
+    Vector3D pCamera = worldToCamera.transformPoint(p);
+    if (pCamera.z <= 0)
+        return false;
+
+    // Project onto the image plane (z = 1) and undo ndcToCameraSpace
+    double size = 2.0 * std::tan(fov/2);
+    double x = pCamera.x / pCamera.z;
+    double y = pCamera.y / pCamera.z;
+    u = (x / aspect + size * 0.5) / size;
+    v = (size * 0.5 - y) / size;
+
+    return u >= 0 && u < 1 && v >= 0 && v < 1;
+}
+
+Vector3D PerspectiveCamera::getPosition() const
+{
+    return cameraToWorld.transformPoint(Vector3D(0, 0, 0));
+}
+
+Vector3D PerspectiveCamera::getViewDirection() const
+{
+    return cameraToWorld.transformVector(Vector3D(0, 0, 1)).normalized();
+}
+
+double PerspectiveCamera::getImagePlaneArea() const
+{
+    double size = 2.0 * std::tan(fov/2);
+    return size * size * aspect;
+}
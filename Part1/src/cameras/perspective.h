@@ -14,9 +14,23 @@ public:
     // Member functions
     virtual Ray generateRay(const double u, const double v) const;
     virtual Vector3D ndcToCameraSpace(const double u, const double v) const;
+    virtual void setCameraToWorld(const Matrix4x4 &cameraToWorld_);
+
+    // Inverse of generateRay: NDC coordinates of the image point that sees p.
+    // Returns false if p is behind the camera or outside the image
+    bool worldToNDC(const Vector3D &p, double &u, double &v) const;
+
+    // Camera position, viewing direction and area of the image plane (at a
+    // focal distance of 1), needed to trace paths that end at the camera
+    Vector3D getPosition() const;
+    Vector3D getViewDirection() const;
+    double getImagePlaneArea() const;
 
     /* Perspective Camera Data */
     double fov; // Radians
+
+private:
+    Matrix4x4 worldToCamera;
 };
 
 #endif // PERSPECTIVE_H
@@ -0,0 +1,81 @@
+#include "animation.h"
+
+#include <algorithm>
+
+AnimatedTransform::AnimatedTransform() :
+    axis(0.0, 1.0, 0.0), pivot(0.0)
+{ }
+
+AnimatedTransform::AnimatedTransform(const Vector3D &axis_, const Vector3D &pivot_) :
+    axis(axis_), pivot(pivot_)
+{ }
+
+void AnimatedTransform::addKey(double time, const Vector3D &translation, double angle, const Vector3D &scale)
+{
+    Key key = { time, translation, angle, scale };
+    auto it = std::upper_bound(keys.begin(), keys.end(), time,
+                               [](double t, const Key &k) { return t < k.time; });
+    keys.insert(it, key);
+}
+
+bool AnimatedTransform::isAnimated() const
+{
+    return !keys.empty();
+}
+
+AnimatedTransform::Key AnimatedTransform::sample(double time) const
+{
+    if (keys.empty())
+        return Key{ time, Vector3D(0.0), 0.0, Vector3D(1.0) };
+    if (time <= keys.front().time)
+        return keys.front();
+    if (time >= keys.back().time)
+        return keys.back();
+
+    // First key after time, and the one before
+    auto next = std::upper_bound(keys.begin(), keys.end(), time,
+                                 [](double t, const Key &k) { return t < k.time; });
+    const Key &k1 = *next;
+    const Key &k0 = *(next - 1);
+    double u = (time - k0.time) / (k1.time - k0.time);
+    return Key{ time,
+                k0.translation + (k1.translation - k0.translation) * u,
+                k0.angle + (k1.angle - k0.angle) * u,
+                k0.scale + (k1.scale - k0.scale) * u };
+}
+
+Matrix4x4 AnimatedTransform::evaluate(double time) const
+{
+    if (keys.empty())
+        return Matrix4x4();
+
+    Key k = sample(time);
+    return Matrix4x4::translate(k.translation) * Matrix4x4::translate(pivot)
+        * Matrix4x4::rotate(k.angle, axis) * Matrix4x4::scale(k.scale) * Matrix4x4::translate(-pivot);
+}
+
+bool AnimatedTransform::isStatic(double time0, double time1) const
+{
+    if (keys.empty())
+        return true;
+
+    // Held before the first key and after the last one
+    double t0 = std::clamp(std::min(time0, time1), keys.front().time, keys.back().time);
+    double t1 = std::clamp(std::max(time0, time1), keys.front().time, keys.back().time);
+    if (t0 == t1)
+        return true;
+
+    // Every key in [t0, t1] (and the interpolated ends) must be equal
+    Key a = sample(t0);
+    auto equal = [&a](const Key &b) {
+        return a.translation.x == b.translation.x && a.translation.y == b.translation.y
+            && a.translation.z == b.translation.z && a.angle == b.angle
+            && a.scale.x == b.scale.x && a.scale.y == b.scale.y && a.scale.z == b.scale.z;
+    };
+    if (!equal(sample(t1)))
+        return false;
+    for (const Key &k : keys)
+        if (k.time > t0 && k.time < t1 && !equal(k))
+            return false;
+    return true;
+}
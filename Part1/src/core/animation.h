@@ -0,0 +1,55 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <vector>
+
+#include "matrix4x4.h"
+#include "vector3d.h"
+
+/**
+ * @brief The AnimatedTransform class
+ *
+ * Motion applied on top of the rest pose of a shape or a camera (the pose
+ * it was created with). Keyframes give a translation, an angle around the
+ * rotation axis and a scale; between keys they are interpolated linearly,
+ * and before the first key or after the last one they are held:
+ *
+ *   M(t) = translate(T) * translate(pivot) * rotate(angle, axis) * scale(S) * translate(-pivot)
+ *
+ * A transform without keys is the identity (the rest pose).
+ */
+class AnimatedTransform
+{
+public:
+    AnimatedTransform();
+    // Rotations turn around the axis through pivot (a turntable around the
+    // centre of the scene)
+    AnimatedTransform(const Vector3D &axis_, const Vector3D &pivot_);
+
+    // Keys can be added in any order
+    void addKey(double time, const Vector3D &translation,
+                double angle = 0, const Vector3D &scale = Vector3D(1.0));
+
+    Matrix4x4 evaluate(double time) const;
+    // Whether the motion is the same at both times (a held frame)
+    bool isStatic(double time0, double time1) const;
+    bool isAnimated() const;
+
+private:
+    struct Key
+    {
+        double time;
+        Vector3D translation;
+        double angle;       // Radians
+        Vector3D scale;
+    };
+
+    // Interpolated key at time
+    Key sample(double time) const;
+
+    Vector3D axis;
+    Vector3D pivot;
+    std::vector<Key> keys;
+};
+
+#endif // ANIMATION_H
@@ -126,13 +126,17 @@ int BitMap::save(Vector3D** &data, const size_t &width, const size_t &height)
     if(outputFile.is_open())
     {
         // Write the file header
-        outputFile.write(fileHeader.toCharBlock(), 14);
+        char *fileBlock = fileHeader.toCharBlock();
+        outputFile.write(fileBlock, 14);
+        free(fileBlock);
 
         // Write the info header
-        outputFile.write(infoHeader.toCharBlock(), 40);
+        char *infoBlock = infoHeader.toCharBlock();
+        outputFile.write(infoBlock, 40);
+        free(infoBlock);
 
         int extra_bytes = (4 - (infoHeader.width * 3) % 4) % 4;
-        void* padd = (void*)malloc(extra_bytes);
+        const char padd[3] = { 0, 0, 0 };
 
         // Store the image in the BMP format (bottom-up, i.e.,
         //  first row stores is the lowermost one)
@@ -153,7 +157,7 @@ int BitMap::save(Vector3D** &data, const size_t &width, const size_t &height)
 
             }
             // Padd the rest of the row;
-            outputFile.write(reinterpret_cast<const char *>(padd), extra_bytes);
+            outputFile.write(padd, extra_bytes);
         }
 
         outputFile.close();
@@ -0,0 +1,697 @@
+#include "compiledscene.h"
+#include "parallel.h"
+#include "../shapes/infiniteplan.h"
+#include "../shapes/sphere.h"
+#include "../shapes/square.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define COMPILEDSCENE_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(COMPILEDSCENE_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace
+{
+    const size_t LANES = 8;
+    // Without an acceleration structure the flat arrays beat the virtual loop
+    // at every size measured (up to the 262 shapes of a 16x16 sphere grid);
+    // past this both are brute force over a list that no longer fits in cache
+    const size_t DEFAULT_MAX_PRIMITIVES = 1024;
+
+    // The float kernels only pick the candidate: hits further than this from
+    // the one confirmed by the shape go through the virtual path
+    const double CONFIRM_TOLERANCE = 1e-3;
+
+    // Hits of different types this close are ties (e.g. the area light
+    // square lying on the ceiling plan of the Cornell box)
+    const float TIE_TOLERANCE = 1e-5f;
+
+    float tieLimit(float t)
+    {
+        return t + TIE_TOLERANCE * (1.0f + t);
+    }
+
+    // Ray in the precision of the kernels
+    struct FloatRay
+    {
+        float ox, oy, oz;
+        float dx, dy, dz;
+        float minT;
+    };
+
+    FloatRay toFloat(const Ray &ray)
+    {
+        return FloatRay{ (float)ray.o.x, (float)ray.o.y, (float)ray.o.z,
+                         (float)ray.d.x, (float)ray.d.y, (float)ray.d.z, (float)ray.minT };
+    }
+
+    bool cpuHasAVX2()
+    {
+#if defined(COMPILEDSCENE_X86) && (defined(__GNUC__) || defined(__clang__))
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#elif defined(COMPILEDSCENE_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        __cpuid(info, 1);
+        bool fma = (info[2] & (1 << 12)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        __cpuidex(info, 7, 0);
+        bool avx2 = (info[1] & (1 << 5)) != 0;
+        // The OS must save the YMM registers
+        return fma && avx2 && osxsave && (_xgetbv(0) & 6) == 6;
+#else
+        return false;
+#endif
+    }
+
+    const bool HAS_AVX2 = cpuHasAVX2();
+
+    // Candidate of a kernel: closest t in [minT, tBest] (ties go to the last one)
+    struct Candidate
+    {
+        float tBest;
+        uint32_t index;
+        bool found;
+    };
+
+    // 1. Scalar kernels, for CPUs without AVX2
+
+    void spheresScalar(const float *cx, const float *cy, const float *cz, const float *r2,
+                       size_t begin, size_t end, const FloatRay &r, float a, Candidate &c, bool any)
+    {
+        for (size_t i = begin; i < end; i++) {
+            float ocx = r.ox - cx[i], ocy = r.oy - cy[i], ocz = r.oz - cz[i];
+            float b = ocx * r.dx + ocy * r.dy + ocz * r.dz;
+            float k = ocx * ocx + ocy * ocy + ocz * ocz - r2[i];
+            float disc = b * b - a * k;
+            if (disc < 0)
+                continue;
+            float sq = std::sqrt(disc);
+            float t = (-b - sq) / a;
+            if (t < r.minT)
+                t = (-b + sq) / a;
+            if (t < r.minT || t > c.tBest)
+                continue;
+            c = Candidate{ t, (uint32_t)i, true };
+            if (any)
+                return;
+        }
+    }
+
+    void squaresScalar(const float *const *s, size_t begin, size_t end, const FloatRay &r,
+                       Candidate &c, bool any)
+    {
+        const float *px = s[0], *py = s[1], *pz = s[2], *nx = s[3], *ny = s[4], *nz = s[5];
+        const float *ax = s[6], *ay = s[7], *az = s[8], *bx = s[9], *by = s[10], *bz = s[11];
+        for (size_t i = begin; i < end; i++) {
+            float denom = r.dx * nx[i] + r.dy * ny[i] + r.dz * nz[i];
+            if (std::abs(denom) < (float)Epsilon)
+                continue;
+            float t = ((px[i] - r.ox) * nx[i] + (py[i] - r.oy) * ny[i] + (pz[i] - r.oz) * nz[i]) / denom;
+            if (t < r.minT || t > c.tBest)
+                continue;
+            float qx = r.ox + r.dx * t - px[i], qy = r.oy + r.dy * t - py[i], qz = r.oz + r.dz * t - pz[i];
+            float alpha = qx * ax[i] + qy * ay[i] + qz * az[i];
+            float beta = qx * bx[i] + qy * by[i] + qz * bz[i];
+            if (!(alpha > 0 && alpha < 1) || !(beta > 0 && beta < 1))
+                continue;
+            c = Candidate{ t, (uint32_t)i, true };
+            if (any)
+                return;
+        }
+    }
+
+    void plansScalar(const float *nx, const float *ny, const float *nz, const float *d,
+                     size_t begin, size_t end, const FloatRay &r, Candidate &c, bool any)
+    {
+        for (size_t i = begin; i < end; i++) {
+            float denom = r.dx * nx[i] + r.dy * ny[i] + r.dz * nz[i];
+            if (std::abs(denom) < (float)Epsilon)
+                continue;
+            float t = (d[i] - (r.ox * nx[i] + r.oy * ny[i] + r.oz * nz[i])) / denom;
+            if (t < r.minT || t > c.tBest)
+                continue;
+            c = Candidate{ t, (uint32_t)i, true };
+            if (any)
+                return;
+        }
+    }
+
+#ifdef COMPILEDSCENE_X86
+    // 2. AVX2 kernels: 8 primitives per iteration. The arrays are padded to a
+    //    multiple of 8 with primitives that are never hit
+
+    int lowestBit(int bits)
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long index;
+        _BitScanForward(&index, (unsigned long)bits);
+        return (int)index;
+#else
+        return __builtin_ctz((unsigned)bits);
+#endif
+    }
+
+    // Keep the lanes of mask in order, so ties behave as in the scalar kernels
+    TARGET_AVX2 bool pickLanes(__m256 t, __m256 mask, size_t base, Candidate &c, bool any)
+    {
+        int bits = _mm256_movemask_ps(mask);
+        if (bits == 0)
+            return false;
+
+        alignas(32) float ts[LANES];
+        _mm256_store_ps(ts, t);
+        while (bits != 0) {
+            int lane = lowestBit(bits);
+            bits &= bits - 1;
+            if (ts[lane] <= c.tBest)
+                c = Candidate{ ts[lane], (uint32_t)(base + lane), true };
+        }
+        return any;
+    }
+
+    TARGET_AVX2 void spheresAVX2(const float *cx, const float *cy, const float *cz, const float *r2,
+                                 size_t count, const FloatRay &r, float a, Candidate &c, bool any)
+    {
+        __m256 ox = _mm256_set1_ps(r.ox), oy = _mm256_set1_ps(r.oy), oz = _mm256_set1_ps(r.oz);
+        __m256 dx = _mm256_set1_ps(r.dx), dy = _mm256_set1_ps(r.dy), dz = _mm256_set1_ps(r.dz);
+        __m256 minT = _mm256_set1_ps(r.minT);
+        __m256 va = _mm256_set1_ps(a);
+        __m256 invA = _mm256_set1_ps(1.0f / a);
+        __m256 zero = _mm256_setzero_ps();
+
+        for (size_t i = 0; i < count; i += LANES) {
+            __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(cx + i));
+            __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(cy + i));
+            __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(cz + i));
+            __m256 b = _mm256_fmadd_ps(ocz, dz, _mm256_fmadd_ps(ocy, dy, _mm256_mul_ps(ocx, dx)));
+            __m256 k = _mm256_fmadd_ps(ocz, ocz, _mm256_fmadd_ps(ocy, ocy, _mm256_mul_ps(ocx, ocx)));
+            k = _mm256_sub_ps(k, _mm256_loadu_ps(r2 + i));
+            __m256 disc = _mm256_fmsub_ps(b, b, _mm256_mul_ps(va, k));
+            __m256 hit = _mm256_cmp_ps(disc, zero, _CMP_GE_OQ);
+
+            __m256 sq = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+            __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(zero, b), sq), invA);
+            __m256 t1 = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(zero, b), sq), invA);
+            __m256 t = _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, minT, _CMP_GE_OQ));
+
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, minT, _CMP_GE_OQ));
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, _mm256_set1_ps(c.tBest), _CMP_LE_OQ));
+            if (pickLanes(t, hit, i, c, any))
+                return;
+        }
+    }
+
+    TARGET_AVX2 void squaresAVX2(const float *const *s, size_t count, const FloatRay &r,
+                                 Candidate &c, bool any)
+    {
+        __m256 ox = _mm256_set1_ps(r.ox), oy = _mm256_set1_ps(r.oy), oz = _mm256_set1_ps(r.oz);
+        __m256 dx = _mm256_set1_ps(r.dx), dy = _mm256_set1_ps(r.dy), dz = _mm256_set1_ps(r.dz);
+        __m256 minT = _mm256_set1_ps(r.minT);
+        __m256 eps = _mm256_set1_ps((float)Epsilon);
+        __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+        __m256 zero = _mm256_setzero_ps();
+        __m256 one = _mm256_set1_ps(1.0f);
+
+        for (size_t i = 0; i < count; i += LANES) {
+            __m256 nx = _mm256_loadu_ps(s[3] + i), ny = _mm256_loadu_ps(s[4] + i), nz = _mm256_loadu_ps(s[5] + i);
+            __m256 denom = _mm256_fmadd_ps(dz, nz, _mm256_fmadd_ps(dy, ny, _mm256_mul_ps(dx, nx)));
+            __m256 hit = _mm256_cmp_ps(_mm256_and_ps(denom, absMask), eps, _CMP_GE_OQ);
+            if (_mm256_movemask_ps(hit) == 0)
+                continue;
+
+            __m256 cx = _mm256_loadu_ps(s[0] + i), cy = _mm256_loadu_ps(s[1] + i), cz = _mm256_loadu_ps(s[2] + i);
+            __m256 ocx = _mm256_sub_ps(cx, ox), ocy = _mm256_sub_ps(cy, oy), ocz = _mm256_sub_ps(cz, oz);
+            __m256 num = _mm256_fmadd_ps(ocz, nz, _mm256_fmadd_ps(ocy, ny, _mm256_mul_ps(ocx, nx)));
+            __m256 t = _mm256_div_ps(num, denom);
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, minT, _CMP_GE_OQ));
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, _mm256_set1_ps(c.tBest), _CMP_LE_OQ));
+            if (_mm256_movemask_ps(hit) == 0)
+                continue;
+
+            // Hit point relative to the corner: t * d - (corner - o)
+            __m256 qx = _mm256_fmsub_ps(dx, t, ocx), qy = _mm256_fmsub_ps(dy, t, ocy), qz = _mm256_fmsub_ps(dz, t, ocz);
+            __m256 alpha = _mm256_fmadd_ps(qz, _mm256_loadu_ps(s[8] + i),
+                           _mm256_fmadd_ps(qy, _mm256_loadu_ps(s[7] + i), _mm256_mul_ps(qx, _mm256_loadu_ps(s[6] + i))));
+            __m256 beta = _mm256_fmadd_ps(qz, _mm256_loadu_ps(s[11] + i),
+                          _mm256_fmadd_ps(qy, _mm256_loadu_ps(s[10] + i), _mm256_mul_ps(qx, _mm256_loadu_ps(s[9] + i))));
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(alpha, zero, _CMP_GT_OQ));
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(alpha, one, _CMP_LT_OQ));
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(beta, zero, _CMP_GT_OQ));
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(beta, one, _CMP_LT_OQ));
+            if (pickLanes(t, hit, i, c, any))
+                return;
+        }
+    }
+
+    TARGET_AVX2 void plansAVX2(const float *nxs, const float *nys, const float *nzs, const float *ds,
+                               size_t count, const FloatRay &r, Candidate &c, bool any)
+    {
+        __m256 ox = _mm256_set1_ps(r.ox), oy = _mm256_set1_ps(r.oy), oz = _mm256_set1_ps(r.oz);
+        __m256 dx = _mm256_set1_ps(r.dx), dy = _mm256_set1_ps(r.dy), dz = _mm256_set1_ps(r.dz);
+        __m256 minT = _mm256_set1_ps(r.minT);
+        __m256 eps = _mm256_set1_ps((float)Epsilon);
+        __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+        for (size_t i = 0; i < count; i += LANES) {
+            __m256 nx = _mm256_loadu_ps(nxs + i), ny = _mm256_loadu_ps(nys + i), nz = _mm256_loadu_ps(nzs + i);
+            __m256 denom = _mm256_fmadd_ps(dz, nz, _mm256_fmadd_ps(dy, ny, _mm256_mul_ps(dx, nx)));
+            __m256 on = _mm256_fmadd_ps(oz, nz, _mm256_fmadd_ps(oy, ny, _mm256_mul_ps(ox, nx)));
+            __m256 t = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(ds + i), on), denom);
+
+            __m256 hit = _mm256_cmp_ps(_mm256_and_ps(denom, absMask), eps, _CMP_GE_OQ);
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, minT, _CMP_GE_OQ));
+            hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, _mm256_set1_ps(c.tBest), _CMP_LE_OQ));
+            if (pickLanes(t, hit, i, c, any))
+                return;
+        }
+    }
+#endif
+
+    // 3. Registry of the compiled object lists
+
+    struct CacheEntry
+    {
+        const std::vector<Shape*> *list;
+        Shape *const *data;
+        size_t size;
+        uint64_t generation;
+        size_t node;                // NUMA node of the copy (0 if not replicated)
+        std::shared_ptr<CompiledScene> scene;
+    };
+
+    std::mutex registryMutex;
+    std::vector<CacheEntry> registry;
+    std::vector<const std::vector<Shape*>*> attachedLists;
+    std::atomic<uint64_t> registryGeneration(0);
+    std::atomic<size_t> maxPrimitives(DEFAULT_MAX_PRIMITIVES);
+    std::atomic<bool> replicated(false);
+
+    // Last list looked up by this thread
+    thread_local CacheEntry lastEntry = { nullptr, nullptr, 0, 0, 0, nullptr };
+
+    // Same list in the same state (any copy)
+    bool matches(const CacheEntry &entry, const std::vector<Shape*> &objList, uint64_t generation)
+    {
+        return entry.list == &objList && entry.data == objList.data()
+            && entry.size == objList.size() && entry.generation == generation;
+    }
+
+    bool matches(const CacheEntry &entry, const std::vector<Shape*> &objList, uint64_t generation, size_t node)
+    {
+        return matches(entry, objList, generation) && entry.node == node;
+    }
+
+    // Drop the copies of a list (registryMutex held). The other entries move
+    // to the new generation: only the threads that looked this list up last
+    // have to search the registry again
+    void eraseList(const std::vector<Shape*> &objList)
+    {
+        for (size_t i = registry.size(); i-- > 0;)
+            if (registry[i].list == &objList)
+                registry.erase(registry.begin() + i);
+        uint64_t generation = ++registryGeneration;
+        for (CacheEntry &entry : registry)
+            entry.generation = generation;
+    }
+
+}
+
+CompiledScene::CompiledScene(const std::vector<Shape*> &objList) :
+    primitiveCount(objList.size())
+{
+    // 1. Sort the shapes by type
+    for (uint32_t order = 0; order < (uint32_t)objList.size(); order++) {
+        const Shape *shape = objList[order];
+        if (const Sphere *sphere = dynamic_cast<const Sphere*>(shape); sphere && sphere->hasUniformScale()) {
+            spheres.shape.push_back(shape);
+            spheres.order.push_back(order);
+        }
+        else if (dynamic_cast<const Square*>(shape)) {
+            squares.shape.push_back(shape);
+            squares.order.push_back(order);
+        }
+        else if (dynamic_cast<const InfinitePlan*>(shape)) {
+            plans.shape.push_back(shape);
+            plans.order.push_back(order);
+        }
+        else {
+            others.push_back(shape);
+        }
+    }
+
+    // 2. Fill the arrays
+    padArrays();
+    update();
+}
+
+void CompiledScene::setSphere(size_t i, const Sphere &sphere)
+{
+    Vector3D c = sphere.getCenter();
+    double radius = sphere.getRadius();
+    spheres.cx[i] = (float)c.x;
+    spheres.cy[i] = (float)c.y;
+    spheres.cz[i] = (float)c.z;
+    spheres.r2[i] = (float)(radius * radius);
+}
+
+void CompiledScene::setSquare(size_t i, const Square &square)
+{
+    Vector3D a = cross(square.v2, square.w);
+    Vector3D b = cross(square.w, square.v1);
+    squares.px[i] = (float)square.corner.x;
+    squares.py[i] = (float)square.corner.y;
+    squares.pz[i] = (float)square.corner.z;
+    squares.nx[i] = (float)square.normal.x;
+    squares.ny[i] = (float)square.normal.y;
+    squares.nz[i] = (float)square.normal.z;
+    squares.ax[i] = (float)a.x;
+    squares.ay[i] = (float)a.y;
+    squares.az[i] = (float)a.z;
+    squares.bx[i] = (float)b.x;
+    squares.by[i] = (float)b.y;
+    squares.bz[i] = (float)b.z;
+}
+
+void CompiledScene::setPlan(size_t i, const InfinitePlan &plan)
+{
+    Vector3D n = plan.getNormalWorld();
+    plans.nx[i] = (float)n.x;
+    plans.ny[i] = (float)n.y;
+    plans.nz[i] = (float)n.z;
+    plans.d[i] = (float)dot(plan.getPointWorld(), n);
+}
+
+bool CompiledScene::update()
+{
+    for (size_t i = 0; i < spheres.shape.size(); i++) {
+        const Sphere &sphere = static_cast<const Sphere&>(*spheres.shape[i]);
+        if (!sphere.hasUniformScale())
+            return false;
+        setSphere(i, sphere);
+    }
+    for (size_t i = 0; i < squares.shape.size(); i++)
+        setSquare(i, static_cast<const Square&>(*squares.shape[i]));
+    for (size_t i = 0; i < plans.shape.size(); i++)
+        setPlan(i, static_cast<const InfinitePlan&>(*plans.shape[i]));
+    return true;
+}
+
+void CompiledScene::padArrays()
+{
+    // Never hit: spheres of squared radius -inf (the discriminant is -inf or
+    // NaN even with rounding), squares and plans of null normal (always
+    // parallel to the ray)
+    auto padded = [](size_t n) { return (n + LANES - 1) / LANES * LANES; };
+
+    size_t n = padded(spheres.shape.size());
+    spheres.cx.resize(n, 0.0f);
+    spheres.cy.resize(n, 0.0f);
+    spheres.cz.resize(n, 0.0f);
+    spheres.r2.resize(n, -std::numeric_limits<float>::infinity());
+
+    n = padded(squares.shape.size());
+    for (std::vector<float> *v : { &squares.px, &squares.py, &squares.pz, &squares.nx, &squares.ny, &squares.nz,
+                                   &squares.ax, &squares.ay, &squares.az, &squares.bx, &squares.by, &squares.bz })
+        v->resize(n, 0.0f);
+
+    n = padded(plans.shape.size());
+    for (std::vector<float> *v : { &plans.nx, &plans.ny, &plans.nz, &plans.d })
+        v->resize(n, 0.0f);
+}
+
+size_t CompiledScene::getPrimitiveCount() const
+{
+    return primitiveCount;
+}
+
+bool CompiledScene::usesAVX2()
+{
+    return HAS_AVX2;
+}
+
+void CompiledScene::intersectSpheres(const Ray &ray, Hit &hit, bool any) const
+{
+    size_t count = spheres.shape.size();
+    if (count == 0)
+        return;
+
+    FloatRay r = toFloat(ray);
+    float a = r.dx * r.dx + r.dy * r.dy + r.dz * r.dz;
+    Candidate c = { searchLimit(hit), 0, false };
+#ifdef COMPILEDSCENE_X86
+    if (HAS_AVX2)
+        spheresAVX2(spheres.cx.data(), spheres.cy.data(), spheres.cz.data(), spheres.r2.data(),
+                    spheres.cx.size(), r, a, c, any);
+    else
+#endif
+        spheresScalar(spheres.cx.data(), spheres.cy.data(), spheres.cz.data(), spheres.r2.data(),
+                      0, count, r, a, c, any);
+
+    keepCandidate(hit, c.found, c.tBest, SPHERE, c.index, c.found ? spheres.order[c.index] : 0);
+}
+
+void CompiledScene::intersectSquares(const Ray &ray, Hit &hit, bool any) const
+{
+    size_t count = squares.shape.size();
+    if (count == 0)
+        return;
+
+    const float *arrays[12] = { squares.px.data(), squares.py.data(), squares.pz.data(),
+                                squares.nx.data(), squares.ny.data(), squares.nz.data(),
+                                squares.ax.data(), squares.ay.data(), squares.az.data(),
+                                squares.bx.data(), squares.by.data(), squares.bz.data() };
+    FloatRay r = toFloat(ray);
+    Candidate c = { searchLimit(hit), 0, false };
+#ifdef COMPILEDSCENE_X86
+    if (HAS_AVX2)
+        squaresAVX2(arrays, squares.px.size(), r, c, any);
+    else
+#endif
+        squaresScalar(arrays, 0, count, r, c, any);
+
+    keepCandidate(hit, c.found, c.tBest, SQUARE, c.index, c.found ? squares.order[c.index] : 0);
+}
+
+void CompiledScene::intersectPlans(const Ray &ray, Hit &hit, bool any) const
+{
+    size_t count = plans.shape.size();
+    if (count == 0)
+        return;
+
+    FloatRay r = toFloat(ray);
+    Candidate c = { searchLimit(hit), 0, false };
+#ifdef COMPILEDSCENE_X86
+    if (HAS_AVX2)
+        plansAVX2(plans.nx.data(), plans.ny.data(), plans.nz.data(), plans.d.data(),
+                  plans.nx.size(), r, c, any);
+    else
+#endif
+        plansScalar(plans.nx.data(), plans.ny.data(), plans.nz.data(), plans.d.data(), 0, count, r, c, any);
+
+    keepCandidate(hit, c.found, c.tBest, PLAN, c.index, c.found ? plans.order[c.index] : 0);
+}
+
+float CompiledScene::searchLimit(const Hit &hit)
+{
+    // Nothing found yet: the end of the ray is a hard limit
+    return hit.type == OTHER ? hit.t : tieLimit(hit.t);
+}
+
+void CompiledScene::keepCandidate(Hit &hit, bool found, float t, PrimitiveType type,
+                                  uint32_t index, uint32_t order)
+{
+    if (!found)
+        return;
+    bool tie = hit.type != OTHER && tieLimit(t) >= hit.t;
+    if (!tie || order > hit.order)
+        hit = Hit{ t, type, index, order };
+}
+
+const Shape* CompiledScene::getShape(const Hit &hit) const
+{
+    switch (hit.type) {
+    case SPHERE: return spheres.shape[hit.index];
+    case SQUARE: return squares.shape[hit.index];
+    case PLAN:   return plans.shape[hit.index];
+    default:     return nullptr;
+    }
+}
+
+bool CompiledScene::closestHit(const Ray &ray, Intersection &its) const
+{
+    // 1. Closest candidate of the flat primitives
+    float maxT = ray.maxT > std::numeric_limits<float>::max() ? std::numeric_limits<float>::infinity() : (float)ray.maxT;
+    Hit hit = { maxT, OTHER, 0, 0 };
+    intersectSpheres(ray, hit, false);
+    intersectSquares(ray, hit, false);
+    intersectPlans(ray, hit, false);
+
+    // 2. Confirm it with the shape itself, for the exact hit data. If the
+    //    shape disagrees (float rounding near a silhouette or minT), test
+    //    every shape as Utils::getClosestIntersection would
+    bool found = false;
+    if (const Shape *shape = getShape(hit)) {
+        double originalMaxT = ray.maxT;
+        found = shape->rayIntersect(ray, its);
+        if (!found || std::abs(ray.maxT - hit.t) > CONFIRM_TOLERANCE * (1.0 + hit.t)) {
+            ray.maxT = originalMaxT;
+            found = false;
+            for (const Shape *s : spheres.shape)
+                found |= s->rayIntersect(ray, its);
+            for (const Shape *s : squares.shape)
+                found |= s->rayIntersect(ray, its);
+            for (const Shape *s : plans.shape)
+                found |= s->rayIntersect(ray, its);
+        }
+    }
+
+    // 3. Shapes without a flat form
+    for (const Shape *shape : others)
+        found |= shape->rayIntersect(ray, its);
+    return found;
+}
+
+bool CompiledScene::anyHit(const Ray &ray) const
+{
+    Hit hit = { ray.maxT > std::numeric_limits<float>::max() ? std::numeric_limits<float>::infinity() : (float)ray.maxT,
+                OTHER, 0, 0 };
+    intersectSpheres(ray, hit, true);
+    if (hit.type != OTHER)
+        return true;
+    intersectSquares(ray, hit, true);
+    if (hit.type != OTHER)
+        return true;
+    intersectPlans(ray, hit, true);
+    if (hit.type != OTHER)
+        return true;
+
+    for (const Shape *shape : others)
+        if (shape->rayIntersectP(ray))
+            return true;
+    return false;
+}
+
+const CompiledScene* CompiledScene::get(const std::vector<Shape*> &objList)
+{
+    uint64_t generation = registryGeneration.load(std::memory_order_acquire);
+    size_t node = replicated ? ThreadPool::getThreadNode() : 0;
+    if (matches(lastEntry, objList, generation, node))
+        return lastEntry.scene.get();
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    generation = registryGeneration.load(std::memory_order_acquire);
+    for (const CacheEntry &entry : registry) {
+        if (matches(entry, objList, generation, node)) {
+            lastEntry = entry;
+            return lastEntry.scene.get();
+        }
+    }
+
+    // First use of this list on this node (or it changed): entries of the
+    // same address in another state are stale
+    for (size_t i = registry.size(); i-- > 0;)
+        if (registry[i].list == &objList && !matches(registry[i], objList, generation))
+            registry.erase(registry.begin() + i);
+
+    // Compiled by the calling thread, so the arrays are local to its node.
+    // Lists without owner keep an empty entry (traced through the virtuals)
+    bool attached = std::find(attachedLists.begin(), attachedLists.end(), &objList) != attachedLists.end();
+    std::shared_ptr<CompiledScene> scene;
+    if (attached && !objList.empty() && objList.size() <= maxPrimitives.load())
+        scene = std::make_shared<CompiledScene>(objList);
+    registry.push_back(CacheEntry{ &objList, objList.data(), objList.size(), generation, node, scene });
+    lastEntry = registry.back();
+    return lastEntry.scene.get();
+}
+
+bool CompiledScene::refit(const std::vector<Shape*> &objList)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    uint64_t generation = registryGeneration.load(std::memory_order_acquire);
+    bool cached = false, updated = true;
+    for (const CacheEntry &entry : registry) {
+        if (!matches(entry, objList, generation) || !entry.scene)
+            continue;
+        // The threads that looked the list up share these copies (one per
+        // node when replicated)
+        cached = true;
+        updated = entry.scene->update() && updated;
+    }
+    // Not compiled yet: it will be with the new positions
+    if (!cached || updated)
+        return true;
+
+    // A shape can not keep its place in the arrays: compile the list again
+    // on its next use
+    eraseList(objList);
+    return false;
+}
+
+void CompiledScene::invalidate()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    registry.clear();
+    registryGeneration++;
+}
+
+void CompiledScene::invalidate(const std::vector<Shape*> &objList)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    eraseList(objList);
+}
+
+void CompiledScene::attach(const std::vector<Shape*> &objList)
+{
+    // The empty entries left at this address by a list without owner go too
+    std::lock_guard<std::mutex> lock(registryMutex);
+    eraseList(objList);
+    attachedLists.push_back(&objList);
+}
+
+void CompiledScene::detach(const std::vector<Shape*> &objList)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    eraseList(objList);
+    attachedLists.erase(std::remove(attachedLists.begin(), attachedLists.end(), &objList), attachedLists.end());
+}
+
+void CompiledScene::setMaxPrimitives(size_t count)
+{
+    maxPrimitives = count;
+    invalidate();
+}
+
+size_t CompiledScene::getMaxPrimitives()
+{
+    return maxPrimitives;
+}
+
+void CompiledScene::setReplication(bool enabled)
+{
+    replicated = enabled;
+    invalidate();
+}
+
+bool CompiledScene::isReplicated()
+{
+    return replicated;
+}
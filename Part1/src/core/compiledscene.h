@@ -0,0 +1,146 @@
+#ifndef COMPILEDSCENE_H
+#define COMPILEDSCENE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "intersection.h"
+#include "ray.h"
+#include "../shapes/shape.h"
+
+class Sphere;
+class Square;
+class InfinitePlan;
+
+/**
+ * @brief The CompiledScene class
+ *
+ * Flat copy of a small object list for brute-force ray queries without
+ * virtual calls. Spheres, squares and infinite plans are stored by type in
+ * Structure-of-Arrays form (float, padded to 8 entries), so one ray can be
+ * tested against 8 primitives of a type at once with AVX2. CPUs without
+ * AVX2 run the same kernels one lane at a time. Shapes of other types are
+ * kept aside and tested through their virtuals.
+ *
+ * Utils::getClosestIntersection() and Utils::hasIntersection() use it
+ * automatically for object lists of at most getMaxPrimitives() shapes
+ * (see get()). The closest candidate is confirmed by its own shape, so the
+ * intersection data is exactly the one the shape computes.
+ */
+class CompiledScene
+{
+public:
+    explicit CompiledScene(const std::vector<Shape*> &objList);
+
+    // Same contract as Utils::getClosestIntersection (ray.maxT is updated)
+    bool closestHit(const Ray &ray, Intersection &its) const;
+    // Same contract as Utils::hasIntersection
+    bool anyHit(const Ray &ray) const;
+
+    size_t getPrimitiveCount() const;
+
+    // Compiled version of an object list, built on first use (nullptr if the
+    // list is larger than the threshold or not attached). A list is recognised
+    // by its address, buffer and size: call invalidate() after changing its
+    // shapes in place
+    static const CompiledScene* get(const std::vector<Shape*> &objList);
+    static void invalidate();
+    // Drop the compiled copies of one list only
+    static void invalidate(const std::vector<Shape*> &objList);
+    // Only the lists attached by their owner are compiled, and the owner
+    // detaches them before freeing them (see Scene), so a new list allocated
+    // at the same address never finds the copy of the previous one, whose
+    // shapes may be gone
+    static void attach(const std::vector<Shape*> &objList);
+    static void detach(const std::vector<Shape*> &objList);
+    // Update the compiled copy of a list after its shapes moved (same shapes
+    // in the same order), keeping its arrays. Must not run during a render.
+    // Returns false if the list has to be compiled again (e.g. a sphere lost
+    // its uniform scale), which then happens on its next use
+    static bool refit(const std::vector<Shape*> &objList);
+
+    // Largest object list compiled automatically (0 disables the compiled path)
+    static void setMaxPrimitives(size_t count);
+    static size_t getMaxPrimitives();
+
+    // One copy of every list per NUMA node, compiled by the first thread of
+    // the node that uses it (see ThreadPool::setPinning()), so the ray
+    // queries read node-local memory
+    static void setReplication(bool enabled);
+    static bool isReplicated();
+
+    // Whether the AVX2 kernels are used on this CPU
+    static bool usesAVX2();
+
+private:
+    enum PrimitiveType : uint8_t
+    {
+        SPHERE,
+        SQUARE,
+        PLAN,
+        OTHER
+    };
+
+    // Closest candidate found by the kernels
+    struct Hit
+    {
+        float t;
+        PrimitiveType type;
+        uint32_t index;
+        uint32_t order;      // Position in the object list (ties go to the last)
+    };
+
+    struct Spheres
+    {
+        std::vector<float> cx, cy, cz, r2;
+        std::vector<const Shape*> shape;
+        std::vector<uint32_t> order;
+    };
+
+    struct Squares
+    {
+        std::vector<float> px, py, pz;    // Corner
+        std::vector<float> nx, ny, nz;    // Normal
+        std::vector<float> ax, ay, az;    // alpha = dot(p - corner, a)
+        std::vector<float> bx, by, bz;    // beta = dot(p - corner, b)
+        std::vector<const Shape*> shape;
+        std::vector<uint32_t> order;
+    };
+
+    struct Plans
+    {
+        std::vector<float> nx, ny, nz;
+        std::vector<float> d;             // dot(point, normal)
+        std::vector<const Shape*> shape;
+        std::vector<uint32_t> order;
+    };
+
+    void padArrays();
+    // Fill the arrays from the current shapes (false if a sphere can no
+    // longer be stored as one)
+    bool update();
+    void setSphere(size_t i, const Sphere &sphere);
+    void setSquare(size_t i, const Square &square);
+    void setPlan(size_t i, const InfinitePlan &plan);
+
+    // Closest candidate of every type with t in [minT, hit.t]
+    void intersectSpheres(const Ray &ray, Hit &hit, bool any) const;
+    void intersectSquares(const Ray &ray, Hit &hit, bool any) const;
+    void intersectPlans(const Ray &ray, Hit &hit, bool any) const;
+
+    // Largest t a kernel has to look at, ties included
+    static float searchLimit(const Hit &hit);
+    // Keep the candidate of a kernel if it is closer than hit, or as close
+    // (coplanar shapes) but later in the object list
+    static void keepCandidate(Hit &hit, bool found, float t, PrimitiveType type,
+                              uint32_t index, uint32_t order);
+    const Shape* getShape(const Hit &hit) const;
+
+    Spheres spheres;
+    Squares squares;
+    Plans plans;
+    std::vector<const Shape*> others;
+    size_t primitiveCount;
+};
+
+#endif // COMPILEDSCENE_H
@@ -0,0 +1,160 @@
+#include "costprofiler.h"
+#include "imageoutput.h"
+#include "parallel.h"
+#include "random.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define HAS_CYCLE_COUNTER
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_CYCLE_COUNTER
+#endif
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // Time stamp counter (constant rate on current CPUs, a few cycles to
+    // read); nanoseconds of the steady clock elsewhere
+    uint64_t readCycles()
+    {
+#ifdef HAS_CYCLE_COUNTER
+        return __rdtsc();
+#else
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now().time_since_epoch()).count();
+#endif
+    }
+}
+
+CostProfiler::CostProfiler() :
+    CostProfiler(Settings())
+{ }
+
+CostProfiler::CostProfiler(const Settings &settings_) :
+    settings(settings_), elapsedTime(0), rayCount(0)
+{ }
+
+double CostProfiler::getElapsedTime() const
+{
+    return elapsedTime;
+}
+
+uint64_t CostProfiler::getRayCount() const
+{
+    return rayCount;
+}
+
+void CostProfiler::render(const Camera &cam, Shader &shader, Film &film,
+                          const std::vector<Shape*> &objList,
+                          const std::vector<LightSource*> &lsList)
+{
+    size_t resX = film.getWidth();
+    size_t resY = film.getHeight();
+    size_t spp = std::max<size_t>(1, shader.getRenderSettings().samplesPerPixel);
+
+    size_t timeAOV = film.addAOV("time");
+    size_t raysAOV = film.addAOV("rays");
+    size_t depthAOV = film.addAOV("depth");
+    std::vector<uint64_t> cycles(resX * resY, 0);
+    std::vector<uint64_t> lineRays(resY, 0);
+
+    shader.beginPass(0, objList, lsList);
+
+    // 1. Render, measuring every pixel
+    Clock::time_point start = Clock::now();
+    uint64_t startCycles = readCycles();
+    ThreadPool::global().parallelForLocal(resY, 1, [&](size_t begin, size_t end) {
+        RayCounters &counters = Utils::getRayCounters();
+        for (size_t lin = begin; lin < end; lin++) {
+            for (size_t col = 0; col < resX; col++) {
+                Random::seed(Random::hash(col, lin, 0));
+                counters = RayCounters();
+                counters.enabled = true;
+                uint64_t pixelStart = readCycles();
+
+                Vector3D pixelColor(0.0);
+                for (size_t sample = 0; sample < spp; sample++) {
+                    double x = (col + (spp > 1 ? Random::uniform() : 0.5)) / resX;
+                    double y = (lin + (spp > 1 ? Random::uniform() : 0.5)) / resY;
+                    pixelColor += shader.computeColor(cam.generateRay(x, y), objList, lsList);
+                }
+                pixelColor /= (double)spp;
+
+                cycles[lin * resX + col] = readCycles() - pixelStart;
+                lineRays[lin] += counters.getRays();
+                film.setPixelValue(col, lin, pixelColor);
+                film.setAOV(raysAOV, col, lin, (float)counters.getRays());
+                film.setAOV(depthAOV, col, lin, (float)counters.maxDepth);
+            }
+        }
+        counters.enabled = false;
+    });
+    uint64_t totalCycles = readCycles() - startCycles;
+    elapsedTime = std::chrono::duration<double>(Clock::now() - start).count();
+    film.resolveSplats(1.0 / spp);
+
+    // 2. Cycles to microseconds, with the rate of the counter over the render
+    double microsPerCycle = totalCycles > 0 ? elapsedTime * 1e6 / totalCycles : 0.0;
+    rayCount = 0;
+    for (size_t lin = 0; lin < resY; lin++) {
+        rayCount += lineRays[lin];
+        for (size_t col = 0; col < resX; col++)
+            film.setAOV(timeAOV, col, lin, (float)(cycles[lin * resX + col] * microsPerCycle));
+    }
+}
+
+bool CostProfiler::saveHeatmap(const Film &film, const std::string &aovName, const std::string &filename) const
+{
+    size_t aov = 0;
+    while (aov < film.getAOVCount() && film.getAOVName(aov) != aovName)
+        aov++;
+    if (aov == film.getAOVCount())
+        return false;
+
+    size_t resX = film.getWidth();
+    size_t resY = film.getHeight();
+    std::vector<double> values(resX * resY);
+    for (size_t lin = 0; lin < resY; lin++)
+        for (size_t col = 0; col < resX; col++) {
+            double value = std::max(0.0f, film.getAOV(aov, col, lin));
+            values[lin * resX + col] = settings.logScale ? std::log1p(value) : value;
+        }
+
+    // 1. Values drawn in red and in blue: the percentile of the image and
+    // the opposite one (the costs of most pixels are close to each other)
+    double percentile = std::clamp(settings.percentile, 0.5, 1.0);
+    std::vector<double> sorted = values;
+    size_t highRank = (size_t)(percentile * (sorted.size() - 1));
+    size_t lowRank = (size_t)((1.0 - percentile) * (sorted.size() - 1));
+    std::nth_element(sorted.begin(), sorted.begin() + highRank, sorted.end());
+    double maxValue = sorted[highRank];
+    std::nth_element(sorted.begin(), sorted.begin() + lowRank, sorted.begin() + highRank);
+    double minValue = sorted[lowRank];
+
+    // 2. False colours
+    Film heatmap(resX, resY);
+    for (size_t lin = 0; lin < resY; lin++)
+        for (size_t col = 0; col < resX; col++) {
+            double scalar = maxValue > minValue ?
+                std::clamp((values[lin * resX + col] - minValue) / (maxValue - minValue), 0.0, 1.0) : 0.0;
+            Vector3D color = Utils::scalarToRGB(scalar);
+            heatmap.setPixelValue(col, lin, color);
+        }
+    return ImageOutput().save(heatmap, filename);
+}
+
+bool CostProfiler::save(const Film &film, const std::string &basename) const
+{
+    bool ok = film.saveAOVs(basename + "_cost.exr");
+    for (size_t aov = 0; aov < film.getAOVCount(); aov++)
+        ok = saveHeatmap(film, film.getAOVName(aov), basename + "_" + film.getAOVName(aov) + ".png") && ok;
+    return ok;
+}
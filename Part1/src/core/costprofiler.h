@@ -0,0 +1,64 @@
+#ifndef COSTPROFILER_H
+#define COSTPROFILER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "film.h"
+#include "../cameras/camera.h"
+#include "../lightsources/lightsource.h"
+#include "../shaders/shader.h"
+#include "../shapes/shape.h"
+
+/**
+ * @brief The CostProfiler class
+ *
+ * Instrumented render to find where the time of an image goes: the image is
+ * rendered as raytrace() does, and for every pixel it also records
+ *  - "time": wall time spent in the shader, in microseconds (read from the
+ *    cycle counter of the CPU, converted with the frequency measured over
+ *    the whole render),
+ *  - "rays": rays traced (closest hits and shadow rays, counted by Utils
+ *    while the profiler enables its counters),
+ *  - "depth": depth of the deepest ray,
+ * as AOVs of the film (see Film::addAOV()).
+ *
+ * save() exports them as raw float channels of an EXR file and as false
+ * colour heatmaps (Utils::scalarToRGB(): blue is cheap, red expensive).
+ * The heatmaps span the values between two percentiles of the image, so a
+ * few outliers do not flatten the contrast of the rest.
+ */
+class CostProfiler
+{
+public:
+    struct Settings
+    {
+        bool logScale = true;       // Heatmaps of log(1 + value)
+        // Values drawn in red (and above), and blue (1 - percentile, and below)
+        double percentile = 0.99;
+    };
+
+    CostProfiler();
+    explicit CostProfiler(const Settings &settings_);
+
+    void render(const Camera &cam, Shader &shader, Film &film,
+                const std::vector<Shape*> &objList,
+                const std::vector<LightSource*> &lsList);
+
+    // Heatmap of an AOV of the film (.png, .bmp or .exr)
+    bool saveHeatmap(const Film &film, const std::string &aovName, const std::string &filename) const;
+    // basename_cost.exr with every AOV, and basename_<aov>.png for each
+    bool save(const Film &film, const std::string &basename) const;
+
+    // Statistics of the last render
+    double getElapsedTime() const;   // Seconds
+    uint64_t getRayCount() const;
+
+private:
+    Settings settings;
+    double elapsedTime;
+    uint64_t rayCount;
+};
+
+#endif // COSTPROFILER_H
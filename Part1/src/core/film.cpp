@@ -1,11 +1,57 @@
 #include "film.h"
+#include "imageoutput.h"
+#include "parallel.h"
 
 #define TINYEXR_IMPLEMENTATION
 #include "tinyexr.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <vector>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+void compressEXRZip(const unsigned char *src, size_t size, std::vector<unsigned char> &dst)
+{
+    // tinyexr compresses into a buffer of the size of the data at least
+    dst.resize(std::max<size_t>(size, tinyexr::miniz::mz_compressBound((tinyexr::miniz::mz_ulong)size)));
+    tinyexr::tinyexr_uint64 packedSize = 0;
+    tinyexr::CompressZip(dst.data(), packedSize, src, (unsigned long)size);
+    dst.resize((size_t)packedSize);
+}
+
+void compressZlib(const unsigned char *src, size_t size, std::vector<unsigned char> &dst)
+{
+    tinyexr::miniz::mz_ulong packedSize = tinyexr::miniz::mz_compressBound((tinyexr::miniz::mz_ulong)size);
+    dst.resize(packedSize);
+    if (tinyexr::miniz::mz_compress(dst.data(), &packedSize, src, (tinyexr::miniz::mz_ulong)size)
+        != tinyexr::miniz::MZ_OK)
+        packedSize = 0;
+    dst.resize(packedSize);
+}
+
+bool replaceFile(const std::string &source, const std::string &target)
+{
+#ifdef _WIN32
+    // rename() fails on Windows when the target exists
+    return MoveFileExA(source.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return std::rename(source.c_str(), target.c_str()) == 0;
+#endif
+}
+
+uint32_t computeCRC32(uint32_t crc, const unsigned char *data, size_t size)
+{
+    return (uint32_t)tinyexr::miniz::mz_crc32(crc, data, size);
+}
+
 /**
  * @brief Film::Film
  */
@@ -16,12 +62,24 @@ Film::Film(size_t width_, size_t height_)
     width  = width_;
     height = height_;
 
-    // Allocate memory for the image matrix
+    // Allocate memory for the image matrix. Every line is allocated and
+    // zeroed by a thread of the NUMA node that renders it (see
+    // ThreadPool::parallelForLocal()), so its pages are local to that node
     data = new Vector3D*[height];
-    for( size_t i=0; i<height; i++)
-    {
-        data[i] = new Vector3D[width];
-    }
+    luminanceSq.resize(width * height);
+    sampleCounts.resize(width * height);
+    ThreadPool::global().parallelForLocal(height, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            data[i] = new Vector3D[width];
+            std::fill_n(&luminanceSq[i * width], width, 0.0);
+            std::fill_n(&sampleCounts[i * width], width, 0);
+        }
+    });
+
+    splats.reset(new std::atomic<float>[width * height * 3]);
+    for (size_t i = 0; i < width * height * 3; i++)
+        splats[i] = 0.0f;
+    hasSplats = false;
 
     // Set all values to zero
     clearData();
@@ -52,73 +110,394 @@ Vector3D Film::getPixelValue(size_t w, size_t h) const
     return data[h][w];
 }
 
+const Vector3D* Film::getRow(size_t h) const
+{
+    return data[h];
+}
+
 void Film::setPixelValue(size_t w, size_t h, Vector3D &value)
 {
     data[h][w] = value;
 }
 
-void Film::clearData()
+void Film::addSplat(size_t w, size_t h, const Vector3D &value)
 {
-    Vector3D zero;
+    size_t idx = (h * width + w) * 3;
+    splats[idx + 0].fetch_add(value.x, std::memory_order_relaxed);
+    splats[idx + 1].fetch_add(value.y, std::memory_order_relaxed);
+    splats[idx + 2].fetch_add(value.z, std::memory_order_relaxed);
+    hasSplats.store(true, std::memory_order_relaxed);
+}
 
-    for(size_t h=0; h<height; h++)
+void Film::resolveSplats(double scale)
+{
+    if (!hasSplats)
+        return;
+
+    for (size_t h = 0; h < height; h++)
     {
-        for(size_t w=0; w<width; w++)
+        for (size_t w = 0; w < width; w++)
         {
-            setPixelValue(w, h, zero);
+            size_t idx = (h * width + w) * 3;
+            data[h][w] += Vector3D(splats[idx + 0], splats[idx + 1], splats[idx + 2]) * scale;
+            splats[idx + 0] = 0.0f;
+            splats[idx + 1] = 0.0f;
+            splats[idx + 2] = 0.0f;
         }
     }
+    hasSplats = false;
 }
 
-int Film::save()
+namespace
 {
-    return BitMap::save(data, width, height);
+    double luminance(const Vector3D &c)
+    {
+        return (c.x + c.y + c.z) / 3.0;
+    }
 }
 
+void Film::addPassSample(size_t w, size_t h, const Vector3D &value, size_t pass)
+{
+    double l = luminance(value);
+    double &sq = luminanceSq[h * width + w];
+    sampleCounts[h * width + w] = (uint32_t)(pass + 1);
+    if (pass == 0) {
+        data[h][w] = value;
+        sq = l * l;
+        return;
+    }
+    data[h][w] += (value - data[h][w]) / double(pass + 1);
+    sq += (l * l - sq) / double(pass + 1);
+}
 
-int Film::saveEXR()
+double Film::estimateRelativeError(size_t passes) const
 {
-    const char* fname = "output.exr";
+    if (passes < 2 || luminanceSq.size() != width * height)
+        return INFINITY;
+
+    // Sum over the pixels of sqrt(var / n), with the unbiased variance
+    double n = (double)passes;
+    double errorSum = 0, luminanceSum = 0;
+    for (size_t h = 0; h < height; h++)
+    {
+        for (size_t w = 0; w < width; w++)
+        {
+            double mean = luminance(data[h][w]);
+            double variance = std::max(0.0, luminanceSq[h * width + w] - mean * mean) * n / (n - 1);
+            errorSum += std::sqrt(variance / n);
+            luminanceSum += mean;
+        }
+    }
+    return luminanceSum > 0 ? errorSum / luminanceSum : 0.0;
+}
 
-    unsigned int N_COMPONENTS = 3;
+uint32_t Film::getSampleCount(size_t w, size_t h) const
+{
+    return sampleCounts.empty() ? 0 : sampleCounts[h * width + w];
+}
 
-    ImageBufferEXR buffer;
-    buffer.data = data;
-    buffer.width = width;
-    buffer.height = height;
+namespace
+{
+    const char CHECKPOINT_MAGIC[8] = { 'A', 'C', 'G', 'C', 'K', 'P', 'T', '\0' };
+    const uint32_t CHECKPOINT_VERSION = 1;
+    const uint32_t CHECKPOINT_COMPRESSED = 1;
 
-    const std::string filename(fname);
+    // 64 bytes, followed by the payload: mean squared luminance (double per
+    // pixel), mean color (3 floats per pixel), samples (uint32 per pixel)
+    struct CheckpointHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t flags;
+        uint64_t width;
+        uint64_t height;
+        uint64_t passes;
+        double elapsedTime;
+        uint64_t payloadSize;   // Bytes stored after the header
+        uint64_t rawSize;       // Bytes of the payload once uncompressed
+    };
+    static_assert(sizeof(CheckpointHeader) == 64, "Checkpoint header must stay 64 bytes");
+}
 
-    float* myImage = (float*)malloc(sizeof(float) * width* height* N_COMPONENTS);    
-  
-    for (size_t i = 0; i < static_cast<size_t>(width); i++) {
-        for (size_t j = 0; j < static_cast<size_t>(height); j++) {
-            int idx = j * width + i;
-            myImage[idx * 3 + 0] = data[height - j - 1][i].x;
-            myImage[idx * 3 + 1] = data[height - j - 1][i].y;
-            myImage[idx * 3 + 2] = data[height - j - 1][i].z;
+bool Film::saveCheckpoint(const std::string &filename, const CheckpointInfo &info, bool compress) const
+{
+    // 1. Payload
+    size_t pixels = width * height;
+    std::vector<unsigned char> raw(pixels * (sizeof(double) + 3 * sizeof(float) + sizeof(uint32_t)));
+    unsigned char *out = raw.data();
+    for (size_t i = 0; i < pixels; i++) {
+        double sq = luminanceSq.empty() ? 0.0 : luminanceSq[i];
+        std::memcpy(out, &sq, sizeof(double));
+        out += sizeof(double);
+    }
+    for (size_t h = 0; h < height; h++) {
+        for (size_t w = 0; w < width; w++) {
+            float rgb[3] = { data[h][w].x, data[h][w].y, data[h][w].z };
+            std::memcpy(out, rgb, sizeof(rgb));
+            out += sizeof(rgb);
         }
     }
+    for (size_t i = 0; i < pixels; i++) {
+        uint32_t count = sampleCounts.empty() ? 0 : sampleCounts[i];
+        std::memcpy(out, &count, sizeof(uint32_t));
+        out += sizeof(uint32_t);
+    }
+
+    std::vector<unsigned char> packed;
+    const std::vector<unsigned char> *payload = &raw;
+    if (compress) {
+        tinyexr::miniz::mz_ulong packedSize = tinyexr::miniz::mz_compressBound((tinyexr::miniz::mz_ulong)raw.size());
+        packed.resize(packedSize);
+        if (tinyexr::miniz::mz_compress(packed.data(), &packedSize, raw.data(), (tinyexr::miniz::mz_ulong)raw.size())
+            != tinyexr::miniz::MZ_OK)
+            return false;
+        packed.resize(packedSize);
+        payload = &packed;
+    }
+
+    CheckpointHeader header;
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.flags = compress ? CHECKPOINT_COMPRESSED : 0;
+    header.width = width;
+    header.height = height;
+    header.passes = info.passes;
+    header.elapsedTime = info.elapsedTime;
+    header.payloadSize = payload->size();
+    header.rawSize = raw.size();
+
+    // 2. Write next to the old checkpoint, then replace it
+    std::string tmpName = filename + ".tmp";
+    FILE *file = fopen(tmpName.c_str(), "wb");
+    if (!file)
+        return false;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(payload->data(), 1, payload->size(), file) == payload->size();
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        std::remove(tmpName.c_str());
+        return false;
+    }
+    return replaceFile(tmpName, filename);
+}
+
+bool Film::loadCheckpoint(const std::string &filename, CheckpointInfo &info)
+{
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (!file)
+        return false;
+
+    CheckpointHeader header;
+    std::vector<unsigned char> payload;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1
+        && std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0
+        && header.version == CHECKPOINT_VERSION
+        && header.width == width && header.height == height;
+    if (ok) {
+        payload.resize(header.payloadSize);
+        ok = fread(payload.data(), 1, payload.size(), file) == payload.size();
+    }
+    fclose(file);
 
-    const char* err = "";
-    int32_t ret = SaveEXR(
-        myImage,
-        buffer.width,
-        buffer.height,
-        N_COMPONENTS, // num components
-        0, // save_as_fp32
-        filename.c_str(),
-        &err);
+    size_t pixels = width * height;
+    size_t expectedSize = pixels * (sizeof(double) + 3 * sizeof(float) + sizeof(uint32_t));
+    if (!ok || header.rawSize != expectedSize) {
+        std::cout << "Invalid checkpoint " << filename << std::endl;
+        return false;
+    }
 
-    free(myImage);
+    std::vector<unsigned char> raw;
+    if (header.flags & CHECKPOINT_COMPRESSED) {
+        raw.resize(expectedSize);
+        tinyexr::miniz::mz_ulong rawSize = (tinyexr::miniz::mz_ulong)raw.size();
+        if (tinyexr::miniz::mz_uncompress(raw.data(), &rawSize, payload.data(), (tinyexr::miniz::mz_ulong)payload.size())
+            != tinyexr::miniz::MZ_OK || rawSize != expectedSize)
+            return false;
+    }
+    else {
+        if (payload.size() != expectedSize)
+            return false;
+        raw.swap(payload);
+    }
+
+    const unsigned char *in = raw.data();
+    luminanceSq.resize(pixels);
+    sampleCounts.resize(pixels);
+    std::memcpy(luminanceSq.data(), in, pixels * sizeof(double));
+    in += pixels * sizeof(double);
+    for (size_t h = 0; h < height; h++) {
+        for (size_t w = 0; w < width; w++) {
+            float rgb[3];
+            std::memcpy(rgb, in, sizeof(rgb));
+            in += sizeof(rgb);
+            data[h][w] = Vector3D(rgb[0], rgb[1], rgb[2]);
+        }
+    }
+    std::memcpy(sampleCounts.data(), in, pixels * sizeof(uint32_t));
+
+    info.passes = header.passes;
+    info.elapsedTime = header.elapsedTime;
+    return true;
+}
+
+bool Film::mergeCheckpoint(const std::string &filename, CheckpointInfo &info)
+{
+    Film part(width, height);
+    CheckpointInfo partInfo;
+    if (!part.loadCheckpoint(filename, partInfo))
+        return false;
+
+    size_t pixels = width * height;
+    if (sampleCounts.size() != pixels) {
+        luminanceSq.assign(pixels, 0.0);
+        sampleCounts.assign(pixels, 0);
+    }
+
+    uint32_t maxCount = 0;
+    for (size_t h = 0; h < height; h++) {
+        for (size_t w = 0; w < width; w++) {
+            size_t i = h * width + w;
+            double n1 = sampleCounts[i];
+            double n2 = part.sampleCounts[i];
+            if (n2 > 0) {
+                // Weighted mean in double, rounded once to the film precision
+                double n = n1 + n2;
+                const Vector3D &a = data[h][w];
+                const Vector3D &b = part.data[h][w];
+                data[h][w] = Vector3D((n1 * a.x + n2 * b.x) / n, (n1 * a.y + n2 * b.y) / n,
+                                      (n1 * a.z + n2 * b.z) / n);
+                luminanceSq[i] = (n1 * luminanceSq[i] + n2 * part.luminanceSq[i]) / n;
+                sampleCounts[i] += part.sampleCounts[i];
+            }
+            maxCount = std::max(maxCount, sampleCounts[i]);
+        }
+    }
+
+    info.passes = maxCount;
+    info.elapsedTime += partInfo.elapsedTime;
+    return true;
+}
+
+size_t Film::addAOV(const std::string &name)
+{
+    for (size_t aov = 0; aov < aovNames.size(); aov++)
+        if (aovNames[aov] == name)
+            return aov;
+    aovNames.push_back(name);
+    aovs.emplace_back(width * height, 0.0f);
+    return aovNames.size() - 1;
+}
+
+size_t Film::getAOVCount() const
+{
+    return aovNames.size();
+}
+
+const std::string& Film::getAOVName(size_t aov) const
+{
+    return aovNames[aov];
+}
+
+float Film::getAOV(size_t aov, size_t w, size_t h) const
+{
+    return aovs[aov][h * width + w];
+}
+
+void Film::setAOV(size_t aov, size_t w, size_t h, float value)
+{
+    aovs[aov][h * width + w] = value;
+}
+
+bool Film::saveAOVs(const std::string &filename) const
+{
+    if (aovs.empty())
+        return false;
+
+    // 1. Channels in alphabetical order, as the format expects
+    std::vector<size_t> order(aovs.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return aovNames[a] < aovNames[b]; });
+
+    std::vector<EXRChannelInfo> channels(order.size());
+    std::vector<int> pixelTypes(order.size(), TINYEXR_PIXELTYPE_FLOAT);
+    std::vector<const float*> images(order.size());
+    for (size_t c = 0; c < order.size(); c++) {
+        std::memset(&channels[c], 0, sizeof(EXRChannelInfo));
+        std::strncpy(channels[c].name, aovNames[order[c]].c_str(), sizeof(channels[c].name) - 1);
+        images[c] = aovs[order[c]].data();
+    }
+
+    // 2. Image and header (first line at the top, as the film)
+    EXRImage image;
+    InitEXRImage(&image);
+    image.num_channels = (int)order.size();
+    image.images = (unsigned char**)images.data();
+    image.width = (int)width;
+    image.height = (int)height;
+
+    EXRHeader header;
+    InitEXRHeader(&header);
+    header.num_channels = (int)order.size();
+    header.channels = channels.data();
+    header.pixel_types = pixelTypes.data();
+    header.requested_pixel_types = pixelTypes.data();
+    header.compression_type = TINYEXR_COMPRESSIONTYPE_ZIP;
+
+    const char *err = nullptr;
+    if (SaveEXRImageToFile(&image, &header, filename.c_str(), &err) != TINYEXR_SUCCESS) {
+        std::cout << "Error storing " << filename << ": " << (err ? err : "unknown error") << std::endl;
+        if (err)
+            FreeEXRErrorMessage(err);
+        return false;
+    }
+    return true;
+}
+
+void Film::clearData()
+{
+    Vector3D zero;
+
+    for(size_t h=0; h<height; h++)
+    {
+        for(size_t w=0; w<width; w++)
+        {
+            setPixelValue(w, h, zero);
+        }
+    }
+    std::fill(luminanceSq.begin(), luminanceSq.end(), 0.0);
+    std::fill(sampleCounts.begin(), sampleCounts.end(), 0);
+    for (std::vector<float> &aov : aovs)
+        std::fill(aov.begin(), aov.end(), 0.0f);
+}
+
+int Film::save()
+{
+    return ImageOutput().save(*this, "./output.bmp", ImageOutput::BMP) ? 0 : 1;
+}
+
+
+int Film::saveEXR()
+{
+    return saveEXR("output.exr");
+}
+
+int Film::saveEXR(const std::string &filename, bool verbose)
+{
+    // Straight from the film lines, in parallel (see ImageOutput)
+    const char* err = "could not write the file";
+    if (ImageOutput().save(*this, filename, ImageOutput::EXR))
+        err = "";
 
     bool saved_correctly = (err != NULL) && (err[0] == '\0');
     if (saved_correctly) {
-        printf("EXR Stored Correctly :) \n"); 
+        if (verbose)
+            printf("EXR Stored Correctly :) \n"); 
         return 1;
     }
     else {
-        std::cout <<"Error storing EXR file :( --> " << err;
+        if (verbose)
+            std::cout <<"Error storing EXR file :( --> " << err;
         return 0;
     }
 
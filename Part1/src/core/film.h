@@ -3,8 +3,14 @@
 
 #include "vector3d.h"
 #include "bitmap.h"
+#include "numa.h"
 
+#include <atomic>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 
 
 enum BufferImageFormat
@@ -28,6 +34,24 @@ struct ImageBufferEXR
     void destroy();
 };
 
+// Render state stored next to the film buffers in a checkpoint
+struct CheckpointInfo
+{
+    uint64_t passes = 0;        // Passes already accumulated (next pass to render)
+    double elapsedTime = 0;     // Seconds spent so far
+};
+
+// ZIP compression of an EXR chunk with the tinyexr build in film.cpp, for
+// the writers that produce their own chunks (see TileFilm). The data is
+// copied as is when it does not get smaller, as the format requires
+void compressEXRZip(const unsigned char *src, size_t size, std::vector<unsigned char> &dst);
+// zlib stream and CRC-32 of the same build, for PNG files
+void compressZlib(const unsigned char *src, size_t size, std::vector<unsigned char> &dst);
+uint32_t computeCRC32(uint32_t crc, const unsigned char *data, size_t size);
+// Move a finished file over another in one step: a crash leaves either the
+// old target or the new one, never none (rename() on POSIX)
+bool replaceFile(const std::string &source, const std::string &target);
+
 /**
  * @brief The Film class
  */
@@ -45,13 +69,58 @@ public:
     size_t getWidth() const;
     size_t getHeight() const;
     Vector3D getPixelValue(size_t w, size_t h) const;
+    // Pixels of a line (the RGB floats of its Vector3D one after the other)
+    const Vector3D* getRow(size_t h) const;
 
     // Setters
     void setPixelValue(size_t w, size_t h, Vector3D &value);
 
+    // Thread-safe accumulation of contributions that can land on any pixel
+    // (light tracing). They are kept apart until resolveSplats() adds them,
+    // multiplied by scale, to the image
+    void addSplat(size_t w, size_t h, const Vector3D &value);
+    void resolveSplats(double scale);
+
+    // Progressive rendering: running mean of one sample per pixel and pass
+    // (pass 0 restarts the pixel), together with the mean squared luminance
+    // used to estimate the noise left in the image
+    void addPassSample(size_t w, size_t h, const Vector3D &value, size_t pass);
+    // Standard error of the pixel luminances after the given number of
+    // passes, relative to the mean luminance of the image
+    double estimateRelativeError(size_t passes) const;
+    // Samples accumulated by a pixel with addPassSample()
+    uint32_t getSampleCount(size_t w, size_t h) const;
+
+    // Checkpoints: the accumulation buffers (mean color, mean squared
+    // luminance, samples per pixel) and the render state in a binary file,
+    // optionally deflate-compressed. Uncompressed files keep every array
+    // aligned at a fixed offset, so they can be memory-mapped. The file is
+    // written under a temporary name and then renamed, so a crash while
+    // saving keeps the previous checkpoint
+    bool saveCheckpoint(const std::string &filename, const CheckpointInfo &info, bool compress = false) const;
+    bool loadCheckpoint(const std::string &filename, CheckpointInfo &info);
+    // Add a partial render (checkpoint of a tile or a range of passes) to the
+    // film: every pixel is the mean of both weighted by their sample counts.
+    // info.passes becomes the largest sample count and the times are added
+    bool mergeCheckpoint(const std::string &filename, CheckpointInfo &info);
+
+    // Arbitrary output variables (AOVs): named float channels next to the
+    // image, e.g. the render cost of every pixel (see CostProfiler)
+    // addAOV() returns the index of the channel (the existing one if the
+    // name is taken), zeroed when it is new
+    size_t addAOV(const std::string &name);
+    size_t getAOVCount() const;
+    const std::string& getAOVName(size_t aov) const;
+    float getAOV(size_t aov, size_t w, size_t h) const;
+    void setAOV(size_t aov, size_t w, size_t h, float value);
+    // Every AOV as a float channel of a ZIP-compressed EXR file
+    bool saveAOVs(const std::string &filename) const;
+
     // Other functions
     int save();
     int saveEXR();
+    // verbose: report the result on the standard output
+    int saveEXR(const std::string &filename, bool verbose = true);
     void clearData();
 
 private:
@@ -61,6 +130,19 @@ private:
 
     // Pointer to image data
     Vector3D **data;
+
+    // Mean squared luminance of the passes and samples taken (per pixel).
+    // Like the lines, first written by the threads that render them
+    std::vector<double, FirstTouchAllocator<double>> luminanceSq;
+    std::vector<uint32_t, FirstTouchAllocator<uint32_t>> sampleCounts;
+
+    // AOV names and values (one float per pixel, line by line)
+    std::vector<std::string> aovNames;
+    std::vector<std::vector<float>> aovs;
+
+    // Splat buffer (RGB per pixel)
+    std::unique_ptr<std::atomic<float>[]> splats;
+    std::atomic<bool> hasSplats;
 };
 
 #endif // FILM_H
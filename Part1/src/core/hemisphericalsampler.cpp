@@ -1,5 +1,6 @@
 #include "hemisphericalsampler.h"
 #include "matrix4x4.h"
+#include "random.h"
 
 #include <random>
 #define _USE_MATH_DEFINES
@@ -16,8 +17,8 @@ HemisphericalSampler::HemisphericalSampler()
 Vector3D HemisphericalSampler::getSample(const Vector3D &normal) const
 {
     // Get two i.i.d. random numbers between 0-1
-    double psi1 = (double)std::rand() / RAND_MAX;
-    double psi2 = (double)std::rand() / RAND_MAX;
+    double psi1 = Random::uniform();
+    double psi2 = Random::uniform();
 
     // Generate the direction in spherical coordinates (arround (0, 1, 0))
     double theta = std::acos(psi1);
@@ -55,3 +56,28 @@ Vector3D HemisphericalSampler::getSample(const Vector3D &normal) const
     //Center the hemisphere on the provided normal
     return randomDir.normalized();
 }
+
+Vector3D HemisphericalSampler::getCosineSample(const Vector3D &normal) const
+{
+    // Malley's method: uniform point on the disk projected to the hemisphere
+    double psi1 = Random::uniform();
+    double psi2 = Random::uniform();
+
+    double sinTheta = std::sqrt(psi1);
+    double cosTheta = std::sqrt(std::max(0.0, 1.0 - psi1));
+    double phi = psi2 * 2 * M_PI;
+
+    // Local frame (n = yy local), same construction as getSample
+    Vector3D yL = normal.normalized();
+    Vector3D xL = cross(yL, Vector3D(0.0, 1.0, 0.0));
+    if( std::abs(xL.x) < 0.001 &&
+        std::abs(xL.y) < 0.001 &&
+        std::abs(xL.z) < 0.001 )
+    {
+        xL = cross(yL, Vector3D(1.0, 0.0, 0.0));
+    }
+    xL = xL.normalized();
+    Vector3D zL = cross(xL, yL).normalized();
+
+    return (xL * (cos(phi) * sinTheta) + yL * cosTheta + zL * (sin(phi) * sinTheta)).normalized();
+}
@@ -11,6 +11,8 @@ class HemisphericalSampler
 public:
     HemisphericalSampler();
     Vector3D getSample(const Vector3D &normal) const;
+    // Cosine-weighted direction (pdf = cos(theta) / pi)
+    Vector3D getCosineSample(const Vector3D &normal) const;
     //Vector3D getSample_OMP(const Vector3D &normal, const double rand_numbers[], int idx, int n_spp) const;
 };
 
@@ -0,0 +1,403 @@
+#include "imageoutput.h"
+#include "bitmap.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
+namespace
+{
+    // The film lines are read as plain float arrays
+    static_assert(sizeof(Vector3D) == 3 * sizeof(float), "Vector3D must hold 3 packed floats");
+
+    // EXR constants (OpenEXR file layout)
+    const uint8_t EXR_MAGIC[4] = { 0x76, 0x2f, 0x31, 0x01 };
+    const uint32_t EXR_VERSION = 2;
+    const uint32_t EXR_TILED_FLAG = 0x200;
+    const int32_t EXR_PIXEL_FLOAT = 2;
+    const uint8_t EXR_COMPRESSION[] = { 0, 2, 3 };     // NONE, ZIPS, ZIP
+    const size_t EXR_LINES_PER_BLOCK[] = { 1, 1, 16 };
+    const uint8_t EXR_INCREASING_Y = 0;
+    const uint8_t EXR_RANDOM_Y = 2;
+    const uint8_t EXR_ONE_LEVEL = 0;
+
+    const size_t SRGB_TABLE_SIZE = 4096;
+
+    // Exposed value of a channel; NaN and infinite values (diverging samples)
+    // are drawn black, and never reach the sRGB table
+    inline float exposed(float value, float scale)
+    {
+        float v = value * scale;
+        return std::isfinite(v) ? std::max(v, 0.0f) : 0.0f;
+    }
+
+    // Little-endian values, as the rest of the binary files of the renderer
+    template <typename T>
+    void put(std::vector<unsigned char> &out, T value)
+    {
+        size_t at = out.size();
+        out.resize(at + sizeof(T));
+        std::memcpy(&out[at], &value, sizeof(T));
+    }
+
+    // PNG numbers are big-endian
+    void putBigEndian(std::vector<unsigned char> &out, uint32_t value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back((unsigned char)(value >> shift));
+    }
+
+    void putString(std::vector<unsigned char> &out, const char *text)
+    {
+        out.insert(out.end(), text, text + std::strlen(text) + 1);
+    }
+
+    // Attribute: name, type name, size of the value and the value
+    void putAttribute(std::vector<unsigned char> &out, const char *name, const char *type,
+                      const std::vector<unsigned char> &value)
+    {
+        putString(out, name);
+        putString(out, type);
+        put<int32_t>(out, (int32_t)value.size());
+        out.insert(out.end(), value.begin(), value.end());
+    }
+
+    std::vector<unsigned char> box(size_t width, size_t height)
+    {
+        std::vector<unsigned char> value;
+        put<int32_t>(value, 0);
+        put<int32_t>(value, 0);
+        put<int32_t>(value, (int32_t)width - 1);
+        put<int32_t>(value, (int32_t)height - 1);
+        return value;
+    }
+
+    // PNG chunk: length, type, data and the CRC of type and data
+    void putChunk(std::vector<unsigned char> &out, const char *type,
+                  const unsigned char *data, size_t size)
+    {
+        putBigEndian(out, (uint32_t)size);
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data, data + size);
+        putBigEndian(out, computeCRC32(0, &out[start], out.size() - start));
+    }
+
+    // 8-bit sRGB values of [0, 1], sampled finely enough to round every
+    // output level right
+    const std::array<uint8_t, SRGB_TABLE_SIZE>& sRGBTable()
+    {
+        static const std::array<uint8_t, SRGB_TABLE_SIZE> table = [] {
+            std::array<uint8_t, SRGB_TABLE_SIZE> values;
+            for (size_t i = 0; i < SRGB_TABLE_SIZE; i++) {
+                double v = double(i) / (SRGB_TABLE_SIZE - 1);
+                v = v <= 0.0031308 ? 12.92 * v : 1.055 * std::pow(v, 1.0 / 2.4) - 0.055;
+                values[i] = (uint8_t)std::lround(v * 255.0);
+            }
+            return values;
+        }();
+        return table;
+    }
+
+    void forEachLine(size_t count, bool parallel, const std::function<void(size_t, size_t)> &func)
+    {
+        if (parallel)
+            ThreadPool::global().parallelFor(count, 16, func);
+        else
+            func(0, count);
+    }
+
+    bool writeFile(const std::string &filename, const std::vector<std::vector<unsigned char>> &parts)
+    {
+        FILE *file = fopen(filename.c_str(), "wb");
+        if (!file)
+            return false;
+        bool ok = true;
+        for (const std::vector<unsigned char> &part : parts)
+            ok = ok && fwrite(part.data(), 1, part.size(), file) == part.size();
+        return (fclose(file) == 0) && ok;
+    }
+}
+
+ImageOutput::ImageOutput() :
+    ImageOutput(Settings())
+{ }
+
+ImageOutput::ImageOutput(const Settings &settings_) :
+    settings(settings_), writeResult(true)
+{ }
+
+ImageOutput::~ImageOutput()
+{
+    wait();
+}
+
+bool ImageOutput::wait()
+{
+    if (writer.joinable())
+        writer.join();
+    return writeResult;
+}
+
+ImageOutput::Format ImageOutput::getFormat(const std::string &filename)
+{
+    std::string extension = filename.substr(filename.find_last_of('.') + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return (char)std::tolower(c); });
+    if (extension == "bmp")
+        return BMP;
+    if (extension == "png")
+        return PNG;
+    return EXR;
+}
+
+bool ImageOutput::save(const Film &film, const std::string &filename)
+{
+    return save(film, filename, getFormat(filename));
+}
+
+bool ImageOutput::save(const Film &film, const std::string &filename, Format format)
+{
+    Image image;
+    image.width = film.getWidth();
+    image.height = film.getHeight();
+    image.rows.resize(image.height);
+
+    // 1. Synchronous: encode from the film lines
+    if (!settings.async) {
+        for (size_t h = 0; h < image.height; h++)
+            image.rows[h] = film.getRow(h);
+        return encode(image, filename, format, true);
+    }
+
+    // 2. Asynchronous: copy the film (after the previous write is done) and
+    // encode on the writer thread, which must not use the thread pool of the
+    // render
+    wait();
+    pixels.resize(image.width * image.height);
+    forEachLine(image.height, true, [&](size_t begin, size_t end) {
+        for (size_t h = begin; h < end; h++) {
+            std::copy(film.getRow(h), film.getRow(h) + image.width, &pixels[h * image.width]);
+            image.rows[h] = &pixels[h * image.width];
+        }
+    });
+    writer = std::thread([this, image, filename, format]() {
+        writeResult = encode(image, filename, format, false);
+    });
+    return true;
+}
+
+bool ImageOutput::encode(const Image &image, const std::string &filename, Format format, bool parallel) const
+{
+    if (image.width == 0 || image.height == 0)
+        return false;
+    switch (format) {
+    case BMP:
+        return encodeBMP(image, filename, parallel);
+    case PNG:
+        return encodePNG(image, filename, parallel);
+    default:
+        return encodeEXR(image, filename, parallel);
+    }
+}
+
+void ImageOutput::toneMapRow(const Vector3D *row, size_t width, float *buffer, uint8_t *rgb) const
+{
+    const float *in = &row[0].x;
+    size_t count = width * 3;
+    float scale = (float)std::exp2(settings.exposure);
+
+    // 1. Exposure and tone mapping, channel by channel
+    switch (settings.toneMap) {
+    case REINHARD:
+        for (size_t i = 0; i < count; i++) {
+            float v = exposed(in[i], scale);
+            buffer[i] = v / (1.0f + v);
+        }
+        break;
+    case ACES:
+        for (size_t i = 0; i < count; i++) {
+            float v = exposed(in[i], scale);
+            v = (v * (2.51f * v + 0.03f)) / (v * (2.43f * v + 0.59f) + 0.14f);
+            buffer[i] = std::min(v, 1.0f);
+        }
+        break;
+    default:
+        for (size_t i = 0; i < count; i++)
+            buffer[i] = std::min(exposed(in[i], scale), 1.0f);
+        break;
+    }
+
+    // 2. 8-bit values: sRGB table, or linear values truncated as BitMap::save()
+    if (settings.sRGB) {
+        const std::array<uint8_t, SRGB_TABLE_SIZE> &table = sRGBTable();
+        for (size_t i = 0; i < count; i++)
+            rgb[i] = table[(size_t)(buffer[i] * (SRGB_TABLE_SIZE - 1) + 0.5f)];
+    }
+    else {
+        for (size_t i = 0; i < count; i++)
+            rgb[i] = (uint8_t)(buffer[i] * 255.0);
+    }
+}
+
+bool ImageOutput::encodeBMP(const Image &image, const std::string &filename, bool parallel) const
+{
+    // Lines are stored bottom-up, in BGR order and padded to 4 bytes
+    bmp24_info_header infoHeader(image.width, image.height);
+    bmp24_file_header fileHeader;
+    size_t lineSize = (image.width * 3 + 3) & ~size_t(3);
+    fileHeader.size = (int32_t)(54 + lineSize * image.height);
+
+    std::vector<unsigned char> header(54);
+    char *fileBlock = fileHeader.toCharBlock();
+    char *infoBlock = infoHeader.toCharBlock();
+    std::memcpy(&header[0], fileBlock, 14);
+    std::memcpy(&header[14], infoBlock, 40);
+    free(fileBlock);
+    free(infoBlock);
+
+    std::vector<unsigned char> body(lineSize * image.height, 0);
+    forEachLine(image.height, parallel, [&](size_t begin, size_t end) {
+        std::vector<float> buffer(image.width * 3);
+        std::vector<uint8_t> rgb(image.width * 3);
+        for (size_t h = begin; h < end; h++) {
+            toneMapRow(image.rows[h], image.width, buffer.data(), rgb.data());
+            unsigned char *out = &body[(image.height - 1 - h) * lineSize];
+            for (size_t w = 0; w < image.width; w++) {
+                out[w * 3 + 0] = rgb[w * 3 + 2];
+                out[w * 3 + 1] = rgb[w * 3 + 1];
+                out[w * 3 + 2] = rgb[w * 3 + 0];
+            }
+        }
+    });
+    return writeFile(filename, { header, body });
+}
+
+bool ImageOutput::encodePNG(const Image &image, const std::string &filename, bool parallel) const
+{
+    // 1. Lines top-down, each with its filter type: Sub (difference with the
+    // pixel on the left), which deflate compresses better than raw values
+    size_t lineSize = 1 + image.width * 3;
+    std::vector<unsigned char> lines(lineSize * image.height);
+    forEachLine(image.height, parallel, [&](size_t begin, size_t end) {
+        std::vector<float> buffer(image.width * 3);
+        for (size_t h = begin; h < end; h++) {
+            unsigned char *out = &lines[h * lineSize];
+            out[0] = 1;
+            toneMapRow(image.rows[h], image.width, buffer.data(), out + 1);
+            for (size_t i = image.width * 3; i > 3; i--)
+                out[i] = (unsigned char)(out[i] - out[i - 3]);
+        }
+    });
+    std::vector<unsigned char> packed;
+    compressZlib(lines.data(), lines.size(), packed);
+    if (packed.empty())
+        return false;
+
+    // 2. Signature, header (8-bit RGB), data and end chunks
+    std::vector<unsigned char> file = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    std::vector<unsigned char> info;
+    putBigEndian(info, (uint32_t)image.width);
+    putBigEndian(info, (uint32_t)image.height);
+    info.insert(info.end(), { 8, 2, 0, 0, 0 });   // Bit depth, RGB, deflate, filters, no interlace
+    putChunk(file, "IHDR", info.data(), info.size());
+    putChunk(file, "IDAT", packed.data(), packed.size());
+    putChunk(file, "IEND", nullptr, 0);
+    return writeFile(filename, { file });
+}
+
+bool ImageOutput::encodeEXR(const Image &image, const std::string &filename, bool parallel) const
+{
+    // Blocks of lines, from the first line of the film (top of the image)
+    size_t linesPerBlock = EXR_LINES_PER_BLOCK[settings.compression];
+    size_t blockCount = (image.height + linesPerBlock - 1) / linesPerBlock;
+    float scale = (float)std::exp2(settings.exposure);
+
+    // 1. Every block: its B, G and R values line by line, compressed
+    std::vector<std::vector<unsigned char>> blocks(blockCount);
+    forEachLine(blockCount, parallel, [&](size_t begin, size_t end) {
+        std::vector<float> raw;
+        for (size_t b = begin; b < end; b++) {
+            size_t y0 = b * linesPerBlock;
+            size_t y1 = std::min(y0 + linesPerBlock, image.height);
+            raw.resize((y1 - y0) * image.width * 3);
+            float *out = raw.data();
+            for (size_t y = y0; y < y1; y++) {
+                const float *in = &image.rows[y][0].x;
+                for (int c = 2; c >= 0; c--) {
+                    for (size_t w = 0; w < image.width; w++)
+                        out[w] = in[w * 3 + c] * scale;
+                    out += image.width;
+                }
+            }
+
+            std::vector<unsigned char> data;
+            const unsigned char *bytes = reinterpret_cast<const unsigned char*>(raw.data());
+            size_t size = raw.size() * sizeof(float);
+            if (settings.compression == NO_COMPRESSION)
+                data.assign(bytes, bytes + size);
+            else
+                compressEXRZip(bytes, size, data);
+
+            std::vector<unsigned char> &block = blocks[b];
+            block.reserve(data.size() + 2 * sizeof(int32_t));
+            put<int32_t>(block, (int32_t)y0);
+            put<int32_t>(block, (int32_t)data.size());
+            block.insert(block.end(), data.begin(), data.end());
+        }
+    });
+
+    // 2. Header and the offset of every block
+    std::vector<unsigned char> header = exrHeader(image.width, image.height, settings.compression);
+    uint64_t offset = header.size() + blockCount * sizeof(uint64_t);
+    for (const std::vector<unsigned char> &block : blocks) {
+        put<uint64_t>(header, offset);
+        offset += block.size();
+    }
+    blocks.insert(blocks.begin(), std::move(header));
+    return writeFile(filename, blocks);
+}
+
+std::vector<unsigned char> ImageOutput::exrHeader(size_t width, size_t height,
+                                                  Compression compression, size_t tileSize)
+{
+    std::vector<unsigned char> header(EXR_MAGIC, EXR_MAGIC + 4);
+    put<uint32_t>(header, tileSize > 0 ? EXR_VERSION | EXR_TILED_FLAG : EXR_VERSION);
+
+    // Channels in alphabetical order, as the format requires
+    std::vector<unsigned char> channels;
+    for (const char *name : { "B", "G", "R" }) {
+        putString(channels, name);
+        put<int32_t>(channels, EXR_PIXEL_FLOAT);
+        put<uint32_t>(channels, 0);     // pLinear and reserved bytes
+        put<int32_t>(channels, 1);      // x and y sampling
+        put<int32_t>(channels, 1);
+    }
+    channels.push_back(0);
+    putAttribute(header, "channels", "chlist", channels);
+    putAttribute(header, "compression", "compression", { EXR_COMPRESSION[compression] });
+    putAttribute(header, "dataWindow", "box2i", box(width, height));
+    putAttribute(header, "displayWindow", "box2i", box(width, height));
+    putAttribute(header, "lineOrder", "lineOrder", { tileSize > 0 ? EXR_RANDOM_Y : EXR_INCREASING_Y });
+    std::vector<unsigned char> one, center;
+    put<float>(one, 1.0f);
+    put<float>(center, 0.0f);
+    put<float>(center, 0.0f);
+    putAttribute(header, "pixelAspectRatio", "float", one);
+    putAttribute(header, "screenWindowCenter", "v2f", center);
+    putAttribute(header, "screenWindowWidth", "float", one);
+    if (tileSize > 0) {
+        std::vector<unsigned char> tiles;
+        put<uint32_t>(tiles, (uint32_t)tileSize);
+        put<uint32_t>(tiles, (uint32_t)tileSize);
+        tiles.push_back(EXR_ONE_LEVEL);
+        putAttribute(header, "tiles", "tiledesc", tiles);
+    }
+    header.push_back(0);
+    return header;
+}
@@ -0,0 +1,101 @@
+#ifndef IMAGEOUTPUT_H
+#define IMAGEOUTPUT_H
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "film.h"
+
+/**
+ * @brief The ImageOutput class
+ *
+ * Output stage of the renderer: encodes a film as EXR (32-bit float, with
+ * or without ZIP compression), BMP or PNG (8 bits per channel, after an
+ * exposure, a tone mapping operator and optionally the sRGB curve).
+ *
+ * The lines of the film are converted in parallel, straight from its memory
+ * into the layout of the file (no flipped copy of the whole image), by
+ * loops over plain float arrays that the compiler vectorizes.
+ *
+ * In asynchronous mode save() only copies the film and returns: a
+ * background thread encodes and writes the file while rendering goes on
+ * (progressive snapshots). There is one write in flight at most: the next
+ * save() waits for the previous one.
+ */
+class ImageOutput
+{
+public:
+    enum Format { BMP, PNG, EXR };
+    enum ToneMap
+    {
+        CLAMP,      // Values above 1 are clipped (as BitMap::save())
+        REINHARD,   // x / (1 + x)
+        ACES        // Filmic curve (fit of the ACES reference transform)
+    };
+    enum Compression
+    {
+        NO_COMPRESSION,
+        ZIPS_COMPRESSION,   // zlib, one line per block
+        ZIP_COMPRESSION     // zlib, 16 lines per block (smaller files)
+    };
+
+    struct Settings
+    {
+        double exposure = 0;                // Stops (every format)
+        ToneMap toneMap = CLAMP;            // BMP and PNG
+        bool sRGB = false;                  // sRGB curve instead of linear values (BMP and PNG)
+        Compression compression = ZIP_COMPRESSION;  // EXR
+        bool async = false;                 // Write on a background thread
+    };
+
+    ImageOutput();
+    explicit ImageOutput(const Settings &settings_);
+    // Waits for the file being written
+    ~ImageOutput();
+
+    ImageOutput(const ImageOutput &) = delete;
+    ImageOutput& operator=(const ImageOutput &) = delete;
+
+    // Save a film, in the format of the file extension (.bmp, .png, .exr;
+    // EXR otherwise). false if the file can not be written; in asynchronous
+    // mode the result of the write is returned by wait()
+    bool save(const Film &film, const std::string &filename);
+    bool save(const Film &film, const std::string &filename, Format format);
+    // Wait for the background write (true if there is none)
+    bool wait();
+
+    static Format getFormat(const std::string &filename);
+
+    // EXR header (float B, G, R channels) of a scanline image, or of a tiled
+    // image when tileSize > 0, up to the end of its attributes
+    static std::vector<unsigned char> exrHeader(size_t width, size_t height,
+                                                Compression compression, size_t tileSize = 0);
+
+private:
+    // Lines of the image to encode: the film, or its copy in asynchronous mode
+    struct Image
+    {
+        size_t width = 0;
+        size_t height = 0;
+        std::vector<const Vector3D*> rows;
+    };
+
+    bool encode(const Image &image, const std::string &filename, Format format, bool parallel) const;
+    bool encodeBMP(const Image &image, const std::string &filename, bool parallel) const;
+    bool encodePNG(const Image &image, const std::string &filename, bool parallel) const;
+    bool encodeEXR(const Image &image, const std::string &filename, bool parallel) const;
+
+    // 8-bit RGB of a line (exposure, tone mapping and transfer curve)
+    void toneMapRow(const Vector3D *row, size_t width, float *buffer, uint8_t *rgb) const;
+
+    Settings settings;
+
+    // Background write
+    std::thread writer;
+    std::vector<Vector3D> pixels;
+    bool writeResult;
+};
+
+#endif // IMAGEOUTPUT_H
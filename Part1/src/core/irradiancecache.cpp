@@ -0,0 +1,270 @@
+#include "irradiancecache.h"
+#include "random.h"
+
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+IrradianceCache::IrradianceCache(const Vector3D &center, double halfSize, double accuracy_,
+                                 double minRadius_, double maxRadius_,
+                                 int thetaStrata_, int phiStrata_) :
+    accuracy(accuracy_), minRadius(minRadius_), maxRadius(maxRadius_),
+    thetaStrata(thetaStrata_), phiStrata(phiStrata_), recordCount(0)
+{
+    root.center = center;
+    root.halfSize = halfSize;
+}
+
+IrradianceCache::~IrradianceCache()
+{ }
+
+size_t IrradianceCache::getRecordCount() const
+{
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return recordCount;
+}
+
+void IrradianceCache::clear()
+{
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    root.records.clear();
+    for (std::unique_ptr<Node> &child : root.children)
+        child.reset();
+    recordCount = 0;
+}
+
+int IrradianceCache::getSampleCount() const
+{
+    return thetaStrata * phiStrata;
+}
+
+void IrradianceCache::buildFrame(const Vector3D &n, Vector3D &u, Vector3D &v) const
+{
+    // Same construction as the HemisphericalSampler
+    u = cross(n, Vector3D(0.0, 1.0, 0.0));
+    if (u.lengthSq() < 1e-6)
+        u = cross(n, Vector3D(1.0, 0.0, 0.0));
+    u = u.normalized();
+    v = cross(n, u).normalized();
+}
+
+void IrradianceCache::generateDirections(const Vector3D &n, std::vector<Vector3D> &directions) const
+{
+    Vector3D u, v;
+    buildFrame(n, u, v);
+
+    directions.resize(getSampleCount());
+    for (int j = 0; j < thetaStrata; j++)
+    {
+        for (int k = 0; k < phiStrata; k++)
+        {
+            // Cosine-weighted stratum (j, k), jittered
+            double sinTheta = std::sqrt((j + Random::uniform()) / thetaStrata);
+            double cosTheta = std::sqrt(std::max(0.0, 1.0 - sinTheta * sinTheta));
+            double phi = 2 * M_PI * (k + Random::uniform()) / phiStrata;
+
+            directions[j * phiStrata + k] = (u * (std::cos(phi) * sinTheta)
+                                          + v * (std::sin(phi) * sinTheta)
+                                          + n * cosTheta).normalized();
+        }
+    }
+}
+
+Vector3D IrradianceCache::addRecord(const Vector3D &p, const Vector3D &n,
+                                    const std::vector<Vector3D> &radiance,
+                                    const std::vector<double> &distances)
+{
+    const int M = thetaStrata;
+    const int N = phiStrata;
+    const double NO_HIT = 1e30;
+
+    Vector3D u, v;
+    buildFrame(n, u, v);
+
+    IrradianceRecord record;
+    record.position = p;
+    record.normal = n;
+
+    // Accessors with wrap-around in phi
+    auto L = [&](int j, int k) -> const Vector3D& { return radiance[j * N + (k + N) % N]; };
+    auto r = [&](int j, int k) -> double {
+        double d = distances[j * N + (k + N) % N];
+        return d > 0 ? d : NO_HIT;
+    };
+
+    // 1. Irradiance (cosine-weighted estimator) and harmonic mean distance
+    Vector3D sumL(0.0);
+    double sumInvDist = 0;
+    for (int j = 0; j < M; j++)
+    {
+        for (int k = 0; k < N; k++)
+        {
+            sumL += L(j, k);
+            sumInvDist += 1.0 / r(j, k);
+        }
+    }
+    record.irradiance = sumL * (M_PI / (M * N));
+
+    // 2. Rotational and translational gradients (Ward & Heckbert 1992)
+    double rot[3][3] = { { 0 } };
+    double trans[3][3] = { { 0 } };
+    for (int k = 0; k < N; k++)
+    {
+        double phiK = 2 * M_PI * (k + 0.5) / N;   // Center of the stratum
+        double phiKMinus = 2 * M_PI * k / N;      // Boundary with stratum k-1
+        Vector3D uK = u * std::cos(phiK) + v * std::sin(phiK);
+        Vector3D vK = v * std::cos(phiK) - u * std::sin(phiK);
+        Vector3D vKMinus = v * std::cos(phiKMinus) - u * std::sin(phiKMinus);
+
+        Vector3D rotSum(0.0);
+        Vector3D thetaSum(0.0);
+        Vector3D phiSum(0.0);
+        for (int j = 0; j < M; j++)
+        {
+            double thetaJ = std::asin(std::sqrt((j + 0.5) / M));
+            double thetaJMinus = std::asin(std::sqrt((double)j / M));
+            double thetaJPlus = std::asin(std::sqrt((double)(j + 1) / M));
+
+            rotSum += L(j, k) * (-std::tan(thetaJ));
+
+            // Change across the boundary between theta strata j-1 and j
+            if (j > 0)
+            {
+                double cosMinus = std::cos(thetaJMinus);
+                thetaSum += (L(j, k) - L(j - 1, k))
+                    * (std::sin(thetaJMinus) * cosMinus * cosMinus / std::min(r(j, k), r(j - 1, k)));
+            }
+
+            // Change across the boundary between phi strata k-1 and k
+            phiSum += (L(j, k) - L(j, k - 1))
+                * ((std::cos(thetaJMinus) - std::cos(thetaJPlus))
+                   / (std::sin(thetaJ) * std::min(r(j, k), r(j, k - 1))));
+        }
+        thetaSum = thetaSum * (2 * M_PI / N);
+
+        double rotC[3] = { rotSum.x, rotSum.y, rotSum.z };
+        double thetaC[3] = { thetaSum.x, thetaSum.y, thetaSum.z };
+        double phiC[3] = { phiSum.x, phiSum.y, phiSum.z };
+        double vKc[3] = { vK.x, vK.y, vK.z };
+        double uKc[3] = { uK.x, uK.y, uK.z };
+        double vKMc[3] = { vKMinus.x, vKMinus.y, vKMinus.z };
+        for (int c = 0; c < 3; c++)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                rot[c][a] += vKc[a] * rotC[c];
+                trans[c][a] += uKc[a] * thetaC[c] + vKMc[a] * phiC[c];
+            }
+        }
+    }
+    for (int c = 0; c < 3; c++)
+    {
+        record.rotGradient[c] = Vector3D(rot[c][0], rot[c][1], rot[c][2]) * (M_PI / (M * N));
+        record.transGradient[c] = Vector3D(trans[c][0], trans[c][1], trans[c][2]);
+    }
+
+    // 3. Validity radius: harmonic mean distance, limited by the translational
+    //    gradient so the first order extrapolation can not go negative
+    double radius = sumInvDist > 0 ? (M * N) / sumInvDist : maxRadius;
+    double E[3] = { record.irradiance.x, record.irradiance.y, record.irradiance.z };
+    for (int c = 0; c < 3; c++)
+    {
+        double gradLength = record.transGradient[c].length();
+        if (E[c] > 0 && gradLength > 0)
+            radius = std::min(radius, E[c] / gradLength);
+    }
+    record.radius = std::clamp(radius, minRadius, maxRadius);
+
+    insert(record);
+    return record.irradiance;
+}
+
+void IrradianceCache::insert(const IrradianceRecord &record)
+{
+    // Records influence points closer than accuracy * radius
+    double influence = accuracy * record.radius;
+
+    std::unique_lock<std::shared_mutex> lock(mutex);
+
+    // Descend to the smallest node that contains the record position and is
+    // still at least as large as its influence region (loose octree)
+    Node* node = &root;
+    while (true)
+    {
+        const Vector3D &c = node->center;
+        const Vector3D &pos = record.position;
+        double childHalf = node->halfSize * 0.5;
+        bool outside = std::abs(pos.x - c.x) > node->halfSize || std::abs(pos.y - c.y) > node->halfSize
+                    || std::abs(pos.z - c.z) > node->halfSize;
+        if (outside || childHalf < influence)
+            break;
+
+        int child = (pos.x > c.x ? 4 : 0) | (pos.y > c.y ? 2 : 0) | (pos.z > c.z ? 1 : 0);
+        if (!node->children[child])
+        {
+            node->children[child] = std::make_unique<Node>();
+            node->children[child]->halfSize = childHalf;
+            node->children[child]->center = c + Vector3D((child & 4) ? childHalf : -childHalf,
+                                                         (child & 2) ? childHalf : -childHalf,
+                                                         (child & 1) ? childHalf : -childHalf);
+        }
+        node = node->children[child].get();
+    }
+
+    node->records.push_back(record);
+    recordCount++;
+}
+
+void IrradianceCache::lookupNode(const Node *node, const Vector3D &p, const Vector3D &n,
+                                 Vector3D &sumE, double &sumW) const
+{
+    for (const IrradianceRecord &rec : node->records)
+    {
+        // Ward's weight: distance and normal divergence
+        Vector3D diff = p - rec.position;
+        double normalTerm = std::sqrt(std::max(0.0, 1.0 - dot(n, rec.normal)));
+        double w = 1.0 / std::max(1e-6, diff.length() / rec.radius + normalTerm);
+        if (w <= 1.0 / accuracy)
+            continue;
+
+        // Discard records lying in front of the point
+        if (dot(diff, (n + rec.normal) * 0.5) < -0.01 * rec.radius)
+            continue;
+
+        // First order extrapolation with the gradients
+        Vector3D axis = cross(rec.normal, n);
+        Vector3D E(rec.irradiance.x + dot(axis, rec.rotGradient[0]) + dot(diff, rec.transGradient[0]),
+                   rec.irradiance.y + dot(axis, rec.rotGradient[1]) + dot(diff, rec.transGradient[1]),
+                   rec.irradiance.z + dot(axis, rec.rotGradient[2]) + dot(diff, rec.transGradient[2]));
+
+        sumE += E * w;
+        sumW += w;
+    }
+
+    for (const std::unique_ptr<Node> &child : node->children)
+    {
+        // Records of a node reach at most halfSize beyond its bounds
+        if (child && std::abs(p.x - child->center.x) <= 2 * child->halfSize
+                  && std::abs(p.y - child->center.y) <= 2 * child->halfSize
+                  && std::abs(p.z - child->center.z) <= 2 * child->halfSize)
+            lookupNode(child.get(), p, n, sumE, sumW);
+    }
+}
+
+bool IrradianceCache::lookup(const Vector3D &p, const Vector3D &n, Vector3D &E) const
+{
+    Vector3D sumE(0.0);
+    double sumW = 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        lookupNode(&root, p, n, sumE, sumW);
+    }
+
+    if (sumW <= 0)
+        return false;
+
+    E = sumE / sumW;
+    E = Vector3D(std::max(0.0f, E.x), std::max(0.0f, E.y), std::max(0.0f, E.z));
+    return true;
+}
@@ -0,0 +1,87 @@
+#ifndef IRRADIANCECACHE_H
+#define IRRADIANCECACHE_H
+
+#include <memory>
+#include <shared_mutex>
+#include <vector>
+
+#include "vector3d.h"
+
+// Irradiance sample stored in the cache (Ward et al. 1988)
+struct IrradianceRecord
+{
+    Vector3D position;
+    Vector3D normal;
+    Vector3D irradiance;
+
+    // Irradiance gradients, one vector per color channel (Ward & Heckbert 1992)
+    Vector3D rotGradient[3];
+    Vector3D transGradient[3];
+
+    // Validity radius of the record
+    double radius;
+};
+
+/**
+ * @brief The IrradianceCache class
+ *
+ * Sparse cache of irradiance records used to interpolate the slowly varying
+ * diffuse indirect illumination. Records are kept in a loose octree and the
+ * cache can be queried and filled from several render threads at once.
+ */
+class IrradianceCache
+{
+public:
+    IrradianceCache() = delete;
+    // center/halfSize: region of the scene covered by the octree
+    // accuracy: maximum allowed interpolation error (Ward's "a")
+    IrradianceCache(const Vector3D &center, double halfSize, double accuracy_ = 0.25,
+                    double minRadius_ = 0.1, double maxRadius_ = 3.0,
+                    int thetaStrata_ = 6, int phiStrata_ = 18);
+    ~IrradianceCache();
+
+    // Interpolate the irradiance at (p, n) from the valid records.
+    // Returns false if no record is valid there
+    bool lookup(const Vector3D &p, const Vector3D &n, Vector3D &E) const;
+
+    // Stratified, cosine-weighted hemisphere directions to compute a new
+    // record. Sample j * phiStrata + k lies in theta stratum j, phi stratum k
+    int getSampleCount() const;
+    void generateDirections(const Vector3D &n, std::vector<Vector3D> &directions) const;
+
+    // Build a record from the incoming radiance and hit distance of every
+    // direction generated above, insert it and return its irradiance
+    Vector3D addRecord(const Vector3D &p, const Vector3D &n,
+                       const std::vector<Vector3D> &radiance,
+                       const std::vector<double> &distances);
+
+    size_t getRecordCount() const;
+    // Remove every record (e.g. when the scene moves)
+    void clear();
+
+private:
+    struct Node
+    {
+        Vector3D center;
+        double halfSize;
+        std::vector<IrradianceRecord> records;
+        std::unique_ptr<Node> children[8];
+    };
+
+    void buildFrame(const Vector3D &n, Vector3D &u, Vector3D &v) const;
+    void insert(const IrradianceRecord &record);
+    void lookupNode(const Node *node, const Vector3D &p, const Vector3D &n,
+                    Vector3D &sumE, double &sumW) const;
+
+    Node root;
+    double accuracy;
+    double minRadius;
+    double maxRadius;
+    int thetaStrata;
+    int phiStrata;
+    size_t recordCount;
+
+    mutable std::shared_mutex mutex;
+};
+
+#endif // IRRADIANCECACHE_H
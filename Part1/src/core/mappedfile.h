@@ -0,0 +1,39 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief The MappedFile class
+ *
+ * Read-only memory mapping of a whole file (mmap on POSIX systems,
+ * MapViewOfFile on Windows). The pages are loaded by the OS when they are
+ * first read, and shared between processes mapping the same file.
+ */
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile& operator=(const MappedFile &) = delete;
+
+    // false if the file can not be opened or mapped (empty files included)
+    bool open(const std::string &filename);
+    void close();
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char *bytes;
+    size_t length;
+#ifdef _WIN32
+    void *fileHandle;
+    void *mappingHandle;
+#endif
+};
+
+#endif // MAPPEDFILE_H
@@ -0,0 +1,137 @@
+#include "numa.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace
+{
+    struct Topology
+    {
+        std::vector<std::vector<size_t>> nodeCpus;
+    };
+
+    // Lists of the form "0-3,8,10-11"
+    std::vector<size_t> parseList(const std::string &text)
+    {
+        std::vector<size_t> values;
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t end = text.find(',', pos);
+            if (end == std::string::npos)
+                end = text.size();
+            std::string range = text.substr(pos, end - pos);
+            size_t dash = range.find('-');
+            try {
+                size_t first = std::stoul(range.substr(0, dash));
+                size_t last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+                for (size_t v = first; v <= last; v++)
+                    values.push_back(v);
+            }
+            catch (...) {}
+            pos = end + 1;
+        }
+        return values;
+    }
+
+    Topology readTopology()
+    {
+        Topology topology;
+#ifdef _WIN32
+        ULONG highest = 0;
+        if (GetNumaHighestNodeNumber(&highest)) {
+            for (ULONG node = 0; node <= highest; node++) {
+                ULONGLONG mask = 0;
+                std::vector<size_t> cpus;
+                if (GetNumaNodeProcessorMask((UCHAR)node, &mask))
+                    for (size_t cpu = 0; cpu < 64; cpu++)
+                        if (mask & (1ULL << cpu))
+                            cpus.push_back(cpu);
+                if (!cpus.empty())
+                    topology.nodeCpus.push_back(cpus);
+            }
+        }
+#elif defined(__linux__)
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string nodes;
+        if (online && std::getline(online, nodes)) {
+            for (size_t node : parseList(nodes)) {
+                std::ifstream list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                std::string cpus;
+                // Nodes with memory but no CPUs can not run threads
+                if (list && std::getline(list, cpus) && !parseList(cpus).empty())
+                    topology.nodeCpus.push_back(parseList(cpus));
+            }
+        }
+#endif
+        // Unknown topology: a single node with every CPU
+        if (topology.nodeCpus.empty()) {
+            std::vector<size_t> cpus(std::max<size_t>(1, std::thread::hardware_concurrency()));
+            for (size_t cpu = 0; cpu < cpus.size(); cpu++)
+                cpus[cpu] = cpu;
+            topology.nodeCpus.push_back(cpus);
+        }
+        return topology;
+    }
+
+    const Topology& topology()
+    {
+        static const Topology instance = readTopology();
+        return instance;
+    }
+
+    bool setAffinity(const std::vector<size_t> &cpus)
+    {
+#ifdef _WIN32
+        DWORD_PTR mask = 0;
+        for (size_t cpu : cpus)
+            if (cpu < sizeof(DWORD_PTR) * 8)
+                mask |= DWORD_PTR(1) << cpu;
+        return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (size_t cpu : cpus)
+            if (cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        (void)cpus;
+        return false;
+#endif
+    }
+}
+
+size_t Numa::getNodeCount()
+{
+    return topology().nodeCpus.size();
+}
+
+const std::vector<size_t>& Numa::getNodeCpus(size_t node)
+{
+    return topology().nodeCpus[node % getNodeCount()];
+}
+
+bool Numa::pinCurrentThread(size_t node, size_t slot)
+{
+    const std::vector<size_t> &cpus = getNodeCpus(node);
+    return setAffinity({ cpus[slot % cpus.size()] });
+}
+
+bool Numa::unpinCurrentThread()
+{
+    std::vector<size_t> cpus;
+    for (const std::vector<size_t> &nodeCpus : topology().nodeCpus)
+        cpus.insert(cpus.end(), nodeCpus.begin(), nodeCpus.end());
+    return setAffinity(cpus);
+}
@@ -0,0 +1,56 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief The Numa class
+ *
+ * NUMA topology of the machine (nodes and their CPUs, read from
+ * /sys/devices/system/node on Linux and from the system on Windows; a
+ * single node elsewhere) and placement of threads on its nodes. Memory is
+ * placed by the OS on the node of the thread that first writes a page
+ * ("first touch"), so data written by threads of a node stays local to it.
+ */
+class Numa
+{
+public:
+    static size_t getNodeCount();
+    static const std::vector<size_t>& getNodeCpus(size_t node);
+
+    // Restrict the calling thread to one CPU of a node (the slot-th, modulo
+    // its CPU count), or let it run on any CPU again. false if the system
+    // refuses it
+    static bool pinCurrentThread(size_t node, size_t slot);
+    static bool unpinCurrentThread();
+};
+
+/**
+ * @brief The FirstTouchAllocator class
+ *
+ * Allocator that leaves new elements of trivial types uninitialised (no
+ * zeroing by the thread that resizes the vector), so the threads that will
+ * use each part of the buffer can be the first ones to write it.
+ */
+template <typename T>
+class FirstTouchAllocator : public std::allocator<T>
+{
+public:
+    template <typename U>
+    struct rebind { typedef FirstTouchAllocator<U> other; };
+
+    FirstTouchAllocator() = default;
+    template <typename U>
+    FirstTouchAllocator(const FirstTouchAllocator<U> &) {}
+
+    template <typename U>
+    void construct(U *p) { ::new (static_cast<void*>(p)) U; }
+    template <typename U, typename... Args>
+    void construct(U *p, Args&&... args) { ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...); }
+};
+
+#endif // NUMA_H
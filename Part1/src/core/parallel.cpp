@@ -0,0 +1,201 @@
+#include "parallel.h"
+#include "numa.h"
+
+#include <algorithm>
+
+namespace
+{
+    thread_local size_t threadIndex = 0;
+    thread_local bool insideJob = false;
+    thread_local size_t threadNode = 0;
+    thread_local size_t threadPinning = 0;   // Pinning generation applied
+    thread_local bool threadPinned = false;
+}
+
+ThreadPool::ThreadPool(size_t nThreads) :
+    stopping(false), job(nullptr), jobCount(0), jobGrain(1),
+    jobGeneration(0), nextChunk(0), pendingWorkers(0),
+    pinned(false), pinningGeneration(0), jobLocal(false),
+    nodeCount(Numa::getNodeCount()), nodeChunks(new std::atomic<size_t>[Numa::getNodeCount()])
+{
+    if (nThreads == 0)
+        nThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+    // The calling thread counts as one of the threads
+    for (size_t i = 1; i < nThreads; i++)
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobReady.notify_all();
+
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+size_t ThreadPool::getThreadCount() const
+{
+    return workers.size() + 1;
+}
+
+size_t ThreadPool::getThreadIndex()
+{
+    return threadIndex;
+}
+
+size_t ThreadPool::getThreadNode()
+{
+    return threadNode;
+}
+
+void ThreadPool::setPinning(bool enabled)
+{
+    pinned = enabled;
+    pinningGeneration++;
+    applyPinning(0);
+}
+
+bool ThreadPool::isPinned() const
+{
+    return pinned;
+}
+
+void ThreadPool::applyPinning(size_t index)
+{
+    size_t generation = pinningGeneration;
+    if (threadPinning == generation)
+        return;
+    threadPinning = generation;
+    if (pinned) {
+        // Thread i on node i % nodes, one CPU of the node per thread
+        threadNode = index % nodeCount;
+        threadPinned = Numa::pinCurrentThread(threadNode, index / nodeCount);
+    }
+    else if (threadPinned) {
+        threadNode = 0;
+        threadPinned = !Numa::unpinCurrentThread();
+    }
+}
+
+ThreadPool& ThreadPool::global()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::runChunks()
+{
+    // Grab chunks until the job is exhausted
+    size_t nChunks = (jobCount + jobGrain - 1) / jobGrain;
+    if (!jobLocal)
+    {
+        for (size_t chunk = nextChunk++; chunk < nChunks; chunk = nextChunk++)
+        {
+            size_t begin = chunk * jobGrain;
+            size_t end = std::min(jobCount, begin + jobGrain);
+            (*job)(begin, end);
+        }
+        return;
+    }
+
+    // Band of the own node first, then the bands of the others
+    for (size_t k = 0; k < nodeCount; k++)
+    {
+        size_t node = (threadNode + k) % nodeCount;
+        size_t bandBegin = node * nChunks / nodeCount;
+        size_t bandEnd = (node + 1) * nChunks / nodeCount;
+        for (size_t chunk = bandBegin + nodeChunks[node]++; chunk < bandEnd;
+             chunk = bandBegin + nodeChunks[node]++)
+        {
+            size_t begin = chunk * jobGrain;
+            size_t end = std::min(jobCount, begin + jobGrain);
+            (*job)(begin, end);
+        }
+    }
+}
+
+void ThreadPool::workerLoop(size_t index)
+{
+    threadIndex = index;
+    insideJob = true;
+
+    size_t seenGeneration = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobReady.wait(lock, [&] { return stopping || jobGeneration != seenGeneration; });
+            if (stopping)
+                return;
+            seenGeneration = jobGeneration;
+        }
+
+        applyPinning(index);
+        runChunks();
+
+        // Every worker reports back, so the job parameters stay valid
+        // until nobody can be reading them anymore
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pendingWorkers--;
+        }
+        jobDone.notify_all();
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, size_t grainSize,
+                             const std::function<void(size_t, size_t)> &func)
+{
+    run(count, grainSize, false, func);
+}
+
+void ThreadPool::parallelForLocal(size_t count, size_t grainSize,
+                                  const std::function<void(size_t, size_t)> &func)
+{
+    run(count, grainSize, pinned && nodeCount > 1, func);
+}
+
+void ThreadPool::run(size_t count, size_t grainSize, bool local,
+                     const std::function<void(size_t, size_t)> &func)
+{
+    if (count == 0)
+        return;
+    grainSize = std::max<size_t>(1, grainSize);
+
+    // Serial fallback: single thread, tiny job or nested call
+    if (workers.empty() || count <= grainSize || insideJob)
+    {
+        for (size_t begin = 0; begin < count; begin += grainSize)
+            func(begin, std::min(count, begin + grainSize));
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &func;
+        jobCount = count;
+        jobGrain = grainSize;
+        nextChunk = 0;
+        jobLocal = local;
+        for (size_t node = 0; node < nodeCount; node++)
+            nodeChunks[node] = 0;
+        pendingWorkers = workers.size();
+        jobGeneration++;
+    }
+    jobReady.notify_all();
+
+    // The calling thread works too
+    insideJob = true;
+    runChunks();
+    insideJob = false;
+
+    // Wait until every worker has left the job
+    std::unique_lock<std::mutex> lock(mutex);
+    jobDone.wait(lock, [&] { return pendingWorkers == 0; });
+    job = nullptr;
+}
@@ -0,0 +1,94 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief The ThreadPool class
+ *
+ * Persistent set of worker threads used by the parallel render loops.
+ * The thread calling parallelFor() also takes part in the work.
+ *
+ * The threads can be pinned to CPUs with setPinning(), spread over the NUMA
+ * nodes round robin (the calling thread on node 0). parallelForLocal() then gives
+ * every node a fixed band of the range, so buffers first written through it
+ * (see Film) are written again by threads of the same node.
+ */
+class ThreadPool
+{
+public:
+    // A value of 0 threads uses all the hardware threads available
+    ThreadPool(size_t nThreads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads working on a job (workers + calling thread)
+    size_t getThreadCount() const;
+
+    // Split [0, count) into chunks of grainSize elements and call
+    // func(begin, end) on every chunk. Returns when all chunks are done.
+    // Nested calls from inside a job are executed serially.
+    void parallelFor(size_t count, size_t grainSize,
+                     const std::function<void(size_t begin, size_t end)> &func);
+
+    // Like parallelFor(), but [0, count) is cut in one band of chunks per
+    // NUMA node: the threads of a node run the chunks of its band, and help
+    // the other nodes once it is done. Same as parallelFor() when the threads
+    // are not pinned
+    void parallelForLocal(size_t count, size_t grainSize,
+                          const std::function<void(size_t begin, size_t end)> &func);
+
+    // Pin every thread to a CPU of its NUMA node (applied by the workers
+    // when they take their next job), or let them run anywhere again. Must be
+    // called from the thread that calls parallelFor()
+    void setPinning(bool enabled);
+    bool isPinned() const;
+
+    // Index of the calling thread inside its pool (0 for the caller thread)
+    static size_t getThreadIndex();
+    // NUMA node of the calling thread (0 if it is not pinned)
+    static size_t getThreadNode();
+
+    // Pool shared by the whole renderer
+    static ThreadPool& global();
+
+private:
+    void workerLoop(size_t index);
+    void runChunks();
+    void run(size_t count, size_t grainSize, bool local,
+             const std::function<void(size_t, size_t)> &func);
+    // Pin or unpin the calling thread as the settings ask
+    void applyPinning(size_t index);
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+    bool stopping;
+
+    // Current job
+    const std::function<void(size_t, size_t)> *job;
+    size_t jobCount;
+    size_t jobGrain;
+    size_t jobGeneration;
+    std::atomic<size_t> nextChunk;
+    size_t pendingWorkers;
+
+    // NUMA placement: next chunk of the band of every node (local jobs)
+    std::atomic<bool> pinned;
+    std::atomic<size_t> pinningGeneration;
+    bool jobLocal;
+    size_t nodeCount;
+    std::unique_ptr<std::atomic<size_t>[]> nodeChunks;
+};
+
+#endif // PARALLEL_H
@@ -0,0 +1,145 @@
+#include "photonmap.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+    struct Range
+    {
+        size_t begin, end;
+    };
+
+    // Ranges smaller than this are finished serially by one thread
+    const size_t SERIAL_RANGE = 2048;
+
+    void buildSubtree(Photon *photons, size_t begin, size_t end, std::vector<Range> *pending)
+    {
+        while (end - begin > 1)
+        {
+            // Split along the largest extent of the range
+            float minP[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+            float maxP[3] = { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+            for (size_t i = begin; i < end; i++)
+            {
+                for (int a = 0; a < 3; a++)
+                {
+                    minP[a] = std::min(minP[a], photons[i].position[a]);
+                    maxP[a] = std::max(maxP[a], photons[i].position[a]);
+                }
+            }
+            uint8_t axis = 0;
+            for (uint8_t a = 1; a < 3; a++)
+                if (maxP[a] - minP[a] > maxP[axis] - minP[axis])
+                    axis = a;
+
+            size_t mid = (begin + end) / 2;
+            std::nth_element(photons + begin, photons + mid, photons + end,
+                             [axis](const Photon &a, const Photon &b) { return a.position[axis] < b.position[axis]; });
+            photons[mid].axis = axis;
+
+            // Large subtrees are handed back to be processed in parallel
+            if (pending != nullptr)
+            {
+                pending->push_back({ begin, mid });
+                pending->push_back({ mid + 1, end });
+                return;
+            }
+            buildSubtree(photons, begin, mid, nullptr);
+            begin = mid + 1;
+        }
+        if (end - begin == 1)
+            photons[begin].axis = 0;
+    }
+}
+
+void Photon::setDirection(const Vector3D &d)
+{
+    dir[0] = (int8_t)std::lround(std::clamp(d.x, -1.0f, 1.0f) * 127);
+    dir[1] = (int8_t)std::lround(std::clamp(d.y, -1.0f, 1.0f) * 127);
+    dir[2] = (int8_t)std::lround(std::clamp(d.z, -1.0f, 1.0f) * 127);
+}
+
+PhotonMap::PhotonMap()
+{ }
+
+size_t PhotonMap::size() const
+{
+    return photons.size();
+}
+
+void PhotonMap::clear()
+{
+    photons.clear();
+}
+
+void PhotonMap::build(std::vector<Photon> &&photons_)
+{
+    photons = std::move(photons_);
+
+    // Level by level: every range of the level is split in parallel, and
+    // once the ranges are small each thread finishes its subtrees alone
+    std::vector<Range> level(1, Range{ 0, photons.size() });
+    while (!level.empty())
+    {
+        std::vector<std::vector<Range>> next(level.size());
+        ThreadPool::global().parallelFor(level.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; r++)
+            {
+                bool large = level[r].end - level[r].begin > SERIAL_RANGE;
+                buildSubtree(photons.data(), level[r].begin, level[r].end, large ? &next[r] : nullptr);
+            }
+        });
+
+        level.clear();
+        for (std::vector<Range> &ranges : next)
+            level.insert(level.end(), ranges.begin(), ranges.end());
+    }
+}
+
+void PhotonMap::gatherRadius(const Vector3D &p, double radius2,
+                             const std::function<void(const Photon&, double)> &func) const
+{
+    if (photons.empty())
+        return;
+
+    float query[3] = { p.x, p.y, p.z };
+
+    // Iterative traversal with an explicit stack of ranges
+    Range stack[64];
+    int top = 0;
+    stack[top++] = { 0, photons.size() };
+    while (top > 0)
+    {
+        Range range = stack[--top];
+        if (range.begin >= range.end)
+            continue;
+
+        size_t mid = (range.begin + range.end) / 2;
+        const Photon &photon = photons[mid];
+
+        double dx = query[0] - photon.position[0];
+        double dy = query[1] - photon.position[1];
+        double dz = query[2] - photon.position[2];
+        double dist2 = dx * dx + dy * dy + dz * dz;
+        if (dist2 < radius2)
+            func(photon, dist2);
+
+        if (range.end - range.begin == 1)
+            continue;
+
+        // Visit the near side always, the far side only if the sphere crosses the plane
+        double delta = query[photon.axis] - photon.position[photon.axis];
+        Range left = { range.begin, mid };
+        Range right = { mid + 1, range.end };
+        if (delta * delta < radius2)
+        {
+            stack[top++] = left;
+            stack[top++] = right;
+        }
+        else
+            stack[top++] = (delta < 0) ? left : right;
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef PHOTONMAP_H
+#define PHOTONMAP_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "vector3d.h"
+
+// Photon stored on a diffuse surface (compact: 28 bytes)
+struct Photon
+{
+    float position[3];
+    float power[3];
+    uint8_t axis;      // Split axis of the kd-tree node
+    int8_t dir[3];     // Incoming direction, quantized to [-127, 127]
+
+    Vector3D getPosition() const { return Vector3D(position[0], position[1], position[2]); }
+    Vector3D getPower() const { return Vector3D(power[0], power[1], power[2]); }
+    Vector3D getDirection() const { return Vector3D(dir[0], dir[1], dir[2]).normalized(); }
+    void setDirection(const Vector3D &d);
+};
+
+/**
+ * @brief The PhotonMap class
+ *
+ * Balanced kd-tree stored implicitly in a flat array: the photons of the
+ * range [begin, end) are split by the photon at (begin + end) / 2, which keeps
+ * the tree pointer-free. The tree is built level by level, with the ranges
+ * of a level processed in parallel.
+ */
+class PhotonMap
+{
+public:
+    PhotonMap();
+
+    // Take ownership of the photons and build the tree
+    void build(std::vector<Photon> &&photons_);
+    void clear();
+
+    size_t size() const;
+
+    // Call func(photon, squaredDistance) for every photon closer than sqrt(radius2)
+    void gatherRadius(const Vector3D &p, double radius2,
+                      const std::function<void(const Photon&, double)> &func) const;
+
+private:
+    std::vector<Photon> photons;
+};
+
+#endif // PHOTONMAP_H
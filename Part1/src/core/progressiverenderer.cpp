@@ -0,0 +1,167 @@
+#include "progressiverenderer.h"
+#include "imageoutput.h"
+#include "parallel.h"
+#include "random.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    double secondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+}
+
+ProgressiveRenderer::ProgressiveRenderer(const Settings &settings_) :
+    settings(settings_), passCount(0), elapsedTime(0), relativeError(INFINITY), resumed(false)
+{ }
+
+bool ProgressiveRenderer::resume(const std::string &checkpointFile, Film &film)
+{
+    CheckpointInfo info;
+    if (!film.loadCheckpoint(checkpointFile, info))
+        return false;
+
+    passCount = (size_t)info.passes;
+    elapsedTime = info.elapsedTime;
+    relativeError = film.estimateRelativeError(passCount);
+    resumed = true;
+    return true;
+}
+
+size_t ProgressiveRenderer::getPassCount() const
+{
+    return passCount;
+}
+
+double ProgressiveRenderer::getElapsedTime() const
+{
+    return elapsedTime;
+}
+
+double ProgressiveRenderer::getRelativeError() const
+{
+    return relativeError;
+}
+
+bool ProgressiveRenderer::keepGoing(double lastPassTime) const
+{
+    bool anyCondition = settings.timeBudget > 0 || settings.targetSpp > 0 || settings.noiseTarget > 0;
+    if (!anyCondition)
+        return passCount < 1;
+
+    if (settings.targetSpp > 0 && passCount >= settings.targetSpp)
+        return false;
+    // Do not start a pass that is expected to end after the budget
+    if (settings.timeBudget > 0 && passCount > 0 && elapsedTime + lastPassTime > settings.timeBudget)
+        return false;
+    if (settings.noiseTarget > 0 && passCount >= std::max<size_t>(2, settings.minSpp)
+        && relativeError <= settings.noiseTarget)
+        return false;
+    return true;
+}
+
+double ProgressiveRenderer::getProgress() const
+{
+    // Closest stop condition
+    double progress = 0;
+    if (settings.timeBudget > 0)
+        progress = std::max(progress, elapsedTime / settings.timeBudget);
+    if (settings.targetSpp > 0)
+        progress = std::max(progress, (double)passCount / settings.targetSpp);
+    if (settings.noiseTarget > 0 && std::isfinite(relativeError) && relativeError > 0)
+        progress = std::max(progress, std::min(1.0, settings.noiseTarget / relativeError));
+    return std::min(progress, 1.0);
+}
+
+void ProgressiveRenderer::renderPass(const Camera &cam, const Shader &shader, Film &film,
+                                     const std::vector<Shape*> &objList,
+                                     const std::vector<LightSource*> &lsList, size_t pass) const
+{
+    size_t resX = film.getWidth();
+    size_t resY = film.getHeight();
+    size_t x0 = 0, y0 = 0, x1 = resX, y1 = resY;
+    if (settings.x1 > settings.x0 && settings.y1 > settings.y0) {
+        x0 = std::min(settings.x0, resX);
+        y0 = std::min(settings.y0, resY);
+        x1 = std::min(settings.x1, resX);
+        y1 = std::min(settings.y1, resY);
+    }
+
+    // The seeds use the pass number of the whole render, the film the
+    // number of passes of this range
+    size_t globalPass = settings.firstPass + pass;
+    ThreadPool::global().parallelForLocal(y1 - y0, 1, [&](size_t begin, size_t end) {
+        for (size_t lin = y0 + begin; lin < y0 + end; lin++) {
+            for (size_t col = x0; col < x1; col++) {
+                Random::seed(Random::hash(col, lin, globalPass));
+                // A different point of the pixel every pass (antialiasing)
+                double x = (col + Random::uniform()) / resX;
+                double y = (lin + Random::uniform()) / resY;
+                Ray cameraRay = cam.generateRay(x, y);
+                film.addPassSample(col, lin, shader.computeColor(cameraRay, objList, lsList), pass);
+            }
+        }
+    });
+
+    // Light tracing splats of this pass (BDPT) enter the mean too
+    film.resolveSplats(1.0 / (pass + 1));
+}
+
+size_t ProgressiveRenderer::render(const Camera &cam, Shader &shader, Film &film,
+                                   const std::vector<Shape*> &objList,
+                                   const std::vector<LightSource*> &lsList)
+{
+    // Time already spent by a resumed render counts for the budget
+    if (!resumed) {
+        passCount = 0;
+        elapsedTime = 0;
+        relativeError = INFINITY;
+    }
+    resumed = false;
+    double startTime = elapsedTime;
+    Clock::time_point start = Clock::now();
+    double lastSnapshot = elapsedTime;
+    double lastCheckpoint = elapsedTime;
+    double lastPassTime = 0;
+
+    // Snapshots are written by a background thread while the next passes render
+    ImageOutput::Settings snapshotSettings;
+    snapshotSettings.async = true;
+    ImageOutput snapshots(snapshotSettings);
+
+    while (keepGoing(lastPassTime)) {
+        double passStart = startTime + secondsSince(start);
+
+        shader.beginPass(settings.firstPass + passCount, objList, lsList);
+        renderPass(cam, shader, film, objList, lsList, passCount);
+        passCount++;
+
+        elapsedTime = startTime + secondsSince(start);
+        lastPassTime = elapsedTime - passStart;
+        relativeError = film.estimateRelativeError(passCount);
+        if (settings.showProgress)
+            Utils::printProgress(getProgress());
+
+        if (settings.snapshotInterval > 0 && elapsedTime - lastSnapshot >= settings.snapshotInterval) {
+            snapshots.save(film, settings.snapshotFile);
+            lastSnapshot = elapsedTime;
+        }
+        if (settings.checkpointInterval > 0 && elapsedTime - lastCheckpoint >= settings.checkpointInterval) {
+            CheckpointInfo info;
+            info.passes = passCount;
+            info.elapsedTime = elapsedTime;
+            if (!film.saveCheckpoint(settings.checkpointFile, info, settings.compressCheckpoints))
+                std::cout << "\nError storing checkpoint " << settings.checkpointFile << std::endl;
+            lastCheckpoint = elapsedTime;
+        }
+    }
+    return passCount;
+}
@@ -0,0 +1,95 @@
+#ifndef PROGRESSIVERENDERER_H
+#define PROGRESSIVERENDERER_H
+
+#include <string>
+#include <vector>
+
+#include "film.h"
+#include "../cameras/camera.h"
+#include "../lightsources/lightsource.h"
+#include "../shaders/shader.h"
+#include "../shapes/shape.h"
+
+/**
+ * @brief The ProgressiveRenderer class
+ *
+ * Renders passes of one jittered sample per pixel with any Shader and
+ * averages them in the film, until a stop condition is met: a wall-clock
+ * budget, a number of samples per pixel or a noise target (see
+ * Film::estimateRelativeError()). The image can be saved as a snapshot every
+ * few seconds while it converges, written in the background (ImageOutput).
+ *
+ * Every pixel of a pass is seeded from its coordinates and the pass number,
+ * and it is only written by the thread rendering its line, so the result
+ * after n passes does not depend on the number of threads.
+ *
+ * A render can be limited to a tile of the film and to a range of passes,
+ * so several processes or hosts can share an image. Each saves its part as
+ * a checkpoint (the samples per pixel tell which pixels it covers), and
+ * Film::mergeCheckpoint() puts the parts together: tiles give exactly the
+ * image of a single render, pass ranges the same up to float rounding.
+ *
+ * Long renders can save a checkpoint of the film every few seconds (see
+ * Film::saveCheckpoint()). As the samplers are seeded per pass, the
+ * checkpoint only needs the buffers and the pass count: a render resumed
+ * with resume() gives the same image as an uninterrupted one (for shaders
+ * without state between passes; photon maps and guiding trees are rebuilt).
+ */
+class ProgressiveRenderer
+{
+public:
+    // The first condition met ends the render (0 disables a condition). With
+    // none of them set, a single pass is rendered
+    struct Settings
+    {
+        double timeBudget = 0;          // Seconds
+        size_t targetSpp = 0;           // Passes
+        double noiseTarget = 0;         // Relative error of the film
+        size_t minSpp = 4;              // Passes before the noise estimate is trusted
+        double snapshotInterval = 0;    // Seconds between snapshots
+        std::string snapshotFile = "progress.exr";  // .exr, .png or .bmp
+        double checkpointInterval = 0;  // Seconds between checkpoints
+        std::string checkpointFile = "render.ckpt";
+        bool compressCheckpoints = false;
+        bool showProgress = true;       // Progress bar on the standard output
+        // Distributed rendering: only the pixels in [x0, x1) x [y0, y1) (an
+        // empty region is the whole film), and the passes from firstPass on
+        // (targetSpp counts the passes of this range)
+        size_t x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+        size_t firstPass = 0;
+    };
+
+    ProgressiveRenderer() = delete;
+    explicit ProgressiveRenderer(const Settings &settings_);
+
+    // Continue the next render from a checkpoint (false if it can not be
+    // read or does not match the film size)
+    bool resume(const std::string &checkpointFile, Film &film);
+
+    // Returns the number of passes accumulated in the film
+    size_t render(const Camera &cam, Shader &shader, Film &film,
+                  const std::vector<Shape*> &objList,
+                  const std::vector<LightSource*> &lsList);
+
+    // Statistics of the last render
+    size_t getPassCount() const;
+    double getElapsedTime() const;   // Seconds
+    double getRelativeError() const; // Estimate after the last pass
+
+private:
+    void renderPass(const Camera &cam, const Shader &shader, Film &film,
+                    const std::vector<Shape*> &objList,
+                    const std::vector<LightSource*> &lsList, size_t pass) const;
+
+    // Whether another pass can start, given the time the last one took
+    bool keepGoing(double lastPassTime) const;
+    double getProgress() const;
+
+    Settings settings;
+    size_t passCount;
+    double elapsedTime;
+    double relativeError;
+    bool resumed;
+};
+
+#endif // PROGRESSIVERENDERER_H
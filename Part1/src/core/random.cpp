@@ -0,0 +1,54 @@
+#include "random.h"
+
+namespace
+{
+    const uint64_t PCG_MULTIPLIER = 6364136223846793005ULL;
+    const uint64_t PCG_DEFAULT_STATE = 0x853c49e6748fea9bULL;
+    const uint64_t PCG_DEFAULT_INC = 0xda3e39cb94b95bdbULL;
+
+    struct PCGState
+    {
+        uint64_t state = PCG_DEFAULT_STATE;
+        uint64_t inc = PCG_DEFAULT_INC;
+    };
+
+    thread_local PCGState pcg;
+
+    uint64_t splitMix(uint64_t x)
+    {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+}
+
+void Random::seed(uint64_t seed, uint64_t stream)
+{
+    // Standard PCG32 seeding sequence
+    pcg.state = 0U;
+    pcg.inc = (stream << 1u) | 1u;
+    nextUInt();
+    pcg.state += seed;
+    nextUInt();
+}
+
+uint32_t Random::nextUInt()
+{
+    uint64_t oldState = pcg.state;
+    pcg.state = oldState * PCG_MULTIPLIER + pcg.inc;
+    uint32_t xorShifted = (uint32_t)(((oldState >> 18u) ^ oldState) >> 27u);
+    uint32_t rot = (uint32_t)(oldState >> 59u);
+    return (xorShifted >> rot) | (xorShifted << ((~rot + 1u) & 31));
+}
+
+double Random::uniform()
+{
+    // 32 random bits mapped to [0, 1)
+    return nextUInt() * (1.0 / 4294967296.0);
+}
+
+uint64_t Random::hash(uint64_t a, uint64_t b, uint64_t c)
+{
+    return splitMix(a ^ splitMix(b ^ splitMix(c)));
+}
@@ -0,0 +1,26 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+
+// Small PCG32 random number generator. Every thread owns its own state,
+// so samplers can be called from several render threads at once, and a
+// thread can be re-seeded to make a piece of work reproducible no matter
+// which thread ends up executing it.
+class Random
+{
+public:
+    Random() = delete;
+
+    // Re-seed the generator of the calling thread
+    static void seed(uint64_t seed, uint64_t stream = 0);
+
+    // Uniformly distributed numbers
+    static uint32_t nextUInt();
+    static double uniform(); // [0, 1)
+
+    // Mix several integers into a well distributed seed
+    static uint64_t hash(uint64_t a, uint64_t b = 0, uint64_t c = 0);
+};
+
+#endif // RANDOM_H
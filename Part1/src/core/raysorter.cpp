@@ -0,0 +1,105 @@
+#include "raysorter.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+    // Spread the lower 10 bits of v so there are two zeros between each bit
+    uint32_t expandBits(uint32_t v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    uint32_t quantize(float value, float minValue, float invExtent, uint32_t levels)
+    {
+        float t = (value - minValue) * invExtent;
+        uint32_t q = (uint32_t)(t * levels);
+        return std::min(q, levels - 1);
+    }
+}
+
+RaySorter::RaySorter(Mode mode_) : mode(mode_)
+{ }
+
+RaySorter::Mode RaySorter::getMode() const
+{
+    return mode;
+}
+
+void RaySorter::sort(std::vector<uint32_t> &indices,
+                     const float *ox, const float *oy, const float *oz,
+                     const float *dx, const float *dy, const float *dz)
+{
+    size_t n = indices.size();
+    if (mode == NONE || n < 2)
+        return;
+
+    // 1. Bounds of the ray origins
+    float minP[3] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    float maxP[3] = { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+    for (uint32_t i : indices)
+    {
+        minP[0] = std::min(minP[0], ox[i]); maxP[0] = std::max(maxP[0], ox[i]);
+        minP[1] = std::min(minP[1], oy[i]); maxP[1] = std::max(maxP[1], oy[i]);
+        minP[2] = std::min(minP[2], oz[i]); maxP[2] = std::max(maxP[2], oz[i]);
+    }
+    float invExtent[3];
+    for (int a = 0; a < 3; a++)
+        invExtent[a] = maxP[a] > minP[a] ? 1.0f / (maxP[a] - minP[a]) : 0.0f;
+
+    // 2. Binning keys: the direction octant goes in the top bits, so rays
+    //    heading the same way end up together, then the origin location
+    keys.resize(n);
+    ThreadPool::global().parallelFor(n, 4096, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++)
+        {
+            uint32_t i = indices[k];
+            uint32_t octant = (dx[i] < 0 ? 4u : 0u) | (dy[i] < 0 ? 2u : 0u) | (dz[i] < 0 ? 1u : 0u);
+
+            if (mode == MORTON)
+            {
+                // 9 bits per axis
+                uint32_t morton = (expandBits(quantize(ox[i], minP[0], invExtent[0], 512)) << 2)
+                                | (expandBits(quantize(oy[i], minP[1], invExtent[1], 512)) << 1)
+                                |  expandBits(quantize(oz[i], minP[2], invExtent[2], 512));
+                keys[k] = (octant << 27) | morton;
+            }
+            else
+            {
+                // Linear index of a 32x32x32 grid
+                uint32_t cell = (quantize(ox[i], minP[0], invExtent[0], 32) << 10)
+                              | (quantize(oy[i], minP[1], invExtent[1], 32) << 5)
+                              |  quantize(oz[i], minP[2], invExtent[2], 32);
+                keys[k] = (octant << 15) | cell;
+            }
+        }
+    });
+
+    // 3. LSD radix sort of the (key, index) pairs, 8 bits per pass (stable)
+    tmpKeys.resize(n);
+    tmpIndices.resize(n);
+    int nPasses = (mode == MORTON) ? 4 : 3; // 30 or 18 significant bits
+    for (int pass = 0; pass < nPasses; pass++)
+    {
+        int shift = pass * 8;
+        size_t count[257] = { 0 };
+        for (size_t k = 0; k < n; k++)
+            count[((keys[k] >> shift) & 0xFF) + 1]++;
+        for (int b = 0; b < 256; b++)
+            count[b + 1] += count[b];
+        for (size_t k = 0; k < n; k++)
+        {
+            size_t dst = count[(keys[k] >> shift) & 0xFF]++;
+            tmpKeys[dst] = keys[k];
+            tmpIndices[dst] = indices[k];
+        }
+        keys.swap(tmpKeys);
+        indices.swap(tmpIndices);
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef RAYSORTER_H
+#define RAYSORTER_H
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief The RaySorter class
+ *
+ * Reorders a batch of rays so that rays with nearby origins and similar
+ * directions are traced one after the other. The rays are given in SoA form
+ * and only the index list is permuted.
+ */
+class RaySorter
+{
+public:
+    enum Mode
+    {
+        NONE,        // Keep the incoming order
+        OCTANT_CELL, // Bin by direction octant, then by origin cell of a 32^3 grid
+        MORTON       // Bin by direction octant, then by Morton code of the origin
+    };
+
+    RaySorter(Mode mode_ = MORTON);
+
+    Mode getMode() const;
+
+    // Sort indices[] (into the SoA ray arrays) by the binning key
+    void sort(std::vector<uint32_t> &indices,
+              const float *ox, const float *oy, const float *oz,
+              const float *dx, const float *dy, const float *dz);
+
+private:
+    Mode mode;
+
+    // Scratch buffers reused between calls
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> tmpKeys;
+    std::vector<uint32_t> tmpIndices;
+};
+
+#endif // RAYSORTER_H
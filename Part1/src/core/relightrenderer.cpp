@@ -0,0 +1,239 @@
+#include "relightrenderer.h"
+#include "parallel.h"
+#include "random.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    double secondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // a / b per channel (0 where b is 0)
+    Vector3D ratio(const Vector3D &a, const Vector3D &b)
+    {
+        return Vector3D(b.x > 0 ? a.x / b.x : 0.0,
+                        b.y > 0 ? a.y / b.y : 0.0,
+                        b.z > 0 ? a.z / b.z : 0.0);
+    }
+
+    // One light sample seen from p, as the NEE integrators take it. The
+    // radiance is 0 if the light is not visible
+    LightSample sampleLight(const LightSource &light, const Vector3D &p, const Vector3D &n,
+                            const std::vector<Shape*> &objList, Vector3D &wi)
+    {
+        LightSample ls = light.sample(p);
+        wi = Vector3D(0.0);
+        if (ls.pdf <= 0)
+            return LightSample();
+
+        wi = (ls.position - p).normalized();
+        if (dot(wi, n) <= 0) {
+            ls.radiance = Vector3D(0.0);
+            return ls;
+        }
+
+        // Visibility (same test as NEEImprovedIntegrator::directRadiance)
+        Ray shadowRay(p, wi);
+        Intersection shadowIts;
+        if (Utils::getClosestIntersection(shadowRay, objList, shadowIts)) {
+            double distToLight = (ls.position - p).length();
+            if ((shadowIts.itsPoint - p).length() < distToLight - Epsilon)
+                ls.radiance = Vector3D(0.0);
+        }
+        return ls;
+    }
+}
+
+void RelightRenderer::GBuffer::resize(size_t n)
+{
+    for (std::vector<float>* v : { &px, &py, &pz, &nx, &ny, &nz, &wx, &wy, &wz })
+        v->assign(n, 0.0f);
+    material.assign(n, 0);
+    shape.assign(n, nullptr);
+}
+
+void RelightRenderer::LightSamples::resize(size_t n)
+{
+    for (std::vector<float>* v : { &dx, &dy, &dz, &lr, &lg, &lb, &pdf })
+        v->assign(n, 0.0f);
+}
+
+RelightRenderer::RelightRenderer(const Settings &settings_) :
+    settings(settings_), width(0), height(0), lightCount(0), captureTime(0), relightTime(0)
+{ }
+
+double RelightRenderer::getCaptureTime() const
+{
+    return captureTime;
+}
+
+double RelightRenderer::getRelightTime() const
+{
+    return relightTime;
+}
+
+size_t RelightRenderer::getMemoryBytes() const
+{
+    size_t pixels = gbuffer.shape.size();
+    return pixels * (9 * sizeof(float) + sizeof(uint32_t) + sizeof(const Shape*))
+        + samples.dx.size() * 7 * sizeof(float);
+}
+
+void RelightRenderer::capture(const Camera &cam, size_t width_, size_t height_,
+                              const std::vector<Shape*> &objList,
+                              const std::vector<LightSource*> &lsList)
+{
+    Clock::time_point start = Clock::now();
+    width = width_;
+    height = height_;
+    lightCount = lsList.size();
+    captureIntensity.clear();
+    for (const LightSource* ls : lsList)
+        captureIntensity.push_back(ls->getIntensity());
+
+    // Material ids of the shapes
+    materials.build(objList);
+
+    size_t samplesPerPixel = lightCount * settings.lightSamples;
+    gbuffer.resize(width * height);
+    samples.resize(settings.cacheVisibility ? width * height * samplesPerPixel : 0);
+
+    ThreadPool::global().parallelForLocal(height, 1, [&](size_t begin, size_t end) {
+        for (size_t lin = begin; lin < end; lin++) {
+            for (size_t col = 0; col < width; col++) {
+                size_t pixel = lin * width + col;
+                Ray cameraRay = cam.generateRay((col + 0.5) / width, (lin + 0.5) / height);
+                Intersection its;
+                if (!Utils::getClosestIntersection(cameraRay, objList, its))
+                    continue;
+
+                // 1. First hit
+                Vector3D n = its.normal.normalized();
+                Vector3D wo = -cameraRay.d;
+                gbuffer.px[pixel] = (float)its.itsPoint.x;
+                gbuffer.py[pixel] = (float)its.itsPoint.y;
+                gbuffer.pz[pixel] = (float)its.itsPoint.z;
+                gbuffer.nx[pixel] = (float)n.x;
+                gbuffer.ny[pixel] = (float)n.y;
+                gbuffer.nz[pixel] = (float)n.z;
+                gbuffer.wx[pixel] = (float)wo.x;
+                gbuffer.wy[pixel] = (float)wo.y;
+                gbuffer.wz[pixel] = (float)wo.z;
+                gbuffer.material[pixel] = its.shape->getMaterialId();
+                gbuffer.shape[pixel] = its.shape;
+
+                // 2. Light samples and their visibility (only diffuse and
+                // glossy hits use them)
+                if (!settings.cacheVisibility || !materials[gbuffer.material[pixel]].hasDiffuseOrGlossy())
+                    continue;
+                Random::seed(Random::hash(col, lin));
+                Vector3D p(gbuffer.px[pixel], gbuffer.py[pixel], gbuffer.pz[pixel]);
+                Vector3D nf(gbuffer.nx[pixel], gbuffer.ny[pixel], gbuffer.nz[pixel]);
+                size_t s = pixel * samplesPerPixel;
+                for (size_t l = 0; l < lightCount; l++) {
+                    for (size_t j = 0; j < settings.lightSamples; j++, s++) {
+                        Vector3D wi;
+                        LightSample ls = sampleLight(*lsList[l], p, nf, objList, wi);
+                        samples.lr[s] = (float)ls.radiance.x;
+                        samples.lg[s] = (float)ls.radiance.y;
+                        samples.lb[s] = (float)ls.radiance.z;
+                        samples.pdf[s] = (float)ls.pdf;
+                        samples.dx[s] = (float)wi.x;
+                        samples.dy[s] = (float)wi.y;
+                        samples.dz[s] = (float)wi.z;
+                    }
+                }
+            }
+        }
+    });
+    captureTime = secondsSince(start);
+}
+
+Vector3D RelightRenderer::directLight(size_t pixel, const Vector3D &p, const Vector3D &n, const Vector3D &wo,
+                                      uint32_t material, const std::vector<Vector3D> &intensityScale,
+                                      const std::vector<Shape*> &objList,
+                                      const std::vector<LightSource*> &lsList) const
+{
+    Vector3D color(0.0);
+    double invN = 1.0 / settings.lightSamples;
+    size_t s = pixel * lightCount * settings.lightSamples;
+    for (size_t l = 0; l < lightCount; l++) {
+        for (size_t j = 0; j < settings.lightSamples; j++, s++) {
+            Vector3D wi, radiance;
+            double pdf;
+            if (settings.cacheVisibility) {
+                radiance = Vector3D(samples.lr[s], samples.lg[s], samples.lb[s]) * intensityScale[l];
+                pdf = samples.pdf[s];
+                wi = Vector3D(samples.dx[s], samples.dy[s], samples.dz[s]);
+            }
+            else {
+                LightSample ls = sampleLight(*lsList[l], p, n, objList, wi);
+                radiance = ls.radiance;
+                pdf = ls.pdf;
+            }
+            if (radiance.x > 0 || radiance.y > 0 || radiance.z > 0)
+                color += invN * radiance * (dot(wi, n) / pdf) * materials.getReflectance(material, n, wo, wi);
+        }
+    }
+    return color;
+}
+
+void RelightRenderer::relight(Film &film, const std::vector<Shape*> &objList,
+                              const std::vector<LightSource*> &lsList,
+                              const Shader *indirectShader)
+{
+    Clock::time_point start = Clock::now();
+    if (film.getWidth() != width || film.getHeight() != height || lsList.size() != lightCount) {
+        std::cout << "RelightRenderer: the film or the lights do not match the capture" << std::endl;
+        return;
+    }
+
+    // Records with the current material parameters (the ids do not change)
+    materials.build(objList);
+
+    // Change of the light intensities since the capture, per channel
+    std::vector<Vector3D> intensityScale(lightCount);
+    for (size_t l = 0; l < lightCount; l++)
+        intensityScale[l] = ratio(lsList[l]->getIntensity(), captureIntensity[l]);
+
+    ThreadPool::global().parallelForLocal(height, 1, [&](size_t begin, size_t end) {
+        for (size_t lin = begin; lin < end; lin++) {
+            for (size_t col = 0; col < width; col++) {
+                size_t pixel = lin * width + col;
+                Vector3D color(0.0);
+                if (const Shape *shape = gbuffer.shape[pixel]) {
+                    Vector3D p(gbuffer.px[pixel], gbuffer.py[pixel], gbuffer.pz[pixel]);
+                    Vector3D n(gbuffer.nx[pixel], gbuffer.ny[pixel], gbuffer.nz[pixel]);
+                    Vector3D wo(gbuffer.wx[pixel], gbuffer.wy[pixel], gbuffer.wz[pixel]);
+                    const MaterialRecord &m = materials[gbuffer.material[pixel]];
+                    Random::seed(Random::hash(col, lin));
+
+                    // 1. Emission
+                    color = m.emission;
+                    // 2. Direct light
+                    if (m.hasDiffuseOrGlossy())
+                        color += directLight(pixel, p, n, wo, gbuffer.material[pixel], intensityScale, objList, lsList);
+                    // 3. Indirect light
+                    if (indirectShader) {
+                        Intersection its;
+                        its.itsPoint = p;
+                        its.normal = n;
+                        its.shape = shape;
+                        color += indirectShader->indirectLight(its, wo, objList, lsList);
+                    }
+                }
+                else if (indirectShader)
+                    color = indirectShader->bgColor;
+                film.setPixelValue(col, lin, color);
+            }
+        }
+    });
+    relightTime = secondsSince(start);
+}
@@ -0,0 +1,108 @@
+#ifndef RELIGHTRENDERER_H
+#define RELIGHTRENDERER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "film.h"
+#include "../cameras/camera.h"
+#include "../lightsources/lightsource.h"
+#include "../materials/materialtable.h"
+#include "../shaders/shader.h"
+#include "../shapes/shape.h"
+
+/**
+ * @brief The RelightRenderer class
+ *
+ * Look development mode: capture() traces the camera rays once (through the
+ * pixel centres, as raytrace() does) and keeps the first hits in a G-buffer:
+ * position, normal, view direction and material id. It can also keep the
+ * light samples of every hit with their visibility already tested.
+ *
+ * relight() then shades the cached hits with the current materials and
+ * light intensities (edited with the setters of Phong and Emissive), without
+ * tracing camera rays, and without tracing shadow rays when the visibility
+ * is cached: the direct light of a Cornell box is reshaded in milliseconds.
+ * A shader can add the indirect light of the hits (see
+ * Shader::indirectLight()), which does trace new paths.
+ *
+ * The geometry, the camera, the light positions and which material every
+ * shape uses must not change between capture() and relight().
+ */
+class RelightRenderer
+{
+public:
+    struct Settings
+    {
+        size_t lightSamples = 4;        // Per light source and hit (as the NEE integrators)
+        bool cacheVisibility = true;    // Keep the light samples and their shadow tests
+    };
+
+    RelightRenderer() = delete;
+    explicit RelightRenderer(const Settings &settings_);
+
+    // Trace the camera rays and fill the G-buffer (and the light samples)
+    void capture(const Camera &cam, size_t width, size_t height,
+                 const std::vector<Shape*> &objList,
+                 const std::vector<LightSource*> &lsList);
+
+    // Shade the cached hits into the film (same size as the capture):
+    // emission + direct light + the indirect light of the shader, if any
+    void relight(Film &film, const std::vector<Shape*> &objList,
+                 const std::vector<LightSource*> &lsList,
+                 const Shader *indirectShader = nullptr);
+
+    // Statistics
+    double getCaptureTime() const;  // Seconds of the last capture()
+    double getRelightTime() const;  // Seconds of the last relight()
+    size_t getMemoryBytes() const;  // G-buffer and light samples
+
+private:
+    // First hits, one entry per pixel (shape is nullptr on a miss)
+    struct GBuffer
+    {
+        std::vector<float> px, py, pz;
+        std::vector<float> nx, ny, nz;
+        std::vector<float> wx, wy, wz;      // wo: from the hit to the camera
+        std::vector<uint32_t> material;
+        std::vector<const Shape*> shape;
+
+        void resize(size_t n);
+    };
+
+    // Light samples of the hits: lightSamples per light and pixel, with the
+    // radiance (0 if occluded) and pdf of LightSource::sample(). The radiance
+    // keeps the colour of the sample (e.g. a pixel of an environment map) and
+    // is rescaled in relight() by the change of the intensity of its light
+    struct LightSamples
+    {
+        std::vector<float> dx, dy, dz;      // wi: from the hit to the light
+        std::vector<float> lr, lg, lb;      // radiance
+        std::vector<float> pdf;
+
+        void resize(size_t n);
+    };
+
+    // Direct light of a hit, from its cached light samples (scaled by
+    // intensityScale, one entry per light) or from new ones (the same, as
+    // the pixels are seeded alike)
+    Vector3D directLight(size_t pixel, const Vector3D &p, const Vector3D &n, const Vector3D &wo,
+                         uint32_t material, const std::vector<Vector3D> &intensityScale,
+                         const std::vector<Shape*> &objList,
+                         const std::vector<LightSource*> &lsList) const;
+
+    Settings settings;
+    size_t width;
+    size_t height;
+    size_t lightCount;                      // Light sources at capture time
+    std::vector<Vector3D> captureIntensity; // Their intensities at capture time
+
+    GBuffer gbuffer;
+    LightSamples samples;
+    MaterialTable materials;
+
+    double captureTime;
+    double relightTime;
+};
+
+#endif // RELIGHTRENDERER_H
@@ -0,0 +1,276 @@
+#include "renderserver.h"
+#include "compiledscene.h"
+#include "utils.h"
+#include "../cameras/perspective.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+
+namespace
+{
+    // FNV-1a hash of a scene description
+    uint64_t hashDescription(const std::string &text)
+    {
+        uint64_t h = 14695981039346656037ull;
+        for (unsigned char c : text) {
+            h ^= c;
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+    bool parseNumber(const std::string &text, double &value)
+    {
+        char* end = nullptr;
+        value = std::strtod(text.c_str(), &end);
+        return end != text.c_str() && *end == '\0';
+    }
+
+    bool parseCount(const std::string &text, size_t &value)
+    {
+        char* end = nullptr;
+        unsigned long long v = std::strtoull(text.c_str(), &end, 10);
+        value = (size_t)v;
+        return end != text.c_str() && *end == '\0' && text[0] != '-';
+    }
+}
+
+RenderServer::RenderServer(const ShaderFactory &shaderFactory_, size_t maxCachedScenes_) :
+    shaderFactory(shaderFactory_), maxCachedScenes(std::max<size_t>(1, maxCachedScenes_)),
+    useCounter(0), jobCount(0), cacheHits(0), cacheMisses(0)
+{ }
+
+RenderServer::~RenderServer()
+{
+    for (std::unique_ptr<CachedScene> &entry : cache)
+        entry->scene.release();
+}
+
+void RenderServer::addScene(const std::string &name, const SceneBuilder &builder)
+{
+    builders.emplace_back(name, builder);
+}
+
+size_t RenderServer::getJobCount() const
+{
+    return jobCount;
+}
+
+size_t RenderServer::getCacheHits() const
+{
+    return cacheHits;
+}
+
+size_t RenderServer::getCacheMisses() const
+{
+    return cacheMisses;
+}
+
+bool RenderServer::parseJob(const std::string &options, RenderJob &job, std::string &error)
+{
+    std::istringstream tokens(options);
+    std::string token;
+    while (tokens >> token) {
+        size_t eq = token.find('=');
+        if (eq == std::string::npos) {
+            error = "expected key=value: " + token;
+            return false;
+        }
+        std::string key = token.substr(0, eq);
+        std::string value = token.substr(eq + 1);
+
+        bool valid = true;
+        if (key == "id")
+            job.id = value;
+        else if (key == "scene")
+            job.scene = value;
+        else if (key == "out")
+            job.output = value;
+        else if (key == "size") {
+            size_t x = value.find('x');
+            valid = x != std::string::npos && parseCount(value.substr(0, x), job.width)
+                && parseCount(value.substr(x + 1), job.height) && job.width > 0 && job.height > 0;
+        }
+        else if (key == "spp")
+            valid = parseCount(value, job.settings.targetSpp);
+        else if (key == "time")
+            valid = parseNumber(value, job.settings.timeBudget);
+        else if (key == "noise")
+            valid = parseNumber(value, job.settings.noiseTarget);
+        else if (key == "fov")
+            valid = parseNumber(value, job.fovDegrees) && job.fovDegrees > 0 && job.fovDegrees < 180;
+        else if (key == "camera") {
+            std::istringstream coords(value);
+            char comma1 = 0, comma2 = 0;
+            valid = (coords >> job.position.x >> comma1 >> job.position.y >> comma2 >> job.position.z)
+                && comma1 == ',' && comma2 == ',';
+            job.overridePosition = true;
+        }
+        else {
+            error = "unknown option " + key;
+            return false;
+        }
+        if (!valid) {
+            error = "invalid value for " + key + ": " + value;
+            return false;
+        }
+    }
+
+    if (job.scene.empty() || job.output.empty()) {
+        error = "a job needs a scene and an output file";
+        return false;
+    }
+    return true;
+}
+
+RenderServer::CachedScene* RenderServer::findScene(const std::string &description, std::string &error)
+{
+    uint64_t key = hashDescription(description);
+    for (std::unique_ptr<CachedScene> &entry : cache) {
+        if (entry->key == key && entry->description == description) {
+            entry->lastUse = ++useCounter;
+            cacheHits++;
+            return entry.get();
+        }
+    }
+
+    // 1. Find the builder of the scene
+    size_t colon = description.find(':');
+    std::string name = description.substr(0, colon);
+    std::string arguments = colon == std::string::npos ? "" : description.substr(colon + 1);
+    const SceneBuilder *builder = nullptr;
+    for (const std::pair<std::string, SceneBuilder> &b : builders)
+        if (b.first == name)
+            builder = &b.second;
+    if (!builder) {
+        error = "unknown scene " + name;
+        return nullptr;
+    }
+
+    // 2. Make room for it, releasing the scene used longest ago
+    if (cache.size() >= maxCachedScenes) {
+        auto oldest = std::min_element(cache.begin(), cache.end(),
+            [](const std::unique_ptr<CachedScene> &a, const std::unique_ptr<CachedScene> &b) {
+                return a->lastUse < b->lastUse;
+            });
+        (*oldest)->scene.release();
+        cache.erase(oldest);
+    }
+
+    // 3. Build it. The camera is created again for the film of every job,
+    // only its placement and fov are kept
+    std::unique_ptr<CachedScene> entry(new CachedScene());
+    Film builderFilm(1, 1);
+    Film *filmPtr = &builderFilm;
+    Camera *cam = nullptr;
+    (*builder)(cam, filmPtr, entry->scene, arguments);
+
+    PerspectiveCamera *perspective = dynamic_cast<PerspectiveCamera*>(cam);
+    if (!perspective) {
+        delete cam;
+        entry->scene.release();
+        error = "scene " + name + " could not be built or has no perspective camera";
+        return nullptr;
+    }
+    entry->key = key;
+    entry->description = description;
+    entry->cameraToWorld = perspective->cameraToWorld;
+    entry->fov = perspective->fov;
+    entry->lastUse = ++useCounter;
+    delete cam;
+
+    cacheMisses++;
+    cache.push_back(std::move(entry));
+    return cache.back().get();
+}
+
+Film& RenderServer::getFilm(size_t width, size_t height)
+{
+    if (!film || film->getWidth() != width || film->getHeight() != height)
+        film.reset(new Film(width, height));
+    else
+        film->clearData();
+    return *film;
+}
+
+bool RenderServer::render(const RenderJob &job, std::string &error)
+{
+    CachedScene *cached = findScene(job.scene, error);
+    if (!cached)
+        return false;
+
+    // 1. Camera of the scene with the overrides of the job
+    Film &jobFilm = getFilm(job.width, job.height);
+    Matrix4x4 cameraToWorld = cached->cameraToWorld;
+    if (job.overridePosition) {
+        // Translation column only: the camera keeps its orientation
+        cameraToWorld.data[0][3] = job.position.x;
+        cameraToWorld.data[1][3] = job.position.y;
+        cameraToWorld.data[2][3] = job.position.z;
+    }
+    double fov = job.fovDegrees > 0 ? Utils::degreesToRadians(job.fovDegrees) : cached->fov;
+    PerspectiveCamera cam(cameraToWorld, fov, jobFilm);
+
+    // 2. Render (the output of the server is the protocol: no progress bar)
+    ProgressiveRenderer::Settings settings = job.settings;
+    settings.showProgress = false;
+    ProgressiveRenderer renderer(settings);
+    std::unique_ptr<Shader> shader(shaderFactory());
+    renderer.render(cam, *shader, jobFilm, *cached->scene.objectsList, *cached->scene.LightSourceList);
+
+    jobCount++;
+    if (!jobFilm.saveEXR(job.output, false)) {
+        error = "could not write " + job.output;
+        return false;
+    }
+    return true;
+}
+
+size_t RenderServer::serve(std::istream &in, std::ostream &out)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    size_t rendered = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream tokens(line);
+        std::string command;
+        if (!(tokens >> command))
+            continue;
+
+        if (command == "quit") {
+            out << "ok quit" << std::endl;
+            break;
+        }
+        if (command == "stats") {
+            out << "ok stats jobs=" << jobCount << " scenes=" << cache.size()
+                << " hits=" << cacheHits << " misses=" << cacheMisses << std::endl;
+            continue;
+        }
+        if (command != "render") {
+            out << "error unknown command " << command << std::endl;
+            continue;
+        }
+
+        std::string options;
+        std::getline(tokens, options);
+        RenderJob job;
+        std::string error;
+        if (!parseJob(options, job, error)) {
+            out << "error " << job.id << " " << error << std::endl;
+            continue;
+        }
+
+        Clock::time_point start = Clock::now();
+        if (!render(job, error)) {
+            out << "error " << job.id << " " << error << std::endl;
+            continue;
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        out << "ok " << job.id << " " << job.output << " time=" << seconds << std::endl;
+        rendered++;
+    }
+    return rendered;
+}
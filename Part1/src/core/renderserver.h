@@ -0,0 +1,116 @@
+#ifndef RENDERSERVER_H
+#define RENDERSERVER_H
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "film.h"
+#include "progressiverenderer.h"
+#include "scene.h"
+#include "../cameras/camera.h"
+#include "../shaders/shader.h"
+
+// One render request of the server
+struct RenderJob
+{
+    std::string id;
+    std::string scene;                  // "name" or "name:arguments"
+    size_t width = 720, height = 512;
+    // Camera overrides (the camera of the scene otherwise). The position
+    // keeps the orientation of the camera of the scene
+    bool overridePosition = false;
+    Vector3D position;
+    double fovDegrees = 0;              // 0 keeps the fov of the scene
+    ProgressiveRenderer::Settings settings;
+    std::string output;                 // EXR file
+};
+
+/**
+ * @brief The RenderServer class
+ *
+ * Long-running render process: it reads jobs, one per line, and renders
+ * them with the progressive renderer into EXR files, so short jobs do not
+ * pay for starting the program, building the scene and creating threads.
+ *
+ * Scenes are registered by name with a builder (the buildScene functions
+ * of main). A built scene stays cached, together with its compiled object
+ * list (see CompiledScene), under the hash of its description; the least
+ * recently used one is released when more than maxCachedScenes are kept.
+ * The threads of ThreadPool::global() are shared by all the jobs.
+ *
+ * Protocol (see parseJob() for the job options):
+ *   render id=j1 scene=cornell size=320x240 spp=16 out=j1.exr
+ *   stats
+ *   quit
+ * Every command is answered with one line starting with "ok" or "error".
+ * Nothing else is written to out, so messages of the renderer must go to
+ * another stream (see serveJobs() in main).
+ */
+class RenderServer
+{
+public:
+    // Builds a scene and its camera (the argument string is the part of the
+    // scene description after ':')
+    typedef std::function<void(Camera*&, Film*&, Scene, const std::string&)> SceneBuilder;
+    // New shader for a job (deleted when the job ends)
+    typedef std::function<Shader*()> ShaderFactory;
+
+    RenderServer() = delete;
+    RenderServer(const ShaderFactory &shaderFactory_, size_t maxCachedScenes_ = 4);
+    ~RenderServer();
+
+    RenderServer(const RenderServer &) = delete;
+    RenderServer& operator=(const RenderServer &) = delete;
+
+    void addScene(const std::string &name, const SceneBuilder &builder);
+
+    // Answer the commands read from in until "quit" or the end of the input.
+    // Returns the number of jobs rendered
+    size_t serve(std::istream &in, std::ostream &out);
+
+    // Render one job (false and a message on error)
+    bool render(const RenderJob &job, std::string &error);
+
+    // Parse the options of a "render" command:
+    //   id=name scene=name[:args] size=WxH spp=n time=s noise=e
+    //   camera=x,y,z fov=degrees out=file.exr
+    static bool parseJob(const std::string &options, RenderJob &job, std::string &error);
+
+    // Statistics
+    size_t getJobCount() const;
+    size_t getCacheHits() const;
+    size_t getCacheMisses() const;
+
+private:
+    struct CachedScene
+    {
+        uint64_t key;
+        std::string description;        // Compared on a hit (hashes can collide)
+        Scene scene;
+        Matrix4x4 cameraToWorld;
+        double fov;                     // Radians
+        uint64_t lastUse;
+    };
+
+    // Built scene for a description (nullptr if it is not registered)
+    CachedScene* findScene(const std::string &description, std::string &error);
+    Film& getFilm(size_t width, size_t height);
+
+    ShaderFactory shaderFactory;
+    size_t maxCachedScenes;
+    std::vector<std::pair<std::string, SceneBuilder>> builders;
+    std::vector<std::unique_ptr<CachedScene>> cache;
+    std::unique_ptr<Film> film;         // Reused while the size does not change
+
+    uint64_t useCounter;
+    size_t jobCount;
+    size_t cacheHits;
+    size_t cacheMisses;
+};
+
+#endif // RENDERSERVER_H
@@ -0,0 +1,309 @@
+#include "restirrenderer.h"
+#include "parallel.h"
+#include "random.h"
+#include "utils.h"
+
+#include <algorithm>
+
+namespace
+{
+    const int MAX_SPECULAR_BOUNCES = 8;
+
+    // Normals and distances of two pixels must be this close to share samples
+    const double MIN_NORMAL_DOT = 0.9;
+    const double MAX_DISTANCE_RATIO = 0.1;
+
+    enum Stage
+    {
+        STAGE_CANDIDATES,
+        STAGE_TEMPORAL,
+        STAGE_SPATIAL
+    };
+
+    double luminance(const Vector3D &c)
+    {
+        return (c.x + c.y + c.z) / 3.0;
+    }
+}
+
+bool ReSTIRRenderer::Reservoir::update(const LightSample &sample_, int light_, double weight, double u)
+{
+    wSum += weight;
+    if (weight <= 0 || u * wSum >= weight)
+        return false;
+
+    sample = sample_;
+    light = light_;
+    return true;
+}
+
+ReSTIRRenderer::ReSTIRRenderer(Vector3D bgColor_, size_t candidates_, size_t spatialNeighbours_,
+                               double spatialRadius_, size_t historyLimit_) :
+    bgColor(bgColor_), candidates(std::max<size_t>(1, candidates_)), spatialNeighbours(spatialNeighbours_),
+    spatialRadius(spatialRadius_), historyLimit(historyLimit_), currentPass(0), shadowRayCount(0)
+{ }
+
+size_t ReSTIRRenderer::getShadowRayCount() const
+{
+    return shadowRayCount;
+}
+
+void ReSTIRRenderer::seedPixel(size_t stage, size_t pixel) const
+{
+    Random::seed(Random::hash(pixel, currentPass), stage);
+}
+
+void ReSTIRRenderer::renderPass(const Camera &cam, Film &film,
+                                const std::vector<Shape*> &objList,
+                                const std::vector<LightSource*> &lsList, size_t pass)
+{
+    size_t width = film.getWidth();
+    size_t height = film.getHeight();
+    currentPass = pass;
+
+    // The history is dropped on the first pass or if the image size changed
+    if (pass == 0 || previousReservoirs.size() != width * height) {
+        previousSurfaces.clear();
+        previousReservoirs.clear();
+    }
+
+    primaryHits(cam, width, height, objList);
+    initialCandidates(lsList);
+    if (!previousReservoirs.empty())
+        temporalReuse();
+    spatialReuse(width, height);
+    shade(film, width, height, objList);
+
+    // Keep this pass for the temporal reuse of the next one
+    std::swap(previousSurfaces, surfaces);
+    std::swap(previousReservoirs, spatialReservoirs);
+}
+
+void ReSTIRRenderer::primaryHits(const Camera &cam, size_t width, size_t height,
+                                 const std::vector<Shape*> &objList)
+{
+    surfaces.resize(width * height);
+
+    ThreadPool::global().parallelForLocal(height, 1, [&](size_t begin, size_t end) {
+        for (size_t lin = begin; lin < end; lin++) {
+            for (size_t col = 0; col < width; col++) {
+                SurfacePoint &sp = surfaces[lin * width + col];
+                sp.valid = false;
+                sp.emitted = Vector3D(0.0);
+                sp.distance = 0;
+
+                // Follow the specular surfaces up to the first diffuse or glossy one
+                Ray ray = cam.generateRay((col + 0.5) / width, (lin + 0.5) / height);
+                for (int bounce = 0; bounce <= MAX_SPECULAR_BOUNCES; bounce++) {
+                    Intersection its;
+                    if (!Utils::getClosestIntersection(ray, objList, its)) {
+                        sp.emitted += bgColor;
+                        break;
+                    }
+
+                    const Material &material = its.shape->getMaterial();
+                    Vector3D wo = -ray.d;
+                    Vector3D n = its.normal.normalized();
+                    sp.emitted += material.getEmissiveRadiance();
+                    sp.distance += (its.itsPoint - ray.o).length();
+
+                    if (material.hasSpecular() || material.hasTransmission()) {
+                        ray = Ray(its.itsPoint, Utils::computeSpecularDirection(material, n, wo), bounce + 1);
+                        continue;
+                    }
+                    if (material.hasDiffuseOrGlossy()) {
+                        sp.p = its.itsPoint;
+                        sp.n = dot(n, wo) < 0 ? -n : n;
+                        sp.wo = wo;
+                        sp.material = &material;
+                        sp.valid = true;
+                    }
+                    break;
+                }
+            }
+        }
+    });
+}
+
+Vector3D ReSTIRRenderer::unshadowedContribution(const SurfacePoint &sp, const LightSample &sample) const
+{
+    Vector3D toLight = sample.position - sp.p;
+    double dist2 = toLight.lengthSq();
+    if (dist2 <= 0)
+        return Vector3D(0.0);
+    Vector3D wi = toLight / std::sqrt(dist2);
+
+    double cosSurface = dot(wi, sp.n);
+    if (cosSurface <= 0)
+        return Vector3D(0.0);
+
+    // Area lights: per unit area of the light. Point lights (no normal):
+    // per light, the radiance being their intensity
+    double G = cosSurface / dist2;
+    if (sample.normal.lengthSq() > 0)
+        G *= std::max(0.0, dot(-wi, sample.normal));
+
+    return sp.material->getReflectance(sp.n, sp.wo, wi) * sample.radiance * G;
+}
+
+double ReSTIRRenderer::targetPdf(const SurfacePoint &sp, const LightSample &sample) const
+{
+    // Empty reservoirs hold a sample without radiance
+    return luminance(unshadowedContribution(sp, sample));
+}
+
+void ReSTIRRenderer::initialCandidates(const std::vector<LightSource*> &lsList)
+{
+    reservoirs.assign(surfaces.size(), Reservoir{ LightSample(), -1, 0, 0, 0 });
+
+    // Lights with a position to pick (lights at infinity have none)
+    std::vector<int> sources;
+    for (size_t l = 0; l < lsList.size(); l++)
+        if (!lsList[l]->isEnvironment())
+            sources.push_back((int)l);
+    if (sources.empty())
+        return;
+
+    size_t nLights = sources.size();
+    ThreadPool::global().parallelFor(surfaces.size(), 1024, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const SurfacePoint &sp = surfaces[i];
+            if (!sp.valid)
+                continue;
+            seedPixel(STAGE_CANDIDATES, i);
+
+            // Resampled importance sampling: candidates from the source
+            // distribution (uniform light, uniform point on it), one kept
+            // with probability proportional to target / source
+            Reservoir &r = reservoirs[i];
+            for (size_t c = 0; c < candidates; c++) {
+                int light = sources[std::min(nLights - 1, (size_t)(Random::uniform() * nLights))];
+                // Density per unit area (area lights) or per light (point lights)
+                LightSample lightSample = lsList[light]->samplePosition();
+                if (lightSample.pdf <= 0)
+                    continue;
+                double sourcePdf = lightSample.pdf / nLights;
+
+                double weight = targetPdf(sp, lightSample) / sourcePdf;
+                r.update(lightSample, light, weight, Random::uniform());
+            }
+            r.M = (double)candidates;
+
+            double p = targetPdf(sp, r.sample);
+            r.W = p > 0 ? r.wSum / (r.M * p) : 0;
+        }
+    });
+}
+
+void ReSTIRRenderer::temporalReuse()
+{
+    // The camera does not move between passes: the history of a pixel is the
+    // same pixel, as long as it still sees the same surface
+    ThreadPool::global().parallelFor(surfaces.size(), 1024, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const SurfacePoint &sp = surfaces[i];
+            const SurfacePoint &prevSp = previousSurfaces[i];
+            const Reservoir &prev = previousReservoirs[i];
+            if (!sp.valid || !prevSp.valid || prev.light < 0 || dot(sp.n, prevSp.n) < MIN_NORMAL_DOT
+                || std::abs(sp.distance - prevSp.distance) > MAX_DISTANCE_RATIO * sp.distance)
+                continue;
+            seedPixel(STAGE_TEMPORAL, i);
+
+            Reservoir cur = reservoirs[i];
+            double prevM = std::min(prev.M, (double)(historyLimit * candidates));
+
+            Reservoir r = { LightSample(), -1, 0, 0, 0 };
+            r.update(cur.sample, cur.light, cur.wSum, Random::uniform());
+            r.update(prev.sample, prev.light, targetPdf(sp, prev.sample) * prev.W * prevM, Random::uniform());
+            r.M = cur.M + prevM;
+
+            double p = targetPdf(sp, r.sample);
+            r.W = p > 0 ? r.wSum / (r.M * p) : 0;
+            reservoirs[i] = r;
+        }
+    });
+}
+
+void ReSTIRRenderer::spatialReuse(size_t width, size_t height)
+{
+    spatialReservoirs = reservoirs;
+    if (spatialNeighbours == 0)
+        return;
+
+    ThreadPool::global().parallelForLocal(height, 1, [&](size_t begin, size_t end) {
+        for (size_t lin = begin; lin < end; lin++) {
+            for (size_t col = 0; col < width; col++) {
+                size_t i = lin * width + col;
+                const SurfacePoint &sp = surfaces[i];
+                if (!sp.valid)
+                    continue;
+                seedPixel(STAGE_SPATIAL, i);
+
+                Reservoir r = { LightSample(), -1, 0, 0, 0 };
+                const Reservoir &self = reservoirs[i];
+                r.update(self.sample, self.light, self.wSum, Random::uniform());
+                r.M = self.M;
+
+                for (size_t k = 0; k < spatialNeighbours; k++) {
+                    // Random pixel in a disk around this one
+                    double radius = spatialRadius * std::sqrt(Random::uniform());
+                    double angle = 2 * M_PI * Random::uniform();
+                    long x = (long)col + std::lround(radius * std::cos(angle));
+                    long y = (long)lin + std::lround(radius * std::sin(angle));
+                    if (x < 0 || y < 0 || x >= (long)width || y >= (long)height)
+                        continue;
+
+                    size_t j = y * width + x;
+                    const SurfacePoint &nSp = surfaces[j];
+                    const Reservoir &n = reservoirs[j];
+                    if (j == i || !nSp.valid || n.light < 0 || dot(sp.n, nSp.n) < MIN_NORMAL_DOT
+                        || std::abs(sp.distance - nSp.distance) > MAX_DISTANCE_RATIO * sp.distance)
+                        continue;
+
+                    r.update(n.sample, n.light, targetPdf(sp, n.sample) * n.W * n.M, Random::uniform());
+                    r.M += n.M;
+                }
+
+                double p = targetPdf(sp, r.sample);
+                r.W = p > 0 ? r.wSum / (r.M * p) : 0;
+                spatialReservoirs[i] = r;
+            }
+        }
+    });
+}
+
+void ReSTIRRenderer::shade(Film &film, size_t width, size_t height, const std::vector<Shape*> &objList)
+{
+    std::vector<size_t> lineShadowRays(height, 0);
+
+    ThreadPool::global().parallelForLocal(height, 1, [&](size_t begin, size_t end) {
+        for (size_t lin = begin; lin < end; lin++) {
+            for (size_t col = 0; col < width; col++) {
+                size_t i = lin * width + col;
+                const SurfacePoint &sp = surfaces[i];
+                Reservoir &r = spatialReservoirs[i];
+                Vector3D color = sp.emitted;
+
+                // A single shadow ray, for the sample kept by the reservoir
+                if (sp.valid && r.light >= 0 && r.W > 0) {
+                    Vector3D toLight = r.sample.position - sp.p;
+                    double dist = toLight.length();
+                    Ray shadowRay = Ray(sp.p, toLight / dist, 0, Epsilon, dist - Epsilon);
+                    lineShadowRays[lin]++;
+
+                    if (!Utils::hasIntersection(shadowRay, objList))
+                        color += unshadowedContribution(sp, r.sample) * r.W;
+                }
+
+                // Running mean of the passes
+                if (currentPass > 0)
+                    color = film.getPixelValue(col, lin) + (color - film.getPixelValue(col, lin)) / double(currentPass + 1);
+                film.setPixelValue(col, lin, color);
+            }
+        }
+    });
+
+    shadowRayCount = 0;
+    for (size_t n : lineShadowRays)
+        shadowRayCount += n;
+}
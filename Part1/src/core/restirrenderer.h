@@ -0,0 +1,106 @@
+#ifndef RESTIRRENDERER_H
+#define RESTIRRENDERER_H
+
+#include <vector>
+
+#include "film.h"
+#include "../cameras/camera.h"
+#include "../lightsources/lightsource.h"
+#include "../shapes/shape.h"
+
+/**
+ * @brief The ReSTIRRenderer class
+ *
+ * Direct illumination with reservoir-based spatiotemporal importance
+ * resampling (Bitterli et al. 2020). Every pass over the image:
+ *
+ *   primary hits -> candidates (RIS) -> temporal reuse -> spatial reuse -> shading
+ *
+ * Each pixel streams a few light candidates through a one-sample reservoir,
+ * weighted by their unshadowed contribution. The reservoir is then merged with
+ * the one kept by the pixel in the previous pass and with those of some
+ * neighbouring pixels, and only the surviving sample is tested with a shadow
+ * ray. Passes are averaged in the film (progressive rendering).
+ *
+ * Mirror and transmissive surfaces are followed until the first diffuse or
+ * glossy hit, which receives the direct light. The reuse uses the biased
+ * (1/M) combination, without visibility checks on the neighbours, and the
+ * reservoirs are kept unshadowed so occlusion does not leak between pixels.
+ * Candidates are drawn from the point and area lights: lights at infinity
+ * have no position to resample.
+ */
+class ReSTIRRenderer
+{
+public:
+    ReSTIRRenderer() = delete;
+    // candidates: light samples per pixel and pass before any reuse
+    // spatialNeighbours/spatialRadius: pixels merged in the spatial reuse
+    // historyLimit: maximum weight of the previous passes, in multiples of
+    // candidates. Long histories correlate the passes averaged in the film
+    ReSTIRRenderer(Vector3D bgColor_, size_t candidates_ = 16, size_t spatialNeighbours_ = 4,
+                   double spatialRadius_ = 16.0, size_t historyLimit_ = 2);
+
+    // Render one pass and average it with the previous ones (pass 0 resets)
+    void renderPass(const Camera &cam, Film &film,
+                    const std::vector<Shape*> &objList,
+                    const std::vector<LightSource*> &lsList, size_t pass);
+
+    // Shadow rays traced in the last pass
+    size_t getShadowRayCount() const;
+
+private:
+    // First diffuse or glossy surface seen by a pixel
+    struct SurfacePoint
+    {
+        Vector3D p;
+        Vector3D n;          // Facing the viewer
+        Vector3D wo;
+        const Material* material;
+        Vector3D emitted;    // Emission and background found on the way
+        double distance;
+        bool valid;
+    };
+
+    // Light sample kept by a reservoir
+    struct Reservoir
+    {
+        LightSample sample;  // Point of the light (LightSource::samplePosition())
+        int light;           // -1: empty
+        double wSum;
+        double M;
+        double W;            // Unbiased contribution weight of the sample
+
+        bool update(const LightSample &sample_, int light_, double weight, double u);
+    };
+
+    void primaryHits(const Camera &cam, size_t width, size_t height,
+                     const std::vector<Shape*> &objList);
+    void initialCandidates(const std::vector<LightSource*> &lsList);
+    void temporalReuse();
+    void spatialReuse(size_t width, size_t height);
+    void shade(Film &film, size_t width, size_t height, const std::vector<Shape*> &objList);
+
+    // Unshadowed contribution of a light sample, and its luminance (target
+    // function). Only the values of the sample are read, never the light
+    Vector3D unshadowedContribution(const SurfacePoint &sp, const LightSample &sample) const;
+    double targetPdf(const SurfacePoint &sp, const LightSample &sample) const;
+
+    void seedPixel(size_t stage, size_t pixel) const;
+
+    Vector3D bgColor;
+    size_t candidates;
+    size_t spatialNeighbours;
+    double spatialRadius;
+    size_t historyLimit;
+
+    std::vector<SurfacePoint> surfaces;
+    std::vector<SurfacePoint> previousSurfaces;
+    std::vector<Reservoir> reservoirs;
+    std::vector<Reservoir> previousReservoirs;
+    std::vector<Reservoir> spatialReservoirs;
+
+    size_t currentPass;
+    size_t shadowRayCount;
+};
+
+#endif // RESTIRRENDERER_H
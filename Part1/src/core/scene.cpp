@@ -1,18 +1,29 @@
 #include "scene.h"
+#include "compiledscene.h"
 #include "../lightsources/arealightsource.h"
+#include "../lightsources/spherelightsource.h"
 
 Scene::Scene()
 {
 	objectsList = new std::vector<Shape*>;
 	LightSourceList = new std::vector<LightSource*>;
+	arena = new SceneArena();
+	CompiledScene::attach(*objectsList);
 
 }
 
 void Scene::AddObject(Shape* new_object)
 {
 	objectsList->push_back(new_object);
-	if (new_object->getMaterial().isEmissive())
-		LightSourceList->push_back(new AreaLightSource(dynamic_cast<Square*>(new_object)));
+	if (!new_object->getMaterial().isEmissive())
+		return;
+
+	// Emissive shapes that can be sampled become light sources. The others
+	// (infinite planes) are only found by the paths that hit them
+	if (Square* square = dynamic_cast<Square*>(new_object))
+		LightSourceList->push_back(create<AreaLightSource>(square));
+	else if (Sphere* sphere = dynamic_cast<Sphere*>(new_object))
+		LightSourceList->push_back(create<SphereLightSource>(sphere));
 
 }	
 
@@ -21,3 +32,17 @@ void Scene::AddPointLight(PointLightSource* new_pointLight)
 	LightSourceList->push_back(new_pointLight);
 }
 
+
+void Scene::release()
+{
+	// A new list could be allocated at the same address: drop the compiled
+	// copies of this one (those of the other scenes stay valid)
+	CompiledScene::detach(*objectsList);
+
+	delete objectsList;
+	delete LightSourceList;
+	delete arena;
+	objectsList = nullptr;
+	LightSourceList = nullptr;
+	arena = nullptr;
+}
@@ -4,6 +4,7 @@
 #include "vector3d.h"
 #include <stdlib.h> /* srand, rand */
 #include <vector>
+#include "scenearena.h"
 #include "../lightsources/pointlightsource.h"
 #include "../shapes/shape.h"
 
@@ -19,10 +20,22 @@ public:
     void AddObject(Shape* new_object);
     
     void AddPointLight(PointLightSource* new_pointLight);
+
+    // Create a shape, material or light source owned by the scene arena
+    template <typename T, typename... Args>
+    T* create(Args&&... args)
+    {
+        return arena->get(arena->create<T>(std::forward<Args>(args)...));
+    }
+
+    // Free the lists and every object of the arena at once. Copies of this
+    // scene share them, so none of them can be used afterwards
+    void release();
                                  
     // Declare pointers to all the variables which describe the scene
     std::vector<Shape*>* objectsList;
     std::vector<LightSource*>* LightSourceList;
+    SceneArena* arena;
 };
 
 #endif 
@@ -0,0 +1,30 @@
+#include "scenearena.h"
+
+#include <atomic>
+
+SceneArena::~SceneArena()
+{
+    clear();
+}
+
+size_t SceneArena::nextTypeId()
+{
+    static std::atomic<size_t> counter(0);
+    return counter++;
+}
+
+void SceneArena::clear()
+{
+    // Lights point to shapes and shapes to materials, but none of them uses
+    // the others when destroyed: the pools can go in any order
+    pools.clear();
+}
+
+size_t SceneArena::getReservedBytes() const
+{
+    size_t bytes = 0;
+    for (const std::unique_ptr<PoolBase> &p : pools)
+        if (p)
+            bytes += p->getReservedBytes();
+    return bytes;
+}
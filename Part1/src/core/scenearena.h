@@ -0,0 +1,158 @@
+#ifndef SCENEARENA_H
+#define SCENEARENA_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// 32-bit index of an object inside the pool of its type
+template <typename T>
+struct Handle
+{
+    static const uint32_t INVALID = UINT32_MAX;
+
+    uint32_t index = INVALID;
+
+    bool isValid() const { return index != INVALID; }
+};
+
+/**
+ * @brief The SceneArena class
+ *
+ * Owns the objects of a scene (shapes, materials, light sources) in one pool
+ * per concrete type. A pool stores its objects contiguously in blocks of
+ * about 16 KB, so objects created together stay close in memory and their
+ * addresses never change while the arena lives. Objects are addressed by a
+ * Handle (their index in the pool) or by the pointer returned by get().
+ *
+ * clear() destroys every object and returns the blocks at once: nothing in
+ * the arena has to be deleted on its own.
+ */
+class SceneArena
+{
+public:
+    SceneArena() = default;
+    SceneArena(const SceneArena &) = delete;
+    SceneArena& operator=(const SceneArena &) = delete;
+    ~SceneArena();
+
+    template <typename T, typename... Args>
+    Handle<T> create(Args&&... args)
+    {
+        return pool<T>().create(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    T* get(Handle<T> handle) const
+    {
+        const Pool<T> *p = findPool<T>();
+        return p ? p->get(handle) : nullptr;
+    }
+
+    // Objects of type T created so far
+    template <typename T>
+    size_t count() const
+    {
+        const Pool<T> *p = findPool<T>();
+        return p ? p->size() : 0;
+    }
+
+    // Destroy all the objects (the handles and pointers given are no longer valid)
+    void clear();
+
+    // Memory reserved by the pools, in bytes
+    size_t getReservedBytes() const;
+
+private:
+    class PoolBase
+    {
+    public:
+        virtual ~PoolBase() = default;
+        virtual void clear() = 0;
+        virtual size_t getReservedBytes() const = 0;
+    };
+
+    template <typename T>
+    class Pool : public PoolBase
+    {
+    public:
+        ~Pool() { clear(); }
+
+        template <typename... Args>
+        Handle<T> create(Args&&... args)
+        {
+            if (count == blocks.size() * PER_BLOCK)
+                blocks.emplace_back(new Slot[PER_BLOCK]);
+            Slot &slot = blocks[count / PER_BLOCK][count % PER_BLOCK];
+            ::new (static_cast<void*>(slot.bytes)) T(std::forward<Args>(args)...);
+            return Handle<T>{ (uint32_t)count++ };
+        }
+
+        T* get(Handle<T> handle) const
+        {
+            if (handle.index >= count)
+                return nullptr;
+            Slot &slot = blocks[handle.index / PER_BLOCK][handle.index % PER_BLOCK];
+            return std::launder(reinterpret_cast<T*>(slot.bytes));
+        }
+
+        size_t size() const { return count; }
+
+        void clear() override
+        {
+            for (size_t i = count; i-- > 0;)
+                get(Handle<T>{ (uint32_t)i })->~T();
+            count = 0;
+            blocks.clear();
+        }
+
+        size_t getReservedBytes() const override
+        {
+            return blocks.size() * PER_BLOCK * sizeof(Slot);
+        }
+
+    private:
+        struct alignas(T) Slot
+        {
+            unsigned char bytes[sizeof(T)];
+        };
+        static constexpr size_t PER_BLOCK = std::max<size_t>(1, 16384 / sizeof(Slot));
+
+        std::vector<std::unique_ptr<Slot[]>> blocks;
+        size_t count = 0;
+    };
+
+    // Small dense id per type, used to find its pool
+    static size_t nextTypeId();
+    template <typename T>
+    static size_t typeId()
+    {
+        static const size_t id = nextTypeId();
+        return id;
+    }
+
+    template <typename T>
+    Pool<T>& pool()
+    {
+        size_t id = typeId<T>();
+        if (id >= pools.size())
+            pools.resize(id + 1);
+        if (!pools[id])
+            pools[id].reset(new Pool<T>());
+        return *static_cast<Pool<T>*>(pools[id].get());
+    }
+
+    template <typename T>
+    const Pool<T>* findPool() const
+    {
+        size_t id = typeId<T>();
+        return id < pools.size() ? static_cast<const Pool<T>*>(pools[id].get()) : nullptr;
+    }
+
+    std::vector<std::unique_ptr<PoolBase>> pools;
+};
+
+#endif // SCENEARENA_H
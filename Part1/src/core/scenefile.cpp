@@ -0,0 +1,349 @@
+#include "scenefile.h"
+#include "mappedfile.h"
+#include "../cameras/perspective.h"
+#include "../lightsources/pointlightsource.h"
+#include "../materials/emissive.h"
+#include "../materials/mirror.h"
+#include "../materials/phong.h"
+#include "../materials/transmissive.h"
+#include "../shapes/infiniteplan.h"
+#include "../shapes/sphere.h"
+#include "../shapes/square.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+    const char SCENE_MAGIC[8] = { 'A', 'C', 'G', 'S', 'C', 'E', 'N', 'E' };
+    const uint32_t SCENE_VERSION = 1;
+    const uint32_t SCENE_HAS_CAMERA = 1;
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t flags;
+        uint64_t materialCount;
+        uint64_t shapeCount;
+        uint64_t pointLightCount;
+        uint64_t materialOffset;    // Bytes from the start of the file
+        uint64_t shapeOffset;
+        uint64_t pointLightOffset;
+    };
+    static_assert(sizeof(FileHeader) == 64, "Scene header must stay 64 bytes");
+
+    // Right after the header
+    struct FileCamera
+    {
+        double cameraToWorld[16];   // Row-major
+        double fov;                 // Radians
+        double reserved;
+    };
+
+    enum FileMaterialType : uint32_t
+    {
+        MATERIAL_PHONG,
+        MATERIAL_EMISSIVE,
+        MATERIAL_MIRROR,
+        MATERIAL_TRANSMISSIVE
+    };
+
+    struct FileMaterial
+    {
+        uint32_t type;
+        uint32_t reserved;
+        double color0[3];           // Phong: Kd, emissive: Ke
+        double color1[3];           // Phong: Ks, emissive: rho_d
+        double value;               // Phong: shininess, transmissive: index of refraction
+    };
+
+    enum FileShapeType : uint32_t
+    {
+        SHAPE_SPHERE,
+        SHAPE_SQUARE,
+        SHAPE_PLAN
+    };
+
+    struct FileShape
+    {
+        uint32_t type;
+        uint32_t material;          // Index in the material array
+        // Sphere: object to world transform (row-major)
+        // Square: corner, v1, v2, normal. Plan: point, normal
+        double data[16];
+        double radius;              // Sphere (before the transform)
+    };
+
+    struct FilePointLight
+    {
+        double position[3];
+        double intensity[3];
+    };
+
+    static_assert(std::is_trivially_copyable<FileShape>::value, "Records are read in place");
+    static_assert(sizeof(FileCamera) % 8 == 0 && sizeof(FileMaterial) % 8 == 0
+                  && sizeof(FileShape) % 8 == 0 && sizeof(FilePointLight) % 8 == 0,
+                  "Records keep the arrays 8-byte aligned");
+
+    void store(double *out, const Vector3D &v)
+    {
+        out[0] = v.x;
+        out[1] = v.y;
+        out[2] = v.z;
+    }
+
+    Vector3D vector(const double *in)
+    {
+        return Vector3D(in[0], in[1], in[2]);
+    }
+
+    bool makeMaterialRecord(const Material &material, FileMaterial &record)
+    {
+        record = FileMaterial();
+        if (const Phong *phong = dynamic_cast<const Phong*>(&material)) {
+            record.type = MATERIAL_PHONG;
+            store(record.color0, phong->getDiffuseReflectance());
+            store(record.color1, phong->getSpecularReflectance());
+            record.value = phong->getShininess();
+        }
+        else if (dynamic_cast<const Emissive*>(&material)) {
+            record.type = MATERIAL_EMISSIVE;
+            store(record.color0, material.getEmissiveRadiance());
+            store(record.color1, material.getDiffuseReflectance());
+        }
+        else if (dynamic_cast<const Mirror*>(&material))
+            record.type = MATERIAL_MIRROR;
+        else if (dynamic_cast<const Transmissive*>(&material)) {
+            record.type = MATERIAL_TRANSMISSIVE;
+            record.value = material.getIndexOfRefraction();
+        }
+        else
+            return false;
+        return true;
+    }
+
+    bool makeShapeRecord(const Shape &shape, uint32_t material, FileShape &record)
+    {
+        record = FileShape();
+        record.material = material;
+        if (const Sphere *sphere = dynamic_cast<const Sphere*>(&shape)) {
+            record.type = SHAPE_SPHERE;
+            const Matrix4x4 &t = sphere->getTransform();
+            for (int i = 0; i < 16; i++)
+                record.data[i] = t.data[i / 4][i % 4];
+            record.radius = sphere->getLocalRadius();
+        }
+        else if (const Square *square = dynamic_cast<const Square*>(&shape)) {
+            record.type = SHAPE_SQUARE;
+            store(record.data, square->corner);
+            store(record.data + 3, square->v1);
+            store(record.data + 6, square->v2);
+            store(record.data + 9, square->normal);
+        }
+        else if (const InfinitePlan *plan = dynamic_cast<const InfinitePlan*>(&shape)) {
+            record.type = SHAPE_PLAN;
+            store(record.data, plan->getPointWorld());
+            store(record.data + 3, plan->getNormalWorld());
+        }
+        else
+            return false;
+        return true;
+    }
+
+    void append(std::vector<unsigned char> &buffer, const void *data, size_t size)
+    {
+        const unsigned char *bytes = static_cast<const unsigned char*>(data);
+        buffer.insert(buffer.end(), bytes, bytes + size);
+    }
+
+    // Whether count records of size bytes fit in the file at offset
+    bool fits(uint64_t offset, uint64_t count, size_t size, size_t fileSize)
+    {
+        return offset % 8 == 0 && offset <= fileSize && count <= (fileSize - offset) / size;
+    }
+}
+
+bool SceneFile::save(const std::string &filename, const Scene &scene, const Camera *cam)
+{
+    // 1. Records (materials shared by several shapes are stored once)
+    std::vector<FileMaterial> materials;
+    std::vector<FileShape> shapes;
+    std::vector<FilePointLight> pointLights;
+    std::unordered_map<const Material*, uint32_t> materialIds;
+
+    for (const Shape *shape : *scene.objectsList) {
+        const Material *material = &shape->getMaterial();
+        auto it = materialIds.find(material);
+        if (it == materialIds.end()) {
+            FileMaterial record;
+            if (!makeMaterialRecord(*material, record)) {
+                std::cout << "SceneFile: unsupported material type" << std::endl;
+                return false;
+            }
+            it = materialIds.emplace(material, (uint32_t)materials.size()).first;
+            materials.push_back(record);
+        }
+        FileShape record;
+        if (!makeShapeRecord(*shape, it->second, record)) {
+            std::cout << "SceneFile: unsupported shape type" << std::endl;
+            return false;
+        }
+        shapes.push_back(record);
+    }
+    for (const LightSource *light : *scene.LightSourceList) {
+        if (dynamic_cast<const PointLightSource*>(light)) {
+            FilePointLight record;
+            store(record.position, light->samplePosition().position);
+            store(record.intensity, light->getIntensity());
+            pointLights.push_back(record);
+        }
+    }
+
+    FileCamera camera = FileCamera();
+    const PerspectiveCamera *perspective = dynamic_cast<const PerspectiveCamera*>(cam);
+    if (perspective) {
+        for (int i = 0; i < 16; i++)
+            camera.cameraToWorld[i] = perspective->cameraToWorld.data[i / 4][i % 4];
+        camera.fov = perspective->fov;
+    }
+
+    // 2. Header, camera and arrays, in this order
+    FileHeader header;
+    std::memcpy(header.magic, SCENE_MAGIC, sizeof(header.magic));
+    header.version = SCENE_VERSION;
+    header.flags = perspective ? SCENE_HAS_CAMERA : 0;
+    header.materialCount = materials.size();
+    header.shapeCount = shapes.size();
+    header.pointLightCount = pointLights.size();
+    header.materialOffset = sizeof(FileHeader) + sizeof(FileCamera);
+    header.shapeOffset = header.materialOffset + materials.size() * sizeof(FileMaterial);
+    header.pointLightOffset = header.shapeOffset + shapes.size() * sizeof(FileShape);
+
+    std::vector<unsigned char> buffer;
+    buffer.reserve(header.pointLightOffset + pointLights.size() * sizeof(FilePointLight));
+    append(buffer, &header, sizeof(header));
+    append(buffer, &camera, sizeof(camera));
+    append(buffer, materials.data(), materials.size() * sizeof(FileMaterial));
+    append(buffer, shapes.data(), shapes.size() * sizeof(FileShape));
+    append(buffer, pointLights.data(), pointLights.size() * sizeof(FilePointLight));
+
+    // 3. Write next to the old file, then replace it
+    std::string tmpName = filename + ".tmp";
+    FILE *file = fopen(tmpName.c_str(), "wb");
+    if (!file)
+        return false;
+    bool ok = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        std::remove(tmpName.c_str());
+        return false;
+    }
+    return replaceFile(tmpName, filename);
+}
+
+bool SceneFile::load(const std::string &filename, Scene scene, Camera *&cam, const Film &film)
+{
+    // 1. Map the file and check the header and the extent of the arrays
+    MappedFile file;
+    if (!file.open(filename) || file.size() < sizeof(FileHeader) + sizeof(FileCamera))
+        return false;
+    const unsigned char *base = file.data();
+    const FileHeader &header = *reinterpret_cast<const FileHeader*>(base);
+    if (std::memcmp(header.magic, SCENE_MAGIC, sizeof(header.magic)) != 0 || header.version != SCENE_VERSION) {
+        std::cout << "SceneFile: " << filename << " is not a scene of version " << SCENE_VERSION << std::endl;
+        return false;
+    }
+    if (!fits(header.materialOffset, header.materialCount, sizeof(FileMaterial), file.size())
+        || !fits(header.shapeOffset, header.shapeCount, sizeof(FileShape), file.size())
+        || !fits(header.pointLightOffset, header.pointLightCount, sizeof(FilePointLight), file.size())) {
+        std::cout << "SceneFile: " << filename << " is truncated" << std::endl;
+        return false;
+    }
+
+    // 2. The records are read where they are mapped
+    const FileCamera &camera = *reinterpret_cast<const FileCamera*>(base + sizeof(FileHeader));
+    const FileMaterial *materialRecords = reinterpret_cast<const FileMaterial*>(base + header.materialOffset);
+    const FileShape *shapeRecords = reinterpret_cast<const FileShape*>(base + header.shapeOffset);
+    const FilePointLight *lightRecords = reinterpret_cast<const FilePointLight*>(base + header.pointLightOffset);
+
+    std::vector<Material*> materials(header.materialCount);
+    for (size_t i = 0; i < materials.size(); i++) {
+        const FileMaterial &m = materialRecords[i];
+        switch (m.type) {
+        case MATERIAL_PHONG:
+            materials[i] = scene.create<Phong>(vector(m.color0), vector(m.color1), (float)m.value);
+            break;
+        case MATERIAL_EMISSIVE:
+            materials[i] = scene.create<Emissive>(vector(m.color0), vector(m.color1));
+            break;
+        case MATERIAL_MIRROR:
+            materials[i] = scene.create<Mirror>();
+            break;
+        case MATERIAL_TRANSMISSIVE:
+            materials[i] = scene.create<Transmissive>(m.value);
+            break;
+        default:
+            std::cout << "SceneFile: unknown material type " << m.type << std::endl;
+            return false;
+        }
+    }
+
+    // Nothing is added to the scene before the whole file has been read
+    std::vector<Shape*> shapes;
+    shapes.reserve(header.shapeCount);
+    for (size_t i = 0; i < header.shapeCount; i++) {
+        const FileShape &s = shapeRecords[i];
+        if (s.material >= materials.size()) {
+            std::cout << "SceneFile: shape " << i << " has no valid material" << std::endl;
+            return false;
+        }
+        Material *material = materials[s.material];
+        Shape *shape = nullptr;
+        switch (s.type) {
+        case SHAPE_SPHERE: {
+            double t[4][4];
+            for (int j = 0; j < 16; j++)
+                t[j / 4][j % 4] = s.data[j];
+            shape = scene.create<Sphere>(s.radius, Matrix4x4(t), material);
+            break;
+        }
+        case SHAPE_SQUARE:
+            shape = scene.create<Square>(vector(s.data), vector(s.data + 3), vector(s.data + 6),
+                                         vector(s.data + 9), material);
+            break;
+        case SHAPE_PLAN:
+            shape = scene.create<InfinitePlan>(vector(s.data), vector(s.data + 3), material);
+            break;
+        default:
+            std::cout << "SceneFile: unknown shape type " << s.type << std::endl;
+            return false;
+        }
+        shapes.push_back(shape);
+    }
+
+    std::vector<PointLightSource*> lights;
+    lights.reserve(header.pointLightCount);
+    for (size_t i = 0; i < header.pointLightCount; i++) {
+        const FilePointLight &l = lightRecords[i];
+        lights.push_back(scene.create<PointLightSource>(vector(l.position), vector(l.intensity)));
+    }
+
+    // 3. Add the objects and the camera
+    scene.objectsList->reserve(scene.objectsList->size() + shapes.size());
+    for (Shape *shape : shapes)
+        scene.AddObject(shape);
+    for (PointLightSource *light : lights)
+        scene.AddPointLight(light);
+    if (header.flags & SCENE_HAS_CAMERA) {
+        double t[4][4];
+        for (int j = 0; j < 16; j++)
+            t[j / 4][j % 4] = camera.cameraToWorld[j];
+        cam = new PerspectiveCamera(Matrix4x4(t), camera.fov, film);
+    }
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <string>
+
+#include "film.h"
+#include "scene.h"
+#include "../cameras/camera.h"
+
+/**
+ * @brief The SceneFile class
+ *
+ * Versioned binary scene container (".acgscene"): a 64-byte header with
+ * the counts and offsets of flat arrays of fixed-size records (materials,
+ * shapes, point lights) and the camera. Records hold plain numbers and
+ * indices, never pointers, at 8-byte aligned offsets, so the file is read
+ * in place through a memory mapping: loading only creates the objects in
+ * the scene arena. Numbers are stored in the byte order of the machine
+ * (little-endian on every platform the renderer targets).
+ *
+ * Area and sphere lights are not stored: the emissive shapes become light
+ * sources again when they are added to the scene.
+ */
+class SceneFile
+{
+public:
+    // Store the shapes, materials and point lights of a scene and its camera
+    // (perspective cameras only; nullptr to leave it out)
+    static bool save(const std::string &filename, const Scene &scene, const Camera *cam);
+
+    // Add the objects of a file to scene and create its camera for film
+    // (cam is left unchanged if the file has none). false, with the scene
+    // left unchanged, if the file can not be read or is not valid
+    static bool load(const std::string &filename, Scene scene, Camera *&cam, const Film &film);
+};
+
+#endif // SCENEFILE_H
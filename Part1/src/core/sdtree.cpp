@@ -0,0 +1,319 @@
+#include "sdtree.h"
+#include "parallel.h"
+
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+namespace
+{
+    const int MAX_DTREE_DEPTH = 20;
+
+    // Equal-area mapping between the sphere and [0,1]^2
+    void directionToSquare(const Vector3D &d, double &u, double &v)
+    {
+        u = std::clamp((d.z + 1.0) * 0.5, 0.0, 1.0);
+        double phi = std::atan2(d.y, d.x);
+        if (phi < 0)
+            phi += 2 * M_PI;
+        v = std::clamp(phi / (2 * M_PI), 0.0, 1.0);
+    }
+
+    Vector3D squareToDirection(double u, double v)
+    {
+        double cosTheta = 2 * u - 1;
+        double sinTheta = std::sqrt(std::max(0.0, 1.0 - cosTheta * cosTheta));
+        double phi = 2 * M_PI * v;
+        return Vector3D(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+    }
+
+    // Quadrant of (u, v) inside the unit square; (u, v) are rescaled to it
+    int selectQuadrant(double &u, double &v)
+    {
+        int q = 0;
+        u *= 2;
+        v *= 2;
+        if (u >= 1) { q |= 1; u -= 1; }
+        if (v >= 1) { q |= 2; v -= 1; }
+        u = std::min(u, 1.0);
+        v = std::min(v, 1.0);
+        return q;
+    }
+}
+
+DTree::DTree()
+{
+    nodes.push_back(Node{ { 0, 0, 0, 0 }, { 0, 0, 0, 0 } });
+}
+
+float DTree::getTotal() const
+{
+    const Node &root = nodes[0];
+    return root.sum[0] + root.sum[1] + root.sum[2] + root.sum[3];
+}
+
+Vector3D DTree::sample(double u1, double u2) const
+{
+    if (getTotal() <= 0)
+        return squareToDirection(u1, u2);
+
+    // Descend choosing the quadrants proportionally to their energy. u1 is
+    // rescaled after every choice so it can be reused at the next level
+    double x = 0, y = 0, size = 1;
+    uint32_t n = 0;
+    while (true)
+    {
+        const Node &node = nodes[n];
+        double total = node.sum[0] + node.sum[1] + node.sum[2] + node.sum[3];
+        double target = u1 * total;
+        int q = 0;
+        while (q < 3 && (target >= node.sum[q] || node.sum[q] <= 0))
+        {
+            target -= node.sum[q];
+            q++;
+        }
+        u1 = node.sum[q] > 0 ? std::clamp(target / node.sum[q], 0.0, 1.0 - 1e-9) : u1;
+
+        size *= 0.5;
+        if (q & 1) x += size;
+        if (q & 2) y += size;
+        if (node.child[q] == 0)
+            return squareToDirection(x + u1 * size, y + u2 * size);
+        n = node.child[q];
+    }
+}
+
+double DTree::pdf(const Vector3D &d) const
+{
+    const double uniformPdf = 1.0 / (4 * M_PI);
+    if (getTotal() <= 0)
+        return uniformPdf;
+
+    double u, v;
+    directionToSquare(d, u, v);
+
+    double p = 1.0;
+    uint32_t n = 0;
+    while (true)
+    {
+        const Node &node = nodes[n];
+        double total = node.sum[0] + node.sum[1] + node.sum[2] + node.sum[3];
+        if (total <= 0)
+            break;
+        int q = selectQuadrant(u, v);
+        p *= 4 * node.sum[q] / total;
+        if (node.child[q] == 0)
+            break;
+        n = node.child[q];
+    }
+    return p * uniformPdf;
+}
+
+void DTree::record(const Vector3D &d, float value)
+{
+    double u, v;
+    directionToSquare(d, u, v);
+
+    // Every node along the path holds the energy of its quadrants
+    uint32_t n = 0;
+    while (true)
+    {
+        int q = selectQuadrant(u, v);
+        nodes[n].sum[q] += value;
+        if (nodes[n].child[q] == 0)
+            break;
+        n = nodes[n].child[q];
+    }
+}
+
+DTree DTree::refined(double threshold, int maxDepth) const
+{
+    DTree result;
+    result.nodes[0] = Node{ { nodes[0].sum[0], nodes[0].sum[1], nodes[0].sum[2], nodes[0].sum[3] }, { 0, 0, 0, 0 } };
+
+    double total = getTotal();
+    if (total <= 0)
+        return result;
+
+    // (new node, old node or -1 if it did not exist, depth)
+    std::vector<std::tuple<uint32_t, int64_t, int>> stack;
+    stack.emplace_back(0, 0, 1);
+    while (!stack.empty())
+    {
+        auto [newIndex, oldIndex, depth] = stack.back();
+        stack.pop_back();
+
+        for (int q = 0; q < 4; q++)
+        {
+            float energy = result.nodes[newIndex].sum[q];
+            if (energy / total <= threshold || depth >= maxDepth)
+                continue;
+
+            // Subdivide the quadrant: keep the old children energy if there
+            // were children, spread it evenly otherwise
+            Node child = { { energy / 4, energy / 4, energy / 4, energy / 4 }, { 0, 0, 0, 0 } };
+            int64_t oldChild = -1;
+            if (oldIndex >= 0 && nodes[oldIndex].child[q] != 0)
+            {
+                oldChild = nodes[oldIndex].child[q];
+                for (int c = 0; c < 4; c++)
+                    child.sum[c] = nodes[oldChild].sum[c];
+            }
+
+            uint32_t childIndex = (uint32_t)result.nodes.size();
+            result.nodes.push_back(child);
+            result.nodes[newIndex].child[q] = childIndex;
+            stack.emplace_back(childIndex, oldChild, depth + 1);
+        }
+    }
+    return result;
+}
+
+void DTree::clearEnergy()
+{
+    for (Node &node : nodes)
+        std::fill(node.sum, node.sum + 4, 0.0f);
+}
+
+SDTree::SDTree(const Vector3D &center_, double halfSize_, size_t spatialThreshold_,
+               double directionalThreshold_) :
+    center(center_), halfSize(halfSize_), spatialThreshold(spatialThreshold_),
+    directionalThreshold(directionalThreshold_), iteration(0)
+{
+    spatialNodes.push_back(SpatialNode{ 0, 0, 0 });
+    leaves.push_back(Leaf{ DTree(), DTree(), 0, false });
+    threadRecords.resize(ThreadPool::global().getThreadCount());
+}
+
+void SDTree::reset()
+{
+    iteration = 0;
+    spatialNodes.assign(1, SpatialNode{ 0, 0, 0 });
+    leaves.assign(1, Leaf{ DTree(), DTree(), 0, false });
+    for (std::vector<Record> &buffer : threadRecords)
+        buffer.clear();
+}
+
+size_t SDTree::getLeafCount() const
+{
+    return leaves.size();
+}
+
+uint32_t SDTree::findLeaf(const Vector3D &p) const
+{
+    double pos[3] = { p.x, p.y, p.z };
+    double lo[3] = { center.x - halfSize, center.y - halfSize, center.z - halfSize };
+    double hi[3] = { center.x + halfSize, center.y + halfSize, center.z + halfSize };
+
+    // Points outside the bounds end in the closest leaf
+    uint32_t n = 0;
+    while (spatialNodes[n].child != 0)
+    {
+        int axis = spatialNodes[n].axis;
+        double mid = 0.5 * (lo[axis] + hi[axis]);
+        if (pos[axis] < mid)
+        {
+            hi[axis] = mid;
+            n = spatialNodes[n].child;
+        }
+        else
+        {
+            lo[axis] = mid;
+            n = spatialNodes[n].child + 1;
+        }
+    }
+    return spatialNodes[n].leaf;
+}
+
+const DTree* SDTree::getSamplingTree(const Vector3D &p) const
+{
+    const Leaf &leaf = leaves[findLeaf(p)];
+    if (!leaf.trained || leaf.sampling.getTotal() <= 0)
+        return nullptr;
+    return &leaf.sampling;
+}
+
+void SDTree::record(const Vector3D &p, const Vector3D &d, float value)
+{
+    if (!std::isfinite(value) || value < 0)
+        return;
+
+    Record record = { { p.x, p.y, p.z }, { d.x, d.y, d.z }, value, 0 };
+    threadRecords[ThreadPool::getThreadIndex()].push_back(record);
+}
+
+void SDTree::splitLeaf(uint32_t node)
+{
+    // The two halves start with a copy of the distributions of the parent
+    uint32_t leafIndex = spatialNodes[node].leaf;
+    Leaf &leaf = leaves[leafIndex];
+    leaf.sampleCount /= 2;
+    leaves.push_back(leaf);
+
+    uint8_t childAxis = (spatialNodes[node].axis + 1) % 3;
+    uint32_t first = (uint32_t)spatialNodes.size();
+    spatialNodes.push_back(SpatialNode{ 0, leafIndex, childAxis });
+    spatialNodes.push_back(SpatialNode{ 0, (uint32_t)leaves.size() - 1, childAxis });
+    spatialNodes[node].child = first;
+}
+
+void SDTree::endIteration()
+{
+    // 1. Gather the records and sort them, so the sums do not depend on
+    //    which thread rendered each sample
+    std::vector<Record> records;
+    for (std::vector<Record> &buffer : threadRecords)
+    {
+        records.insert(records.end(), buffer.begin(), buffer.end());
+        buffer.clear();
+    }
+    for (Record &record : records)
+        record.leaf = findLeaf(Vector3D(record.position[0], record.position[1], record.position[2]));
+
+    auto key = [](const Record &r) {
+        return std::tie(r.leaf, r.position[0], r.position[1], r.position[2],
+                        r.direction[0], r.direction[1], r.direction[2], r.value);
+    };
+    std::sort(records.begin(), records.end(), [&](const Record &a, const Record &b) { return key(a) < key(b); });
+
+    // 2. Splat the records of every leaf into its training tree (in parallel,
+    //    one leaf per task)
+    std::vector<size_t> leafStart(leaves.size() + 1, records.size());
+    for (size_t i = records.size(); i-- > 0;)
+        leafStart[records[i].leaf] = i;
+    for (size_t l = leaves.size(); l-- > 0;)
+        leafStart[l] = std::min(leafStart[l], leafStart[l + 1]);
+
+    ThreadPool::global().parallelFor(leaves.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t l = begin; l < end; l++)
+        {
+            Leaf &leaf = leaves[l];
+            for (size_t i = leafStart[l]; i < leafStart[l + 1]; i++)
+                leaf.training.record(Vector3D(records[i].direction[0], records[i].direction[1], records[i].direction[2]),
+                                     records[i].value);
+            leaf.sampleCount = leafStart[l + 1] - leafStart[l];
+
+            // 3. The trained distribution is used for sampling from now on,
+            //    and a refined copy of it is trained in the next iteration
+            if (leaf.training.getTotal() > 0)
+            {
+                leaf.sampling = leaf.training;
+                leaf.trained = true;
+            }
+            leaf.training = leaf.sampling.refined(directionalThreshold, MAX_DTREE_DEPTH);
+            leaf.training.clearEnergy();
+        }
+    });
+
+    // 4. Split the spatial leaves that received too many samples
+    double threshold = spatialThreshold * std::sqrt(std::pow(2.0, (double)iteration));
+    for (uint32_t n = 0; n < spatialNodes.size(); n++)
+    {
+        if (spatialNodes[n].child == 0 && leaves[spatialNodes[n].leaf].sampleCount > threshold)
+            splitLeaf(n);
+    }
+    for (Leaf &leaf : leaves)
+        leaf.sampleCount = 0;
+    iteration++;
+}
@@ -0,0 +1,121 @@
+#ifndef SDTREE_H
+#define SDTREE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "vector3d.h"
+
+/**
+ * @brief The DTree class
+ *
+ * Directional quadtree over the sphere of directions, parametrized with the
+ * equal-area mapping (cos(theta), phi) -> [0,1]^2. Every node stores the
+ * energy of its four quadrants, so directions can be sampled proportionally
+ * to the learned incident radiance.
+ */
+class DTree
+{
+public:
+    DTree();
+
+    Vector3D sample(double u1, double u2) const;
+    // Solid angle density of sample()
+    double pdf(const Vector3D &d) const;
+
+    // Add value (incident radiance / pdf) to the leaf containing d
+    void record(const Vector3D &d, float value);
+    float getTotal() const;
+
+    // Same energy, structure adapted to it: quadrants holding more than
+    // threshold of the total energy are subdivided, the rest collapsed
+    DTree refined(double threshold, int maxDepth) const;
+    void clearEnergy();
+
+private:
+    struct Node
+    {
+        float sum[4];
+        uint32_t child[4]; // 0: the quadrant is a leaf
+    };
+
+    std::vector<Node> nodes;
+};
+
+/**
+ * @brief The SDTree class
+ *
+ * Spatio-directional tree for path guiding (Mueller et al. 2017): a binary
+ * tree over the scene bounds with a DTree in every leaf. Each leaf keeps
+ * the distribution learned in the previous iteration (used for sampling)
+ * and the one being trained. Render threads record their samples in
+ * per-thread buffers; the tree is only modified in endIteration(), between
+ * two passes, so it can be read without locks while rendering.
+ */
+class SDTree
+{
+public:
+    SDTree() = delete;
+    // center/halfSize: region of the scene covered by the spatial tree
+    // spatialThreshold: samples needed to split a spatial leaf in the first
+    // iteration; it grows with sqrt(2^k) as iteration k is expected to
+    // hold twice the samples of iteration k - 1
+    // directionalThreshold: energy fraction needed to split a quadrant
+    SDTree(const Vector3D &center, double halfSize, size_t spatialThreshold_ = 4000,
+           double directionalThreshold_ = 0.01);
+
+    // Distribution to sample directions at p (nullptr until trained)
+    const DTree* getSamplingTree(const Vector3D &p) const;
+
+    // Store a sample of the incident radiance at p from direction d
+    void record(const Vector3D &p, const Vector3D &d, float value);
+
+    // Train with the samples recorded since the last call: the trained
+    // distributions become the sampling ones and the trees are refined
+    void endIteration();
+    // Forget everything learned: back to a single untrained leaf
+    void reset();
+
+    size_t getLeafCount() const;
+
+private:
+    struct SpatialNode
+    {
+        uint32_t child;    // First of the two children (0: leaf)
+        uint32_t leaf;     // Index of the leaf data
+        uint8_t axis;
+    };
+
+    struct Leaf
+    {
+        DTree sampling;
+        DTree training;
+        size_t sampleCount;
+        bool trained;
+    };
+
+    struct Record
+    {
+        float position[3];
+        float direction[3];
+        float value;
+        uint32_t leaf;
+    };
+
+    uint32_t findLeaf(const Vector3D &p) const;
+    void splitLeaf(uint32_t node);
+
+    Vector3D center;
+    double halfSize;
+    size_t spatialThreshold;
+    double directionalThreshold;
+    size_t iteration;
+
+    std::vector<SpatialNode> spatialNodes;
+    std::vector<Leaf> leaves;
+
+    // One buffer per thread of the global pool
+    std::vector<std::vector<Record>> threadRecords;
+};
+
+#endif // SDTREE_H
@@ -0,0 +1,127 @@
+#include "sequencerenderer.h"
+#include "compiledscene.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+}
+
+SequenceRenderer::SequenceRenderer(const Settings &settings_) :
+    settings(settings_), renderedFrames(0), heldFrames(0), recompiles(0), elapsedTime(0)
+{ }
+
+void SequenceRenderer::animate(Shape *shape, const AnimatedTransform &motion)
+{
+    tracks.push_back(Track{ shape, motion });
+}
+
+void SequenceRenderer::animateCamera(const AnimatedTransform &motion)
+{
+    cameraMotion = motion;
+}
+
+size_t SequenceRenderer::getRenderedFrames() const
+{
+    return renderedFrames;
+}
+
+size_t SequenceRenderer::getHeldFrames() const
+{
+    return heldFrames;
+}
+
+size_t SequenceRenderer::getRecompiles() const
+{
+    return recompiles;
+}
+
+double SequenceRenderer::getElapsedTime() const
+{
+    return elapsedTime;
+}
+
+double SequenceRenderer::getFrameTime(size_t frame) const
+{
+    return settings.startTime + frame / settings.frameRate;
+}
+
+bool SequenceRenderer::isHeld(double time0, double time1) const
+{
+    if (!cameraMotion.isStatic(time0, time1))
+        return false;
+    for (const Track &track : tracks)
+        if (!track.motion.isStatic(time0, time1))
+            return false;
+    return true;
+}
+
+std::string SequenceRenderer::getFrameFile(size_t frame) const
+{
+    char name[1024];
+    std::snprintf(name, sizeof(name), settings.outputPattern.c_str(), (int)frame);
+    return name;
+}
+
+void SequenceRenderer::setTime(double time, Camera &cam, const Matrix4x4 &restCamera,
+                               const std::vector<Shape*> &objList,
+                               const std::vector<LightSource*> &lsList)
+{
+    for (Track &track : tracks)
+        track.shape->setTransform(track.motion.evaluate(time));
+    if (cameraMotion.isAnimated())
+        cam.setCameraToWorld(cameraMotion.evaluate(time) * restCamera);
+
+    // Lights keep data of their shapes, and the compiled list their positions
+    for (LightSource *light : lsList)
+        light->refresh();
+    if (!tracks.empty() && !CompiledScene::refit(objList))
+        recompiles++;
+}
+
+size_t SequenceRenderer::render(Camera &cam, Shader &shader, Film &film,
+                                const std::vector<Shape*> &objList,
+                                const std::vector<LightSource*> &lsList)
+{
+    Clock::time_point start = Clock::now();
+    renderedFrames = 0;
+    heldFrames = 0;
+    recompiles = 0;
+    Matrix4x4 restCamera = cam.cameraToWorld;
+
+    size_t saved = 0;
+    for (size_t frame = 0; frame < settings.frameCount; frame++) {
+        double time = getFrameTime(frame);
+        std::string file = getFrameFile(frame);
+        std::cout << "\nFrame " << frame << " (t = " << time << " s) -> " << file << std::endl;
+
+        // 1. Nothing moved: the film already holds this frame
+        if (frame > 0 && isHeld(getFrameTime(frame - 1), time))
+            heldFrames++;
+        // 2. Move the scene and render
+        else {
+            setTime(time, cam, restCamera, objList, lsList);
+            shader.beginFrame();
+            ProgressiveRenderer renderer(settings.frame);
+            renderer.render(cam, shader, film, objList, lsList);
+            renderedFrames++;
+        }
+        if (film.saveEXR(file))
+            saved++;
+    }
+
+    // Back to the rest pose
+    for (Track &track : tracks)
+        track.shape->setTransform(Matrix4x4());
+    cam.setCameraToWorld(restCamera);
+    for (LightSource *light : lsList)
+        light->refresh();
+    if (!tracks.empty())
+        CompiledScene::refit(objList);
+
+    elapsedTime = std::chrono::duration<double>(Clock::now() - start).count();
+    return saved;
+}
@@ -0,0 +1,89 @@
+#ifndef SEQUENCERENDERER_H
+#define SEQUENCERENDERER_H
+
+#include <string>
+#include <vector>
+
+#include "animation.h"
+#include "film.h"
+#include "progressiverenderer.h"
+#include "../cameras/camera.h"
+#include "../lightsources/lightsource.h"
+#include "../shaders/shader.h"
+#include "../shapes/shape.h"
+
+/**
+ * @brief The SequenceRenderer class
+ *
+ * Renders the frames of an animation (shapes and camera moved by
+ * AnimatedTransforms) in one process, each with the progressive renderer,
+ * and saves them as numbered EXR files.
+ *
+ * Everything built for the first frame is kept for the next ones: the scene
+ * and its arena, the threads, the film, the shader, and the compiled object
+ * list, which is refitted to the new positions (CompiledScene::refit())
+ * instead of compiled again. The data the shader learned from the scene
+ * (irradiance cache, guiding tree) is dropped before every rendered frame
+ * (Shader::beginFrame()). Frames where nothing moves since the previous
+ * one are not rendered again: the image of the previous frame is saved.
+ *
+ * All the frames use the same sample seeds, so the noise does not flicker.
+ */
+class SequenceRenderer
+{
+public:
+    struct Settings
+    {
+        double startTime = 0;           // Seconds
+        double frameRate = 24;
+        size_t frameCount = 1;
+        ProgressiveRenderer::Settings frame;
+        std::string outputPattern = "frame_%04d.exr";  // printf pattern of the frame number
+    };
+
+    SequenceRenderer() = delete;
+    explicit SequenceRenderer(const Settings &settings_);
+
+    // Motion of a shape or of the camera, relative to their pose when
+    // render() starts (which is restored at the end)
+    void animate(Shape *shape, const AnimatedTransform &motion);
+    void animateCamera(const AnimatedTransform &motion);
+
+    // Returns the number of frames saved
+    size_t render(Camera &cam, Shader &shader, Film &film,
+                  const std::vector<Shape*> &objList,
+                  const std::vector<LightSource*> &lsList);
+
+    // Statistics of the last render
+    size_t getRenderedFrames() const;   // Frames actually rendered
+    size_t getHeldFrames() const;       // Frames copied from the previous one
+    size_t getRecompiles() const;       // Times the object list could not be refitted
+    double getElapsedTime() const;      // Seconds
+
+private:
+    struct Track
+    {
+        Shape *shape;
+        AnimatedTransform motion;
+    };
+
+    double getFrameTime(size_t frame) const;
+    // Whether nothing moves between two times
+    bool isHeld(double time0, double time1) const;
+    // Move the shapes and the camera to time
+    void setTime(double time, Camera &cam, const Matrix4x4 &restCamera,
+                 const std::vector<Shape*> &objList,
+                 const std::vector<LightSource*> &lsList);
+    std::string getFrameFile(size_t frame) const;
+
+    Settings settings;
+    std::vector<Track> tracks;
+    AnimatedTransform cameraMotion;
+
+    size_t renderedFrames;
+    size_t heldFrames;
+    size_t recompiles;
+    double elapsedTime;
+};
+
+#endif // SEQUENCERENDERER_H
@@ -0,0 +1,154 @@
+#include "tilefilm.h"
+#include "film.h"
+#include "imageoutput.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // Little-endian values, as the rest of the binary files of the renderer
+    template <typename T>
+    void put(std::vector<unsigned char> &out, T value)
+    {
+        size_t at = out.size();
+        out.resize(at + sizeof(T));
+        std::memcpy(&out[at], &value, sizeof(T));
+    }
+}
+
+TileFilm::TileFilm(size_t width_, size_t height_, size_t tileSize_) :
+    width(width_), height(height_), tileSize(std::max<size_t>(tileSize_, 1)),
+    file(nullptr), compressed(true), failed(false), tableOffset(0), fileSize(0)
+{
+    tilesX = (width + tileSize - 1) / tileSize;
+    tilesY = (height + tileSize - 1) / tileSize;
+}
+
+TileFilm::~TileFilm()
+{
+    if (file)
+        fclose(file);
+}
+
+size_t TileFilm::getWidth() const
+{
+    return width;
+}
+
+size_t TileFilm::getHeight() const
+{
+    return height;
+}
+
+size_t TileFilm::getTileSize() const
+{
+    return tileSize;
+}
+
+size_t TileFilm::getTileCount() const
+{
+    return tilesX * tilesY;
+}
+
+uint64_t TileFilm::getFileSize() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return fileSize;
+}
+
+bool TileFilm::open(const std::string &filename, bool compress)
+{
+    if (file)
+        fclose(file);
+    file = fopen(filename.c_str(), "wb");
+    if (!file)
+        return false;
+    compressed = compress;
+    failed = false;
+    fileSize = 0;
+    tileOffsets.assign(getTileCount(), 0);
+    writeHeader();
+    return !failed;
+}
+
+void TileFilm::writeHeader()
+{
+    std::vector<unsigned char> header = ImageOutput::exrHeader(width, height,
+        compressed ? ImageOutput::ZIP_COMPRESSION : ImageOutput::NO_COMPRESSION, tileSize);
+
+    // Offset table, filled by close()
+    tableOffset = header.size();
+    header.resize(header.size() + getTileCount() * sizeof(uint64_t), 0);
+
+    failed = fwrite(header.data(), 1, header.size(), file) != header.size();
+    fileSize = header.size();
+}
+
+TileFilm::Tile TileFilm::beginTile(size_t index) const
+{
+    Tile tile;
+    tile.tileX = index % tilesX;
+    tile.tileY = index / tilesX;
+    tile.x0 = tile.tileX * tileSize;
+    tile.y0 = tile.tileY * tileSize;
+    tile.width = std::min(tileSize, width - tile.x0);
+    tile.height = std::min(tileSize, height - tile.y0);
+    tile.pixels.assign(tile.width * tile.height, Vector3D(0.0));
+    return tile;
+}
+
+bool TileFilm::writeTile(const Tile &tile)
+{
+    // 1. Channels line by line (B, G, R lines of every row)
+    std::vector<unsigned char> raw;
+    raw.reserve(tile.width * tile.height * 3 * sizeof(float));
+    for (size_t j = 0; j < tile.height; j++) {
+        const Vector3D *row = &tile.pixels[j * tile.width];
+        for (size_t i = 0; i < tile.width; i++)
+            put<float>(raw, (float)row[i].z);
+        for (size_t i = 0; i < tile.width; i++)
+            put<float>(raw, (float)row[i].y);
+        for (size_t i = 0; i < tile.width; i++)
+            put<float>(raw, (float)row[i].x);
+    }
+    std::vector<unsigned char> packed;
+    if (compressed)
+        compressEXRZip(raw.data(), raw.size(), packed);
+    const std::vector<unsigned char> &data = compressed ? packed : raw;
+
+    // 2. Chunk: tile and level coordinates, data size and data
+    std::vector<unsigned char> chunk;
+    chunk.reserve(data.size() + 5 * sizeof(int32_t));
+    put<int32_t>(chunk, (int32_t)tile.tileX);
+    put<int32_t>(chunk, (int32_t)tile.tileY);
+    put<int32_t>(chunk, 0);
+    put<int32_t>(chunk, 0);
+    put<int32_t>(chunk, (int32_t)data.size());
+    chunk.insert(chunk.end(), data.begin(), data.end());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file || failed)
+        return false;
+    if (fwrite(chunk.data(), 1, chunk.size(), file) != chunk.size()) {
+        failed = true;
+        return false;
+    }
+    tileOffsets[tile.tileY * tilesX + tile.tileX] = fileSize;
+    fileSize += chunk.size();
+    return true;
+}
+
+bool TileFilm::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file)
+        return false;
+    bool complete = std::find(tileOffsets.begin(), tileOffsets.end(), 0) == tileOffsets.end();
+    bool ok = !failed
+        && fseek(file, (long)tableOffset, SEEK_SET) == 0
+        && fwrite(tileOffsets.data(), sizeof(uint64_t), tileOffsets.size(), file) == tileOffsets.size();
+    ok = (fclose(file) == 0) && ok;
+    file = nullptr;
+    return ok && complete;
+}
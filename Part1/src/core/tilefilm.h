@@ -0,0 +1,86 @@
+#ifndef TILEFILM_H
+#define TILEFILM_H
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "vector3d.h"
+
+/**
+ * @brief The TileFilm class
+ *
+ * Film for images too large to keep in memory: the image is split in
+ * square tiles that are written, as soon as they are finished, into a tiled
+ * EXR file (32-bit float RGB, as Film::saveEXR(), ZIP compressed or not).
+ * Only the tiles being rendered are in memory, one per worker thread (see
+ * TileRenderer).
+ *
+ * The header and a table with the offset of every tile are written by
+ * open(); the tiles follow in the order they are finished and close() fills
+ * the table. Pixel rows are camera lines, from the top of the image down,
+ * as Film::saveEXR() stores them.
+ */
+class TileFilm
+{
+public:
+    // Pixels of a tile, row by row
+    struct Tile
+    {
+        size_t tileX = 0, tileY = 0;    // Tile coordinates
+        size_t x0 = 0, y0 = 0;          // First pixel in the EXR
+        size_t width = 0, height = 0;   // Smaller than the tile size at the borders
+        std::vector<Vector3D> pixels;
+    };
+
+    TileFilm(size_t width_, size_t height_, size_t tileSize_ = 64);
+    TileFilm() = delete;
+    ~TileFilm();
+
+    TileFilm(const TileFilm &) = delete;
+    TileFilm& operator=(const TileFilm &) = delete;
+
+    // Getters
+    size_t getWidth() const;
+    size_t getHeight() const;
+    size_t getTileSize() const;
+    size_t getTileCount() const;
+
+    // Create the file (false if it can not be written)
+    bool open(const std::string &filename, bool compress = true);
+    // Bounds of a tile (index in row-major order) with its pixel buffer
+    Tile beginTile(size_t index) const;
+    // Encode and append a finished tile. Thread-safe: tiles are compressed
+    // in parallel and only the write to the file is serialized
+    bool writeTile(const Tile &tile);
+    // Write the offset table and close the file. false if a write failed or
+    // a tile is missing (the file is not a valid EXR then)
+    bool close();
+
+    // Bytes written to the file so far
+    uint64_t getFileSize() const;
+
+private:
+    void writeHeader();
+
+    // Image size
+    size_t width;
+    size_t height;
+    size_t tileSize;
+    size_t tilesX;
+    size_t tilesY;
+
+    // Output file, the position of its offset table and the offsets found
+    // (0 for the tiles not written yet)
+    FILE *file;
+    bool compressed;
+    bool failed;
+    uint64_t tableOffset;
+    uint64_t fileSize;
+    std::vector<uint64_t> tileOffsets;
+    mutable std::mutex mutex;
+};
+
+#endif // TILEFILM_H
@@ -0,0 +1,97 @@
+#include "tilerenderer.h"
+#include "parallel.h"
+#include "random.h"
+#include "utils.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+}
+
+TileRenderer::TileRenderer(const Settings &settings_) :
+    settings(settings_), elapsedTime(0), fileSize(0)
+{ }
+
+double TileRenderer::getElapsedTime() const
+{
+    return elapsedTime;
+}
+
+uint64_t TileRenderer::getFileSize() const
+{
+    return fileSize;
+}
+
+void TileRenderer::renderTile(const Camera &cam, const Shader &shader, TileFilm::Tile &tile,
+                              size_t width, size_t height,
+                              const std::vector<Shape*> &objList,
+                              const std::vector<LightSource*> &lsList) const
+{
+    for (size_t j = 0; j < tile.height; j++) {
+        size_t lin = tile.y0 + j;
+        for (size_t i = 0; i < tile.width; i++) {
+            size_t col = tile.x0 + i;
+            Vector3D &pixel = tile.pixels[j * tile.width + i];
+            // Same samples and running mean as ProgressiveRenderer
+            for (size_t pass = 0; pass < settings.spp; pass++) {
+                Random::seed(Random::hash(col, lin, pass));
+                double x = (col + Random::uniform()) / width;
+                double y = (lin + Random::uniform()) / height;
+                Ray cameraRay = cam.generateRay(x, y);
+                Vector3D value = shader.computeColor(cameraRay, objList, lsList);
+                if (pass == 0)
+                    pixel = value;
+                else
+                    pixel += (value - pixel) / double(pass + 1);
+            }
+        }
+    }
+}
+
+bool TileRenderer::render(const Camera &cam, Shader &shader, size_t width, size_t height,
+                          const std::string &filename,
+                          const std::vector<Shape*> &objList,
+                          const std::vector<LightSource*> &lsList)
+{
+    Clock::time_point start = Clock::now();
+    elapsedTime = 0;
+    fileSize = 0;
+
+    TileFilm film(width, height, settings.tileSize);
+    if (width == 0 || height == 0 || !film.open(filename, settings.compress)) {
+        std::cout << "Could not write " << filename << std::endl;
+        return false;
+    }
+
+    shader.beginPass(0, objList, lsList);
+
+    // One tile per chunk: a worker holds the buffer of its current tile only
+    size_t tileCount = film.getTileCount();
+    std::atomic<size_t> tilesDone(0);
+    std::atomic<bool> failed(false);
+    ThreadPool::global().parallelFor(tileCount, 1, [&](size_t begin, size_t end) {
+        for (size_t index = begin; index < end && !failed; index++) {
+            TileFilm::Tile tile = film.beginTile(index);
+            renderTile(cam, shader, tile, width, height, objList, lsList);
+            if (!film.writeTile(tile))
+                failed = true;
+            size_t done = ++tilesDone;
+            if (settings.showProgress && ThreadPool::getThreadIndex() == 0)
+                Utils::printProgress((double)done / tileCount);
+        }
+    });
+    if (settings.showProgress)
+        Utils::printProgress(1.0);
+
+    bool ok = film.close() && !failed;
+    fileSize = film.getFileSize();
+    elapsedTime = std::chrono::duration<double>(Clock::now() - start).count();
+    if (!ok)
+        std::cout << "\nError writing " << filename << std::endl;
+    return ok;
+}
@@ -0,0 +1,64 @@
+#ifndef TILERENDERER_H
+#define TILERENDERER_H
+
+#include <string>
+#include <vector>
+
+#include "tilefilm.h"
+#include "../cameras/camera.h"
+#include "../lightsources/lightsource.h"
+#include "../shaders/shader.h"
+#include "../shapes/shape.h"
+
+/**
+ * @brief The TileRenderer class
+ *
+ * Renders a TileFilm tile by tile: every worker thread takes the next tile,
+ * takes all its samples per pixel and hands it to the film, which writes it
+ * to the EXR. Memory stays bounded by the number of threads times the size
+ * of a tile, whatever the size of the image.
+ *
+ * Pixels are seeded as in ProgressiveRenderer (coordinates and pass), so a
+ * tiled render gives the image of a progressive render with the same
+ * samples per pixel. The shader gets a single beginPass() call: integrators
+ * that rebuild data every pass (photon maps) keep the data of pass 0, and
+ * light tracing splats (BDPT) are not supported.
+ */
+class TileRenderer
+{
+public:
+    struct Settings
+    {
+        size_t spp = 1;             // Samples per pixel
+        size_t tileSize = 64;       // Pixels per side
+        bool compress = true;       // ZIP compression of the tiles
+        bool showProgress = true;   // Progress bar on the standard output
+    };
+
+    TileRenderer() = delete;
+    explicit TileRenderer(const Settings &settings_);
+
+    // Render an image of width x height pixels into an EXR file. The camera
+    // only uses its film for the aspect ratio, which must be the same.
+    // false if the file can not be written
+    bool render(const Camera &cam, Shader &shader, size_t width, size_t height,
+                const std::string &filename,
+                const std::vector<Shape*> &objList,
+                const std::vector<LightSource*> &lsList);
+
+    // Statistics of the last render
+    double getElapsedTime() const;  // Seconds
+    uint64_t getFileSize() const;   // Bytes
+
+private:
+    void renderTile(const Camera &cam, const Shader &shader, TileFilm::Tile &tile,
+                    size_t width, size_t height,
+                    const std::vector<Shape*> &objList,
+                    const std::vector<LightSource*> &lsList) const;
+
+    Settings settings;
+    double elapsedTime;
+    uint64_t fileSize;
+};
+
+#endif // TILERENDERER_H
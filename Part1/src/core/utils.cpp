@@ -1,8 +1,21 @@
 #include "utils.h"
+#include "compiledscene.h"
+
+#include <algorithm>
+
+namespace
+{
+    thread_local RayCounters rayCounters;
+}
 
 Utils::Utils()
 { }
 
+RayCounters& Utils::getRayCounters()
+{
+    return rayCounters;
+}
+
 double Utils::degreesToRadians(double degrees)
 {
     return degrees * M_PI / 180.0;
@@ -12,6 +25,14 @@ double Utils::degreesToRadians(double degrees)
 
 bool Utils::hasIntersection(const Ray& cameraRay, const std::vector<Shape*>& objectsList) //or Shadow Ray
 {
+    if (rayCounters.enabled) {
+        rayCounters.shadowRays++;
+        rayCounters.maxDepth = std::max(rayCounters.maxDepth, cameraRay.depth);
+    }
+
+    // Small scenes: flat SIMD copy of the list
+    if (const CompiledScene *compiled = CompiledScene::get(objectsList))
+        return compiled->anyHit(cameraRay);
 
     // For each object on the scene...
     for(size_t objIndex = 0; objIndex < objectsList.size(); objIndex ++)
@@ -31,6 +52,14 @@ bool Utils::getClosestIntersection(const Ray& cameraRay, const std::vector<Shape
 {
     //std::cout << "Need to implement the function Utils::getClosestIntersection() in the file utils.cpp" << std::endl;
 
+    if (rayCounters.enabled) {
+        rayCounters.closestRays++;
+        rayCounters.maxDepth = std::max(rayCounters.maxDepth, cameraRay.depth);
+    }
+
+    if (const CompiledScene *compiled = CompiledScene::get(objectsList))
+        return compiled->closestHit(cameraRay, its);
+
     bool hasIntersection = false;
 
     for (size_t objIndex = 0; objIndex < objectsList.size(); objIndex++)
@@ -91,3 +120,25 @@ Vector3D Utils::computeReflectionDirection(const Vector3D &Direction, const Vect
     return wr;
 }
 
+Vector3D Utils::computeSpecularDirection(const Material &material, const Vector3D &normal, const Vector3D &wo)
+{
+    Vector3D n = normal;
+    if (material.hasSpecular())
+        return (2 * dot(wo, n) * n - wo).normalized();
+
+    // Refraction, with the same conventions as the recursive integrators
+    double n_i = 1.0;
+    double n_t = material.getIndexOfRefraction();
+    double mu;
+    if (dot(wo, n) < 0) {
+        n = -n;
+        mu = n_i / n_t;
+    }
+    else mu = n_t / n_i;
+
+    double discr = 1.0 - (mu * mu) * (1.0 - dot(n, wo) * dot(n, wo));
+    // Total internal reflection
+    if (discr < 0)
+        return (2 * dot(wo, n) * n - wo).normalized();
+    return (-mu * wo + n * (mu * dot(n, wo) - sqrt(discr))).normalized();
+}
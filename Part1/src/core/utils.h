@@ -4,6 +4,7 @@
 #define _USE_MATH_DEFINES
 
 #include <cmath>
+#include <cstdint>
 #include <vector>
 
 #include "ray.h"
@@ -13,6 +14,18 @@
 #define PBSTR "||||||||||||||||||||||||||||||||||||||||||||||||||||||||||||"
 #define PBWIDTH 60
 
+// Rays traced by the calling thread (see Utils::getRayCounters()). Only
+// counted while enabled, so renders that are not profiled do not pay for it
+struct RayCounters
+{
+    bool enabled = false;
+    uint64_t closestRays = 0;   // getClosestIntersection()
+    uint64_t shadowRays = 0;    // hasIntersection()
+    size_t maxDepth = 0;        // Deepest ray traced
+
+    uint64_t getRays() const { return closestRays + shadowRays; }
+};
+
 class Utils
 {
 public:
@@ -21,11 +34,18 @@ public:
     static bool getClosestIntersection(const Ray &cameraRay, const std::vector<Shape*> &objectsList, Intersection &its);
     static bool hasIntersection(const Ray &ray, const std::vector<Shape*> &objectsList);
     static Vector3D scalarToRGB(double scalar);
+
+    // Counters of the calling thread, updated by the intersection queries
+    // above once enabled; a profiler enables and resets them before a pixel
+    // and reads them after it
+    static RayCounters& getRayCounters();
     static double degreesToRadians(double degrees);
 
 
 
     static Vector3D computeReflectionDirection(const Vector3D &Direction, const Vector3D &normal);
+    // Direction leaving a mirror or transmissive surface (wo points away from it)
+    static Vector3D computeSpecularDirection(const Material &material, const Vector3D &normal, const Vector3D &wo);
 
 
 
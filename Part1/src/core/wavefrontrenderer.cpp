@@ -0,0 +1,751 @@
+#include "wavefrontrenderer.h"
+#include "compiledscene.h"
+#include "hemisphericalsampler.h"
+#include "parallel.h"
+#include "random.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define WAVEFRONT_X86
+#include <immintrin.h>
+#endif
+
+#if defined(WAVEFRONT_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define TARGET_AVX2
+#endif
+
+namespace
+{
+    // Number of paths processed by one task of the thread pool
+    const size_t CHUNK_SIZE = 1024;
+
+    // Material id of the paths whose ray escaped the scene
+    const uint32_t NO_HIT = UINT32_MAX;
+
+    typedef std::chrono::steady_clock Clock;
+
+    double secondsSince(const Clock::time_point &start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // Stage identifiers used to decorrelate the random streams
+    enum Stage
+    {
+        STAGE_GENERATE,
+        STAGE_SHADE_DIFFUSE
+    };
+
+    // Paths shaded together by the packet kernels (one AVX2 register)
+    const size_t LANES = 8;
+
+    // Reflectance queries of a packet of paths: material, unit normal, wo
+    // and wi of every lane, and the result
+    struct ReflectancePacket
+    {
+        alignas(32) int32_t id[LANES];
+        alignas(32) float nx[LANES];
+        alignas(32) float ny[LANES];
+        alignas(32) float nz[LANES];
+        alignas(32) float wox[LANES];
+        alignas(32) float woy[LANES];
+        alignas(32) float woz[LANES];
+        alignas(32) float wix[LANES];
+        alignas(32) float wiy[LANES];
+        alignas(32) float wiz[LANES];
+        alignas(32) float fr[LANES];
+        alignas(32) float fg[LANES];
+        alignas(32) float fb[LANES];
+
+        void setLane(size_t j, uint32_t material, const Vector3D &n, const Vector3D &wo)
+        {
+            id[j] = (int32_t)material;
+            nx[j] = n.x; ny[j] = n.y; nz[j] = n.z;
+            wox[j] = wo.x; woy[j] = wo.y; woz[j] = wo.z;
+        }
+
+        void setDirection(size_t j, const Vector3D &wi)
+        {
+            wix[j] = wi.x; wiy[j] = wi.y; wiz[j] = wi.z;
+        }
+
+        // Unused lanes repeat the first one, so the kernels read valid data
+        void pad(size_t lanes)
+        {
+            for (size_t j = lanes; j < LANES; j++) {
+                setLane(j, id[0], Vector3D(nx[0], ny[0], nz[0]), Vector3D(wox[0], woy[0], woz[0]));
+                setDirection(j, Vector3D(wix[0], wiy[0], wiz[0]));
+            }
+        }
+
+        // Reflectance of one lane through MaterialTable::getReflectance()
+        void evaluateLane(const MaterialTable &materials, size_t j)
+        {
+            Vector3D f = materials.getReflectance((uint32_t)id[j], Vector3D(nx[j], ny[j], nz[j]),
+                                                  Vector3D(wox[j], woy[j], woz[j]),
+                                                  Vector3D(wix[j], wiy[j], wiz[j]));
+            fr[j] = f.x; fg[j] = f.y; fb[j] = f.z;
+        }
+    };
+
+    // Arrays of the path states moved by the specular stages
+    struct SpecularPaths
+    {
+        float *ox, *oy, *oz;
+        float *dx, *dy, *dz;
+        const float *px, *py, *pz;
+        const float *nx, *ny, *nz;
+        const uint32_t *material;
+        uint32_t *depth;
+        uint8_t *specular;
+    };
+
+    // 1. Scalar kernels, for CPUs without AVX2 and the end of the queues
+
+    void mirrorScalar(const SpecularPaths &s, const uint32_t *queue, size_t begin, size_t end)
+    {
+        for (size_t k = begin; k < end; k++)
+        {
+            uint32_t i = queue[k];
+            // Perfect reflection: wr = 2 (wo . n) n - wo = d - 2 (d . n) n
+            float nx = s.nx[i], ny = s.ny[i], nz = s.nz[i];
+            float dn = s.dx[i] * nx + s.dy[i] * ny + s.dz[i] * nz;
+
+            s.dx[i] -= 2 * dn * nx;
+            s.dy[i] -= 2 * dn * ny;
+            s.dz[i] -= 2 * dn * nz;
+            s.ox[i] = s.px[i]; s.oy[i] = s.py[i]; s.oz[i] = s.pz[i];
+            // Unlike the recursive integrators, specular bounces also count
+            // towards the maximum depth so mirror loops always terminate
+            s.depth[i]++;
+            s.specular[i] = 1;
+        }
+    }
+
+    void transmissiveScalar(const SpecularPaths &s, const float *ior, const uint32_t *queue,
+                            size_t begin, size_t end)
+    {
+        for (size_t k = begin; k < end; k++)
+        {
+            uint32_t i = queue[k];
+            Vector3D wo = -Vector3D(s.dx[i], s.dy[i], s.dz[i]);
+            Vector3D n(s.nx[i], s.ny[i], s.nz[i]);
+
+            double n_i = 1.0; // Index of refraction of the medium outside the object (air)
+            double n_t = ior[s.material[i]];
+            double mu;
+
+            // Ray exiting the object: flip the normal
+            if (dot(wo, n) < 0) {
+                n = -n;
+                mu = n_i / n_t;
+            }
+            else mu = n_t / n_i;
+
+            Vector3D wt;
+            double discr = 1.0 - (mu * mu) * (1.0 - dot(n, wo) * dot(n, wo));
+            if (discr < 0)
+                wt = (2 * dot(wo, n) * n - wo).normalized(); // Total internal reflection
+            else
+                wt = (-mu * wo + n * (mu * dot(n, wo) - sqrt(discr))).normalized();
+
+            s.dx[i] = wt.x; s.dy[i] = wt.y; s.dz[i] = wt.z;
+            s.ox[i] = s.px[i]; s.oy[i] = s.py[i]; s.oz[i] = s.pz[i];
+            s.depth[i]++;
+            s.specular[i] = 1;
+        }
+    }
+
+#ifdef WAVEFRONT_X86
+    // 2. AVX2 kernels: 8 paths per iteration, gathered from the path states
+    //    through their queue indices
+
+    // f = diffuse + specular * cosR^alpha for every lane, cosR being wo
+    // against wi mirrored about n. The power is taken lane by lane, only
+    // where the glossy lobe is seen
+    TARGET_AVX2 void reflectanceAVX2(const MaterialTable::Arrays &m, ReflectancePacket &q)
+    {
+        __m256i id = _mm256_load_si256((const __m256i*)q.id);
+        __m256 nx = _mm256_load_ps(q.nx), ny = _mm256_load_ps(q.ny), nz = _mm256_load_ps(q.nz);
+        __m256 wix = _mm256_load_ps(q.wix), wiy = _mm256_load_ps(q.wiy), wiz = _mm256_load_ps(q.wiz);
+        __m256 zero = _mm256_setzero_ps();
+
+        // wi mirrored about n: 2 (n . wi) n - wi
+        __m256 dn = _mm256_fmadd_ps(nz, wiz, _mm256_fmadd_ps(ny, wiy, _mm256_mul_ps(nx, wix)));
+        __m256 dn2 = _mm256_add_ps(dn, dn);
+        __m256 rx = _mm256_fmsub_ps(dn2, nx, wix);
+        __m256 ry = _mm256_fmsub_ps(dn2, ny, wiy);
+        __m256 rz = _mm256_fmsub_ps(dn2, nz, wiz);
+        __m256 cosR = _mm256_fmadd_ps(_mm256_load_ps(q.woz), rz,
+                      _mm256_fmadd_ps(_mm256_load_ps(q.woy), ry, _mm256_mul_ps(_mm256_load_ps(q.wox), rx)));
+
+        __m256 sr = _mm256_i32gather_ps(m.sr.data(), id, 4);
+        __m256 sg = _mm256_i32gather_ps(m.sg.data(), id, 4);
+        __m256 sb = _mm256_i32gather_ps(m.sb.data(), id, 4);
+        __m256 seen = _mm256_and_ps(_mm256_cmp_ps(cosR, zero, _CMP_GT_OQ),
+                                    _mm256_cmp_ps(_mm256_add_ps(_mm256_add_ps(sr, sg), sb), zero, _CMP_GT_OQ));
+
+        alignas(32) float lobe[LANES];
+        _mm256_store_ps(lobe, cosR);
+        int bits = _mm256_movemask_ps(seen);
+        for (size_t j = 0; j < LANES; j++)
+            lobe[j] = (bits >> j) & 1 ? std::pow(lobe[j], m.alpha[q.id[j]]) : 0.0f;
+        __m256 l = _mm256_load_ps(lobe);
+
+        _mm256_store_ps(q.fr, _mm256_fmadd_ps(sr, l, _mm256_i32gather_ps(m.dr.data(), id, 4)));
+        _mm256_store_ps(q.fg, _mm256_fmadd_ps(sg, l, _mm256_i32gather_ps(m.dg.data(), id, 4)));
+        _mm256_store_ps(q.fb, _mm256_fmadd_ps(sb, l, _mm256_i32gather_ps(m.db.data(), id, 4)));
+    }
+
+    // Each returns the first queue entry it left to the scalar kernel
+    TARGET_AVX2 size_t mirrorAVX2(const SpecularPaths &s, const uint32_t *queue, size_t begin, size_t end)
+    {
+        size_t k = begin;
+        for (; k + LANES <= end; k += LANES) {
+            __m256i idx = _mm256_loadu_si256((const __m256i*)(queue + k));
+            __m256 dx = _mm256_i32gather_ps(s.dx, idx, 4), dy = _mm256_i32gather_ps(s.dy, idx, 4);
+            __m256 dz = _mm256_i32gather_ps(s.dz, idx, 4);
+            __m256 nx = _mm256_i32gather_ps(s.nx, idx, 4), ny = _mm256_i32gather_ps(s.ny, idx, 4);
+            __m256 nz = _mm256_i32gather_ps(s.nz, idx, 4);
+
+            // d - 2 (d . n) n
+            __m256 dn = _mm256_fmadd_ps(dz, nz, _mm256_fmadd_ps(dy, ny, _mm256_mul_ps(dx, nx)));
+            __m256 dn2 = _mm256_add_ps(dn, dn);
+            alignas(32) float rx[LANES], ry[LANES], rz[LANES];
+            _mm256_store_ps(rx, _mm256_fnmadd_ps(dn2, nx, dx));
+            _mm256_store_ps(ry, _mm256_fnmadd_ps(dn2, ny, dy));
+            _mm256_store_ps(rz, _mm256_fnmadd_ps(dn2, nz, dz));
+
+            for (size_t j = 0; j < LANES; j++) {
+                uint32_t i = queue[k + j];
+                s.dx[i] = rx[j]; s.dy[i] = ry[j]; s.dz[i] = rz[j];
+                s.ox[i] = s.px[i]; s.oy[i] = s.py[i]; s.oz[i] = s.pz[i];
+                s.depth[i]++;
+                s.specular[i] = 1;
+            }
+        }
+        return k;
+    }
+
+    TARGET_AVX2 size_t transmissiveAVX2(const SpecularPaths &s, const float *ior, const uint32_t *queue,
+                                        size_t begin, size_t end)
+    {
+        __m256 zero = _mm256_setzero_ps();
+        __m256 one = _mm256_set1_ps(1.0f);
+
+        size_t k = begin;
+        for (; k + LANES <= end; k += LANES) {
+            __m256i idx = _mm256_loadu_si256((const __m256i*)(queue + k));
+            __m256 wox = _mm256_sub_ps(zero, _mm256_i32gather_ps(s.dx, idx, 4));
+            __m256 woy = _mm256_sub_ps(zero, _mm256_i32gather_ps(s.dy, idx, 4));
+            __m256 woz = _mm256_sub_ps(zero, _mm256_i32gather_ps(s.dz, idx, 4));
+            __m256 nx = _mm256_i32gather_ps(s.nx, idx, 4), ny = _mm256_i32gather_ps(s.ny, idx, 4);
+            __m256 nz = _mm256_i32gather_ps(s.nz, idx, 4);
+            __m256i material = _mm256_i32gather_epi32((const int*)s.material, idx, 4);
+            __m256 n_t = _mm256_i32gather_ps(ior, material, 4);
+
+            // Ray exiting the object: flip the normal (same ratios as the
+            // scalar kernel)
+            __m256 cosO = _mm256_fmadd_ps(woz, nz, _mm256_fmadd_ps(woy, ny, _mm256_mul_ps(wox, nx)));
+            __m256 exiting = _mm256_cmp_ps(cosO, zero, _CMP_LT_OQ);
+            nx = _mm256_blendv_ps(nx, _mm256_sub_ps(zero, nx), exiting);
+            ny = _mm256_blendv_ps(ny, _mm256_sub_ps(zero, ny), exiting);
+            nz = _mm256_blendv_ps(nz, _mm256_sub_ps(zero, nz), exiting);
+            __m256 c = _mm256_blendv_ps(cosO, _mm256_sub_ps(zero, cosO), exiting);
+            __m256 mu = _mm256_blendv_ps(n_t, _mm256_div_ps(one, n_t), exiting);
+
+            // Refracted direction, or the reflected one past the critical angle
+            __m256 discr = _mm256_fnmadd_ps(_mm256_mul_ps(mu, mu), _mm256_fnmadd_ps(c, c, one), one);
+            __m256 reflected = _mm256_cmp_ps(discr, zero, _CMP_LT_OQ);
+            __m256 c2 = _mm256_add_ps(c, c);
+            __m256 k_t = _mm256_sub_ps(_mm256_mul_ps(mu, c), _mm256_sqrt_ps(_mm256_max_ps(discr, zero)));
+            __m256 wtx = _mm256_blendv_ps(_mm256_fmsub_ps(nx, k_t, _mm256_mul_ps(mu, wox)),
+                                          _mm256_fmsub_ps(c2, nx, wox), reflected);
+            __m256 wty = _mm256_blendv_ps(_mm256_fmsub_ps(ny, k_t, _mm256_mul_ps(mu, woy)),
+                                          _mm256_fmsub_ps(c2, ny, woy), reflected);
+            __m256 wtz = _mm256_blendv_ps(_mm256_fmsub_ps(nz, k_t, _mm256_mul_ps(mu, woz)),
+                                          _mm256_fmsub_ps(c2, nz, woz), reflected);
+            __m256 len = _mm256_sqrt_ps(_mm256_fmadd_ps(wtz, wtz, _mm256_fmadd_ps(wty, wty, _mm256_mul_ps(wtx, wtx))));
+
+            alignas(32) float tx[LANES], ty[LANES], tz[LANES];
+            _mm256_store_ps(tx, _mm256_div_ps(wtx, len));
+            _mm256_store_ps(ty, _mm256_div_ps(wty, len));
+            _mm256_store_ps(tz, _mm256_div_ps(wtz, len));
+
+            for (size_t j = 0; j < LANES; j++) {
+                uint32_t i = queue[k + j];
+                s.dx[i] = tx[j]; s.dy[i] = ty[j]; s.dz[i] = tz[j];
+                s.ox[i] = s.px[i]; s.oy[i] = s.py[i]; s.oz[i] = s.pz[i];
+                s.depth[i]++;
+                s.specular[i] = 1;
+            }
+        }
+        return k;
+    }
+#endif
+
+    // Reflectance of the first lanes of a packet
+    void evaluateReflectance(const MaterialTable &materials, ReflectancePacket &q, size_t lanes)
+    {
+#ifdef WAVEFRONT_X86
+        if (CompiledScene::usesAVX2()) {
+            const MaterialTable::Arrays &m = materials.getArrays();
+            q.pad(lanes);
+            reflectanceAVX2(m, q);
+            // Materials only their virtuals can evaluate
+            for (size_t j = 0; j < lanes; j++)
+                if (m.other[q.id[j]])
+                    q.evaluateLane(materials, j);
+            return;
+        }
+#endif
+        for (size_t j = 0; j < lanes; j++)
+            q.evaluateLane(materials, j);
+    }
+}
+
+void WavefrontRenderer::PathStates::resize(size_t n)
+{
+    for (std::vector<float>* v : { &ox, &oy, &oz, &dx, &dy, &dz,
+                                   &tr, &tg, &tb, &lr, &lg, &lb,
+                                   &px, &py, &pz, &nx, &ny, &nz })
+        v->resize(n);
+    material.resize(n);
+    depth.resize(n);
+    specular.resize(n);
+}
+
+void WavefrontRenderer::ShadowQueue::resize(size_t n)
+{
+    for (std::vector<float>* v : { &ox, &oy, &oz, &dx, &dy, &dz,
+                                   &dist, &cr, &cg, &cb })
+        v->resize(n);
+    visible.resize(n);
+}
+
+WavefrontRenderer::WavefrontRenderer(Vector3D bgColor_, size_t samplesPerPixel_,
+                                     size_t maxDepth_, size_t maxPathsInFlight_) :
+    bgColor(bgColor_), samplesPerPixel(std::max<size_t>(1, samplesPerPixel_)),
+    maxDepth(maxDepth_), maxPathsInFlight(maxPathsInFlight_),
+    sorter(RaySorter::NONE), batchIndex(0), bounce(0), rayCount(0),
+    shadowRayCount(0), traceTime(0), sortTime(0)
+{
+    // A batch always holds whole pixels
+    maxPathsInFlight = std::max(maxPathsInFlight, samplesPerPixel);
+    maxPathsInFlight -= maxPathsInFlight % samplesPerPixel;
+}
+
+void WavefrontRenderer::setRaySorting(RaySorter::Mode mode)
+{
+    sorter = RaySorter(mode);
+}
+
+size_t WavefrontRenderer::getRayCount() const
+{
+    return rayCount;
+}
+
+size_t WavefrontRenderer::getShadowRayCount() const
+{
+    return shadowRayCount;
+}
+
+double WavefrontRenderer::getTraceTime() const
+{
+    return traceTime;
+}
+
+double WavefrontRenderer::getSortTime() const
+{
+    return sortTime;
+}
+
+void WavefrontRenderer::seedChunk(size_t stage, size_t begin) const
+{
+    Random::seed(Random::hash(batchIndex, bounce, begin), stage);
+}
+
+void WavefrontRenderer::render(const Camera &cam, Film &film,
+                               const std::vector<Shape*> &objList,
+                               const std::vector<LightSource*> &lsList)
+{
+    size_t width = film.getWidth();
+    size_t height = film.getHeight();
+    size_t totalPaths = width * height * samplesPerPixel;
+
+    materials.build(objList);
+    paths.resize(std::min(maxPathsInFlight, totalPaths));
+    kind.resize(paths.depth.size());
+    rayCount = 0;
+    shadowRayCount = 0;
+    traceTime = 0;
+    sortTime = 0;
+
+    // Process the image in batches of whole pixels
+    batchIndex = 0;
+    for (size_t firstPath = 0; firstPath < totalPaths; firstPath += maxPathsInFlight, batchIndex++)
+    {
+        Utils::printProgress((double)firstPath / totalPaths);
+
+        size_t nPaths = std::min(maxPathsInFlight, totalPaths - firstPath);
+        size_t firstPixel = firstPath / samplesPerPixel;
+
+        bounce = 0;
+        generate(cam, width, height, firstPixel, nPaths);
+
+        while (!active.empty())
+        {
+            // Camera rays are already coherent, only the bounces are binned
+            if (bounce > 0)
+                sortRays();
+            extend(objList);
+            classify();
+            shadeDiffuse(lsList);
+            shadeMirror();
+            shadeTransmissive();
+            traceShadows(objList, lsList.size());
+            bounce++;
+        }
+
+        accumulate(film, firstPixel, nPaths);
+    }
+    Utils::printProgress(1.0);
+}
+
+void WavefrontRenderer::generate(const Camera &cam, size_t width, size_t height,
+                                 size_t firstPixel, size_t nPaths)
+{
+    ThreadPool::global().parallelFor(nPaths, CHUNK_SIZE, [&](size_t begin, size_t end) {
+        seedChunk(STAGE_GENERATE, begin);
+        for (size_t i = begin; i < end; i++)
+        {
+            size_t pixel = firstPixel + i / samplesPerPixel;
+            size_t col = pixel % width;
+            size_t lin = pixel / width;
+
+            // Pixel center for one sample, jittered positions otherwise
+            double jx = 0.5, jy = 0.5;
+            if (samplesPerPixel > 1)
+            {
+                jx = Random::uniform();
+                jy = Random::uniform();
+            }
+            Ray cameraRay = cam.generateRay((col + jx) / width, (lin + jy) / height);
+
+            paths.ox[i] = cameraRay.o.x; paths.oy[i] = cameraRay.o.y; paths.oz[i] = cameraRay.o.z;
+            paths.dx[i] = cameraRay.d.x; paths.dy[i] = cameraRay.d.y; paths.dz[i] = cameraRay.d.z;
+        }
+    });
+
+    // Unit throughput, no radiance, camera rays see emission
+    std::fill_n(paths.tr.begin(), nPaths, 1.0f);
+    std::fill_n(paths.tg.begin(), nPaths, 1.0f);
+    std::fill_n(paths.tb.begin(), nPaths, 1.0f);
+    std::fill_n(paths.lr.begin(), nPaths, 0.0f);
+    std::fill_n(paths.lg.begin(), nPaths, 0.0f);
+    std::fill_n(paths.lb.begin(), nPaths, 0.0f);
+    std::fill_n(paths.depth.begin(), nPaths, 0u);
+    std::fill_n(paths.specular.begin(), nPaths, (uint8_t)1);
+
+    active.resize(nPaths);
+    for (size_t i = 0; i < nPaths; i++)
+        active[i] = (uint32_t)i;
+}
+
+void WavefrontRenderer::sortRays()
+{
+    Clock::time_point start = Clock::now();
+    sorter.sort(active, paths.ox.data(), paths.oy.data(), paths.oz.data(),
+                paths.dx.data(), paths.dy.data(), paths.dz.data());
+    sortTime += secondsSince(start);
+}
+
+void WavefrontRenderer::extend(const std::vector<Shape*> &objList)
+{
+    Clock::time_point start = Clock::now();
+    ThreadPool::global().parallelFor(active.size(), CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++)
+        {
+            uint32_t i = active[k];
+            Ray r(Vector3D(paths.ox[i], paths.oy[i], paths.oz[i]),
+                  Vector3D(paths.dx[i], paths.dy[i], paths.dz[i]), paths.depth[i]);
+
+            Intersection its;
+            if (Utils::getClosestIntersection(r, objList, its))
+            {
+                paths.px[i] = its.itsPoint.x; paths.py[i] = its.itsPoint.y; paths.pz[i] = its.itsPoint.z;
+                paths.nx[i] = its.normal.x; paths.ny[i] = its.normal.y; paths.nz[i] = its.normal.z;
+                paths.material[i] = its.shape->getMaterialId();
+            }
+            else
+                paths.material[i] = NO_HIT;
+        }
+    });
+    rayCount += active.size();
+    traceTime += secondsSince(start);
+}
+
+void WavefrontRenderer::classify()
+{
+    // Resolve misses and emission, and tag each path with the queue it goes to
+    ThreadPool::global().parallelFor(active.size(), CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++)
+        {
+            uint32_t i = active[k];
+            uint32_t materialId = paths.material[i];
+
+            // Ray escaped the scene
+            if (materialId == NO_HIT)
+            {
+                paths.lr[i] += paths.tr[i] * bgColor.x;
+                paths.lg[i] += paths.tg[i] * bgColor.y;
+                paths.lb[i] += paths.tb[i] * bgColor.z;
+                kind[i] = PATH_DEAD;
+                continue;
+            }
+
+            const MaterialRecord &material = materials[materialId];
+
+            // Emission is only counted where NEE did not already account for it
+            if (paths.specular[i] && material.isEmissive())
+            {
+                const Vector3D &Le = material.emission;
+                paths.lr[i] += paths.tr[i] * Le.x;
+                paths.lg[i] += paths.tg[i] * Le.y;
+                paths.lb[i] += paths.tb[i] * Le.z;
+            }
+
+            if (paths.depth[i] >= maxDepth)
+                kind[i] = PATH_DEAD;
+            else if (material.hasSpecular())
+                kind[i] = PATH_MIRROR;
+            else if (material.hasTransmission())
+                kind[i] = PATH_TRANSMISSIVE;
+            else if (material.hasDiffuseOrGlossy())
+                kind[i] = PATH_DIFFUSE;
+            else
+                kind[i] = PATH_DEAD;
+        }
+    });
+
+    // Stable partition into the per-material queues (keeps the run deterministic)
+    diffuseQueue.clear();
+    mirrorQueue.clear();
+    transmissiveQueue.clear();
+    for (uint32_t i : active)
+    {
+        switch (kind[i])
+        {
+        case PATH_DIFFUSE: diffuseQueue.push_back(i); break;
+        case PATH_MIRROR: mirrorQueue.push_back(i); break;
+        case PATH_TRANSMISSIVE: transmissiveQueue.push_back(i); break;
+        default: break;
+        }
+    }
+
+    // Surviving paths, in queue order
+    active.clear();
+    active.insert(active.end(), diffuseQueue.begin(), diffuseQueue.end());
+    active.insert(active.end(), mirrorQueue.begin(), mirrorQueue.end());
+    active.insert(active.end(), transmissiveQueue.begin(), transmissiveQueue.end());
+}
+
+void WavefrontRenderer::shadeDiffuse(const std::vector<LightSource*> &lsList)
+{
+    size_t nLights = lsList.size();
+    shadows.resize(diffuseQueue.size() * nLights);
+
+    ThreadPool::global().parallelFor(diffuseQueue.size(), CHUNK_SIZE, [&](size_t begin, size_t end) {
+        seedChunk(STAGE_SHADE_DIFFUSE, begin);
+        HemisphericalSampler sampler;
+        // One packet per light source, and one for the continuation
+        std::vector<ReflectancePacket> packets(nLights + 1);
+
+        for (size_t first = begin; first < end; first += LANES)
+        {
+            size_t lanes = std::min(LANES, end - first);
+
+            // 1. Directions, path by path in the order of the random stream:
+            //    a shadow ray per light source (next event estimation), then
+            //    a uniformly sampled hemisphere direction to continue
+            for (size_t j = 0; j < lanes; j++)
+            {
+                size_t k = first + j;
+                uint32_t i = diffuseQueue[k];
+                Vector3D p(paths.px[i], paths.py[i], paths.pz[i]);
+                Vector3D n = Vector3D(paths.nx[i], paths.ny[i], paths.nz[i]).normalized();
+                Vector3D wo = -Vector3D(paths.dx[i], paths.dy[i], paths.dz[i]);
+                Vector3D T(paths.tr[i], paths.tg[i], paths.tb[i]);
+
+                for (size_t l = 0; l < nLights; l++)
+                {
+                    size_t s = k * nLights + l;
+                    LightSample lightSample = lsList[l]->sample(p);
+                    Vector3D toLight = lightSample.position - p;
+                    double dist = toLight.length();
+                    Vector3D wi = toLight / dist;
+
+                    // Contribution without the reflectance, applied below
+                    double geometricTerm = lightSample.pdf > 0 ? std::max(0.0, dot(wi, n)) / lightSample.pdf : 0.0;
+                    Vector3D c = T * lightSample.radiance * geometricTerm;
+
+                    shadows.ox[s] = p.x; shadows.oy[s] = p.y; shadows.oz[s] = p.z;
+                    shadows.dx[s] = wi.x; shadows.dy[s] = wi.y; shadows.dz[s] = wi.z;
+                    shadows.dist[s] = dist;
+                    shadows.cr[s] = c.x; shadows.cg[s] = c.y; shadows.cb[s] = c.z;
+                    packets[l].setLane(j, paths.material[i], n, wo);
+                    packets[l].setDirection(j, wi);
+                }
+
+                packets[nLights].setLane(j, paths.material[i], n, wo);
+                packets[nLights].setDirection(j, sampler.getSample(n));
+            }
+
+            // 2. Reflectance of the packet, for every light and the continuation
+            for (ReflectancePacket &q : packets)
+                evaluateReflectance(materials, q, lanes);
+
+            // 3. Shadow ray contributions and new path states
+            for (size_t l = 0; l < nLights; l++)
+            {
+                const ReflectancePacket &q = packets[l];
+                for (size_t j = 0; j < lanes; j++)
+                {
+                    size_t s = (first + j) * nLights + l;
+                    shadows.cr[s] *= q.fr[j]; shadows.cg[s] *= q.fg[j]; shadows.cb[s] *= q.fb[j];
+                }
+            }
+
+            const ReflectancePacket &q = packets[nLights];
+            for (size_t j = 0; j < lanes; j++)
+            {
+                uint32_t i = diffuseQueue[first + j];
+                float cosine = std::max(0.0f, q.wix[j] * q.nx[j] + q.wiy[j] * q.ny[j] + q.wiz[j] * q.nz[j]);
+                float weight = cosine * (float)(2 * M_PI);
+
+                paths.tr[i] *= q.fr[j] * weight; paths.tg[i] *= q.fg[j] * weight; paths.tb[i] *= q.fb[j] * weight;
+                paths.ox[i] = paths.px[i]; paths.oy[i] = paths.py[i]; paths.oz[i] = paths.pz[i];
+                paths.dx[i] = q.wix[j]; paths.dy[i] = q.wiy[j]; paths.dz[i] = q.wiz[j];
+                paths.depth[i]++;
+                paths.specular[i] = 0;
+            }
+        }
+    });
+}
+
+void WavefrontRenderer::shadeMirror()
+{
+    SpecularPaths s = { paths.ox.data(), paths.oy.data(), paths.oz.data(),
+                        paths.dx.data(), paths.dy.data(), paths.dz.data(),
+                        paths.px.data(), paths.py.data(), paths.pz.data(),
+                        paths.nx.data(), paths.ny.data(), paths.nz.data(),
+                        paths.material.data(), paths.depth.data(), paths.specular.data() };
+
+    ThreadPool::global().parallelFor(mirrorQueue.size(), CHUNK_SIZE, [&](size_t begin, size_t end) {
+        size_t k = begin;
+#ifdef WAVEFRONT_X86
+        if (CompiledScene::usesAVX2())
+            k = mirrorAVX2(s, mirrorQueue.data(), begin, end);
+#endif
+        mirrorScalar(s, mirrorQueue.data(), k, end);
+    });
+}
+
+void WavefrontRenderer::shadeTransmissive()
+{
+    SpecularPaths s = { paths.ox.data(), paths.oy.data(), paths.oz.data(),
+                        paths.dx.data(), paths.dy.data(), paths.dz.data(),
+                        paths.px.data(), paths.py.data(), paths.pz.data(),
+                        paths.nx.data(), paths.ny.data(), paths.nz.data(),
+                        paths.material.data(), paths.depth.data(), paths.specular.data() };
+    const float *ior = materials.getArrays().ior.data();
+
+    ThreadPool::global().parallelFor(transmissiveQueue.size(), CHUNK_SIZE, [&](size_t begin, size_t end) {
+        size_t k = begin;
+#ifdef WAVEFRONT_X86
+        if (CompiledScene::usesAVX2())
+            k = transmissiveAVX2(s, ior, transmissiveQueue.data(), begin, end);
+#endif
+        transmissiveScalar(s, ior, transmissiveQueue.data(), k, end);
+    });
+}
+
+void WavefrontRenderer::traceShadows(const std::vector<Shape*> &objList, size_t nLights)
+{
+    size_t nShadows = diffuseQueue.size() * nLights;
+
+    // Only the rays that can contribute something are traced
+    shadowOrder.clear();
+    for (size_t s = 0; s < nShadows; s++)
+    {
+        shadows.visible[s] = 0;
+        if (shadows.cr[s] > 0 || shadows.cg[s] > 0 || shadows.cb[s] > 0)
+            shadowOrder.push_back((uint32_t)s);
+    }
+
+    Clock::time_point sortStart = Clock::now();
+    sorter.sort(shadowOrder, shadows.ox.data(), shadows.oy.data(), shadows.oz.data(),
+                shadows.dx.data(), shadows.dy.data(), shadows.dz.data());
+    sortTime += secondsSince(sortStart);
+
+    Clock::time_point traceStart = Clock::now();
+    ThreadPool::global().parallelFor(shadowOrder.size(), CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++)
+        {
+            uint32_t s = shadowOrder[k];
+            // Stop right before the light so it does not occlude itself
+            Ray shadowRay(Vector3D(shadows.ox[s], shadows.oy[s], shadows.oz[s]),
+                          Vector3D(shadows.dx[s], shadows.dy[s], shadows.dz[s]),
+                          0, Epsilon, shadows.dist[s] - Epsilon);
+            shadows.visible[s] = !Utils::hasIntersection(shadowRay, objList);
+        }
+    });
+    traceTime += secondsSince(traceStart);
+
+    // Add the unoccluded contributions (all the shadow rays of a path are contiguous)
+    ThreadPool::global().parallelFor(diffuseQueue.size(), CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++)
+        {
+            uint32_t i = diffuseQueue[k];
+            for (size_t s = k * nLights; s < (k + 1) * nLights; s++)
+            {
+                float v = shadows.visible[s];
+                paths.lr[i] += v * shadows.cr[s];
+                paths.lg[i] += v * shadows.cg[s];
+                paths.lb[i] += v * shadows.cb[s];
+            }
+        }
+    });
+    shadowRayCount += shadowOrder.size();
+}
+
+void WavefrontRenderer::accumulate(Film &film, size_t firstPixel, size_t nPaths)
+{
+    size_t width = film.getWidth();
+    size_t nPixels = nPaths / samplesPerPixel;
+    float invSpp = 1.0f / samplesPerPixel;
+
+    ThreadPool::global().parallelFor(nPixels, CHUNK_SIZE, [&](size_t begin, size_t end) {
+        for (size_t p = begin; p < end; p++)
+        {
+            // The samples of a pixel are stored in consecutive path slots
+            float r = 0, g = 0, b = 0;
+            for (size_t i = p * samplesPerPixel; i < (p + 1) * samplesPerPixel; i++)
+            {
+                r += paths.lr[i];
+                g += paths.lg[i];
+                b += paths.lb[i];
+            }
+            Vector3D pixelColor(r * invSpp, g * invSpp, b * invSpp);
+
+            size_t pixel = firstPixel + p;
+            film.setPixelValue(pixel % width, pixel / width, pixelColor);
+        }
+    });
+}
@@ -0,0 +1,144 @@
+#ifndef WAVEFRONTRENDERER_H
+#define WAVEFRONTRENDERER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "film.h"
+#include "raysorter.h"
+#include "../materials/materialtable.h"
+#include "../cameras/camera.h"
+#include "../lightsources/lightsource.h"
+#include "../shapes/shape.h"
+
+/**
+ * @brief The WavefrontRenderer class
+ *
+ * Stream-based alternative to the recursive Shader::computeColor() design.
+ * Instead of following one path at a time, a whole batch of paths is kept in
+ * Structure-of-Arrays queues and every stage of the path tracer runs over the
+ * complete batch (in parallel) before the next stage starts:
+ *
+ *   generate -> [extend -> shade (one queue per material) -> shadow] * depth -> accumulate
+ *
+ * The estimator is the same one used by the NEE integrators: next event
+ * estimation at diffuse/glossy hits, perfect reflection for mirrors,
+ * refraction for transmissive objects, and emission only counted on camera
+ * rays or after a specular bounce.
+ *
+ * Before tracing, secondary and shadow rays can be binned by direction
+ * octant and origin (see RaySorter) to make consecutive queries coherent.
+ * Hits only keep the material id of the shape; the shading stages read the
+ * flat MaterialTable records instead of calling the Material virtuals. With
+ * AVX2 they run on packets of 8 paths gathered from the queues: the mirror
+ * and refraction directions, and the reflectance of the diffuse and glossy
+ * hits (light sources and random directions are still sampled path by path).
+ */
+class WavefrontRenderer
+{
+public:
+    WavefrontRenderer() = delete;
+    WavefrontRenderer(Vector3D bgColor_, size_t samplesPerPixel_, size_t maxDepth_,
+                      size_t maxPathsInFlight_ = 1 << 18);
+
+    void render(const Camera &cam, Film &film,
+                const std::vector<Shape*> &objList,
+                const std::vector<LightSource*> &lsList);
+
+    // Reordering of the secondary and shadow rays before traversal
+    void setRaySorting(RaySorter::Mode mode);
+
+    // Statistics of the last render
+    size_t getRayCount() const;
+    size_t getShadowRayCount() const;
+    double getTraceTime() const;  // Seconds spent in extend and shadow stages
+    double getSortTime() const;   // Seconds spent binning rays
+
+private:
+    // Path states (one slot per path in the batch)
+    struct PathStates
+    {
+        // Current ray
+        std::vector<float> ox, oy, oz;
+        std::vector<float> dx, dy, dz;
+        // Path throughput and accumulated radiance
+        std::vector<float> tr, tg, tb;
+        std::vector<float> lr, lg, lb;
+        // Closest hit of the current ray (material is NO_HIT on a miss)
+        std::vector<float> px, py, pz;
+        std::vector<float> nx, ny, nz;
+        std::vector<uint32_t> material;
+        // Number of bounces and whether the last one was specular
+        std::vector<uint32_t> depth;
+        std::vector<uint8_t> specular;
+
+        void resize(size_t n);
+    };
+
+    // Shadow rays: one entry per (diffuse path, light source)
+    struct ShadowQueue
+    {
+        std::vector<float> ox, oy, oz;
+        std::vector<float> dx, dy, dz;
+        std::vector<float> dist;
+        std::vector<float> cr, cg, cb;
+        std::vector<uint8_t> visible;
+
+        void resize(size_t n);
+    };
+
+    enum PathKind : uint8_t
+    {
+        PATH_DEAD,
+        PATH_DIFFUSE,
+        PATH_MIRROR,
+        PATH_TRANSMISSIVE
+    };
+
+    // Pipeline stages
+    void generate(const Camera &cam, size_t width, size_t height,
+                  size_t firstPixel, size_t nPaths);
+    void sortRays();
+    void extend(const std::vector<Shape*> &objList);
+    void classify();
+    void shadeDiffuse(const std::vector<LightSource*> &lsList);
+    void shadeMirror();
+    void shadeTransmissive();
+    void traceShadows(const std::vector<Shape*> &objList, size_t nLights);
+    void accumulate(Film &film, size_t firstPixel, size_t nPaths);
+
+    // Re-seed the random generator for a chunk of work, so the result does
+    // not depend on which thread executes it
+    void seedChunk(size_t stage, size_t begin) const;
+
+    Vector3D bgColor;
+    size_t samplesPerPixel;
+    size_t maxDepth;
+    size_t maxPathsInFlight;
+
+    // Materials of the scene, shaded by id
+    MaterialTable materials;
+
+    PathStates paths;
+    ShadowQueue shadows;
+    std::vector<uint8_t> kind;
+
+    // Indices of the live paths and of the per-material queues
+    std::vector<uint32_t> active;
+    std::vector<uint32_t> diffuseQueue;
+    std::vector<uint32_t> mirrorQueue;
+    std::vector<uint32_t> transmissiveQueue;
+
+    // Shadow rays that can contribute, in tracing order
+    std::vector<uint32_t> shadowOrder;
+    RaySorter sorter;
+
+    size_t batchIndex;
+    size_t bounce;
+    size_t rayCount;
+    size_t shadowRayCount;
+    double traceTime;
+    double sortTime;
+};
+
+#endif // WAVEFRONTRENDERER_H
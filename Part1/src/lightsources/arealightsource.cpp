@@ -1,4 +1,15 @@
 #include "arealightsource.h"
+#include "../core/random.h"
+
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // Below this solid angle the spherical rectangle loses precision
+    const double MIN_SOLID_ANGLE = 1e-4;
+}
 
 AreaLightSource::AreaLightSource(Square* areaLightsource_) :
     myAreaLightsource(areaLightsource_)
@@ -12,14 +23,125 @@ Vector3D AreaLightSource::getIntensity() const
 }
 
 
-Vector3D AreaLightSource::sampleLightPosition()   const
+LightSample AreaLightSource::sample(const Vector3D &p, LightSampling sampling) const
+{
+    LightSample ls;
+    ls.normal = myAreaLightsource->normal;
+    if (sampling == SOLID_ANGLE_SAMPLING) {
+        ls.position = sampleSolidAngle(p, ls.pdf);
+    }
+    else {
+        ls.position = samplePosition().position;
+        ls.pdf = areaToSolidAnglePdf(p, ls.position);
+    }
+
+    // Only the side the normal points to emits
+    ls.radiance = dot(p - ls.position, ls.normal) > 0 ? getIntensity() : Vector3D(0.0);
+    return ls;
+}
+
+LightSample AreaLightSource::samplePosition() const
 {
-    double u = (double)std::rand() / RAND_MAX;
-    double v = (double)std::rand() / RAND_MAX;
+    double u = Random::uniform();
+    double v = Random::uniform();
 
     Vector3D randpos = myAreaLightsource->corner
         + u * myAreaLightsource->v1
         + v * myAreaLightsource->v2;
-    return randpos;
+    return LightSample{ randpos, myAreaLightsource->normal, getIntensity(), 1.0 / getArea() };
 }
 
+AreaLightSource::SphericalRectangle AreaLightSource::getSphericalRectangle(const Vector3D &p) const
+{
+    SphericalRectangle sr;
+    double exl = myAreaLightsource->v1.length();
+    double eyl = myAreaLightsource->v2.length();
+    sr.ex = myAreaLightsource->v1 / exl;
+    sr.ey = myAreaLightsource->v2 / eyl;
+    sr.ez = cross(sr.ex, sr.ey);
+
+    // 1. Rectangle in local coordinates, flipping z so it points away from p
+    Vector3D d = myAreaLightsource->corner - p;
+    sr.z0 = dot(d, sr.ez);
+    if (sr.z0 > 0) {
+        sr.ez = -sr.ez;
+        sr.z0 = -sr.z0;
+    }
+    sr.x0 = dot(d, sr.ex);
+    sr.y0 = dot(d, sr.ey);
+    sr.x1 = sr.x0 + exl;
+    sr.y1 = sr.y0 + eyl;
+
+    // 2. Normals of the planes through p and each edge, and internal angles
+    Vector3D v00(sr.x0, sr.y0, sr.z0), v01(sr.x0, sr.y1, sr.z0);
+    Vector3D v10(sr.x1, sr.y0, sr.z0), v11(sr.x1, sr.y1, sr.z0);
+    Vector3D n0 = cross(v00, v10).normalized();
+    Vector3D n1 = cross(v10, v11).normalized();
+    Vector3D n2 = cross(v11, v01).normalized();
+    Vector3D n3 = cross(v01, v00).normalized();
+    auto angle = [](const Vector3D &a, const Vector3D &b) {
+        return std::acos(std::clamp((double)dot(a, b), -1.0, 1.0));
+    };
+    double g0 = angle(-n0, n1);
+    double g1 = angle(-n1, n2);
+    double g2 = angle(-n2, n3);
+    double g3 = angle(-n3, n0);
+
+    sr.b0 = n0.z;
+    sr.b1 = n2.z;
+    sr.k = 2 * M_PI - g2 - g3;
+    sr.solidAngle = g0 + g1 - sr.k;
+    return sr;
+}
+
+Vector3D AreaLightSource::sampleSolidAngle(const Vector3D &p, double &pdf) const
+{
+    SphericalRectangle sr = getSphericalRectangle(p);
+    double u = Random::uniform();
+    double v = Random::uniform();
+
+    // Points on the plane of the light, or lights too small to be worth it:
+    // uniform point on the square, its density converted to solid angle
+    if (useAreaFallback(sr)) {
+        Vector3D lightPos = myAreaLightsource->corner + u * myAreaLightsource->v1 + v * myAreaLightsource->v2;
+        pdf = areaToSolidAnglePdf(p, lightPos);
+        return lightPos;
+    }
+    pdf = 1.0 / sr.solidAngle;
+
+    // 1. Sample x: the sub-rectangle up to xu subtends an area u * solidAngle
+    double au = u * sr.solidAngle + sr.k;
+    double fu = (std::cos(au) * sr.b0 - sr.b1) / std::sin(au);
+    double cu = std::clamp(std::copysign(1.0 / std::sqrt(fu * fu + sr.b0 * sr.b0), fu), -1.0 + 1e-9, 1.0 - 1e-9);
+    double xu = std::clamp(-(cu * sr.z0) / std::sqrt(1.0 - cu * cu), sr.x0, sr.x1);
+
+    // 2. Sample y uniformly in the angle subtended along the vertical line at xu
+    double dd = std::sqrt(xu * xu + sr.z0 * sr.z0);
+    double h0 = sr.y0 / std::sqrt(dd * dd + sr.y0 * sr.y0);
+    double h1 = sr.y1 / std::sqrt(dd * dd + sr.y1 * sr.y1);
+    double hv = h0 + v * (h1 - h0);
+    double yv = (hv * hv < 1.0 - 1e-9) ? (hv * dd) / std::sqrt(1.0 - hv * hv) : sr.y1;
+
+    return p + xu * sr.ex + yv * sr.ey + sr.z0 * sr.ez;
+}
+
+double AreaLightSource::solidAnglePdf(const Vector3D &p, const Vector3D &lightPos) const
+{
+    SphericalRectangle sr = getSphericalRectangle(p);
+    if (useAreaFallback(sr))
+        return areaToSolidAnglePdf(p, lightPos);
+    return 1.0 / sr.solidAngle;
+}
+
+bool AreaLightSource::useAreaFallback(const SphericalRectangle &sr) const
+{
+    return !(sr.solidAngle > MIN_SOLID_ANGLE) || sr.z0 > -Epsilon;
+}
+
+double AreaLightSource::areaToSolidAnglePdf(const Vector3D &p, const Vector3D &lightPos) const
+{
+    Vector3D toLight = lightPos - p;
+    double dist2 = toLight.lengthSq();
+    double cosLight = dist2 > 0 ? std::abs(dot(toLight, myAreaLightsource->normal.normalized())) / std::sqrt(dist2) : 0.0;
+    return cosLight > 0 ? dist2 / (getArea() * cosLight) : 0.0;
+}
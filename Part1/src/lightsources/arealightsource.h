@@ -14,26 +14,39 @@ public:
 
 
     Vector3D getIntensity() const;        
-    Vector3D sampleLightPosition() const ;
-
+    LightSample sample(const Vector3D &p, LightSampling sampling = AREA_SAMPLING) const;
+    LightSample samplePosition() const;
+
+    // Solid angle sampling (spherical rectangle, Urena et al. 2013): point
+    // of the light seen from p, uniformly distributed in the solid angle the
+    // rectangle subtends at p. pdf is per unit solid angle (0 if the light
+    // cannot be sampled from p). The square must be a rectangle (v1 _|_ v2)
+    Vector3D sampleSolidAngle(const Vector3D &p, double &pdf) const;
+    // Solid angle density of sampleSolidAngle() for the point lightPos
+    double solidAnglePdf(const Vector3D &p, const Vector3D &lightPos) const;
+
+    // Area of the parallelogram spanned by the sides (any orientation)
     double getArea() const {
-        Vector3D square_dim = myAreaLightsource->v1 + myAreaLightsource->v2;
-        if (square_dim.x <= Epsilon) {
-            return square_dim.y * square_dim.z;
-        }
-        if (square_dim.y <= Epsilon) {
-            return square_dim.x * square_dim.z;
-        }
-        if (square_dim.z <= Epsilon) {
-            return square_dim.x * square_dim.y;
-        }
+        return cross(myAreaLightsource->v1, myAreaLightsource->v2).length();
     }
 
-    Vector3D getNormal() const {
-        return myAreaLightsource->normal;
+    const Shape* getShape() const {
+        return myAreaLightsource;
     };
 
 private:
+    // Rectangle in a frame centred at p, with the axes along v1, v2 and the
+    // normal pointing away from p: corners (x0..x1, y0..y1, z0), z0 <= 0
+    struct SphericalRectangle
+    {
+        Vector3D ex, ey, ez;
+        double x0, x1, y0, y1, z0;
+        double b0, b1, k, solidAngle;
+    };
+    SphericalRectangle getSphericalRectangle(const Vector3D &p) const;
+    bool useAreaFallback(const SphericalRectangle &sr) const;
+    double areaToSolidAnglePdf(const Vector3D &p, const Vector3D &lightPos) const;
+
     Square* myAreaLightsource;
 };
 
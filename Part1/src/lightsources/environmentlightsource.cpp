@@ -0,0 +1,184 @@
+#include "environmentlightsource.h"
+#include "../core/random.h"
+#include "../core/tinyexr.h"
+
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+    // Distance of the points returned by sample(): beyond any object of the
+    // scene, so every hit of a shadow ray is an occluder
+    const double FarDistance = 1e5;
+
+    // Lines of the map of a constant environment (a single line would not
+    // let the distribution follow sin(theta))
+    const size_t ConstantMapHeight = 64;
+
+    double luminance(const Vector3D &c)
+    {
+        return 0.2126 * c.x + 0.7152 * c.y + 0.0722 * c.z;
+    }
+
+    // Bin i of a CDF with n bins such that cdf[i] <= u < cdf[i + 1], and
+    // the position of u inside it (in [0, 1))
+    size_t sampleCdf(const double *cdf, size_t n, double u, double &offset)
+    {
+        size_t i = std::upper_bound(cdf, cdf + n + 1, u) - cdf;
+        i = std::min(n - 1, i > 0 ? i - 1 : 0);
+        double width = cdf[i + 1] - cdf[i];
+        offset = width > 0 ? std::clamp((u - cdf[i]) / width, 0.0, 1.0) : 0.5;
+        return i;
+    }
+}
+
+EnvironmentLightSource::EnvironmentLightSource(const std::string &filename, double scale_, double rotation_) :
+    width(0), height(0), scale(scale_), rotation(rotation_), loaded(false), meanWeight(0)
+{
+    // 1. Read the image (RGBA floats, top line first)
+    float *rgba = nullptr;
+    int w = 0, h = 0;
+    const char *err = nullptr;
+    if (LoadEXR(&rgba, &w, &h, filename.c_str(), &err) == TINYEXR_SUCCESS && w > 0 && h > 0) {
+        width = (size_t)w;
+        height = (size_t)h;
+        pixels.resize(width * height);
+        for (size_t i = 0; i < pixels.size(); i++) {
+            // Negative values (from some encoders) do not emit
+            pixels[i] = Vector3D(std::max(0.0f, rgba[4 * i]),
+                                 std::max(0.0f, rgba[4 * i + 1]),
+                                 std::max(0.0f, rgba[4 * i + 2])) * scale;
+        }
+        loaded = true;
+    }
+    else {
+        std::cout << "Could not read the environment map " << filename;
+        if (err)
+            std::cout << ": " << err;
+        std::cout << std::endl;
+        width = 1;
+        height = 1;
+        pixels.assign(1, Vector3D(0.0));
+    }
+    free(rgba);
+    if (err)
+        FreeEXRErrorMessage(err);
+
+    // 2. Sampling distribution
+    buildDistribution();
+}
+
+EnvironmentLightSource::EnvironmentLightSource(Vector3D radiance_) :
+    width(1), height(ConstantMapHeight), pixels(ConstantMapHeight, radiance_),
+    scale(1.0), rotation(0.0), loaded(true), meanWeight(0)
+{
+    buildDistribution();
+}
+
+bool EnvironmentLightSource::isLoaded() const
+{
+    return loaded;
+}
+
+void EnvironmentLightSource::buildDistribution()
+{
+    weights.assign(width * height, 0.0f);
+    marginalCdf.assign(height + 1, 0.0);
+    conditionalCdf.assign(height * (width + 1), 0.0);
+
+    Vector3D radianceSum(0.0);
+    double solidAngleSum = 0;
+    double weightSum = 0;
+    for (size_t j = 0; j < height; j++) {
+        // Solid angle of the pixels of the line (up to a constant)
+        double sinTheta = std::sin(M_PI * (j + 0.5) / height);
+        double *cdf = &conditionalCdf[j * (width + 1)];
+        for (size_t i = 0; i < width; i++) {
+            const Vector3D &L = pixels[j * width + i];
+            weights[j * width + i] = (float)(luminance(L) * sinTheta);
+            cdf[i + 1] = cdf[i] + weights[j * width + i];
+            radianceSum += L * sinTheta;
+            solidAngleSum += sinTheta;
+        }
+        double rowSum = cdf[width];
+        marginalCdf[j + 1] = marginalCdf[j] + rowSum;
+        weightSum += rowSum;
+
+        // Normalise the line (uniform if it is black: never chosen anyway)
+        for (size_t i = 1; i <= width; i++)
+            cdf[i] = rowSum > 0 ? cdf[i] / rowSum : (double)i / width;
+    }
+    for (size_t j = 1; j <= height; j++)
+        marginalCdf[j] = weightSum > 0 ? marginalCdf[j] / weightSum : (double)j / height;
+
+    meanWeight = weightSum / (width * height);
+    meanRadiance = solidAngleSum > 0 ? radianceSum / solidAngleSum : Vector3D(0.0);
+}
+
+size_t EnvironmentLightSource::pixelIndex(const Vector3D &dir, double &sinTheta) const
+{
+    Vector3D d = dir.normalized();
+    double cosTheta = std::clamp((double)d.y, -1.0, 1.0);
+    sinTheta = std::sqrt(std::max(0.0, 1.0 - cosTheta * cosTheta));
+    double theta = std::acos(cosTheta);
+    double phi = std::atan2((double)d.z, (double)d.x) - rotation;
+    phi -= 2 * M_PI * std::floor(phi / (2 * M_PI));
+
+    size_t i = std::min(width - 1, (size_t)(phi / (2 * M_PI) * width));
+    size_t j = std::min(height - 1, (size_t)(theta / M_PI * height));
+    return j * width + i;
+}
+
+Vector3D EnvironmentLightSource::getIntensity() const
+{
+    return meanRadiance;
+}
+
+Vector3D EnvironmentLightSource::getEnvironmentRadiance(const Vector3D &dir) const
+{
+    double sinTheta;
+    return pixels[pixelIndex(dir, sinTheta)];
+}
+
+double EnvironmentLightSource::getEnvironmentPdf(const Vector3D &dir) const
+{
+    double sinTheta;
+    size_t index = pixelIndex(dir, sinTheta);
+    if (meanWeight <= 0 || sinTheta <= 0)
+        return 0;
+    // Density in the image (u, v) over the Jacobian of the mapping
+    return weights[index] / meanWeight / (2 * M_PI * M_PI * sinTheta);
+}
+
+LightSample EnvironmentLightSource::sample(const Vector3D &p, LightSampling) const
+{
+    if (meanWeight <= 0)
+        return LightSample{ p, Vector3D(0.0), Vector3D(0.0), 0.0 };
+
+    // 1. Line from the marginal CDF, column from the conditional one
+    double dv, du;
+    size_t j = sampleCdf(marginalCdf.data(), height, Random::uniform(), dv);
+    size_t i = sampleCdf(&conditionalCdf[j * (width + 1)], width, Random::uniform(), du);
+
+    // 2. Direction of that point of the image
+    double theta = M_PI * (j + dv) / height;
+    double phi = 2 * M_PI * (i + du) / width + rotation;
+    double sinTheta = std::sin(theta);
+    if (sinTheta <= 0)
+        return LightSample{ p, Vector3D(0.0), Vector3D(0.0), 0.0 };
+    Vector3D wi(sinTheta * std::cos(phi), std::cos(theta), sinTheta * std::sin(phi));
+
+    // 3. Density per unit solid angle
+    size_t index = j * width + i;
+    double pdf = weights[index] / meanWeight / (2 * M_PI * M_PI * sinTheta);
+
+    return LightSample{ p + wi * FarDistance, -wi, pixels[index], pdf };
+}
+
+LightSample EnvironmentLightSource::samplePosition() const
+{
+    return LightSample{ Vector3D(0.0), Vector3D(0.0), Vector3D(0.0), 0.0 };
+}
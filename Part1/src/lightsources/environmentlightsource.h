@@ -0,0 +1,77 @@
+#ifndef ENVIRONMENTLIGHTSOURCE_H
+#define ENVIRONMENTLIGHTSOURCE_H
+
+#include <string>
+#include <vector>
+
+#include "lightsource.h"
+
+/**
+ * @brief The EnvironmentLightSource class
+ *
+ * Light arriving from infinitely far away in every direction, given by an
+ * HDR image in latitude-longitude layout (first line: +Y, the zenith;
+ * columns: azimuth around Y).
+ *
+ * Directions are importance sampled from a 2D piecewise-constant
+ * distribution proportional to the luminance of the pixels (times the
+ * sin(theta) of their row, the solid angle they cover): a marginal CDF
+ * chooses the row and the conditional CDF of that row the column. Bright
+ * regions (the sun) get most of the samples, so a few light samples per
+ * hit are enough outdoors.
+ *
+ * It has no shape nor area: the points it returns are placed far along
+ * the sampled direction, so the shadow rays of the integrators work as for
+ * the other lights, and the rays that leave the scene take its radiance
+ * (see Shader::background()). Renderers that emit from the lights
+ * (photon mapping, BDPT, ReSTIR) skip it.
+ */
+class EnvironmentLightSource : public LightSource
+{
+public:
+    EnvironmentLightSource() = delete;
+    // Image from an EXR file (a black environment if it can not be read).
+    // The radiance is multiplied by scale, and the map rotated by
+    // rotation radians around Y
+    EnvironmentLightSource(const std::string &filename, double scale_ = 1.0, double rotation_ = 0.0);
+    // Constant radiance in every direction (uniform sky)
+    EnvironmentLightSource(Vector3D radiance_);
+
+    bool isLoaded() const;
+
+    // Mean radiance over the sphere of directions
+    Vector3D getIntensity() const;
+    LightSample sample(const Vector3D &p, LightSampling sampling = AREA_SAMPLING) const;
+    // Not a position light: pdf 0
+    LightSample samplePosition() const;
+
+    double getArea() const { return 0.0; };
+    const Shape* getShape() const { return nullptr; };
+
+    bool isEnvironment() const { return true; };
+    Vector3D getEnvironmentRadiance(const Vector3D &dir) const;
+    double getEnvironmentPdf(const Vector3D &dir) const;
+
+private:
+    void buildDistribution();
+    // Pixel of the map seen in a direction
+    size_t pixelIndex(const Vector3D &dir, double &sinTheta) const;
+
+    size_t width;
+    size_t height;
+    std::vector<Vector3D> pixels;   // Radiance (scale applied), top line first
+    double scale;
+    double rotation;
+    bool loaded;
+
+    // Sampling distribution: sampling weight of every pixel, its mean over
+    // the image, the marginal CDF of the rows (height + 1 values) and the
+    // conditional CDF of the columns of every row (width + 1 values each)
+    std::vector<float> weights;
+    double meanWeight;
+    std::vector<double> marginalCdf;
+    std::vector<double> conditionalCdf;
+    Vector3D meanRadiance;
+};
+
+#endif // ENVIRONMENTLIGHTSOURCE_H
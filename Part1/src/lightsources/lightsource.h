@@ -1,6 +1,19 @@
 #ifndef LIGHTSOURCE_H
 #define LIGHTSOURCE_H
 
+#include "../core/vector3d.h"
+
+class Shape;
+
+// Point of a light source chosen by one of its sampling methods, with all
+// the integrators need to use it
+struct LightSample
+{
+    Vector3D position;
+    Vector3D normal;     // Normal of the light at position (0 for point lights)
+    Vector3D radiance;   // Emitted radiance (point lights: see sample())
+    double pdf;          // 0: the sample can not be used
+};
 
 // To start, let this be the interface of a point light source
 // Then, make this an abstract class from which we can derive:
@@ -10,16 +23,37 @@
 class LightSource
 {
 public:
+    // How area lights choose the point seen from a reference point: uniform
+    // points on the light, or uniform directions in its solid angle
+    enum LightSampling { AREA_SAMPLING, SOLID_ANGLE_SAMPLING };
+
     LightSource() {}; 
 
 
     virtual Vector3D getIntensity() const = 0;
-    virtual Vector3D sampleLightPosition() const = 0;
+
+    // Point of the light to illuminate p, pdf per unit solid angle at p
+    // (the contribution is radiance * fr * cos / pdf). Point lights return
+    // radiance = intensity / distance^2 and pdf = 1
+    virtual LightSample sample(const Vector3D &p, LightSampling sampling = AREA_SAMPLING) const = 0;
+    // Point of the light alone (to emit from it), pdf per unit area.
+    // Point lights return pdf = 1
+    virtual LightSample samplePosition() const = 0;
 
     virtual double getArea() const = 0;
-    virtual Vector3D getNormal() const = 0;
 
+    // Emitting shape (to recognise the light when a path hits it)
+    virtual const Shape* getShape() const = 0;
+
+    // Update the data kept from the shape after it moved (animations)
+    virtual void refresh() {}
 
+    // Lights at infinity (see EnvironmentLightSource): radiance arriving
+    // from a direction that leaves the scene, and the density per unit
+    // solid angle with which sample() chooses that direction
+    virtual bool isEnvironment() const { return false; }
+    virtual Vector3D getEnvironmentRadiance(const Vector3D &) const { return Vector3D(0.0); }
+    virtual double getEnvironmentPdf(const Vector3D &) const { return 0.0; }
 };
 
 #endif 
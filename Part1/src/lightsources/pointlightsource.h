@@ -16,12 +16,19 @@ public:
 
 
     Vector3D getIntensity() const { return intensity; };
-    Vector3D sampleLightPosition() const { return pos; };
+
+    LightSample sample(const Vector3D &p, LightSampling = AREA_SAMPLING) const {
+        double dist2 = (pos - p).lengthSq();
+        return LightSample{ pos, Vector3D(0.0), dist2 > 0 ? intensity / dist2 : Vector3D(0.0), 1.0 };
+    };
+    LightSample samplePosition() const {
+        return LightSample{ pos, Vector3D(0.0), intensity, 1.0 };
+    };
 
     ////A point light emits light uniformly in all directions
     //Its Area is zero and have no Normal
     double getArea() const { return 0.0; };              
-    Vector3D getNormal() const { return Vector3D(0.0); };
+    const Shape* getShape() const { return nullptr; };
 
 private:
     Vector3D pos;
@@ -0,0 +1,89 @@
+#include "spherelightsource.h"
+#include "../core/random.h"
+
+#define _USE_MATH_DEFINES
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // Orthonormal basis (x, y) of the plane perpendicular to the unit vector z
+    void buildFrame(const Vector3D &z, Vector3D &x, Vector3D &y)
+    {
+        x = std::abs(z.x) > 0.9 ? cross(Vector3D(0.0, 1.0, 0.0), z) : cross(Vector3D(1.0, 0.0, 0.0), z);
+        x = x.normalized();
+        y = cross(z, x);
+    }
+}
+
+SphereLightSource::SphereLightSource(Sphere* sphereLightsource_) :
+    mySphereLightsource(sphereLightsource_),
+    center(sphereLightsource_->getCenter()), radius(sphereLightsource_->getRadius())
+{ }
+
+void SphereLightSource::refresh()
+{
+    center = mySphereLightsource->getCenter();
+    radius = mySphereLightsource->getRadius();
+}
+
+Vector3D SphereLightSource::getIntensity() const
+{
+    return mySphereLightsource->getMaterial().getEmissiveRadiance();
+}
+
+double SphereLightSource::getArea() const
+{
+    return 4 * M_PI * radius * radius;
+}
+
+LightSample SphereLightSource::sample(const Vector3D &p, LightSampling) const
+{
+    Vector3D toCenter = center - p;
+    double dc2 = toCenter.lengthSq();
+    double r2 = radius * radius;
+
+    // 1. Inside the sphere: uniform point, density converted to solid angle
+    if (dc2 <= r2) {
+        LightSample ls = samplePosition();
+        Vector3D toLight = ls.position - p;
+        double dist2 = toLight.lengthSq();
+        double cosLight = dist2 > 0 ? std::abs(dot(toLight, ls.normal)) / std::sqrt(dist2) : 0.0;
+        ls.pdf = cosLight > 0 ? dist2 / (getArea() * cosLight) : 0.0;
+        return ls;
+    }
+
+    // 2. Outside: uniform direction in the cone around the center
+    double dc = std::sqrt(dc2);
+    double sinThetaMax2 = r2 / dc2;
+    double cosThetaMax = std::sqrt(std::max(0.0, 1.0 - sinThetaMax2));
+    double oneMinusCosThetaMax = sinThetaMax2 / (1.0 + cosThetaMax);
+
+    double cosTheta = 1.0 - Random::uniform() * oneMinusCosThetaMax;
+    double sinTheta2 = std::max(0.0, 1.0 - cosTheta * cosTheta);
+    double phi = 2 * M_PI * Random::uniform();
+
+    // 3. Point of the sphere in that direction, given by its angle alpha
+    //    from the center (seen from the center, measured from -toCenter)
+    double ds = dc * cosTheta - std::sqrt(std::max(0.0, r2 - dc2 * sinTheta2));
+    double cosAlpha = std::clamp((dc2 + r2 - ds * ds) / (2 * dc * radius), -1.0, 1.0);
+    double sinAlpha = std::sqrt(std::max(0.0, 1.0 - cosAlpha * cosAlpha));
+
+    Vector3D w = -toCenter / dc;
+    Vector3D x, y;
+    buildFrame(w, x, y);
+    Vector3D n = x * (sinAlpha * std::cos(phi)) + y * (sinAlpha * std::sin(phi)) + w * cosAlpha;
+
+    return LightSample{ center + n * radius, n, getIntensity(), 1.0 / (2 * M_PI * oneMinusCosThetaMax) };
+}
+
+LightSample SphereLightSource::samplePosition() const
+{
+    // Uniform point on the sphere
+    double z = 1.0 - 2.0 * Random::uniform();
+    double r = std::sqrt(std::max(0.0, 1.0 - z * z));
+    double phi = 2 * M_PI * Random::uniform();
+    Vector3D n(r * std::cos(phi), r * std::sin(phi), z);
+
+    return LightSample{ center + n * radius, n, getIntensity(), 1.0 / getArea() };
+}
@@ -0,0 +1,35 @@
+#ifndef SPHERELIGHTSOURCE_H
+#define SPHERELIGHTSOURCE_H
+
+#include "../shapes/sphere.h"
+#include "lightsource.h"
+
+// Emissive sphere. Seen from outside, the points are sampled uniformly in
+// the cone of directions the sphere subtends (its visible cap only)
+class SphereLightSource : public LightSource
+{
+public:
+    SphereLightSource() = delete;
+
+    SphereLightSource(Sphere* sphereLightsource);
+
+
+    Vector3D getIntensity() const;
+    LightSample sample(const Vector3D &p, LightSampling sampling = AREA_SAMPLING) const;
+    LightSample samplePosition() const;
+
+    double getArea() const;
+
+    void refresh();
+
+    const Shape* getShape() const {
+        return mySphereLightsource;
+    };
+
+private:
+    Sphere* mySphereLightsource;
+    Vector3D center;
+    double radius;
+};
+
+#endif // SPHERELIGHTSOURCE_H
@@ -6,7 +6,24 @@
 #include "core/ray.h"
 #include "core/utils.h"
 #include "core/scene.h"
-
+#include "core/parallel.h"
+#include "core/costprofiler.h"
+#include "core/random.h"
+#include "core/wavefrontrenderer.h"
+#include "core/restirrenderer.h"
+#include "core/progressiverenderer.h"
+#include "core/renderserver.h"
+#include "core/scenefile.h"
+#include "core/sequencerenderer.h"
+#include "core/tilerenderer.h"
+#include "core/imageoutput.h"
+#include "core/relightrenderer.h"
+#include "core/tinyexr.h"
+#include "core/compiledscene.h"
+#include "core/numa.h"
+
+
+#include "lightsources/environmentlightsource.h"
 
 #include "shapes/sphere.h"
 #include "shapes/infiniteplan.h"
@@ -23,6 +40,9 @@
 #include "shaders/purepathintegrator.h"
 #include "shaders/neeintegrator.h"
 #include "shaders/neeimprovedintegrator.h"
+#include "shaders/photonmappingintegrator.h"
+#include "shaders/guidedpathintegrator.h"
+#include "shaders/bdptintegrator.h"
 
 
 #include "materials/phong.h"
@@ -30,7 +50,13 @@
 #include "materials/mirror.h"
 #include "materials/transmissive.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
 
 using namespace std::chrono;
 
@@ -49,16 +75,16 @@ void buildSceneCornellBox(Camera*& cam, Film*& film, Scene myScene)
     /* ********* */
     /* Materials */
     /* ********* */
-    Material* redDiffuse = new Phong(Vector3D(0.7, 0.2, 0.3), Vector3D(0, 0, 0), 100);
-    Material* greenDiffuse = new Phong(Vector3D(0.2, 0.7, 0.3), Vector3D(0, 0, 0), 100);
-    Material* greyDiffuse = new Phong(Vector3D(0.8, 0.8, 0.8), Vector3D(0, 0, 0), 100);
-    Material* blueGlossy_20 = new Phong(Vector3D(0.2, 0.3, 0.8), Vector3D(0.2, 0.2, 0.2), 20);
-    Material* blueGlossy_80 = new Phong(Vector3D(0.2, 0.3, 0.8), Vector3D(0.2, 0.2, 0.2), 80);
-    Material* cyandiffuse = new Phong(Vector3D(0.2, 0.8, 0.8), Vector3D(0, 0, 0), 100);
-    Material* emissive = new Emissive(Vector3D(25, 25, 25), Vector3D(0.5));
+    Material* redDiffuse = myScene.create<Phong>(Vector3D(0.7, 0.2, 0.3), Vector3D(0, 0, 0), 100);
+    Material* greenDiffuse = myScene.create<Phong>(Vector3D(0.2, 0.7, 0.3), Vector3D(0, 0, 0), 100);
+    Material* greyDiffuse = myScene.create<Phong>(Vector3D(0.8, 0.8, 0.8), Vector3D(0, 0, 0), 100);
+    Material* blueGlossy_20 = myScene.create<Phong>(Vector3D(0.2, 0.3, 0.8), Vector3D(0.2, 0.2, 0.2), 20);
+    Material* blueGlossy_80 = myScene.create<Phong>(Vector3D(0.2, 0.3, 0.8), Vector3D(0.2, 0.2, 0.2), 80);
+    Material* cyandiffuse = myScene.create<Phong>(Vector3D(0.2, 0.8, 0.8), Vector3D(0, 0, 0), 100);
+    Material* emissive = myScene.create<Emissive>(Vector3D(25, 25, 25), Vector3D(0.5));
 
-    Material* mirror = new Mirror();
-    Material* transmissive = new Transmissive(0.7);
+    Material* mirror = myScene.create<Mirror>();
+    Material* transmissive = myScene.create<Transmissive>(0.7);
 
     /* ******* */
     /* Objects */
@@ -66,12 +92,12 @@ void buildSceneCornellBox(Camera*& cam, Film*& film, Scene myScene)
     double offset = 3.0;
     Matrix4x4 idTransform;
     // Construct the Cornell Box
-    Shape* leftPlan = new InfinitePlan(Vector3D(-offset - 1, 0, 0), Vector3D(1, 0, 0), redDiffuse);
-    Shape* rightPlan = new InfinitePlan(Vector3D(offset + 1, 0, 0), Vector3D(-1, 0, 0), greenDiffuse);
-    Shape* topPlan = new InfinitePlan(Vector3D(0, offset, 0), Vector3D(0, -1, 0), greyDiffuse);
-    Shape* bottomPlan = new InfinitePlan(Vector3D(0, -offset, 0), Vector3D(0, 1, 0), greyDiffuse);
-    Shape* backPlan = new InfinitePlan(Vector3D(0, 0, 3 * offset), Vector3D(0, 0, -1), greyDiffuse);
-    Shape* square_emissive = new Square(Vector3D(-1.0, 3.0, 3.0), Vector3D(2.0, 0.0, 0.0), Vector3D(0.0, 0.0, 2.0), Vector3D(0.0, -1.0, 0.0), emissive);
+    Shape* leftPlan = myScene.create<InfinitePlan>(Vector3D(-offset - 1, 0, 0), Vector3D(1, 0, 0), redDiffuse);
+    Shape* rightPlan = myScene.create<InfinitePlan>(Vector3D(offset + 1, 0, 0), Vector3D(-1, 0, 0), greenDiffuse);
+    Shape* topPlan = myScene.create<InfinitePlan>(Vector3D(0, offset, 0), Vector3D(0, -1, 0), greyDiffuse);
+    Shape* bottomPlan = myScene.create<InfinitePlan>(Vector3D(0, -offset, 0), Vector3D(0, 1, 0), greyDiffuse);
+    Shape* backPlan = myScene.create<InfinitePlan>(Vector3D(0, 0, 3 * offset), Vector3D(0, 0, -1), greyDiffuse);
+    Shape* square_emissive = myScene.create<Square>(Vector3D(-1.0, 3.0, 3.0), Vector3D(2.0, 0.0, 0.0), Vector3D(0.0, 0.0, 2.0), Vector3D(0.0, -1.0, 0.0), emissive);
 
 
     myScene.AddObject(leftPlan);
@@ -86,13 +112,13 @@ void buildSceneCornellBox(Camera*& cam, Film*& film, Scene myScene)
     double radius = 1;
     Matrix4x4 sphereTransform1;
     sphereTransform1 = Matrix4x4::translate(Vector3D(1.5, -offset + radius, 6));
-    Shape* s1 = new Sphere(radius, sphereTransform1, blueGlossy_20);
+    Shape* s1 = myScene.create<Sphere>(radius, sphereTransform1, blueGlossy_20);
 
     Matrix4x4 sphereTransform2;
     sphereTransform2 = Matrix4x4::translate(Vector3D(-1.5, -offset + 3 * radius, 4));
-    Shape* s2 = new Sphere(radius, sphereTransform2, transmissive); //blueGlossy_20);//
+    Shape* s2 = myScene.create<Sphere>(radius, sphereTransform2, transmissive); //blueGlossy_20);//
 
-    Shape* square = new Square(Vector3D(offset + 0.999, -offset - 0.2, 3.0), Vector3D(0.0, 4.0, 0.0), Vector3D(0.0, 0.0, 2.0), Vector3D(-1.0, 0.0, 0.0), mirror); // cyandiffuse);//
+    Shape* square = myScene.create<Square>(Vector3D(offset + 0.999, -offset - 0.2, 3.0), Vector3D(0.0, 4.0, 0.0), Vector3D(0.0, 0.0, 2.0), Vector3D(-1.0, 0.0, 0.0), mirror); // cyandiffuse);//
 
     myScene.AddObject(s1);
     myScene.AddObject(s2);
@@ -100,6 +126,123 @@ void buildSceneCornellBox(Camera*& cam, Film*& film, Scene myScene)
 }
 
 
+// Cornell Box filled with a grid of small spheres (many primitives, used to
+// measure the behaviour of the renderers on larger scenes)
+void buildSceneSphereGrid(Camera*& cam, Film*& film, Scene myScene, int gridSize)
+{
+    Matrix4x4 cameraToWorld = Matrix4x4::translate(Vector3D(0, 0, -3));
+    double fovDegrees = 60;
+    double fovRadians = Utils::degreesToRadians(fovDegrees);
+    cam = new PerspectiveCamera(cameraToWorld, fovRadians, *film);
+
+    Material* greyDiffuse = myScene.create<Phong>(Vector3D(0.8, 0.8, 0.8), Vector3D(0, 0, 0), 100);
+    Material* redDiffuse = myScene.create<Phong>(Vector3D(0.7, 0.2, 0.3), Vector3D(0, 0, 0), 100);
+    Material* blueGlossy = myScene.create<Phong>(Vector3D(0.2, 0.3, 0.8), Vector3D(0.2, 0.2, 0.2), 20);
+    Material* emissive = myScene.create<Emissive>(Vector3D(25, 25, 25), Vector3D(0.5));
+    Material* mirror = myScene.create<Mirror>();
+    Material* transmissive = myScene.create<Transmissive>(0.7);
+    Material* sphereMaterials[4] = { redDiffuse, blueGlossy, mirror, transmissive };
+
+    double offset = 3.0;
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(-offset - 1, 0, 0), Vector3D(1, 0, 0), greyDiffuse));
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(offset + 1, 0, 0), Vector3D(-1, 0, 0), greyDiffuse));
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(0, offset, 0), Vector3D(0, -1, 0), greyDiffuse));
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(0, -offset, 0), Vector3D(0, 1, 0), greyDiffuse));
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(0, 0, 3 * offset), Vector3D(0, 0, -1), greyDiffuse));
+    myScene.AddObject(myScene.create<Square>(Vector3D(-1.0, 3.0, 3.0), Vector3D(2.0, 0.0, 0.0), Vector3D(0.0, 0.0, 2.0), Vector3D(0.0, -1.0, 0.0), emissive));
+
+    // Spheres laid out on the floor
+    double cell = 7.0 / gridSize;
+    double radius = 0.4 * cell;
+    for (int i = 0; i < gridSize; i++)
+    {
+        for (int j = 0; j < gridSize; j++)
+        {
+            Vector3D center(-3.5 + (i + 0.5) * cell, -offset + radius, 2.0 + (j + 0.5) * cell);
+            Shape* s = myScene.create<Sphere>(radius, Matrix4x4::translate(center), sphereMaterials[(i + j) % 4]);
+            myScene.AddObject(s);
+        }
+    }
+}
+
+// Cornell Box with a panel hanging below the area light: the light only
+// leaves through the gap around the panel, most of the room is lit indirectly
+void buildSceneHardLit(Camera*& cam, Film*& film, Scene myScene)
+{
+    Matrix4x4 cameraToWorld = Matrix4x4::translate(Vector3D(0, 0, -3));
+    double fovDegrees = 60;
+    double fovRadians = Utils::degreesToRadians(fovDegrees);
+    cam = new PerspectiveCamera(cameraToWorld, fovRadians, *film);
+
+    Material* redDiffuse = myScene.create<Phong>(Vector3D(0.7, 0.2, 0.3), Vector3D(0, 0, 0), 100);
+    Material* greenDiffuse = myScene.create<Phong>(Vector3D(0.2, 0.7, 0.3), Vector3D(0, 0, 0), 100);
+    Material* greyDiffuse = myScene.create<Phong>(Vector3D(0.8, 0.8, 0.8), Vector3D(0, 0, 0), 100);
+    Material* blueGlossy = myScene.create<Phong>(Vector3D(0.2, 0.3, 0.8), Vector3D(0.2, 0.2, 0.2), 20);
+    Material* emissive = myScene.create<Emissive>(Vector3D(50, 50, 50), Vector3D(0.5));
+
+    double offset = 3.0;
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(-offset - 1, 0, 0), Vector3D(1, 0, 0), redDiffuse));
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(offset + 1, 0, 0), Vector3D(-1, 0, 0), greenDiffuse));
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(0, offset, 0), Vector3D(0, -1, 0), greyDiffuse));
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(0, -offset, 0), Vector3D(0, 1, 0), greyDiffuse));
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(0, 0, 3 * offset), Vector3D(0, 0, -1), greyDiffuse));
+    myScene.AddObject(myScene.create<Square>(Vector3D(-1.0, 3.0, 3.0), Vector3D(2.0, 0.0, 0.0), Vector3D(0.0, 0.0, 2.0), Vector3D(0.0, -1.0, 0.0), emissive));
+
+    // Panel below the light, leaving a gap of 1
+    myScene.AddObject(myScene.create<Square>(Vector3D(-2.0, 2.0, 2.0), Vector3D(4.0, 0.0, 0.0), Vector3D(0.0, 0.0, 4.0), Vector3D(0.0, -1.0, 0.0), greyDiffuse));
+
+    myScene.AddObject(myScene.create<Sphere>(1.0, Matrix4x4::translate(Vector3D(1.5, -offset + 1.0, 6)), blueGlossy));
+    myScene.AddObject(myScene.create<Sphere>(1.0, Matrix4x4::translate(Vector3D(-1.5, -offset + 1.0, 4)), greyDiffuse));
+}
+
+// Spheres on a ground plane lit only by an HDR environment map (sky and
+// sun), importance sampled by the NEE integrators
+void buildSceneOutdoor(Camera*& cam, Film*& film, Scene myScene, const std::string &envMap)
+{
+    Matrix4x4 cameraToWorld = Matrix4x4::translate(Vector3D(0, 0, -3));
+    double fovDegrees = 60;
+    double fovRadians = Utils::degreesToRadians(fovDegrees);
+    cam = new PerspectiveCamera(cameraToWorld, fovRadians, *film);
+
+    Material* greyDiffuse = myScene.create<Phong>(Vector3D(0.6, 0.6, 0.6), Vector3D(0, 0, 0), 100);
+    Material* blueGlossy = myScene.create<Phong>(Vector3D(0.2, 0.3, 0.8), Vector3D(0.2, 0.2, 0.2), 20);
+    Material* mirror = myScene.create<Mirror>();
+
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(0, -1, 0), Vector3D(0, 1, 0), greyDiffuse));
+    myScene.AddObject(myScene.create<Sphere>(1.0, Matrix4x4::translate(Vector3D(-1.5, 0.0, 5)), blueGlossy));
+    myScene.AddObject(myScene.create<Sphere>(1.0, Matrix4x4::translate(Vector3D(1.5, 0.0, 6)), mirror));
+
+    // Environment light (not a shape: added to the light list directly)
+    myScene.LightSourceList->push_back(myScene.create<EnvironmentLightSource>(envMap));
+}
+
+// Grey box lit only by a grid of small emissive spheres (many small lights,
+// sampled by the cone they subtend)
+void buildSceneSphereLights(Camera*& cam, Film*& film, Scene myScene)
+{
+    Matrix4x4 cameraToWorld = Matrix4x4::translate(Vector3D(0, 0, -3));
+    double fovDegrees = 60;
+    double fovRadians = Utils::degreesToRadians(fovDegrees);
+    cam = new PerspectiveCamera(cameraToWorld, fovRadians, *film);
+
+    Material* greyDiffuse = myScene.create<Phong>(Vector3D(0.8, 0.8, 0.8), Vector3D(0, 0, 0), 100);
+    Material* blueGlossy = myScene.create<Phong>(Vector3D(0.2, 0.3, 0.8), Vector3D(0.2, 0.2, 0.2), 20);
+    Material* emissive = myScene.create<Emissive>(Vector3D(200, 200, 200), Vector3D(0.5));
+
+    double offset = 3.0;
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(-offset - 1, 0, 0), Vector3D(1, 0, 0), greyDiffuse));
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(offset + 1, 0, 0), Vector3D(-1, 0, 0), greyDiffuse));
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(0, offset, 0), Vector3D(0, -1, 0), greyDiffuse));
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(0, -offset, 0), Vector3D(0, 1, 0), greyDiffuse));
+    myScene.AddObject(myScene.create<InfinitePlan>(Vector3D(0, 0, 3 * offset), Vector3D(0, 0, -1), greyDiffuse));
+    myScene.AddObject(myScene.create<Sphere>(1.0, Matrix4x4::translate(Vector3D(0.0, -2.0, 5.0)), blueGlossy));
+
+    // 4x4 grid of small lights below the ceiling
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            myScene.AddObject(myScene.create<Sphere>(0.08, Matrix4x4::translate(Vector3D(-3.0 + 2.0 * i, 2.6, 3.0 + 1.5 * j)), emissive));
+}
+
 void buildSceneSphere(Camera*& cam, Film*& film,
     Scene myScene)
 {
@@ -118,22 +261,22 @@ void buildSceneSphere(Camera*& cam, Film*& film,
     /* ************************** */
     /* DEFINE YOUR MATERIALS HERE */
     /* ************************** */
-    Material* green_100 = new Phong(Vector3D(0.2, 0.7, 0.3), Vector3D(0.2, 0.6, 0.2), 50);
+    Material* green_100 = myScene.create<Phong>(Vector3D(0.2, 0.7, 0.3), Vector3D(0.2, 0.6, 0.2), 50);
 
     // Define and place a sphere
     Matrix4x4 sphereTransform1;
     sphereTransform1 = sphereTransform1.translate(Vector3D(-1.25, 0.5, 4.0));
-    Shape* s1 = new Sphere(1.0, sphereTransform1, green_100);
+    Shape* s1 = myScene.create<Sphere>(1.0, sphereTransform1, green_100);
 
     // Define and place a sphere
     Matrix4x4 sphereTransform2;
     sphereTransform2 = sphereTransform2.translate(Vector3D(1.25, 0.0, 6));
-    Shape* s2 = new Sphere(1.25, sphereTransform2, green_100);
+    Shape* s2 = myScene.create<Sphere>(1.25, sphereTransform2, green_100);
 
     // Define and place a sphere
     Matrix4x4 sphereTransform3;
     sphereTransform3 = sphereTransform3.translate(Vector3D(1.0, -0.75, 3.5));
-    Shape* s3 = new Sphere(0.25, sphereTransform3, green_100);
+    Shape* s3 = myScene.create<Sphere>(0.25, sphereTransform3, green_100);
 
     // Store the objects in the object list
     myScene.AddObject(s1);
@@ -142,8 +285,10 @@ void buildSceneSphere(Camera*& cam, Film*& film,
    
 }
 
+// pass > 0 averages the new pass with the previous ones already in the film
 void raytrace(Camera* &cam, Shader* &shader, Film* &film,
-              std::vector<Shape*>* &objectsList, std::vector<LightSource*>* &lightSourceList)
+              std::vector<Shape*>* &objectsList, std::vector<LightSource*>* &lightSourceList,
+              size_t pass = 0)
 {
     
     double my_PI = 0.0;
@@ -152,34 +297,59 @@ void raytrace(Camera* &cam, Shader* &shader, Film* &film,
 
     size_t resX = film->getWidth();
     size_t resY = film->getHeight();
+    // Camera rays per pixel (sample budget of the shader)
+    size_t spp = std::max<size_t>(1, shader->getRenderSettings().samplesPerPixel);
+
+    // Let the shader precompute its per-pass data (e.g. photon maps)
+    shader->beginPass(pass, *objectsList, *lightSourceList);
 
     // Main raytracing loop
-    // Out-most loop invariant: we have rendered lin lines
-    for(size_t lin=0; lin<resY; lin++)
+    // The lines are distributed among the threads of the pool (the threads
+    // of a NUMA node render the lines of its band when they are pinned)
+    std::atomic<size_t> renderedLines(0);
+    ThreadPool::global().parallelForLocal(resY, 1, [&](size_t begin, size_t end)
     {
-        // Show progression 
-        double progress = (double)lin / double(resY);
-        Utils::printProgress(progress);
-
-        // Inner loop invariant: we have rendered col columns
-        for(size_t col=0; col<resX; col++)
+        for(size_t lin=begin; lin<end; lin++)
         {
-            // Compute the pixel position in NDC
-            double x = (double)(col + 0.5) / resX;
-            double y = (double)(lin + 0.5) / resY;
-            // Generate the camera ray
-            Ray cameraRay = cam->generateRay(x, y);
-            Vector3D pixelColor = Vector3D(0.0);
-
-            // Compute ray color according to the used shader
-            pixelColor += shader->computeColor(cameraRay, *objectsList, *lightSourceList);
-
-            // Store the pixel color
-            film->setPixelValue(col, lin, pixelColor);
+            // Same random sequence for a line whichever thread renders it
+            Random::seed(Random::hash(lin, pass));
+
+            // Inner loop invariant: we have rendered col columns
+            for(size_t col=0; col<resX; col++)
+            {
+                Vector3D pixelColor = Vector3D(0.0);
+                for (size_t sample = 0; sample < spp; sample++)
+                {
+                    // Compute the pixel position in NDC (pixel center for a
+                    // single sample, random positions in the pixel otherwise)
+                    double x = (double)(col + (spp > 1 ? Random::uniform() : 0.5)) / resX;
+                    double y = (double)(lin + (spp > 1 ? Random::uniform() : 0.5)) / resY;
+                    // Generate the camera ray
+                    Ray cameraRay = cam->generateRay(x, y);
+
+                    // Compute ray color according to the used shader
+                    pixelColor += shader->computeColor(cameraRay, *objectsList, *lightSourceList);
+                }
+                pixelColor /= (double)spp;
+
+                // Running mean of the passes
+                if (pass > 0)
+                    pixelColor = film->getPixelValue(col, lin) + (pixelColor - film->getPixelValue(col, lin)) / double(pass + 1);
+
+                // Store the pixel color
+                film->setPixelValue(col, lin, pixelColor);
+            }
+
+            // Show progression (only from the calling thread)
+            size_t done = ++renderedLines;
+            if (ThreadPool::getThreadIndex() == 0)
+                Utils::printProgress((double)done / double(resY));
         }
-    }
-
+    });
 
+    // Light tracing splats of this pass (BDPT) enter the running mean too,
+    // averaged over the samples of the pixels
+    film->resolveSplats(1.0 / ((pass + 1) * spp));
 }
 
 
@@ -209,16 +379,341 @@ void PaintImage(Film* film)
     }
 }
 
-int main()
+// Distributed rendering from the command line. Every process renders a tile
+// and/or a range of passes of the scene built in main() with the progressive
+// renderer and saves it as a checkpoint; the merge step puts them together:
+//   ACG --tile x0 y0 x1 y1 --passes first count --out part.ckpt
+//   ACG --merge merged.ckpt part1.ckpt part2.ckpt ...
+// or serves render jobs read from the standard input (see RenderServer):
+//   ACG --server
+// The scene can be read from a binary scene file, and the scene built in
+// main() can be converted to one (see SceneFile):
+//   ACG --scene cornell.acgscene ...
+//   ACG --export-scene cornell.acgscene
+// The tiled EXR writer can be checked against a progressive render:
+//   ACG --tile-check
+// On NUMA machines the threads can be pinned to the nodes, and the compiled
+// scene replicated per node; --numa-bench compares the placements:
+//   ACG --pin [--replicate-scene] ...
+//   ACG --numa-bench [spp]
+// The render can be profiled: the time, rays and depth of every pixel are
+// saved as heatmaps (name_time.png, ...) and EXR channels (name_cost.exr):
+//   ACG --cost-heatmap name
+struct CommandLine
+{
+    bool server = false;
+    bool tileCheck = false;
+    bool pinThreads = false;
+    bool replicateScene = false;
+    size_t numaBenchSpp = 0;                // Samples per pixel of the NUMA benchmark (0: none)
+    std::string sceneFile;                  // Scene to load (empty: built in main)
+    std::string exportFile;                 // Save the scene built in main and exit
+    ProgressiveRenderer::Settings partial;
+    std::string partialFile;                // Partial render output (empty: full render)
+    std::string mergeFile;                  // Merge output (empty: no merge)
+    std::vector<std::string> mergeInputs;
+    std::string costFile;                   // Base name of the cost heatmaps (empty: no profiling)
+};
+
+bool parseSize(const char* text, size_t &value)
+{
+    char* end = nullptr;
+    unsigned long long v = std::strtoull(text, &end, 10);
+    if (end == text || *end != '\0')
+        return false;
+    value = (size_t)v;
+    return true;
+}
+
+bool parseCommandLine(int argc, char** argv, CommandLine &cmd)
+{
+    cmd.partial.targetSpp = 1;
+    bool partialOptions = false;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--tile" && i + 4 < argc)
+        {
+            ProgressiveRenderer::Settings &p = cmd.partial;
+            if (!parseSize(argv[i + 1], p.x0) || !parseSize(argv[i + 2], p.y0)
+                || !parseSize(argv[i + 3], p.x1) || !parseSize(argv[i + 4], p.y1))
+                return false;
+            partialOptions = true;
+            i += 4;
+        }
+        else if (arg == "--passes" && i + 2 < argc)
+        {
+            if (!parseSize(argv[i + 1], cmd.partial.firstPass) || !parseSize(argv[i + 2], cmd.partial.targetSpp))
+                return false;
+            partialOptions = true;
+            i += 2;
+        }
+        else if (arg == "--server")
+            cmd.server = true;
+        else if (arg == "--tile-check")
+            cmd.tileCheck = true;
+        else if (arg == "--pin")
+            cmd.pinThreads = true;
+        else if (arg == "--replicate-scene")
+            cmd.replicateScene = true;
+        else if (arg == "--numa-bench")
+        {
+            cmd.numaBenchSpp = 4;
+            if (i + 1 < argc && !parseSize(argv[++i], cmd.numaBenchSpp))
+                return false;
+        }
+        else if (arg == "--scene" && i + 1 < argc)
+            cmd.sceneFile = argv[++i];
+        else if (arg == "--export-scene" && i + 1 < argc)
+            cmd.exportFile = argv[++i];
+        else if (arg == "--cost-heatmap" && i + 1 < argc)
+            cmd.costFile = argv[++i];
+        else if (arg == "--out" && i + 1 < argc)
+            cmd.partialFile = argv[++i];
+        else if (arg == "--merge" && i + 2 < argc)
+        {
+            cmd.mergeFile = argv[++i];
+            while (i + 1 < argc)
+                cmd.mergeInputs.push_back(argv[++i]);
+        }
+        else
+            return false;
+    }
+    // Tiles and pass ranges are only useful saved for the merge
+    return !partialOptions || !cmd.partialFile.empty();
+}
+
+int mergePartials(Film* film, const CommandLine &cmd)
+{
+    // The merge rounds differently depending on the order of the parts
+    std::vector<std::string> inputs = cmd.mergeInputs;
+    std::sort(inputs.begin(), inputs.end());
+
+    CheckpointInfo info;
+    for (const std::string &input : inputs)
+    {
+        if (!film->mergeCheckpoint(input, info))
+        {
+            std::cout << "Could not merge " << input << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "Merged " << inputs.size() << " parts (up to " << info.passes << " spp)" << std::endl;
+    if (!film->saveCheckpoint(cmd.mergeFile, info))
+        return 1;
+    return film->saveEXR() ? 0 : 1;
+}
+
+// Round trip of the tiled EXR writer: a small Cornell box rendered by tiles
+// (with partial tiles at the borders) and progressively with the same
+// samples must decode to the same pixels, in the same order
+int tileRoundTrip()
+{
+    const size_t width = 90, height = 64, spp = 2;
+    const char* filename = "tilecheck.exr";
+    Film* film = new Film(width, height);
+    Camera* cam = nullptr;
+    Scene scene;
+    buildSceneCornellBox(cam, film, scene);
+    NormalShader shader(Vector3D(1, 0, 0), Vector3D(0.0));
+
+    TileRenderer::Settings tileSettings;
+    tileSettings.spp = spp;
+    tileSettings.tileSize = 16;
+    tileSettings.showProgress = false;
+    TileRenderer tiled(tileSettings);
+    bool ok = tiled.render(*cam, shader, width, height, filename, *scene.objectsList, *scene.LightSourceList);
+
+    ProgressiveRenderer::Settings progressiveSettings;
+    progressiveSettings.targetSpp = spp;
+    progressiveSettings.showProgress = false;
+    ProgressiveRenderer progressive(progressiveSettings);
+    progressive.render(*cam, shader, *film, *scene.objectsList, *scene.LightSourceList);
+
+    // Decode the tiles. tinyexr flips the lines of every tile when the
+    // line order is not increasing Y, against the format (which places
+    // tiles by their coordinates), so the order is ignored
+    EXRVersion version;
+    EXRHeader header;
+    EXRImage image;
+    InitEXRHeader(&header);
+    InitEXRImage(&image);
+    const char* err = nullptr;
+    ok = ok && ParseEXRVersionFromFile(&version, filename) == TINYEXR_SUCCESS
+        && ParseEXRHeaderFromFile(&header, &version, filename, &err) == TINYEXR_SUCCESS;
+    if (ok)
+    {
+        header.line_order = 0;
+        ok = LoadEXRImageFromFile(&image, &header, filename, &err) == TINYEXR_SUCCESS
+            && header.tiled && header.num_channels == 3
+            && image.width == (int)width && image.height == (int)height;
+    }
+
+    // Channels B, G, R (alphabetical order) against the progressive film
+    double maxError = ok ? 0 : INFINITY;
+    for (int t = 0; ok && t < image.num_tiles; t++)
+    {
+        const EXRTile &tile = image.tiles[t];
+        for (int j = 0; j < tile.height; j++)
+            for (int i = 0; i < tile.width; i++)
+            {
+                size_t col = (size_t)(tile.offset_x * header.tile_size_x + i);
+                size_t lin = (size_t)(tile.offset_y * header.tile_size_y + j);
+                Vector3D expected = film->getPixelValue(col, lin);
+                size_t index = (size_t)(j * header.tile_size_x + i);
+                double decoded[3];
+                for (int c = 0; c < 3; c++)
+                    decoded[c] = ((const float*)tile.images[c])[index];
+                maxError = std::max({ maxError, std::abs(decoded[2] - expected.x),
+                                      std::abs(decoded[1] - expected.y), std::abs(decoded[0] - expected.z) });
+            }
+    }
+    if (!ok)
+        std::cout << "Could not read back " << filename << (err ? ": " : "") << (err ? err : "") << std::endl;
+    if (err)
+        FreeEXRErrorMessage(err);
+    FreeEXRImage(&image);
+    FreeEXRHeader(&header);
+    scene.release();
+    delete cam;
+    delete film;
+    std::remove(filename);
+
+    std::cout << "Tiled EXR round trip: max difference " << maxError << std::endl;
+    return maxError < 1e-5 ? 0 : 1;
+}
+
+// Cornell box rendered with every thread placement: free threads, threads
+// pinned to the NUMA nodes (film lines written by their node), and pinned
+// with a copy of the compiled scene per node
+int numaBenchmark(size_t spp)
+{
+    struct Placement
+    {
+        const char* name;
+        bool pin;
+        bool replicate;
+    };
+    const Placement placements[] = {
+        { "unpinned", false, false },
+        { "pinned", true, false },
+        { "pinned + replicated scene", true, true },
+    };
+
+    std::cout << "NUMA nodes: " << Numa::getNodeCount() << ", threads: "
+              << ThreadPool::global().getThreadCount() << std::endl;
+    for (size_t node = 0; node < Numa::getNodeCount(); node++)
+        std::cout << "  node " << node << ": " << Numa::getNodeCpus(node).size() << " CPUs" << std::endl;
+
+    double baseTime = 0;
+    for (const Placement &placement : placements)
+    {
+        // The film is created after the threads are placed (first touch)
+        ThreadPool::global().setPinning(placement.pin);
+        CompiledScene::setReplication(placement.replicate);
+        Film* film = new Film(720, 512);
+        Camera* cam = nullptr;
+        Scene scene;
+        buildSceneCornellBox(cam, film, scene);
+        NEEImprovedIntegrator shader(Vector3D(1, 0, 0), Vector3D(0.0));
+
+        ProgressiveRenderer::Settings settings;
+        settings.targetSpp = spp;
+        settings.showProgress = false;
+        ProgressiveRenderer renderer(settings);
+        renderer.render(*cam, shader, *film, *scene.objectsList, *scene.LightSourceList);
+
+        double time = renderer.getElapsedTime();
+        if (baseTime == 0)
+            baseTime = time;
+        std::cout << placement.name << ": " << time << " s (" << spp << " spp, speedup x"
+                  << baseTime / time << ")" << std::endl;
+        scene.release();
+        delete cam;
+        delete film;
+    }
+    ThreadPool::global().setPinning(false);
+    CompiledScene::setReplication(false);
+    return 0;
+}
+
+int serveJobs()
+{
+    Vector3D bgColor(0.0, 0.0, 0.0);
+    Vector3D intersectionColor(1, 0, 0);
+    RenderServer server([=]() { return new NEEImprovedIntegrator(intersectionColor, bgColor); });
+
+    server.addScene("cornell", [](Camera*& cam, Film*& film, Scene scene, const std::string&) {
+        buildSceneCornellBox(cam, film, scene);
+    });
+    server.addScene("spheres", [](Camera*& cam, Film*& film, Scene scene, const std::string&) {
+        buildSceneSphere(cam, film, scene);
+    });
+    server.addScene("grid", [](Camera*& cam, Film*& film, Scene scene, const std::string &args) {
+        int gridSize = args.empty() ? 16 : std::max(1, std::atoi(args.c_str()));
+        buildSceneSphereGrid(cam, film, scene, gridSize);
+    });
+    server.addScene("hardlit", [](Camera*& cam, Film*& film, Scene scene, const std::string&) {
+        buildSceneHardLit(cam, film, scene);
+    });
+    server.addScene("spherelights", [](Camera*& cam, Film*& film, Scene scene, const std::string&) {
+        buildSceneSphereLights(cam, film, scene);
+    });
+    // scene=file:path.acgscene
+    server.addScene("file", [](Camera*& cam, Film*& film, Scene scene, const std::string &path) {
+        if (!SceneFile::load(path, scene, cam, *film))
+            cam = nullptr;
+    });
+
+    // The standard output is the protocol: the messages of the scene
+    // builders and the renderer go to the error output meanwhile
+    std::streambuf* protocol = std::cout.rdbuf(std::cerr.rdbuf());
+    std::ostream out(protocol);
+    server.serve(std::cin, out);
+    std::cout.rdbuf(protocol);
+    return 0;
+}
+
+int main(int argc, char** argv)
 {
     std::string separator     = "\n----------------------------------------------\n";
     std::string separatorStar = "\n**********************************************\n";
-    std::cout << separator << "RT-ACG - Ray Tracer for \"Advanced Computer Graphics\"" << separator << std::endl;
+    CommandLine cmd;
+    bool validCommandLine = parseCommandLine(argc, argv, cmd);
+    // The standard output of the server is its protocol
+    std::ostream &log = cmd.server ? std::cerr : std::cout;
+    log << separator << "RT-ACG - Ray Tracer for \"Advanced Computer Graphics\"" << separator << std::endl;
+
+    if (!validCommandLine)
+    {
+        log << "Usage: ACG [--tile x0 y0 x1 y1] [--passes first count] [--out part.ckpt]" << std::endl
+           << "       ACG --merge merged.ckpt part1.ckpt part2.ckpt ..." << std::endl
+           << "       ACG --server" << std::endl
+           << "       ACG --export-scene scene.acgscene" << std::endl
+           << "       ACG --tile-check" << std::endl
+           << "       ACG --numa-bench [spp]" << std::endl
+           << "Options: --scene scene.acgscene (instead of the scene built in main)" << std::endl
+           << "         --pin [--replicate-scene] (NUMA placement of the threads)" << std::endl
+           << "         --cost-heatmap name (per-pixel render cost: name_*.png, name_cost.exr)" << std::endl;
+        return 1;
+    }
+    if (cmd.tileCheck)
+        return tileRoundTrip();
+    if (cmd.numaBenchSpp > 0)
+        return numaBenchmark(cmd.numaBenchSpp);
+    // Before the film is created, so its lines are placed on their nodes
+    ThreadPool::global().setPinning(cmd.pinThreads);
+    CompiledScene::setReplication(cmd.replicateScene);
+    if (cmd.server)
+        return serveJobs();
 
     // Create an empty film
     Film *film;
     film = new Film(720, 512);
 
+    if (!cmd.mergeFile.empty())
+        return mergePartials(film, cmd);
+
 
     // Declare the shader
     Vector3D bgColor(0.0, 0.0, 0.0); // Background color (for rays which do not intersect anything)
@@ -234,26 +729,129 @@ int main()
     //Shader* purepathshader = new PurePathIntegrator(intersectionColor, bgColor);
     //Shader* neeshader = new NEEIntegrator(intersectionColor, bgColor);
     Shader* neeimprovedshader = new NEEImprovedIntegrator(intersectionColor, bgColor);
+    //Shader* neeimprovedshader = new NEEImprovedIntegrator(intersectionColor, bgColor,
+    //    LightSource::SOLID_ANGLE_SAMPLING); // Less noise close to the lights
+    //Shader* neeimprovedshader = new NEEImprovedIntegrator(intersectionColor, bgColor,
+    //    new IrradianceCache(Vector3D(0.0, 0.0, 4.5), 8.0)); // Irradiance caching mode
+    //Shader* ppmshader = new PhotonMappingIntegrator(intersectionColor, bgColor, 200000, 0.1, 0.3);
+    //Shader* guidedshader = new GuidedPathIntegrator(intersectionColor, bgColor,
+    //    new SDTree(Vector3D(0.0, 0.0, 4.5), 8.0)); // Path guiding (needs several passes)
+    // Sample budgets of a shader (cost against quality) without recompiling
+    //RenderSettings renderSettings = neeimprovedshader->getRenderSettings();
+    //renderSettings.samplesPerPixel = 4;
+    //renderSettings.bounceSamples = 25; // 25 hemisphere samples at the first hit...
+    //renderSettings.splittingFactor = 0.2; // ...then 5 at the second one and 1 deeper
+    //renderSettings.maxDepth = 4;
+    //neeimprovedshader->setRenderSettings(renderSettings);
 
   
 
     // Build the scene---------------------------------------------------------
     // 
     // Declare pointers to all the variables which describe the scene
-    Camera* cam;
+    Camera* cam = nullptr;
     Scene myScene;
     //Create Scene Geometry and Illumiantion
-    //buildSceneSphere(cam, film, myScene); //Task 2,3,4;
-    buildSceneCornellBox(cam, film, myScene); //Task 5
+    if (!cmd.sceneFile.empty())
+    {
+        if (!SceneFile::load(cmd.sceneFile, myScene, cam, *film))
+        {
+            std::cout << "Could not load " << cmd.sceneFile << std::endl;
+            return 1;
+        }
+        if (!cam)
+            cam = new PerspectiveCamera(Matrix4x4(), Utils::degreesToRadians(60), *film);
+    }
+    else
+    {
+        //buildSceneSphere(cam, film, myScene); //Task 2,3,4;
+        buildSceneCornellBox(cam, film, myScene); //Task 5
+        //buildSceneSphereGrid(cam, film, myScene, 16); // Large scene
+        //buildSceneHardLit(cam, film, myScene); // Mostly indirect lighting (path guiding)
+        //buildSceneSphereLights(cam, film, myScene); // Many small spherical lights
+        //buildSceneOutdoor(cam, film, myScene, "sky.exr"); // HDR environment map
+    }
+
+    // Bidirectional path tracing needs the camera of the scene
+    //Shader* bdptshader = new BDPTIntegrator(intersectionColor, bgColor, dynamic_cast<PerspectiveCamera*>(cam), film);
 
     //---------------------------------------------------------------------------
 
+    if (!cmd.exportFile.empty())
+        return SceneFile::save(cmd.exportFile, myScene, cam) ? 0 : 1;
+
     //Paint Image ONLY TASK 1
     //PaintImage(film);
 
+    // Part of a distributed render (see parseCommandLine)
+    if (!cmd.partialFile.empty())
+    {
+        ProgressiveRenderer partial(cmd.partial);
+        partial.render(*cam, *neeimprovedshader, *film, *myScene.objectsList, *myScene.LightSourceList);
+        CheckpointInfo info;
+        info.passes = partial.getPassCount();
+        info.elapsedTime = partial.getElapsedTime();
+        return film->saveCheckpoint(cmd.partialFile, info) ? 0 : 1;
+    }
+
     // Launch some rays! TASK 2,3,...   
     auto start = high_resolution_clock::now();
-    raytrace(cam, neeimprovedshader, film, myScene.objectsList, myScene.LightSourceList);
+    if (!cmd.costFile.empty())
+    {
+        // Instrumented render: where the time of the image goes
+        CostProfiler profiler;
+        profiler.render(*cam, *neeimprovedshader, *film, *myScene.objectsList, *myScene.LightSourceList);
+        std::cout << "Profiled " << profiler.getRayCount() << " rays in " << profiler.getElapsedTime() << " s" << std::endl;
+        if (!profiler.save(*film, cmd.costFile))
+            std::cout << "Could not save the cost heatmaps " << cmd.costFile << "_*" << std::endl;
+    }
+    else
+        raytrace(cam, neeimprovedshader, film, myScene.objectsList, myScene.LightSourceList);
+    // Progressive shaders: photon mapping shoots new photons with a smaller
+    // radius every pass, path guiding learns from the previous passes
+    //for (size_t pass = 0; pass < 16; pass++)
+    //    raytrace(cam, ppmshader, film, myScene.objectsList, myScene.LightSourceList, pass);
+    // Wavefront (stream-based) path tracing instead of the recursive shaders
+    //WavefrontRenderer wavefront(bgColor, 16, 5);
+    //wavefront.setRaySorting(RaySorter::MORTON);
+    //wavefront.render(*cam, *film, *myScene.objectsList, *myScene.LightSourceList);
+    // Direct light only, resampled (ReSTIR): one shadow ray per pixel and pass
+    //ReSTIRRenderer restir(bgColor);
+    //for (size_t pass = 0; pass < 16; pass++)
+    //    restir.renderPass(*cam, *film, *myScene.objectsList, *myScene.LightSourceList, pass);
+    // Look development: trace the camera rays once, then reshade the cached
+    // hits after every edit of a light or a material (direct light only, or
+    // with the indirect light of a shader)
+    //RelightRenderer relighter(RelightRenderer::Settings{});
+    //relighter.capture(*cam, film->getWidth(), film->getHeight(), *myScene.objectsList, *myScene.LightSourceList);
+    //relighter.relight(*film, *myScene.objectsList, *myScene.LightSourceList);
+    //relighter.relight(*film, *myScene.objectsList, *myScene.LightSourceList, neeimprovedshader);
+    // Animation: 48 frames of a camera turning around the box, 16 spp each
+    //SequenceRenderer::Settings sequenceSettings;
+    //sequenceSettings.frameCount = 48;
+    //sequenceSettings.frame.targetSpp = 16;
+    //SequenceRenderer sequence(sequenceSettings);
+    //AnimatedTransform turntable(Vector3D(0, 1, 0), Vector3D(0, 0, 4.5));
+    //turntable.addKey(0.0, Vector3D(0.0), 0.0);
+    //turntable.addKey(2.0, Vector3D(0.0), Utils::degreesToRadians(30));
+    //sequence.animateCamera(turntable);
+    //sequence.render(*cam, *neeimprovedshader, *film, *myScene.objectsList, *myScene.LightSourceList);
+    // Gigapixel image straight to a tiled EXR: only the tiles being rendered
+    // are in memory (the camera keeps the aspect ratio of the film)
+    //TileRenderer::Settings tileSettings;
+    //tileSettings.spp = 16;
+    //TileRenderer tiled(tileSettings);
+    //tiled.render(*cam, *neeimprovedshader, 72000, 51200, "gigapixel.exr", *myScene.objectsList, *myScene.LightSourceList);
+    // Best image in a time budget: one sample per pixel and pass until 30 s,
+    // 1024 spp or 1% noise, with a snapshot every 10 s
+    //ProgressiveRenderer::Settings progressiveSettings;
+    //progressiveSettings.timeBudget = 30.0;
+    //progressiveSettings.targetSpp = 1024;
+    //progressiveSettings.noiseTarget = 0.01;
+    //progressiveSettings.snapshotInterval = 10.0;
+    //progressiveSettings.checkpointInterval = 60.0; // Resume with progressive.resume("render.ckpt", *film)
+    //ProgressiveRenderer progressive(progressiveSettings);
+    //progressive.render(*cam, *neeimprovedshader, *film, *myScene.objectsList, *myScene.LightSourceList);
     auto stop = high_resolution_clock::now();
 
     
@@ -262,6 +860,11 @@ int main()
     std::cout << "\n\nSaving the result to file output.bmp\n" << std::endl;
     film->save();
     film->saveEXR();
+    // Display-ready copy: exposure, filmic tone mapping and the sRGB curve
+    //ImageOutput::Settings outputSettings;
+    //outputSettings.toneMap = ImageOutput::ACES;
+    //outputSettings.sRGB = true;
+    //ImageOutput(outputSettings).save(*film, "output.png");
 
     float durationS = (durationMs(stop - start) / 1000.0).count() ;
     std::cout <<  "FINAL_TIME(s): " << durationS << std::endl;
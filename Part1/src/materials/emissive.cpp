@@ -32,3 +32,9 @@ Vector3D Emissive::getDiffuseReflectance() const
 {
     return rho_d;
 }
+
+
+Vector3D Emissive::getSpecularReflectance() const
+{
+    return Vector3D(0.0);
+}
@@ -20,6 +20,10 @@ public:
     double getIndexOfRefraction() const;
     Vector3D getEmissiveRadiance() const;
     Vector3D getDiffuseReflectance() const;
+    Vector3D getSpecularReflectance() const;
+
+    // Edit of the light intensity (see RelightRenderer)
+    void setEmissiveRadiance(const Vector3D &Ke_) { Ke = Ke_; }
 
 private:
     Vector3D Ke;    Vector3D rho_d;
@@ -30,3 +30,12 @@ Vector3D Material::getDiffuseReflectance() const
 
     return -1;
 }
+
+
+Vector3D Material::getSpecularReflectance() const
+{
+    std::cout << "Warning! Calling \"Material::getSpecularReflectance()\" for a non-Glossy material"
+        << std::endl;
+
+    return -1;
+}
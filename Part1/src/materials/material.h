@@ -14,6 +14,7 @@ public:
     virtual double getIndexOfRefraction() const; // Return Refraction ratio of Transmissive Materials
     virtual Vector3D getEmissiveRadiance() const; //Return Emissive Radiance of Emissive Materials
     virtual Vector3D getDiffuseReflectance() const; //Return Difusse Coefficient of Phong Materials
+    virtual Vector3D getSpecularReflectance() const; //Return Specular Coefficient of Phong Materials
 
     //Functions to check the material of the object
     virtual bool hasSpecular() const = 0;
@@ -0,0 +1,99 @@
+#include "materialtable.h"
+#include "emissive.h"
+#include "mirror.h"
+#include "phong.h"
+#include "transmissive.h"
+#include "../shapes/shape.h"
+
+#include <unordered_map>
+
+MaterialTable::MaterialTable()
+{ }
+
+MaterialRecord MaterialTable::makeRecord(const Material &material)
+{
+    MaterialRecord r = { MaterialRecord::OTHER, 0, 0.0f, 1.0f,
+                         Vector3D(0.0), Vector3D(0.0), Vector3D(0.0), &material };
+
+    // 1. Classification flags (the only virtual calls, once per material)
+    if (material.hasSpecular()) r.flags |= MaterialRecord::SPECULAR;
+    if (material.hasTransmission()) r.flags |= MaterialRecord::TRANSMISSION;
+    if (material.hasDiffuseOrGlossy()) r.flags |= MaterialRecord::DIFFUSE_OR_GLOSSY;
+    if (material.isEmissive()) r.flags |= MaterialRecord::EMISSIVE_SURFACE;
+
+    // 2. Constants of the known materials, with the normalizations folded in
+    if (const Phong* phong = dynamic_cast<const Phong*>(&material)) {
+        r.type = MaterialRecord::PHONG;
+        r.alpha = phong->getShininess();
+        r.diffuse = phong->getDiffuseReflectance() / M_PI;
+        r.specular = phong->getSpecularReflectance() * ((r.alpha + 2) / (2 * M_PI));
+        if (r.specular.lengthSq() > 0)
+            r.flags |= MaterialRecord::GLOSSY_LOBE;
+    }
+    else if (const Emissive* emissive = dynamic_cast<const Emissive*>(&material)) {
+        r.type = MaterialRecord::EMISSIVE;
+        r.emission = emissive->getEmissiveRadiance();
+        r.diffuse = emissive->getDiffuseReflectance() / 3.1416; // As Emissive::getReflectance
+    }
+    else if (dynamic_cast<const Mirror*>(&material)) {
+        r.type = MaterialRecord::MIRROR;
+    }
+    else if (const Transmissive* transmissive = dynamic_cast<const Transmissive*>(&material)) {
+        r.type = MaterialRecord::TRANSMISSIVE;
+        r.ior = transmissive->getIndexOfRefraction();
+    }
+    else if (r.flags & MaterialRecord::EMISSIVE_SURFACE) {
+        r.emission = material.getEmissiveRadiance();
+    }
+    return r;
+}
+
+void MaterialTable::build(const std::vector<Shape*> &objList)
+{
+    records.clear();
+
+    // Shapes sharing a Material share its record
+    std::unordered_map<const Material*, uint32_t> ids;
+    for (Shape* shape : objList) {
+        const Material* material = &shape->getMaterial();
+        auto it = ids.find(material);
+        if (it == ids.end()) {
+            it = ids.emplace(material, (uint32_t)records.size()).first;
+            records.push_back(makeRecord(*material));
+        }
+        shape->setMaterialId(it->second);
+    }
+    buildArrays();
+}
+
+void MaterialTable::buildArrays()
+{
+    size_t n = records.size();
+    for (std::vector<float>* v : { &arrays.dr, &arrays.dg, &arrays.db, &arrays.sr, &arrays.sg,
+                                   &arrays.sb, &arrays.alpha, &arrays.ior })
+        v->assign(n, 0.0f);
+    arrays.other.assign(n, 0);
+
+    for (size_t id = 0; id < n; id++) {
+        const MaterialRecord &m = records[id];
+        arrays.ior[id] = m.ior;
+        arrays.alpha[id] = m.alpha;
+        if (m.type == MaterialRecord::OTHER) {
+            arrays.other[id] = 1;
+            continue;
+        }
+        if (m.type != MaterialRecord::PHONG && m.type != MaterialRecord::EMISSIVE)
+            continue;
+        arrays.dr[id] = m.diffuse.x; arrays.dg[id] = m.diffuse.y; arrays.db[id] = m.diffuse.z;
+        if (m.type == MaterialRecord::PHONG && (m.flags & MaterialRecord::GLOSSY_LOBE)) {
+            arrays.sr[id] = m.specular.x; arrays.sg[id] = m.specular.y; arrays.sb[id] = m.specular.z;
+        }
+    }
+}
+
+void MaterialTable::getReflectance(const uint32_t* ids, const Vector3D* n, const Vector3D* wo,
+                                   const Vector3D* wi, Vector3D* out, size_t count) const
+{
+    for (size_t k = 0; k < count; k++)
+        out[k] = getReflectance(ids[k], n[k], wo[k], wi[k]);
+}
@@ -0,0 +1,123 @@
+#ifndef MATERIALTABLE_H
+#define MATERIALTABLE_H
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "material.h"
+
+class Shape;
+
+// Flat copy of a material: a type tag and the constants its evaluation
+// needs, already scaled. Records are trivially copyable and live in one
+// contiguous array, so shading a batch of hits touches no vtable.
+struct MaterialRecord
+{
+    enum Type : uint8_t
+    {
+        PHONG,
+        EMISSIVE,
+        MIRROR,
+        TRANSMISSIVE,
+        OTHER          // Unknown Material subclass: evaluated through its virtuals
+    };
+
+    enum Flags : uint8_t
+    {
+        SPECULAR          = 1 << 0,
+        TRANSMISSION      = 1 << 1,
+        DIFFUSE_OR_GLOSSY = 1 << 2,
+        EMISSIVE_SURFACE  = 1 << 3,
+        GLOSSY_LOBE       = 1 << 4   // Phong with Ks != 0
+    };
+
+    uint8_t type;
+    uint8_t flags;
+    float alpha;                // Phong exponent
+    float ior;                  // Index of refraction (transmissive)
+    Vector3D diffuse;           // rho_d / pi
+    Vector3D specular;          // Ks * (alpha + 2) / (2 pi)
+    Vector3D emission;          // Emitted radiance
+    const Material* material;   // Source material (OTHER only)
+
+    bool hasSpecular() const { return flags & SPECULAR; }
+    bool hasTransmission() const { return flags & TRANSMISSION; }
+    bool hasDiffuseOrGlossy() const { return flags & DIFFUSE_OR_GLOSSY; }
+    bool isEmissive() const { return flags & EMISSIVE_SURFACE; }
+};
+
+/**
+ * @brief The MaterialTable class
+ *
+ * Material records of a scene, indexed by material id. build() gives every
+ * distinct Material of the object list an id (stored in the shapes), so a
+ * hit can be shaded from its id with a switch instead of virtual calls.
+ */
+class MaterialTable
+{
+public:
+    MaterialTable();
+
+    // Rebuild the table from the materials of the shapes and set their ids
+    void build(const std::vector<Shape*> &objList);
+
+    size_t size() const { return records.size(); }
+    const MaterialRecord& operator[](uint32_t id) const { return records[id]; }
+
+    // Same value as Material::getReflectance(). n and wi must be unit vectors
+    // (the mirrored direction is then unit too and is not normalized)
+    Vector3D getReflectance(uint32_t id, const Vector3D &n, const Vector3D &wo,
+                            const Vector3D &wi) const
+    {
+        const MaterialRecord &m = records[id];
+        switch (m.type)
+        {
+        case MaterialRecord::PHONG:
+        {
+            Vector3D f = m.diffuse;
+            if (m.flags & MaterialRecord::GLOSSY_LOBE)
+            {
+                double cosR = dot(wo, 2 * dot(n, wi) * n - wi);
+                if (cosR > 0)
+                    f += m.specular * std::pow(cosR, (double)m.alpha);
+            }
+            return f;
+        }
+        case MaterialRecord::EMISSIVE:
+            return m.diffuse;
+        case MaterialRecord::OTHER:
+            return m.material->getReflectance(n, wo, wi);
+        default:
+            return Vector3D(0.0);
+        }
+    }
+
+    // Batched version: out[k] = getReflectance(ids[k], n[k], wo[k], wi[k])
+    void getReflectance(const uint32_t* ids, const Vector3D* n, const Vector3D* wo,
+                        const Vector3D* wi, Vector3D* out, size_t count) const;
+
+    // The constants of the records as one float array per field, indexed by
+    // material id, for packet kernels that gather them. getReflectance() is
+    // diffuse + specular * cos^alpha for every type but OTHER (specular is 0
+    // without a glossy lobe, both are 0 for mirrors and transmissive ones)
+    struct Arrays
+    {
+        std::vector<float> dr, dg, db;
+        std::vector<float> sr, sg, sb;
+        std::vector<float> alpha;
+        std::vector<float> ior;
+        std::vector<uint8_t> other;
+    };
+    const Arrays& getArrays() const { return arrays; }
+
+private:
+    static MaterialRecord makeRecord(const Material &material);
+    void buildArrays();
+
+    std::vector<MaterialRecord> records;
+    Arrays arrays;
+};
+
+#endif // MATERIALTABLE_H
@@ -36,3 +36,8 @@ Vector3D Mirror::getDiffuseReflectance() const
     return rho_d;
 }
 
+
+Vector3D Mirror::getSpecularReflectance() const
+{
+    return Ks;
+}
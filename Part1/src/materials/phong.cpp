@@ -39,3 +39,8 @@ Vector3D Phong::getDiffuseReflectance() const
     return rho_d;
 }
 
+
+Vector3D Phong::getSpecularReflectance() const
+{
+    return Ks;
+}
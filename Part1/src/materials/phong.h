@@ -22,6 +22,13 @@ public:
     double getIndexOfRefraction() const;
     Vector3D getEmissiveRadiance() const;
     Vector3D getDiffuseReflectance() const;
+    Vector3D getSpecularReflectance() const;
+    float getShininess() const { return alpha; }
+
+    // Edits of the material (look development, see RelightRenderer)
+    void setDiffuseReflectance(const Vector3D &rho_d_) { rho_d = rho_d_; }
+    void setSpecularReflectance(const Vector3D &Ks_) { Ks = Ks_; }
+    void setShininess(float alpha_) { alpha = alpha_; }
 
 
 private:
@@ -36,3 +36,8 @@ Vector3D Transmissive::getDiffuseReflectance() const
     return rho_d;
 }
 
+
+Vector3D Transmissive::getSpecularReflectance() const
+{
+    return Ks;
+}
@@ -23,6 +23,7 @@ public:
     double getIndexOfRefraction() const;
     Vector3D getEmissiveRadiance() const;
     Vector3D getDiffuseReflectance() const;
+    Vector3D getSpecularReflectance() const;
 
 
 private:
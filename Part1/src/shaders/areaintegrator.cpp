@@ -2,12 +2,23 @@
 #include "../core/utils.h"
 #include "../core/hemisphericalsampler.h"
 
+namespace
+{
+    // 256 samples per area light
+    RenderSettings defaultSettings()
+    {
+        RenderSettings settings;
+        settings.lightSamples = 256;
+        return settings;
+    }
+}
+
 AreaIntegrator::AreaIntegrator() :
-    hitColor(Vector3D(1, 0, 0))
+    Shader(Vector3D(0.0), defaultSettings()), hitColor(Vector3D(1, 0, 0))
 { }
 
 AreaIntegrator::AreaIntegrator(Vector3D hitColor_, Vector3D bgColor_) :
-    Shader(bgColor_), hitColor(hitColor_)
+    Shader(bgColor_, defaultSettings()), hitColor(hitColor_)
 { }
 
 Vector3D AreaIntegrator::computeColor(const Ray &r, const std::vector<Shape*> &objList, const std::vector<LightSource*> &lsList) const
@@ -70,19 +81,19 @@ Vector3D AreaIntegrator::computeColor(const Ray &r, const std::vector<Shape*> &o
         
         // 3. PHONG MATERIAL
         else if (material.hasDiffuseOrGlossy()) {
-            int N = 256;
+            int N = settings.lightSamples;
             // For every light source...
             for (int i = 0; i < lsList.size(); i++) {
                 // For every sample in the area lightsource...
                 for (int j = 0; j < N; j++) {
-                    // Incident light position
-                    Vector3D lightPos = lsList[i]->sampleLightPosition();
+                    // Incident light position, with its radiance and pdf (per unit solid angle)
+                    LightSample lightSample = lsList[i]->sample(its.itsPoint);
+                    if (lightSample.pdf <= 0) continue;
+                    Vector3D lightPos = lightSample.position;
                     // Incident light direction (from its to lightsource position)
                     wi = (lightPos - its.itsPoint).normalized();
-                    // Geometric term (negative scalar products will be black, a value of 0)
-                    double geometricTerm = (std::max(0.0, dot(wi, n))
-                        * std::max(0.0, dot(-wi, lsList[i]->getNormal())))
-                        / pow((lightPos - its.itsPoint).length(), 2);
+                    // Geometric term over the pdf (negative scalar products will be black, a value of 0)
+                    double geometricTerm = std::max(0.0, dot(wi, n)) / lightSample.pdf;
 
                     // VISIBILITY TERM
                     // Ray from its to the light source
@@ -94,7 +105,7 @@ Vector3D AreaIntegrator::computeColor(const Ray &r, const std::vector<Shape*> &o
                         double distItsToLight = (lightPos - its.itsPoint).length();
                         double distItsToObstacle = (shadowIts.itsPoint - its.itsPoint).length();
                         // If there is an obstacle between its and light...
-                        if (distItsToObstacle < distItsToLight) {
+                        if (distItsToObstacle < distItsToLight - Epsilon) {
                             V = 0; // Object is not visible
                         }
                         else V = 1; // Else, object is visible
@@ -105,10 +116,10 @@ Vector3D AreaIntegrator::computeColor(const Ray &r, const std::vector<Shape*> &o
                         // REFLECTANCE OF THE MATERIAL (diffuse + specular)
                         fr = material.getReflectance(n, wo, wi);
 						// Emmited light intensity from the area light source
-                        Vector3D Le = lsList[i]->getIntensity();
+                        Vector3D Le = lightSample.radiance;
 
                         // DIRECT ILLUMINATION (DIFFUSE + SPECULAR)
-                        color += 1.0 / N * (Le * fr * geometricTerm) * lsList[i]->getArea();
+                        color += 1.0 / N * (Le * fr * geometricTerm);
                     }
                 }
             }
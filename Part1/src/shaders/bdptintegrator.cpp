@@ -0,0 +1,457 @@
+#include "bdptintegrator.h"
+#include "../core/utils.h"
+#include "../core/hemisphericalsampler.h"
+#include "../core/random.h"
+
+#include <algorithm>
+
+namespace
+{
+    // Bounces of a full path by default and at most (maxDepth of the
+    // settings), and vertices of a subpath for both: sizes of the path
+    // buffers on the stack
+    const int DEFAULT_MAX_DEPTH = 5;
+    const int MAX_DEPTH_LIMIT = 16;
+    const int DEFAULT_VERTICES = DEFAULT_MAX_DEPTH + 2;
+    const int MAX_VERTICES = MAX_DEPTH_LIMIT + 2;
+
+    RenderSettings defaultSettings()
+    {
+        RenderSettings settings;
+        settings.maxDepth = DEFAULT_MAX_DEPTH;
+        return settings;
+    }
+
+    typedef BDPTIntegrator::Vertex Vertex;
+
+    // Solid angle density at 'from' to area density at 'to'
+    double convertDensity(double pdfDir, const Vertex &from, const Vertex &to)
+    {
+        if (pdfDir == 0)
+            return 0;
+        Vector3D w = to.p - from.p;
+        double dist2 = w.lengthSq();
+        double pdf = pdfDir / dist2;
+        if (to.type != Vertex::CAMERA)
+            pdf *= std::abs(dot(to.n, w / std::sqrt(dist2)));
+        return pdf;
+    }
+
+    bool isBlack(const Vector3D &v)
+    {
+        return v.x == 0 && v.y == 0 && v.z == 0;
+    }
+}
+
+BDPTIntegrator::BDPTIntegrator(Vector3D hitColor_, Vector3D bgColor_, const PerspectiveCamera* camera_, Film* film_) :
+    Shader(bgColor_, defaultSettings()), hitColor(hitColor_), camera(camera_), film(film_)
+{ }
+
+void BDPTIntegrator::beginPass(size_t, const std::vector<Shape*> &,
+                               const std::vector<LightSource*> &lsList)
+{
+    lights.clear();
+    environments.clear();
+    for (const LightSource* ls : lsList) {
+        if (ls->isEnvironment())
+            environments.push_back(ls);
+        else if (ls->getShape() && ls->getArea() > 0)
+            lights.push_back(ls);
+    }
+}
+
+Vector3D BDPTIntegrator::computeColor(const Ray &r,
+                                      const std::vector<Shape*> &objList,
+                                      const std::vector<LightSource*> &lsList) const
+{
+    // Buffers sized at compile time: the largest ones cost a lot more to
+    // set up for every sample, so the default depth has its own
+    int maxDepth = std::clamp(settings.maxDepth, 0, MAX_DEPTH_LIMIT);
+    if (maxDepth <= DEFAULT_MAX_DEPTH)
+        return tracePaths<DEFAULT_VERTICES>(r, maxDepth, objList, lsList);
+    return tracePaths<MAX_VERTICES>(r, maxDepth, objList, lsList);
+}
+
+template <int Capacity>
+Vector3D BDPTIntegrator::tracePaths(const Ray &r, int maxDepth, const std::vector<Shape*> &objList,
+                                    const std::vector<LightSource*> &lsList) const
+{
+    Vertex cameraPath[Capacity];
+    Vertex lightPath[Capacity];
+
+    // 1. Trace both subpaths
+    Escape escape = { Vector3D(0.0), Vector3D(0.0), 0.0 };
+    int nCamera = cameraSubpath(r, cameraPath, escape, objList);
+    int nLight = lightSubpath(lightPath, objList);
+
+    // 2. Background and environment lights: only camera paths can reach
+    //    them, by leaving the scene or by a direction sampled towards them
+    Vector3D color = escapedRadiance(escape, lsList);
+    if (!environments.empty()) {
+        for (int t = 2; t <= nCamera && t - 1 <= maxDepth; t++)
+            color += connectEnvironment(cameraPath, t, objList);
+    }
+
+    // 3. Connect every prefix of the light path with every prefix of the camera
+    //    path. Lights seen directly are only found by the camera path (s = 0)
+    for (int t = 1; t <= nCamera; t++) {
+        for (int s = 0; s <= nLight; s++) {
+            int depth = s + t - 2;
+            if ((s == 1 && t == 1) || depth < 0 || depth > maxDepth)
+                continue;
+            color += connect(lightPath, cameraPath, s, t, objList);
+        }
+    }
+
+    return color;
+}
+
+int BDPTIntegrator::cameraSubpath(const Ray &r, Vertex* path, Escape &escape,
+                                  const std::vector<Shape*> &objList) const
+{
+    path[0] = Vertex{ Vertex::CAMERA, camera->getPosition(), camera->getViewDirection(), Vector3D(1.0),
+                      nullptr, nullptr, false, 1.0, 0.0 };
+
+    // Pinhole camera: the importance and the density cancel out (beta = 1)
+    return randomWalk(r, Vector3D(1.0), pdfCameraDirection(r.d), maxVertices(), path, &escape, objList);
+}
+
+int BDPTIntegrator::lightSubpath(Vertex* path, const std::vector<Shape*> &objList) const
+{
+    if (lights.empty())
+        return 0;
+
+    // Uniform light, uniform point, cosine-weighted direction
+    size_t nLights = lights.size();
+    const LightSource* light = lights[std::min(nLights - 1, (size_t)(Random::uniform() * nLights))];
+    LightSample lightSample = light->samplePosition();
+    Vector3D pos = lightSample.position;
+    Vector3D n = lightSample.normal.normalized();
+    double pdfPos = lightSample.pdf / nLights;
+    Vector3D Le = lightSample.radiance;
+
+    path[0] = Vertex{ Vertex::LIGHT, pos, n, Le / pdfPos, light->getShape(),
+                      &light->getShape()->getMaterial(), false, pdfPos, 0.0 };
+
+    Vector3D dir = HemisphericalSampler().getCosineSample(n);
+    double pdfDir = std::max(0.0, dot(dir, n)) / M_PI;
+    if (pdfDir <= 0)
+        return 1;
+
+    Vector3D beta = Le * (dot(dir, n) / (pdfPos * pdfDir));
+    return randomWalk(Ray(pos, dir), beta, pdfDir, maxVertices(), path, nullptr, objList);
+}
+
+int BDPTIntegrator::maxVertices() const
+{
+    return std::clamp(settings.maxDepth, 0, MAX_DEPTH_LIMIT) + 2;
+}
+
+int BDPTIntegrator::randomWalk(Ray ray, Vector3D beta, double pdfDir, int maxVertices, Vertex* path,
+                               Escape* escape, const std::vector<Shape*> &objList) const
+{
+    int count = 1;
+    while (count < maxVertices) {
+        Intersection its;
+        if (!Utils::getClosestIntersection(ray, objList, its)) {
+            if (escape)
+                *escape = Escape{ beta, ray.d, count > 1 ? pdfDir : 0.0 };
+            break;
+        }
+
+        // 1. New vertex, with the density of the direction that found it
+        const Material& material = its.shape->getMaterial();
+        Vertex &prev = path[count - 1];
+        Vertex &v = path[count];
+        v = Vertex{ Vertex::SURFACE, its.itsPoint, its.normal.normalized(), beta, its.shape, &material,
+                    material.hasSpecular() || material.hasTransmission(), 0.0, 0.0 };
+        v.pdfFwd = convertDensity(pdfDir, prev, v);
+        if (++count >= maxVertices)
+            break;
+
+        // 2. Sample the next direction
+        Vector3D wo = -ray.d;
+        Vector3D wi;
+        double pdfRevDir;
+        if (v.delta) {
+            // Specular: no density (handled as a delta in the MIS weights)
+            wi = Utils::computeSpecularDirection(material, v.n, wo);
+            pdfDir = 0;
+            pdfRevDir = 0;
+        }
+        else if (material.hasDiffuseOrGlossy()) {
+            Vector3D nf = dot(v.n, wo) < 0 ? -v.n : v.n;
+            wi = HemisphericalSampler().getCosineSample(nf);
+            double cosTheta = dot(wi, nf);
+            pdfDir = cosTheta / M_PI;
+            if (pdfDir <= 0)
+                break;
+            beta = beta * f(v, wo, wi) * (cosTheta / pdfDir);
+            pdfRevDir = std::max(0.0, dot(wo, nf)) / M_PI;
+        }
+        else break;
+
+        if (isBlack(beta))
+            break;
+
+        // 3. Density of sampling the previous vertex in the opposite direction
+        prev.pdfRev = convertDensity(pdfRevDir, v, prev);
+        ray = Ray(v.p, wi);
+    }
+    return count;
+}
+
+Vector3D BDPTIntegrator::connect(const Vertex* lightPath, const Vertex* cameraPath, int s, int t,
+                                 const std::vector<Shape*> &objList) const
+{
+    const Vertex &pt = cameraPath[t - 1];
+    Vertex sampled = pt;
+    Vector3D L(0.0);
+
+    // 1. The camera path hits a light
+    if (s == 0) {
+        if (pt.type != Vertex::SURFACE || !pt.material->isEmissive())
+            return L;
+        Vector3D wo = (cameraPath[t - 2].p - pt.p).normalized();
+        if (dot(pt.n, wo) <= 0)
+            return L;
+        L = pt.beta * pt.material->getEmissiveRadiance();
+    }
+
+    // 2. Light tracing: the light path is connected to the camera and its
+    //    contribution splatted on the pixel it projects to
+    else if (t == 1) {
+        const Vertex &qs = lightPath[s - 1];
+        double u, v;
+        if (qs.delta || !camera->worldToNDC(qs.p, u, v))
+            return L;
+
+        Vector3D toCamera = pt.p - qs.p;
+        double dist2 = toCamera.lengthSq();
+        Vector3D wo = toCamera / std::sqrt(dist2);
+        Vector3D wi = s > 1 ? (lightPath[s - 2].p - qs.p).normalized() : Vector3D(0.0);
+        double cosCamera = dot(camera->getViewDirection(), -wo);
+        if (cosCamera <= 0)
+            return L;
+
+        // Importance of the pinhole camera (per pixel, one light path per pixel)
+        double importance = 1.0 / (camera->getImagePlaneArea() * cosCamera * cosCamera * cosCamera);
+        Vector3D splat = qs.beta * f(qs, wo, wi) * (std::abs(dot(qs.n, wo)) * importance / dist2);
+        if (isBlack(splat) || !visible(qs.p, pt.p, objList))
+            return L;
+
+        splat = splat * misWeight(lightPath, cameraPath, sampled, s, t);
+        size_t col = std::min(film->getWidth() - 1, (size_t)(u * film->getWidth()));
+        size_t lin = std::min(film->getHeight() - 1, (size_t)(v * film->getHeight()));
+        film->addSplat(col, lin, splat);
+        return L;
+    }
+
+    // 3. Next event estimation: a new point on a light
+    else if (s == 1) {
+        if (pt.delta || lights.empty())
+            return L;
+
+        size_t nLights = lights.size();
+        const LightSource* light = lights[std::min(nLights - 1, (size_t)(Random::uniform() * nLights))];
+        LightSample lightSample = light->samplePosition();
+        Vector3D pos = lightSample.position;
+        Vector3D n = lightSample.normal.normalized();
+        double pdfPos = lightSample.pdf / nLights;
+        Vector3D Le = lightSample.radiance;
+        sampled = Vertex{ Vertex::LIGHT, pos, n, Le / pdfPos, light->getShape(),
+                          &light->getShape()->getMaterial(), false, pdfPos, 0.0 };
+
+        Vector3D toLight = pos - pt.p;
+        double dist2 = toLight.lengthSq();
+        Vector3D wi = toLight / std::sqrt(dist2);
+        Vector3D wo = (cameraPath[t - 2].p - pt.p).normalized();
+        double G = std::abs(dot(pt.n, wi)) * std::max(0.0, dot(n, -wi)) / dist2;
+        L = pt.beta * f(pt, wo, wi) * sampled.beta * G;
+        if (isBlack(L) || !visible(pt.p, pos, objList))
+            return Vector3D(0.0);
+    }
+
+    // 4. General connection between two surface vertices
+    else {
+        const Vertex &qs = lightPath[s - 1];
+        if (qs.delta || pt.delta)
+            return L;
+
+        Vector3D d = pt.p - qs.p;
+        double dist2 = d.lengthSq();
+        Vector3D w = d / std::sqrt(dist2);
+        Vector3D wiQ = s > 1 ? (lightPath[s - 2].p - qs.p).normalized() : Vector3D(0.0);
+        Vector3D woP = (cameraPath[t - 2].p - pt.p).normalized();
+        double G = std::abs(dot(qs.n, w)) * std::abs(dot(pt.n, w)) / dist2;
+        L = qs.beta * f(qs, w, wiQ) * f(pt, woP, -w) * pt.beta * G;
+        if (isBlack(L) || !visible(qs.p, pt.p, objList))
+            return Vector3D(0.0);
+    }
+
+    return L * misWeight(lightPath, cameraPath, sampled, s, t);
+}
+
+Vector3D BDPTIntegrator::escapedRadiance(const Escape &escape, const std::vector<LightSource*> &lsList) const
+{
+    if (isBlack(escape.beta))
+        return Vector3D(0.0);
+    if (environments.empty() || escape.pdfDir <= 0)
+        return escape.beta * background(escape.dir, lsList);
+
+    // Balance heuristic against the direction sampled by every light
+    Vector3D L(0.0);
+    for (const LightSource* env : environments) {
+        double pdfLight = env->getEnvironmentPdf(escape.dir);
+        L += env->getEnvironmentRadiance(escape.dir) * (escape.pdfDir / (escape.pdfDir + pdfLight));
+    }
+    return escape.beta * L;
+}
+
+Vector3D BDPTIntegrator::connectEnvironment(const Vertex* cameraPath, int t,
+                                            const std::vector<Shape*> &objList) const
+{
+    const Vertex &pt = cameraPath[t - 1];
+    if (pt.delta)
+        return Vector3D(0.0);
+
+    // Density of the camera path leaving in the same direction (see randomWalk())
+    Vector3D wo = (cameraPath[t - 2].p - pt.p).normalized();
+    Vector3D nf = dot(pt.n, wo) < 0 ? -pt.n : pt.n;
+    bool continues = pt.material->hasDiffuseOrGlossy();
+
+    Vector3D L(0.0);
+    for (const LightSource* env : environments) {
+        LightSample lightSample = env->sample(pt.p);
+        if (lightSample.pdf <= 0)
+            continue;
+        Vector3D wi = (lightSample.position - pt.p).normalized();
+        Vector3D c = pt.beta * f(pt, wo, wi) * lightSample.radiance * (std::abs(dot(pt.n, wi)) / lightSample.pdf);
+        if (isBlack(c) || !visible(pt.p, lightSample.position, objList))
+            continue;
+
+        double pdfBsdf = continues ? std::max(0.0, dot(wi, nf)) / M_PI : 0.0;
+        L += c * (lightSample.pdf / (lightSample.pdf + pdfBsdf));
+    }
+    return L;
+}
+
+double BDPTIntegrator::misWeight(const Vertex* lightPath, const Vertex* cameraPath, const Vertex &sampled,
+                                 int s, int t) const
+{
+    if (s + t == 2)
+        return 1.0;
+    if (std::max(s, t) <= DEFAULT_VERTICES)
+        return misWeight<DEFAULT_VERTICES>(lightPath, cameraPath, sampled, s, t);
+    return misWeight<MAX_VERTICES>(lightPath, cameraPath, sampled, s, t);
+}
+
+template <int Capacity>
+double BDPTIntegrator::misWeight(const Vertex* lightPath, const Vertex* cameraPath, const Vertex &sampled,
+                                 int s, int t) const
+{
+    // Work on copies: the connection changes the reverse densities of the
+    // vertices next to it
+    Vertex lightCopy[Capacity];
+    Vertex cameraCopy[Capacity];
+    std::copy(lightPath, lightPath + s, lightCopy);
+    std::copy(cameraPath, cameraPath + t, cameraCopy);
+    if (s == 1)
+        lightCopy[0] = sampled;
+
+    Vertex* qs = s > 0 ? &lightCopy[s - 1] : nullptr;
+    Vertex* pt = &cameraCopy[t - 1];
+    Vertex* qsMinus = s > 1 ? &lightCopy[s - 2] : nullptr;
+    Vertex* ptMinus = t > 1 ? &cameraCopy[t - 2] : nullptr;
+
+    pt->delta = false;
+    if (qs)
+        qs->delta = false;
+    pt->pdfRev = s > 0 ? pdf(*qs, qsMinus, *pt) : pdfLightOrigin(*pt);
+    if (ptMinus)
+        ptMinus->pdfRev = s > 0 ? pdf(*pt, qs, *ptMinus) : pdfLight(*pt, *ptMinus);
+    if (qs)
+        qs->pdfRev = pdf(*pt, ptMinus, *qs);
+    if (qsMinus)
+        qsMinus->pdfRev = pdf(*qs, pt, *qsMinus);
+
+    // Balance heuristic: sum of the ratios between the density of every
+    // other strategy and this one (delta densities count as 1)
+    auto remap0 = [](double x) { return x != 0 ? x : 1.0; };
+    double sumRi = 0;
+    double ri = 1;
+    for (int i = t - 1; i > 0; i--) {
+        ri *= remap0(cameraCopy[i].pdfRev) / remap0(cameraCopy[i].pdfFwd);
+        if (!cameraCopy[i].delta && !cameraCopy[i - 1].delta)
+            sumRi += ri;
+    }
+    ri = 1;
+    for (int i = s - 1; i >= 0; i--) {
+        ri *= remap0(lightCopy[i].pdfRev) / remap0(lightCopy[i].pdfFwd);
+        bool deltaPrev = i > 0 ? lightCopy[i - 1].delta : false;
+        if (!lightCopy[i].delta && !deltaPrev)
+            sumRi += ri;
+    }
+    return 1.0 / (1.0 + sumRi);
+}
+
+double BDPTIntegrator::pdf(const Vertex &v, const Vertex* prev, const Vertex &next) const
+{
+    if (v.type == Vertex::LIGHT)
+        return pdfLight(v, next);
+
+    Vector3D wn = (next.p - v.p).normalized();
+    double pdfDir = 0;
+    if (v.type == Vertex::CAMERA)
+        pdfDir = pdfCameraDirection(wn);
+    else if (!v.delta && prev) {
+        Vector3D wp = (prev->p - v.p).normalized();
+        Vector3D nf = dot(v.n, wp) < 0 ? -v.n : v.n;
+        pdfDir = std::max(0.0, dot(wn, nf)) / M_PI;
+    }
+    return convertDensity(pdfDir, v, next);
+}
+
+double BDPTIntegrator::pdfLight(const Vertex &v, const Vertex &next) const
+{
+    Vector3D w = (next.p - v.p).normalized();
+    return convertDensity(std::max(0.0, dot(v.n, w)) / M_PI, v, next);
+}
+
+double BDPTIntegrator::pdfLightOrigin(const Vertex &v) const
+{
+    // The lights sample their points uniformly over the area
+    for (const LightSource* light : lights)
+        if (light->getShape() == v.shape)
+            return 1.0 / (lights.size() * light->getArea());
+    return 0;
+}
+
+double BDPTIntegrator::pdfCameraDirection(const Vector3D &w) const
+{
+    double u, v;
+    double cosTheta = dot(w, camera->getViewDirection());
+    if (cosTheta <= 0 || !camera->worldToNDC(camera->getPosition() + w, u, v))
+        return 0;
+    return 1.0 / (camera->getImagePlaneArea() * cosTheta * cosTheta * cosTheta);
+}
+
+Vector3D BDPTIntegrator::f(const Vertex &v, const Vector3D &wo, const Vector3D &wi) const
+{
+    // Light vertex: its emission is in beta, only its side emits
+    if (v.type == Vertex::LIGHT)
+        return dot(v.n, wo) > 0 ? Vector3D(1.0) : Vector3D(0.0);
+
+    // Reflection only: both directions on the same side
+    if (v.delta || dot(v.n, wo) * dot(v.n, wi) <= 0)
+        return Vector3D(0.0);
+    return v.material->getReflectance(v.n, wo, wi);
+}
+
+bool BDPTIntegrator::visible(const Vector3D &a, const Vector3D &b, const std::vector<Shape*> &objList) const
+{
+    Vector3D d = b - a;
+    double dist = d.length();
+    Ray shadowRay = Ray(a, d / dist, 0, Epsilon, dist - Epsilon);
+    return !Utils::hasIntersection(shadowRay, objList);
+}
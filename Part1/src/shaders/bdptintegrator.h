@@ -0,0 +1,110 @@
+#ifndef BDPTINTEGRATOR_H
+#define BDPTINTEGRATOR_H
+
+#include "shader.h"
+#include "../cameras/perspective.h"
+
+/**
+ * @brief The BDPTIntegrator class
+ *
+ * Bidirectional path tracing (Veach 1997). For every camera sample a camera
+ * subpath and a light subpath are traced, and every pair of their vertices
+ * is connected, weighting each strategy with the balance heuristic. The
+ * strategies that end at the camera (light tracing) can reach any pixel, so
+ * they are splatted into the film and added at the end of the pass: the
+ * integrator expects one computeColor() call per pixel and pass.
+ *
+ * Light subpaths start on the area lights. Environment lights are reached
+ * by the camera subpaths that leave the scene (see Shader::background())
+ * and by a direction sampled towards every one of them from each camera
+ * vertex, both weighted with the balance heuristic.
+ */
+class BDPTIntegrator : public Shader
+{
+public:
+    BDPTIntegrator() = delete;
+    BDPTIntegrator(Vector3D hitColor_, Vector3D bgColor_, const PerspectiveCamera* camera_, Film* film_);
+
+    virtual void beginPass(size_t pass, const std::vector<Shape*> &objList,
+                           const std::vector<LightSource*> &lsList);
+
+    virtual Vector3D computeColor(const Ray &r,
+                                  const std::vector<Shape*> &objList,
+                                  const std::vector<LightSource*> &lsList) const;
+
+    // Camera subpath that left the scene after its last vertex
+    struct Escape
+    {
+        Vector3D beta;      // Throughput of the path (0 if it did not leave)
+        Vector3D dir;
+        double pdfDir;      // Solid angle density of dir (0: camera ray or
+                            // specular bounce, no other strategy finds it)
+    };
+
+    // Path vertex, with the densities (area measure) of sampling it from the
+    // camera side (pdfFwd for camera paths) and from the light side
+    struct Vertex
+    {
+        enum Type { CAMERA, LIGHT, SURFACE };
+
+        Type type;
+        Vector3D p;
+        Vector3D n;
+        Vector3D beta;
+        const Shape* shape;
+        const Material* material;
+        bool delta;
+        double pdfFwd;
+        double pdfRev;
+    };
+
+private:
+    // Both subpaths and their connections, with path buffers of Capacity
+    // vertices (compile-time size, see computeColor())
+    template <int Capacity>
+    Vector3D tracePaths(const Ray &r, int maxDepth, const std::vector<Shape*> &objList,
+                        const std::vector<LightSource*> &lsList) const;
+
+    int cameraSubpath(const Ray &r, Vertex* path, Escape &escape,
+                      const std::vector<Shape*> &objList) const;
+    int lightSubpath(Vertex* path, const std::vector<Shape*> &objList) const;
+    // Vertices of a subpath (maxDepth of the settings, up to a fixed limit)
+    int maxVertices() const;
+    // Extend path[0] up to maxVertices vertices. escape (if not null) gets
+    // the path if it leaves the scene
+    int randomWalk(Ray ray, Vector3D beta, double pdfDir, int maxVertices, Vertex* path,
+                   Escape* escape, const std::vector<Shape*> &objList) const;
+
+    // Contribution of the strategy with s light and t camera vertices
+    Vector3D connect(const Vertex* lightPath, const Vertex* cameraPath, int s, int t,
+                     const std::vector<Shape*> &objList) const;
+    double misWeight(const Vertex* lightPath, const Vertex* cameraPath, const Vertex &sampled,
+                     int s, int t) const;
+    // Environment lights: radiance taken by a camera path that left the
+    // scene, and next event estimation from the last vertex of cameraPath
+    Vector3D escapedRadiance(const Escape &escape, const std::vector<LightSource*> &lsList) const;
+    Vector3D connectEnvironment(const Vertex* cameraPath, int t, const std::vector<Shape*> &objList) const;
+    template <int Capacity>
+    double misWeight(const Vertex* lightPath, const Vertex* cameraPath, const Vertex &sampled,
+                     int s, int t) const;
+
+    // Densities
+    double pdf(const Vertex &v, const Vertex* prev, const Vertex &next) const;
+    double pdfLight(const Vertex &v, const Vertex &next) const;
+    double pdfLightOrigin(const Vertex &v) const;
+    double pdfCameraDirection(const Vector3D &w) const;
+
+    // BSDF of a vertex for light arriving from wi and leaving to wo
+    Vector3D f(const Vertex &v, const Vector3D &wo, const Vector3D &wi) const;
+    bool visible(const Vector3D &a, const Vector3D &b, const std::vector<Shape*> &objList) const;
+
+    Vector3D hitColor;
+    const PerspectiveCamera* camera;
+    Film* film;
+
+    // Area lights of the scene (point lights can not be hit nor emit photons)
+    std::vector<const LightSource*> lights;
+    std::vector<const LightSource*> environments;
+};
+
+#endif // BDPTINTEGRATOR_H
@@ -0,0 +1,145 @@
+#include "guidedpathintegrator.h"
+#include "../core/utils.h"
+#include "../core/hemisphericalsampler.h"
+#include "../core/random.h"
+
+#include <algorithm>
+
+namespace
+{
+    // One light sample per light source, 5 bounces
+    RenderSettings defaultSettings()
+    {
+        RenderSettings settings;
+        settings.lightSamples = 1;
+        settings.maxDepth = 5;
+        return settings;
+    }
+}
+
+GuidedPathIntegrator::GuidedPathIntegrator(Vector3D hitColor_, Vector3D bgColor_, SDTree* sdTree_,
+                                           double bsdfSamplingFraction_) :
+    Shader(bgColor_, defaultSettings()), hitColor(hitColor_), sdTree(sdTree_), bsdfSamplingFraction(bsdfSamplingFraction_)
+{ }
+
+void GuidedPathIntegrator::beginPass(size_t pass, const std::vector<Shape*> &,
+                                     const std::vector<LightSource*> &)
+{
+    // Training iterations of 1, 2, 4, 8... passes: every iteration learns
+    // from twice as many samples as the previous one
+    if (pass > 0 && (pass & (pass - 1)) == 0)
+        sdTree->endIteration();
+}
+
+void GuidedPathIntegrator::beginFrame()
+{
+    sdTree->reset();
+}
+
+Vector3D GuidedPathIntegrator::computeColor(const Ray &r,
+                                            const std::vector<Shape*> &objList,
+                                            const std::vector<LightSource*> &lsList) const
+{
+    return radiance(r, true, objList, lsList);
+}
+
+Vector3D GuidedPathIntegrator::radiance(const Ray &r, bool countEmission,
+                                        const std::vector<Shape*> &objList,
+                                        const std::vector<LightSource*> &lsList) const
+{
+    Intersection its;
+    if (!Utils::getClosestIntersection(r, objList, its)) {
+        // Environment lights are counted by directRadiance() after a bounce
+        if (!countEmission && hasEnvironment(lsList))
+            return Vector3D(0.0);
+        return background(r.d, lsList);
+    }
+
+    const Material& material = its.shape->getMaterial();
+    Vector3D wo = -r.d;
+    Vector3D n = its.normal.normalized();
+
+    // 1. Emitted radiance
+    Vector3D color = countEmission ? material.getEmissiveRadiance() : Vector3D(0.0);
+    if ((int)r.depth >= settings.maxDepth)
+        return color;
+
+    // 2. Mirror and transmissive surfaces: NEE can not reach the lights
+    //    through them, so the emission found after them is counted
+    if (material.hasSpecular() || material.hasTransmission()) {
+        Ray specularRay = Ray(its.itsPoint, Utils::computeSpecularDirection(material, n, wo), r.depth + 1);
+        return color + radiance(specularRay, true, objList, lsList);
+    }
+    if (!material.hasDiffuseOrGlossy())
+        return color;
+
+    if (dot(n, wo) < 0)
+        n = -n;
+
+    // 3. Direct light
+    color += directRadiance(its, n, wo, objList, lsList);
+
+    // 4. Indirect light: guided or BSDF (cosine) sampling, one-sample MIS
+    const DTree* guide = sdTree->getSamplingTree(its.itsPoint);
+    double guideFraction = guide ? 1.0 - bsdfSamplingFraction : 0.0;
+
+    Vector3D wi;
+    if (Random::uniform() < guideFraction)
+        wi = guide->sample(Random::uniform(), Random::uniform());
+    else
+        wi = HemisphericalSampler().getCosineSample(n);
+
+    double cosTheta = dot(wi, n);
+    double pdf = (1.0 - guideFraction) * std::max(0.0, cosTheta) / M_PI;
+    if (guide)
+        pdf += guideFraction * guide->pdf(wi);
+    if (cosTheta <= 0 || pdf <= 0) {
+        // Guided direction below the surface: no light from there
+        sdTree->record(its.itsPoint, wi, 0.0f);
+        return color;
+    }
+
+    Ray indirectRay = Ray(its.itsPoint, wi, r.depth + 1);
+    Vector3D Li = radiance(indirectRay, false, objList, lsList);
+
+    // Train the tree with the incident radiance over its pdf
+    sdTree->record(its.itsPoint, wi, (float)((Li.x + Li.y + Li.z) / 3.0 / pdf));
+
+    Vector3D fr = material.getReflectance(n, wo, wi);
+    color += Li * fr * (cosTheta / pdf);
+
+    return color;
+}
+
+Vector3D GuidedPathIntegrator::directRadiance(const Intersection &its, const Vector3D &n, const Vector3D &wo,
+                                              const std::vector<Shape*> &objList,
+                                              const std::vector<LightSource*> &lsList) const
+{
+    Vector3D color = Vector3D(0.0);
+    const Material& material = its.shape->getMaterial();
+
+    // lightSamples samples per light source
+    int N = settings.lightSamples;
+    for (size_t i = 0; i < lsList.size(); i++) {
+        for (int j = 0; j < N; j++) {
+            LightSample lightSample = lsList[i]->sample(its.itsPoint);
+            if (lightSample.pdf <= 0)
+                continue;
+            Vector3D toLight = lightSample.position - its.itsPoint;
+            double dist = toLight.length();
+            Vector3D wi = toLight / dist;
+
+            double geometricTerm = std::max(0.0, dot(wi, n)) / lightSample.pdf;
+            if (geometricTerm <= 0)
+                continue;
+
+            Ray shadowRay = Ray(its.itsPoint, wi, 0, Epsilon, dist - Epsilon);
+            if (Utils::hasIntersection(shadowRay, objList))
+                continue;
+
+            Vector3D fr = material.getReflectance(n, wo, wi);
+            color += 1.0 / N * (lightSample.radiance * fr * geometricTerm);
+        }
+    }
+    return color;
+}
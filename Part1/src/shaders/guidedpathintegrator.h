@@ -0,0 +1,48 @@
+#ifndef GUIDEDPATHINTEGRATOR_H
+#define GUIDEDPATHINTEGRATOR_H
+
+#include "shader.h"
+#include "../core/sdtree.h"
+
+/**
+ * @brief The GuidedPathIntegrator class
+ *
+ * Path tracer with next event estimation whose indirect bounces are guided
+ * by an SDTree. The tree is trained with the radiance found by the paths of
+ * passes [1, 2), [2, 4), [4, 8)... and every iteration guides the next one,
+ * so it must be rendered in several progressive passes. Guided directions
+ * are mixed (one-sample MIS) with the cosine-weighted sampling of the BSDF.
+ */
+class GuidedPathIntegrator : public Shader
+{
+public:
+    GuidedPathIntegrator() = delete;
+    // bsdfSamplingFraction: probability of sampling the BSDF instead of the guiding distribution
+    GuidedPathIntegrator(Vector3D hitColor_, Vector3D bgColor_, SDTree* sdTree_,
+                         double bsdfSamplingFraction_ = 0.5);
+
+    virtual void beginPass(size_t pass, const std::vector<Shape*> &objList,
+                           const std::vector<LightSource*> &lsList);
+    // Starts training from scratch (the tree learned the old geometry)
+    virtual void beginFrame();
+
+    virtual Vector3D computeColor(const Ray &r,
+                                  const std::vector<Shape*> &objList,
+                                  const std::vector<LightSource*> &lsList) const;
+
+private:
+    // countEmission: false after a diffuse bounce, where NEE already added the lights
+    Vector3D radiance(const Ray &r, bool countEmission,
+                      const std::vector<Shape*> &objList,
+                      const std::vector<LightSource*> &lsList) const;
+
+    Vector3D directRadiance(const Intersection &its, const Vector3D &n, const Vector3D &wo,
+                            const std::vector<Shape*> &objList,
+                            const std::vector<LightSource*> &lsList) const;
+
+    Vector3D hitColor;
+    SDTree* sdTree;
+    double bsdfSamplingFraction;
+};
+
+#endif // GUIDEDPATHINTEGRATOR_H
@@ -2,12 +2,23 @@
 #include "../core/utils.h"
 #include "../core/hemisphericalsampler.h"
 
+namespace
+{
+    // 256 hemisphere samples per hit
+    RenderSettings defaultSettings()
+    {
+        RenderSettings settings;
+        settings.bounceSamples = 256;
+        return settings;
+    }
+}
+
 HemisphericalIntegrator::HemisphericalIntegrator() :
-    hitColor(Vector3D(1, 0, 0))
+    Shader(Vector3D(0.0), defaultSettings()), hitColor(Vector3D(1, 0, 0))
 { }
 
 HemisphericalIntegrator::HemisphericalIntegrator(Vector3D hitColor_, Vector3D bgColor_) :
-    Shader(bgColor_), hitColor(hitColor_)
+    Shader(bgColor_, defaultSettings()), hitColor(hitColor_)
 { }
 
 Vector3D HemisphericalIntegrator::computeColor(const Ray &r, const std::vector<Shape*> &objList, const std::vector<LightSource*> &lsList) const
@@ -70,7 +81,7 @@ Vector3D HemisphericalIntegrator::computeColor(const Ray &r, const std::vector<S
         // 3. PHONG MATERIAL
         else if (material.hasDiffuseOrGlossy()) {
             HemisphericalSampler sampler;
-            int N = 256;
+            int N = settings.getBounceSamples(0);
             // For every sample per pixel...
             for (int i = 0; i < N; i++) {
                 // Incident light direction (from its to lightsource position)
@@ -2,14 +2,38 @@
 #include "../core/utils.h"
 #include "../core/hemisphericalsampler.h"
 
+namespace
+{
+    // Balance heuristic: weight of a sample of strategy a (nA samples with
+    // density pdfA) when strategy b (nB samples, pdfB) can also produce it
+    double balanceWeight(double nA, double pdfA, double nB, double pdfB)
+    {
+        double a = nA * pdfA;
+        double b = nB * pdfB;
+        return a + b > 0 ? a / (a + b) : 0.0;
+    }
+}
+
 NEEImprovedIntegrator::NEEImprovedIntegrator() :
-    hitColor(Vector3D(1, 0, 0))
+    hitColor(Vector3D(1, 0, 0)), irradianceCache(nullptr), lightSampling(LightSource::AREA_SAMPLING)
+{
+}
+
+NEEImprovedIntegrator::NEEImprovedIntegrator(Vector3D hitColor_, Vector3D bgColor_, LightSampling lightSampling_) :
+    Shader(bgColor_), hitColor(hitColor_), irradianceCache(nullptr), lightSampling(lightSampling_)
+{
+}
+
+NEEImprovedIntegrator::NEEImprovedIntegrator(Vector3D hitColor_, Vector3D bgColor_,
+    IrradianceCache* irradianceCache_, LightSampling lightSampling_) :
+    Shader(bgColor_), hitColor(hitColor_), irradianceCache(irradianceCache_), lightSampling(lightSampling_)
 {
 }
 
-NEEImprovedIntegrator::NEEImprovedIntegrator(Vector3D hitColor_, Vector3D bgColor_) :
-    Shader(bgColor_), hitColor(hitColor_)
+void NEEImprovedIntegrator::beginFrame()
 {
+    if (irradianceCache)
+        irradianceCache->clear();
 }
 
 Vector3D NEEImprovedIntegrator::computeColor(const Ray& r,
@@ -29,20 +53,28 @@ Vector3D NEEImprovedIntegrator::computeColor(const Ray& r,
         return color;
     }
 
-    return bgColor;
+    return background(r.d, lsList);
+}
+
+Vector3D NEEImprovedIntegrator::indirectLight(const Intersection& its, const Vector3D& wo,
+    const std::vector<Shape*>& objList,
+    const std::vector<LightSource*>& lsList) const {
+
+    return indirectRadiance(its, wo, 0, objList, lsList);
 }
 
 Vector3D NEEImprovedIntegrator::reflectedRadiance(const Intersection& its, const Vector3D& wo, int depth,
 	const std::vector<Shape*>& objList,
 	const std::vector<LightSource*>& lsList) const {
 
-	Vector3D dir = directRadiance(its, wo, objList, lsList);
+	Vector3D dir = directRadiance(its, wo, depth, objList, lsList);
 	Vector3D ind = indirectRadiance(its, wo, depth, objList, lsList);
 
     return dir + ind;
 }
 
-Vector3D NEEImprovedIntegrator::directRadiance(const Intersection& its, const Vector3D& wo, const std::vector<Shape*>& objList,
+Vector3D NEEImprovedIntegrator::directRadiance(const Intersection& its, const Vector3D& wo, int depth,
+                                        const std::vector<Shape*>& objList,
                                         const std::vector<LightSource*>& lsList) const {
     Vector3D n = its.normal; // Normal at position x
     Vector3D wi; // Incident light direction (depending on each lightsource)
@@ -51,19 +83,21 @@ Vector3D NEEImprovedIntegrator::directRadiance(const Intersection& its, const Ve
     int V = 0; // Visibility term (1 if visible; 0 if occluded)
     const Material& material = its.shape->getMaterial();
 
-    int N = 4;
+    int N = settings.lightSamples;
+    // Hemisphere samples that will also find the environment lights from here
+    int nHemisphere = hemisphereSamples(its, depth);
     // For every light source...
     for (int i = 0; i < lsList.size(); i++) {
         // For every sample in the area lightsource...
         for (int j = 0; j < N; j++) {
-            // Incident light position
-            Vector3D lightPos = lsList[i]->sampleLightPosition();
+            // Incident light position, with its radiance and pdf (per unit solid angle)
+            LightSample lightSample = lsList[i]->sample(its.itsPoint, lightSampling);
+            if (lightSample.pdf <= 0) continue;
+            Vector3D lightPos = lightSample.position;
             // Incident light direction (from its to lightsource position)
             wi = (lightPos - its.itsPoint).normalized();
-            // Geometric term (negative scalar products will be black, a value of 0)
-            double geometricTerm = (std::max(0.0, dot(wi, n))
-                * std::max(0.0, dot(-wi, lsList[i]->getNormal())))
-                / pow((lightPos - its.itsPoint).length(), 2);
+            // Geometric term over the pdf (negative scalar products will be black, a value of 0)
+            double geometricTerm = std::max(0.0, dot(wi, n)) / lightSample.pdf;
 
             // VISIBILITY TERM
             // Ray from its to the light source
@@ -75,7 +109,7 @@ Vector3D NEEImprovedIntegrator::directRadiance(const Intersection& its, const Ve
                 double distItsToLight = (lightPos - its.itsPoint).length();
                 double distItsToObstacle = (shadowIts.itsPoint - its.itsPoint).length();
                 // If there is an obstacle between its and light...
-                if (distItsToObstacle < distItsToLight) {
+                if (distItsToObstacle < distItsToLight - Epsilon) {
                     V = 0; // Object is not visible
                 }
                 else V = 1; // Else, object is visible
@@ -86,10 +120,17 @@ Vector3D NEEImprovedIntegrator::directRadiance(const Intersection& its, const Ve
                 // REFLECTANCE OF THE MATERIAL (diffuse + specular)
                 fr = material.getReflectance(n, wo, wi);
                 // Emmited light intensity from the area light source
-                Vector3D Le = lsList[i]->getIntensity();
+                Vector3D Le = lightSample.radiance;
+
+                // Environment lights are also reached by the hemisphere
+                // samples: weight both strategies (MIS)
+                double weight = 1.0;
+                if (lsList[i]->isEnvironment() && nHemisphere > 0) {
+                    weight = balanceWeight(N, lightSample.pdf, nHemisphere, 1.0 / (2 * M_PI));
+                }
 
                 // DIRECT ILLUMINATION (DIFFUSE + SPECULAR)
-                color += 1.0 / N * (Le * fr * geometricTerm) * lsList[i]->getArea();
+                color += weight / N * (Le * fr * geometricTerm);
             }
         }
     }
@@ -100,9 +141,8 @@ Vector3D NEEImprovedIntegrator::indirectRadiance(const Intersection& its, const
     const std::vector<Shape*>& objList,
     const std::vector<LightSource*>& lsList) const
 {
-    const int MAX_DEPTH = 3;
     Vector3D Lind(0, 0, 0);
-    if (depth >= MAX_DEPTH) {
+    if (depth >= settings.maxDepth) {
         return Lind;
     }
     Vector3D n = its.normal.normalized(); // Normal at position x
@@ -156,14 +196,18 @@ Vector3D NEEImprovedIntegrator::indirectRadiance(const Intersection& its, const
         }
     }
 
-    // 3. PURE PATH TRACING FOR DIFFUSE AND GLOSSY MATERIALS
+    // 3. IRRADIANCE CACHE FOR PURELY DIFFUSE MATERIALS (first hit only)
+    else if (irradianceCache && depth == 0 && material.hasDiffuseOrGlossy()
+        && material.getSpecularReflectance().lengthSq() == 0) {
+        // Lambertian BRDF times the incoming irradiance
+        Lind = material.getDiffuseReflectance() / M_PI * cachedIrradiance(its, depth, objList, lsList);
+    }
+
+    // 4. PURE PATH TRACING FOR DIFFUSE AND GLOSSY MATERIALS
     else if (material.hasDiffuseOrGlossy()) {
         HemisphericalSampler sampler;
-        int N = 100;
+        int N = hemisphereSamples(its, depth);
 
-        if (depth >= 1) {
-            N = 1; // Reduce number of samples for deeper bounces
-        }
         // For every sample per pixel...
         for (int i = 0; i < N; i++) {
             // Incident light direction (from its to lightsource position)
@@ -176,6 +220,16 @@ Vector3D NEEImprovedIntegrator::indirectRadiance(const Intersection& its, const
             if (Utils::getClosestIntersection(shadowRay, objList, shadowIts)) {
                 Li = reflectedRadiance(shadowIts, -wi, depth + 1, objList, lsList);
             }
+            else {
+                // Environment lights in this direction, weighted against
+                // their samples in directRadiance() (MIS)
+                for (const LightSource* ls : lsList) {
+                    if (ls->isEnvironment()) {
+                        Li += ls->getEnvironmentRadiance(wi)
+                            * balanceWeight(N, 1.0 / (2 * M_PI), settings.lightSamples, ls->getEnvironmentPdf(wi));
+                    }
+                }
+            }
             // Direction (negative direction will be black, a value of 0)
             double costheta = std::max(0.0, dot(wi, n));
 
@@ -190,3 +244,47 @@ Vector3D NEEImprovedIntegrator::indirectRadiance(const Intersection& its, const
     return Lind;
 }
 
+int NEEImprovedIntegrator::hemisphereSamples(const Intersection& its, int depth) const
+{
+    const Material& material = its.shape->getMaterial();
+    // Same cases as indirectRadiance(): only the path tracing branch
+    if (depth >= settings.maxDepth || material.hasSpecular() || material.hasTransmission()
+        || !material.hasDiffuseOrGlossy()) {
+        return 0;
+    }
+    if (irradianceCache && depth == 0 && material.getSpecularReflectance().lengthSq() == 0) {
+        return 0;
+    }
+    // Fewer samples for deeper bounces
+    return settings.getBounceSamples(depth);
+}
+
+Vector3D NEEImprovedIntegrator::cachedIrradiance(const Intersection& its, int depth,
+    const std::vector<Shape*>& objList,
+    const std::vector<LightSource*>& lsList) const
+{
+    Vector3D n = its.normal.normalized();
+    Vector3D E;
+
+    // 1. Interpolate from the records valid at this point
+    if (irradianceCache->lookup(its.itsPoint, n, E)) {
+        return E;
+    }
+
+    // 2. Otherwise, sample the hemisphere (stratified) and store a new record
+    std::vector<Vector3D> directions;
+    irradianceCache->generateDirections(n, directions);
+
+    std::vector<Vector3D> radiance(directions.size());
+    std::vector<double> distances(directions.size(), -1.0); // Negative: nothing hit
+    for (size_t i = 0; i < directions.size(); i++) {
+        Ray sampleRay = Ray(its.itsPoint, directions[i], depth + 1);
+        Intersection sampleIts;
+        if (Utils::getClosestIntersection(sampleRay, objList, sampleIts)) {
+            radiance[i] = reflectedRadiance(sampleIts, -directions[i], depth + 1, objList, lsList);
+            distances[i] = (sampleIts.itsPoint - its.itsPoint).length();
+        }
+    }
+
+    return irradianceCache->addRecord(its.itsPoint, n, radiance, distances);
+}
@@ -3,25 +3,40 @@
 
 #include "shader.h"
 #include "materials/phong.h"
+#include "../core/irradiancecache.h"
 
 class NEEImprovedIntegrator : public Shader
 {
 public:
+    typedef LightSource::LightSampling LightSampling;
+
     NEEImprovedIntegrator();
-    NEEImprovedIntegrator(Vector3D hitColor_, Vector3D bgColor_);
+    NEEImprovedIntegrator(Vector3D hitColor_, Vector3D bgColor_, LightSampling lightSampling_ = LightSource::AREA_SAMPLING);
+    // Irradiance caching mode: the diffuse indirect light at the first hit
+    // is interpolated from the cache (filled on demand during the render)
+    NEEImprovedIntegrator(Vector3D hitColor_, Vector3D bgColor_, IrradianceCache* irradianceCache_,
+        LightSampling lightSampling_ = LightSource::AREA_SAMPLING);
 
     // Funci principal per obtenir el color dun raig
     virtual Vector3D computeColor(const Ray& r,
         const std::vector<Shape*>& objList,
         const std::vector<LightSource*>& lsList) const;
 
+    // Empties the irradiance cache (its records belong to the old geometry)
+    virtual void beginFrame();
+
+    // Indirect part of the reflected radiance at a first hit (relighting)
+    virtual Vector3D indirectLight(const Intersection& its, const Vector3D& wo,
+        const std::vector<Shape*>& objList,
+        const std::vector<LightSource*>& lsList) const;
+
 private:
     // Funcions helpers buides segons pseudocodi NEE
     Vector3D reflectedRadiance(const Intersection& its, const Vector3D& wo, int depth,
         const std::vector<Shape*>& objList,
         const std::vector<LightSource*>& lsList) const;
 
-    Vector3D directRadiance(const Intersection& its, const Vector3D& wo,
+    Vector3D directRadiance(const Intersection& its, const Vector3D& wo, int depth,
         const std::vector<Shape*>& objList,
         const std::vector<LightSource*>& lsList) const;
 
@@ -29,7 +44,18 @@ private:
         const std::vector<Shape*>& objList,
         const std::vector<LightSource*>& lsList) const;
 
+    // Number of uniform hemisphere samples indirectRadiance() takes at a
+    // point (0 if it does not sample the hemisphere there)
+    int hemisphereSamples(const Intersection& its, int depth) const;
+
+    // Irradiance at a diffuse point, interpolated or computed as a new record
+    Vector3D cachedIrradiance(const Intersection& its, int depth,
+        const std::vector<Shape*>& objList,
+        const std::vector<LightSource*>& lsList) const;
+
     Vector3D hitColor;
+    IrradianceCache* irradianceCache;
+    LightSampling lightSampling;
 };
 
 #endif // NEEIMPROVEDINTEGRATOR_H
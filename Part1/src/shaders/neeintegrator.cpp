@@ -2,13 +2,24 @@
 #include "../core/utils.h"
 #include "../core/hemisphericalsampler.h"
 
+namespace
+{
+    // 4 light samples, 64 hemisphere samples at the first hit (1 deeper), 3 bounces
+    RenderSettings defaultSettings()
+    {
+        RenderSettings settings;
+        settings.bounceSamples = 64;
+        return settings;
+    }
+}
+
 NEEIntegrator::NEEIntegrator() :
-    hitColor(Vector3D(1, 0, 0))
+    Shader(Vector3D(0.0), defaultSettings()), hitColor(Vector3D(1, 0, 0))
 {
 }
 
 NEEIntegrator::NEEIntegrator(Vector3D hitColor_, Vector3D bgColor_) :
-    Shader(bgColor_), hitColor(hitColor_)
+    Shader(bgColor_, defaultSettings()), hitColor(hitColor_)
 {
 }
 
@@ -29,7 +40,7 @@ Vector3D NEEIntegrator::computeColor(const Ray& r,
         return color;
     }
 
-    return bgColor;
+    return background(r.d, lsList);
 }
 
 Vector3D NEEIntegrator::reflectedRadiance(const Intersection& its, const Vector3D& wo, int depth,
@@ -51,19 +62,19 @@ Vector3D NEEIntegrator::directRadiance(const Intersection& its, const Vector3D&
     int V = 0; // Visibility term (1 if visible; 0 if occluded)
     const Material& material = its.shape->getMaterial();
 
-    int N = 4;
+    int N = settings.lightSamples;
     // For every light source...
     for (int i = 0; i < lsList.size(); i++) {
         // For every sample in the area lightsource...
         for (int j = 0; j < N; j++) {
-            // Incident light position
-            Vector3D lightPos = lsList[i]->sampleLightPosition();
+            // Incident light position, with its radiance and pdf (per unit solid angle)
+            LightSample lightSample = lsList[i]->sample(its.itsPoint);
+            if (lightSample.pdf <= 0) continue;
+            Vector3D lightPos = lightSample.position;
             // Incident light direction (from its to lightsource position)
             wi = (lightPos - its.itsPoint).normalized();
-            // Geometric term (negative scalar products will be black, a value of 0)
-            double geometricTerm = (std::max(0.0, dot(wi, n))
-                * std::max(0.0, dot(-wi, lsList[i]->getNormal())))
-                / pow((lightPos - its.itsPoint).length(), 2);
+            // Geometric term over the pdf (negative scalar products will be black, a value of 0)
+            double geometricTerm = std::max(0.0, dot(wi, n)) / lightSample.pdf;
 
             // VISIBILITY TERM
             // Ray from its to the light source
@@ -75,7 +86,7 @@ Vector3D NEEIntegrator::directRadiance(const Intersection& its, const Vector3D&
                 double distItsToLight = (lightPos - its.itsPoint).length();
                 double distItsToObstacle = (shadowIts.itsPoint - its.itsPoint).length();
                 // If there is an obstacle between its and light...
-                if (distItsToObstacle < distItsToLight) {
+                if (distItsToObstacle < distItsToLight - Epsilon) {
                     V = 0; // Object is not visible
                 }
                 else V = 1; // Else, object is visible
@@ -86,10 +97,10 @@ Vector3D NEEIntegrator::directRadiance(const Intersection& its, const Vector3D&
                 // REFLECTANCE OF THE MATERIAL (diffuse + specular)
                 fr = material.getReflectance(n, wo, wi);
                 // Emmited light intensity from the area light source
-                Vector3D Le = lsList[i]->getIntensity();
+                Vector3D Le = lightSample.radiance;
 
                 // DIRECT ILLUMINATION (DIFFUSE + SPECULAR)
-                color += 1.0 / N * (Le * fr * geometricTerm) * lsList[i]->getArea();
+                color += 1.0 / N * (Le * fr * geometricTerm);
             }
         }
     }
@@ -100,9 +111,8 @@ Vector3D NEEIntegrator::indirectRadiance(const Intersection& its, const Vector3D
     const std::vector<Shape*>& objList,
     const std::vector<LightSource*>& lsList) const
 {
-    const int MAX_DEPTH = 3;
     Vector3D Lind(0, 0, 0);
-    if (depth >= MAX_DEPTH) {
+    if (depth >= settings.maxDepth) {
         return Lind;
     }
     Vector3D n = its.normal.normalized(); // Normal at position x
@@ -111,11 +121,7 @@ Vector3D NEEIntegrator::indirectRadiance(const Intersection& its, const Vector3D
     Vector3D fr; // Reflectance (diffuse + specular)
 
     HemisphericalSampler sampler;
-    int N = 64;
-
-    if (depth >= 1) {
-        N = 1; // Reduce number of samples for deeper bounces
-    }
+    int N = settings.getBounceSamples(depth); // Fewer samples for deeper bounces
     // For every sample per pixel...
     for (int i = 0; i < N; i++) {
         // Incident light direction (from its to lightsource position)
@@ -0,0 +1,238 @@
+#include "photonmappingintegrator.h"
+#include "../core/utils.h"
+#include "../core/hemisphericalsampler.h"
+#include "../core/parallel.h"
+#include "../core/random.h"
+
+#include <algorithm>
+
+namespace
+{
+    const int MAX_PHOTON_DEPTH = 8;
+    const size_t PHOTON_CHUNK = 4096;
+
+    // 4 light samples, camera paths of up to 8 specular bounces
+    RenderSettings defaultSettings()
+    {
+        RenderSettings settings;
+        settings.maxDepth = 8;
+        return settings;
+    }
+
+    Photon makePhoton(const Vector3D &position, const Vector3D &direction, const Vector3D &power)
+    {
+        Photon photon;
+        photon.position[0] = position.x;
+        photon.position[1] = position.y;
+        photon.position[2] = position.z;
+        photon.power[0] = power.x;
+        photon.power[1] = power.y;
+        photon.power[2] = power.z;
+        photon.axis = 0;
+        photon.setDirection(direction);
+        return photon;
+    }
+}
+
+PhotonMappingIntegrator::PhotonMappingIntegrator(Vector3D hitColor_, Vector3D bgColor_, size_t photonsPerPass_,
+                                                 double causticRadius_, double globalRadius_, double alpha_) :
+    Shader(bgColor_, defaultSettings()), hitColor(hitColor_), photonsPerPass(photonsPerPass_), alpha(alpha_),
+    causticRadius2(causticRadius_ * causticRadius_), globalRadius2(globalRadius_ * globalRadius_),
+    initialCausticRadius2(causticRadius_ * causticRadius_), initialGlobalRadius2(globalRadius_ * globalRadius_)
+{ }
+
+void PhotonMappingIntegrator::beginPass(size_t pass, const std::vector<Shape*> &objList,
+                                        const std::vector<LightSource*> &lsList)
+{
+    // 1. Radius reduction: r_{i+1}^2 = r_i^2 * (i + alpha) / (i + 1)
+    if (pass == 0) {
+        causticRadius2 = initialCausticRadius2;
+        globalRadius2 = initialGlobalRadius2;
+    }
+    else {
+        double factor = (pass + alpha) / (pass + 1);
+        causticRadius2 *= factor;
+        globalRadius2 *= factor;
+    }
+
+    // Only area lights emit photons (point lights are handled by NEE only)
+    std::vector<LightSource*> areaLights;
+    for (LightSource* ls : lsList)
+        if (ls->getArea() > 0)
+            areaLights.push_back(ls);
+
+    causticMap.clear();
+    globalMap.clear();
+    if (areaLights.empty() || photonsPerPass == 0)
+        return;
+
+    // 2. Shoot the photons in parallel. Every chunk has its own seed and
+    //    output vectors, merged in chunk order: the maps do not depend on
+    //    the number of threads
+    size_t nChunks = (photonsPerPass + PHOTON_CHUNK - 1) / PHOTON_CHUNK;
+    std::vector<std::vector<Photon>> caustic(nChunks);
+    std::vector<std::vector<Photon>> global(nChunks);
+    ThreadPool::global().parallelFor(nChunks, 1, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++) {
+            Random::seed(Random::hash(pass, c), 1);
+            tracePhotons(c * PHOTON_CHUNK, std::min(photonsPerPass, (c + 1) * PHOTON_CHUNK),
+                         objList, areaLights, caustic[c], global[c]);
+        }
+    });
+
+    std::vector<Photon> causticPhotons;
+    std::vector<Photon> globalPhotons;
+    for (size_t c = 0; c < nChunks; c++) {
+        causticPhotons.insert(causticPhotons.end(), caustic[c].begin(), caustic[c].end());
+        globalPhotons.insert(globalPhotons.end(), global[c].begin(), global[c].end());
+    }
+
+    // 3. Build the kd-trees
+    causticMap.build(std::move(causticPhotons));
+    globalMap.build(std::move(globalPhotons));
+}
+
+void PhotonMappingIntegrator::tracePhotons(size_t begin, size_t end, const std::vector<Shape*> &objList,
+                                           const std::vector<LightSource*> &areaLights,
+                                           std::vector<Photon> &caustic, std::vector<Photon> &global) const
+{
+    HemisphericalSampler sampler;
+    size_t nLights = areaLights.size();
+
+    for (size_t i = begin; i < end; i++) {
+        // 1. Emission: uniform light, uniform point, cosine-weighted direction
+        //    Flux of a lambertian emitter: Le * A * pi
+        const LightSource* light = areaLights[std::min(nLights - 1, (size_t)(Random::uniform() * nLights))];
+        LightSample lightSample = light->samplePosition();
+        Vector3D position = lightSample.position;
+        Vector3D direction = sampler.getCosineSample(lightSample.normal);
+        Vector3D power = lightSample.radiance * (M_PI * nLights / (lightSample.pdf * photonsPerPass));
+
+        int specularBounces = 0;
+        bool diffuseBounce = false;
+        for (int depth = 0; depth < MAX_PHOTON_DEPTH; depth++) {
+            Intersection its;
+            if (!Utils::getClosestIntersection(Ray(position, direction), objList, its))
+                break;
+
+            const Material& material = its.shape->getMaterial();
+            Vector3D n = its.normal.normalized();
+            position = its.itsPoint;
+
+            // 2. Mirror and transmissive surfaces: follow the specular path
+            if (material.hasSpecular() || material.hasTransmission()) {
+                direction = Utils::computeSpecularDirection(material, n, -direction);
+                specularBounces++;
+                continue;
+            }
+            if (!material.hasDiffuseOrGlossy())
+                break;
+
+            // 3. Store: L S+ D in the caustic map, L (S|D)* D D in the global
+            //    map. Direct photons (L D) are not stored, NEE computes them
+            if (!diffuseBounce && specularBounces > 0)
+                caustic.push_back(makePhoton(position, direction, power));
+            else if (diffuseBounce)
+                global.push_back(makePhoton(position, direction, power));
+
+            // 4. Diffuse bounce with russian roulette on the albedo (the
+            //    glossy lobe of Phong materials is not transported)
+            Vector3D rho = material.getDiffuseReflectance();
+            double survival = std::max(rho.x, std::max(rho.y, rho.z));
+            if (survival <= 0 || Random::uniform() >= survival)
+                break;
+            power = power * rho / survival;
+
+            if (dot(n, direction) > 0)
+                n = -n;
+            direction = sampler.getCosineSample(n);
+            diffuseBounce = true;
+        }
+    }
+}
+
+Vector3D PhotonMappingIntegrator::computeColor(const Ray &r,
+                                               const std::vector<Shape*> &objList,
+                                               const std::vector<LightSource*> &lsList) const
+{
+    Intersection its;
+    if (!Utils::getClosestIntersection(r, objList, its))
+        return background(r.d, lsList);
+
+    const Material& material = its.shape->getMaterial();
+    Vector3D wo = -r.d;
+    Vector3D n = its.normal.normalized();
+
+    // 1. Emitted radiance (only camera rays and specular paths reach here)
+    Vector3D color = material.getEmissiveRadiance();
+    if ((int)r.depth >= settings.maxDepth)
+        return color;
+
+    // 2. Mirror and transmissive surfaces: follow the specular path
+    if (material.hasSpecular() || material.hasTransmission()) {
+        Ray specularRay = Ray(its.itsPoint, Utils::computeSpecularDirection(material, n, wo), r.depth + 1);
+        color += computeColor(specularRay, objList, lsList);
+    }
+
+    // 3. Diffuse and glossy surfaces: NEE + photon density estimation
+    else if (material.hasDiffuseOrGlossy()) {
+        if (dot(n, wo) < 0)
+            n = -n;
+        color += directRadiance(its, wo, objList, lsList);
+        color += estimateRadiance(causticMap, causticRadius2, its, n, wo);
+        color += estimateRadiance(globalMap, globalRadius2, its, n, wo);
+    }
+
+    return color;
+}
+
+Vector3D PhotonMappingIntegrator::directRadiance(const Intersection &its, const Vector3D &wo,
+                                                 const std::vector<Shape*> &objList,
+                                                 const std::vector<LightSource*> &lsList) const
+{
+    Vector3D n = its.normal;
+    Vector3D color = Vector3D(0.0);
+    const Material& material = its.shape->getMaterial();
+
+    int N = settings.lightSamples;
+    for (size_t i = 0; i < lsList.size(); i++) {
+        for (int j = 0; j < N; j++) {
+            LightSample lightSample = lsList[i]->sample(its.itsPoint);
+            if (lightSample.pdf <= 0)
+                continue;
+            Vector3D toLight = lightSample.position - its.itsPoint;
+            double dist = toLight.length();
+            Vector3D wi = toLight / dist;
+
+            double geometricTerm = std::max(0.0, dot(wi, n)) / lightSample.pdf;
+            if (geometricTerm <= 0)
+                continue;
+
+            // Shadow ray limited to the light position
+            Ray shadowRay = Ray(its.itsPoint, wi, 0, Epsilon, dist - Epsilon);
+            if (Utils::hasIntersection(shadowRay, objList))
+                continue;
+
+            Vector3D fr = material.getReflectance(n, wo, wi);
+            color += 1.0 / N * (lightSample.radiance * fr * geometricTerm);
+        }
+    }
+    return color;
+}
+
+Vector3D PhotonMappingIntegrator::estimateRadiance(const PhotonMap &map, double radius2, const Intersection &its,
+                                                   const Vector3D &n, const Vector3D &wo) const
+{
+    const Material& material = its.shape->getMaterial();
+    Vector3D flux(0.0);
+
+    // L = sum(fr * power) / (pi * r^2), only photons arriving from the side of n
+    map.gatherRadius(its.itsPoint, radius2, [&](const Photon &photon, double) {
+        Vector3D wi = -photon.getDirection();
+        if (dot(wi, n) <= 0)
+            return;
+        flux += material.getReflectance(n, wo, wi) * photon.getPower();
+    });
+
+    return flux / (M_PI * radius2);
+}
@@ -0,0 +1,62 @@
+#ifndef PHOTONMAPPINGINTEGRATOR_H
+#define PHOTONMAPPINGINTEGRATOR_H
+
+#include "shader.h"
+#include "../core/photonmap.h"
+
+/**
+ * @brief The PhotonMappingIntegrator class
+ *
+ * Progressive photon mapping (Hachisuka et al. 2008, in the probabilistic
+ * formulation of Knaus & Zwicker 2011). Before every pass a new set of
+ * photons is shot from the area light sources and stored in two maps:
+ *   - caustic map: photons that only bounced on mirror/transmissive surfaces
+ *   - global map: photons after at least one diffuse bounce
+ * Direct light is computed with next event estimation, and the radius of the
+ * density estimation shrinks from pass to pass, so averaging the passes
+ * converges to the correct image (caustics included).
+ */
+class PhotonMappingIntegrator : public Shader
+{
+public:
+    PhotonMappingIntegrator() = delete;
+    // alpha: fraction of the photons kept from pass to pass (radius reduction)
+    PhotonMappingIntegrator(Vector3D hitColor_, Vector3D bgColor_, size_t photonsPerPass_,
+                            double causticRadius_, double globalRadius_, double alpha_ = 0.7);
+
+    virtual void beginPass(size_t pass, const std::vector<Shape*> &objList,
+                           const std::vector<LightSource*> &lsList);
+
+    virtual Vector3D computeColor(const Ray &r,
+                                  const std::vector<Shape*> &objList,
+                                  const std::vector<LightSource*> &lsList) const;
+
+private:
+    // Trace photons [begin, end) of the pass into the given vectors
+    void tracePhotons(size_t begin, size_t end, const std::vector<Shape*> &objList,
+                      const std::vector<LightSource*> &areaLights,
+                      std::vector<Photon> &caustic, std::vector<Photon> &global) const;
+
+    Vector3D directRadiance(const Intersection &its, const Vector3D &wo,
+                            const std::vector<Shape*> &objList,
+                            const std::vector<LightSource*> &lsList) const;
+
+    // Radiance estimate from the photons closer than sqrt(radius2)
+    Vector3D estimateRadiance(const PhotonMap &map, double radius2, const Intersection &its,
+                              const Vector3D &n, const Vector3D &wo) const;
+
+    Vector3D hitColor;
+    size_t photonsPerPass;
+    double alpha;
+
+    // Squared radii of the current pass
+    double causticRadius2;
+    double globalRadius2;
+    double initialCausticRadius2;
+    double initialGlobalRadius2;
+
+    PhotonMap causticMap;
+    PhotonMap globalMap;
+};
+
+#endif // PHOTONMAPPINGINTEGRATOR_H
@@ -2,17 +2,28 @@
 #include "../core/utils.h"
 #include "../core/hemisphericalsampler.h"
 
+namespace
+{
+    // 256 hemisphere samples at the first hit (1 deeper), 5 bounces
+    RenderSettings defaultSettings()
+    {
+        RenderSettings settings;
+        settings.bounceSamples = 256;
+        settings.maxDepth = 5;
+        return settings;
+    }
+}
+
 PurePathIntegrator::PurePathIntegrator() :
-    hitColor(Vector3D(1, 0, 0))
+    Shader(Vector3D(0.0), defaultSettings()), hitColor(Vector3D(1, 0, 0))
 { }
 
 PurePathIntegrator::PurePathIntegrator(Vector3D hitColor_, Vector3D bgColor_) :
-    Shader(bgColor_), hitColor(hitColor_)
+    Shader(bgColor_, defaultSettings()), hitColor(hitColor_)
 { }
 
 Vector3D PurePathIntegrator::computeColor(const Ray &r, const std::vector<Shape*> &objList, const std::vector<LightSource*> &lsList) const
 {
-    const int MAX_DEPTH = 5;
     Intersection its;
 
     if (Utils::getClosestIntersection(r, objList, its)) {
@@ -24,7 +35,7 @@ Vector3D PurePathIntegrator::computeColor(const Ray &r, const std::vector<Shape*
         Vector3D color = material.getEmissiveRadiance(); // Emitted light (vector 0 if not emissive)
 
         // If maximum depth is reached...
-        if (r.depth >= MAX_DEPTH) {
+        if ((int)r.depth >= settings.maxDepth) {
             return color;
         }
 
@@ -76,12 +87,9 @@ Vector3D PurePathIntegrator::computeColor(const Ray &r, const std::vector<Shape*
 		// 3. PURE PATH TRACING FOR DIFFUSE AND GLOSSY MATERIALS
         else if (material.hasDiffuseOrGlossy()) {
             HemisphericalSampler sampler;
-            int N = 256;
+            int N = settings.getBounceSamples(r.depth); // Fewer samples for deeper bounces
             Vector3D Lo(0, 0, 0);
 
-			if (r.depth >= 1) {
-				N = 1; // Reduce number of samples for deeper bounces
-            }
             // For every sample per pixel...
             for (int i = 0; i < N; i++) {
                 // Incident light direction (from its to lightsource position)
@@ -104,6 +112,6 @@ Vector3D PurePathIntegrator::computeColor(const Ray &r, const std::vector<Shape*
         return color;
     }
     
-    return bgColor;
+    return background(r.d, lsList);
 }
 
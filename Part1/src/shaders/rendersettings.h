@@ -0,0 +1,34 @@
+#ifndef RENDERSETTINGS_H
+#define RENDERSETTINGS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+/**
+ * @brief The RenderSettings struct
+ *
+ * Sample budgets of a shader, to trade cost against quality per render
+ * without recompiling. Every integrator starts from its own defaults (see
+ * its constructor) and only reads the fields it uses.
+ */
+struct RenderSettings
+{
+    size_t samplesPerPixel = 1;     // Camera rays per pixel and pass (raytrace())
+    int lightSamples = 4;           // Shadow rays per light source and hit (NEE)
+    int bounceSamples = 100;        // Hemisphere samples at the first hit
+    // Hemisphere samples at depth d > 0: bounceSamples * splittingFactor^d,
+    // between 1 and bounceSamples (0: a single sample after the first hit)
+    double splittingFactor = 0.0;
+    int maxDepth = 3;               // Bounces of a path
+
+    int getBounceSamples(int depth) const
+    {
+        if (depth <= 0)
+            return std::max(1, bounceSamples);
+        double samples = bounceSamples * std::pow(splittingFactor, depth);
+        return std::max(1, (int)std::lround(std::min(samples, (double)bounceSamples)));
+    }
+};
+
+#endif // RENDERSETTINGS_H
@@ -5,3 +5,28 @@ Shader::Shader() : bgColor(Vector3D(0.0))
 
 Shader::Shader(Vector3D bgColor_) : bgColor(bgColor_)
 { }
+
+Shader::Shader(Vector3D bgColor_, const RenderSettings &settings_) :
+    bgColor(bgColor_), settings(settings_)
+{ }
+
+Vector3D Shader::background(const Vector3D &dir, const std::vector<LightSource*> &lsList) const
+{
+    Vector3D color(0.0);
+    bool environment = false;
+    for (const LightSource *ls : lsList) {
+        if (ls->isEnvironment()) {
+            color += ls->getEnvironmentRadiance(dir);
+            environment = true;
+        }
+    }
+    return environment ? color : bgColor;
+}
+
+bool Shader::hasEnvironment(const std::vector<LightSource*> &lsList)
+{
+    for (const LightSource *ls : lsList)
+        if (ls->isEnvironment())
+            return true;
+    return false;
+}
@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "../core/ray.h"
+#include "rendersettings.h"
 #include "../lightsources/pointlightsource.h"
 #include "../lightsources/arealightsource.h"
 #include "../shapes/shape.h"
@@ -13,12 +14,44 @@ class Shader
 public:
     Shader();
     Shader(Vector3D bgColor_);
+    Shader(Vector3D bgColor_, const RenderSettings &settings_);
+    virtual ~Shader() = default;
 
     virtual Vector3D computeColor(const Ray &r,
                              const std::vector<Shape*> &objList,
                              const std::vector<LightSource*> &lsList) const = 0;
 
+    // Called before every pass over the image, for the integrators that need
+    // to precompute data from the whole scene (e.g. photon maps)
+    virtual void beginPass(size_t, const std::vector<Shape*> &,
+                           const std::vector<LightSource*> &) {}
+
+    // Called before every frame of an animation, once the scene has moved:
+    // the integrators that keep data between renders (caches, guiding
+    // trees) drop it, as it was learned on the previous geometry
+    virtual void beginFrame() {}
+
+    // Light reflected at a first hit that arrives through other surfaces
+    // (what computeColor() adds to the emission and the direct light), for
+    // renderers that shade hits found before (see RelightRenderer). Shaders
+    // without that split return 0
+    virtual Vector3D indirectLight(const Intersection &, const Vector3D &,
+                                   const std::vector<Shape*> &,
+                                   const std::vector<LightSource*> &) const { return Vector3D(0.0); }
+
+    // Radiance of a ray that leaves the scene in direction dir: the
+    // environment lights of the scene, or bgColor when there is none
+    Vector3D background(const Vector3D &dir, const std::vector<LightSource*> &lsList) const;
+    static bool hasEnvironment(const std::vector<LightSource*> &lsList);
+
+    // Sample budgets (samples, bounces) of the integrator
+    const RenderSettings& getRenderSettings() const { return settings; }
+    void setRenderSettings(const RenderSettings &settings_) { settings = settings_; }
+
     Vector3D bgColor;
+
+protected:
+    RenderSettings settings;
 };
 
 #endif // SHADER_H
@@ -72,7 +72,7 @@ Vector3D WhittedIntegrator::computeColor(const Ray &r, const std::vector<Shape*>
             // For every light source...
             for (int i = 0; i < lsList.size(); i++) {
                 // Incident light position
-                Vector3D lightPos = lsList[i]->sampleLightPosition();
+                Vector3D lightPos = lsList[i]->samplePosition().position;
                 // Incident light direction (from its to lightsource position)
                 wi = (lightPos - its.itsPoint).normalized();
                 // Direction (negative direction will be black, a value of 0)
@@ -3,14 +3,26 @@
 InfinitePlan::InfinitePlan(const Vector3D &p0_, const Vector3D &normal_,
          Material *mat_) :
     Shape(Matrix4x4(), mat_),
-    p0World(p0_), nWorld(normal_.normalized())
+    p0World(p0_), nWorld(normal_.normalized()), p0Rest(p0World), nRest(nWorld)
 { }
 
+void InfinitePlan::setTransform(const Matrix4x4 &motion)
+{
+    Shape::setTransform(motion);
+    p0World = motion.transformPoint(p0Rest);
+    nWorld = normalTransform(motion).transformVector(nRest).normalized();
+}
+
 Vector3D InfinitePlan::getNormalWorld() const
 {
     return nWorld;
 }
 
+Vector3D InfinitePlan::getPointWorld() const
+{
+    return p0World;
+}
+
 bool InfinitePlan::rayIntersect(const Ray &rayWorld, Intersection &its) const
 {
     // Compute the denominator of the tHit formula
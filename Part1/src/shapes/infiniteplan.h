@@ -12,6 +12,11 @@ public:
 
     // Get the normal at a surface point in world coordinates
     Vector3D getNormalWorld() const;
+    // A point of the plan in world coordinates
+    Vector3D getPointWorld() const;
+
+    // Moves the point and the normal
+    void setTransform(const Matrix4x4 &motion);
 
     // Ray/plan intersection methods
     bool rayIntersect(const Ray &ray, Intersection &its) const;
@@ -26,6 +31,9 @@ private:
     /* All values are in world coordinates */
     Vector3D p0World;
     Vector3D nWorld;
+    // Rest pose
+    Vector3D p0Rest;
+    Vector3D nRest;
 };
 
 std::ostream &operator<<(std::ostream &out, const InfinitePlan &t);
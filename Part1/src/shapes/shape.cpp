@@ -2,12 +2,28 @@
 
 Shape::Shape(const Matrix4x4 &t_, Material *material_)
 {
+    restTransform = t_;
     objectToWorld = t_;
     objectToWorld.inverse(worldToObject);
     material = material_;
+    materialId = 0;
 }
 
 const Material& Shape::getMaterial() const
 {
     return *material;
 }
+
+void Shape::setTransform(const Matrix4x4 &motion)
+{
+    objectToWorld = motion * restTransform;
+    objectToWorld.inverse(worldToObject);
+}
+
+Matrix4x4 Shape::normalTransform(const Matrix4x4 &motion)
+{
+    Matrix4x4 inverse, inverseTransposed;
+    motion.inverse(inverse);
+    inverse.transpose(inverseTransposed);
+    return inverseTransposed;
+}
@@ -1,6 +1,8 @@
 #ifndef SHAPE_H
 #define SHAPE_H
 
+#include <cstdint>
+
 #include "../core/matrix4x4.h"
 #include "../core/vector3d.h"
 #include "../core/ray.h"
@@ -21,11 +23,26 @@ public:
 
     // Return the material associated with the shape
     const Material& getMaterial() const;
+    // Current object to world transform
+    const Matrix4x4& getTransform() const { return objectToWorld; }
+
+    // Index of the material in the MaterialTable built for the scene
+    uint32_t getMaterialId() const { return materialId; }
+    void setMaterialId(uint32_t id) { materialId = id; }
+
+    // Place the shape at motion * its rest pose (the transform or world
+    // coordinates it was created with), for animations
+    virtual void setTransform(const Matrix4x4 &motion);
 
 protected:
+    // Transform of the normals of a motion (inverse transposed)
+    static Matrix4x4 normalTransform(const Matrix4x4 &motion);
+
+    Matrix4x4 restTransform;
     Matrix4x4 objectToWorld;
     Matrix4x4 worldToObject;
     Material *material;
+    uint32_t materialId;
     //float area;
 };
 
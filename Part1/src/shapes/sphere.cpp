@@ -32,6 +32,28 @@ Vector3D Sphere::getNormalWorld(const Vector3D &pt_world) const
     return(nWorld.normalized());
 }
 
+Vector3D Sphere::getCenter() const
+{
+    return objectToWorld.transformPoint(Vector3D(0.0));
+}
+
+double Sphere::getRadius() const
+{
+    return radius * objectToWorld.transformVector(Vector3D(1.0, 0.0, 0.0)).length();
+}
+
+bool Sphere::hasUniformScale() const
+{
+    Vector3D x = objectToWorld.transformVector(Vector3D(1.0, 0.0, 0.0));
+    Vector3D y = objectToWorld.transformVector(Vector3D(0.0, 1.0, 0.0));
+    Vector3D z = objectToWorld.transformVector(Vector3D(0.0, 0.0, 1.0));
+    double len = x.length();
+    double tolerance = 1e-5 * len;
+    return std::abs(y.length() - len) < tolerance && std::abs(z.length() - len) < tolerance
+        && std::abs(dot(x, y)) < tolerance * len && std::abs(dot(y, z)) < tolerance * len
+        && std::abs(dot(x, z)) < tolerance * len;
+}
+
 // Chapter 3 PBRT, page 117
 bool Sphere::rayIntersect(const Ray &ray, Intersection &its) const
 {
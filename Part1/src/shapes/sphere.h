@@ -19,6 +19,15 @@ public:
     bool rayIntersectP(const Ray &ray) const;
     std::string toString() const;
 
+    // Center and radius in world coordinates (the transform is assumed to
+    // be a translation, maybe with a uniform scale)
+    Vector3D getCenter() const;
+    double getRadius() const;
+    // Radius before the transform
+    double getLocalRadius() const { return radius; }
+    // Whether the transform keeps the sphere round (so the two above describe it)
+    bool hasUniformScale() const;
+
 private:
     // The center of the sphere in local coordinates is assumed
     // to be (0, 0, 0). To pass to world coordinates just apply the
@@ -2,12 +2,24 @@
 
 
 Square::Square(const Vector3D pos_, const Vector3D& v1_, const Vector3D& v2_, const Vector3D& normal_, Material *material_)
-    : Shape(Matrix4x4(), material_), corner(pos_), v1(v1_), v2(v2_), normal(normal_)
+    : Shape(Matrix4x4(), material_), corner(pos_), v1(v1_), v2(v2_), normal(normal_),
+      restNormal(normal_), restCorner(pos_), restV1(v1_), restV2(v2_)
 { 
     Vector3D n = cross(v1_,v2);
     w = n / dot(n, n);
 }
 
+void Square::setTransform(const Matrix4x4 &motion)
+{
+    Shape::setTransform(motion);
+    corner = motion.transformPoint(restCorner);
+    v1 = motion.transformVector(restV1);
+    v2 = motion.transformVector(restV2);
+    normal = normalTransform(motion).transformVector(restNormal).normalized();
+    Vector3D n = cross(v1, v2);
+    w = n / dot(n, n);
+}
+
 // Return the normal in world coordinates
 
 Vector3D Square::getNormalWorld(const Vector3D &pt_world) const
@@ -19,6 +19,9 @@ public:
     bool rayIntersectP(const Ray &ray) const;
     std::string toString() const;
 
+    // Moves the corner, sides and normal
+    void setTransform(const Matrix4x4 &motion);
+
 
     Vector3D normal;
     Vector3D corner;
@@ -27,6 +30,13 @@ public:
 
     Vector3D    w;//constant for a given quadrilateral
 
+private:
+    // Rest pose (world coordinates given to the constructor)
+    Vector3D restNormal;
+    Vector3D restCorner;
+    Vector3D restV1;
+    Vector3D restV2;
+
 };
 
 std::ostream& operator<<(std::ostream &out, const Square &s);